@@ -8,6 +8,7 @@
 #include <string>
 #include <utility>
 
+#include "chunk/chunk_arena.h"
 #include "hash/hash.h"
 #include "types/type.h"
 #include "utils/logging.h"
@@ -28,12 +29,16 @@ class Chunk : private Moveable {
 
   // create an empty chunk
   Chunk() : Chunk(nullptr) {}
-  // allocate a new chunk with usable capacity (excluding meta data)
+  // allocate a new chunk with usable capacity (excluding meta data), which
+  // also reserves room for the hash right after the chunk, as laid out in the
+  // log of LSTStore
   Chunk(ChunkType type, uint32_t capacity);
   // create chunk but not own the data
   explicit Chunk(const byte_t* head) noexcept : head_(head) {}
   // create chunk and let it own the data
   explicit Chunk(std::unique_ptr<byte_t[]> head) noexcept;
+  // create chunk adopting the bytes, e.g., those received in a message
+  explicit Chunk(std::unique_ptr<std::string> bytes) noexcept;
   // create chunk with existing hash
   // used by lst store
   Chunk(const byte_t* head, const byte_t* hash) noexcept
@@ -45,6 +50,15 @@ class Chunk : private Moveable {
   ~Chunk() = default;
 
   inline bool empty() const noexcept { return head_ == nullptr; }
+  // check if chunk owns the data, rather than viewing a storage
+  inline bool own() const noexcept { return own_ != nullptr; }
+  // check if the data is allocated from a chunk arena
+  inline bool inArena() const noexcept {
+    return own_ != nullptr && own_.get_deleter().block != nullptr;
+  }
+  // copy the data out of its chunk arena onto the heap, e.g., for a chunk
+  // kept long after it is built, which would otherwise pin the whole block
+  void LeaveArena();
   // total number of bytes
   inline uint32_t numBytes() const noexcept {
     return *reinterpret_cast<const uint32_t*>(head_ + kNumBytesOffset);
@@ -68,19 +82,46 @@ class Chunk : private Moveable {
       return &own_[kMetaLength];
   };
 
+  // check if the hash is known without computing it
+  inline bool hashed() const noexcept { return !hash_.empty(); }
   // chunk hash
   inline const Hash& hash() const {
     return hash_.empty() ? forceHash() : hash_;
   }
   // force to re-compute chunk hash
   inline const Hash& forceHash() const {
-    hash_ = Hash::ComputeFrom(head_, numBytes());
+    hash_ = hash_inline_
+            ? Hash::ComputeFrom(head_, numBytes(), &own_[numBytes()])
+            : Hash::ComputeFrom(head_, numBytes());
     return hash_;
   }
 
  private:
+  // free the buffer to the chunk arena it comes from, along with the string
+  // holding it, or to the heap
+  struct BufferDeleter {
+    BufferDeleter() noexcept : block(nullptr), bytes(nullptr) {}
+    explicit BufferDeleter(ChunkArena::Block* b) noexcept
+      : block(b), bytes(nullptr) {}
+    explicit BufferDeleter(std::string* s) noexcept : block(nullptr), bytes(s) {}
+    void operator()(byte_t* buffer) const noexcept {
+      if (block != nullptr) {
+        ChunkArena::Release(block);
+      } else if (bytes != nullptr) {
+        delete bytes;
+      } else {
+        delete[] buffer;
+      }
+    }
+
+    ChunkArena::Block* block;
+    std::string* bytes;
+  };
+
   // own the chunk if created by itself
-  std::unique_ptr<byte_t[]> own_;
+  std::unique_ptr<byte_t[], BufferDeleter> own_;
+  // whether the hash is computed into the bytes following the chunk
+  bool hash_inline_ = false;
   // read-only chunk if passed from chunk storage
   const byte_t* head_ = nullptr;
   mutable Hash hash_;
@@ -0,0 +1,59 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_CHUNK_CHUNK_ARENA_H_
+#define USTORE_CHUNK_CHUNK_ARENA_H_
+
+#include <cstddef>
+#include "types/type.h"
+#include "utils/noncopyable.h"
+
+namespace ustore {
+
+/**
+ * @brief A per-thread bump allocator for the buffers of new chunks.
+ *
+ * Buffers are carved from large blocks, each counting its buffers still in
+ * use. A block is freed once all its buffers are released, and the block a
+ * thread is filling is rewound as soon as it becomes unused. Node builders
+ * make, write and drop chunks one after another, so building a tree keeps
+ * reusing the same block rather than going to the heap for every chunk.
+ * A buffer may be released by any thread, but pins its whole block until
+ * then. A chunk kept long after it is built, e.g., the cell of a UCell, is
+ * therefore copied out by Chunk::LeaveArena, so that a small chunk does not
+ * hold on to a whole block.
+ */
+class ChunkArena : private Noncopyable {
+ public:
+  static constexpr size_t kBlockSize = 1 << 20;
+  // larger buffers are allocated from the heap
+  static constexpr size_t kMaxBufferSize = kBlockSize / 16;
+  static constexpr size_t kAlignment = 16;
+
+  class Block;
+
+  // arena of the calling thread
+  static ChunkArena* ThisThread();
+  // release a buffer allocated from the block
+  static void Release(Block* block) noexcept;
+
+  ~ChunkArena();
+
+  /**
+   * @brief allocate a buffer of n bytes
+   *
+   * @param block set to the block holding the buffer, or nullptr if the
+   * buffer is allocated from the heap and must be freed by delete[]
+   */
+  byte_t* Allocate(size_t n, Block** block);
+
+ private:
+  ChunkArena() = default;
+
+  // block being filled, on which the arena holds a reference
+  Block* current_ = nullptr;
+  size_t used_ = 0;
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_CHUNK_CHUNK_ARENA_H_
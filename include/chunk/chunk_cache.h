@@ -0,0 +1,44 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_CHUNK_CHUNK_CACHE_H_
+#define USTORE_CHUNK_CHUNK_CACHE_H_
+
+#include <memory>
+#include <utility>
+#include "chunk/chunk.h"
+#include "hash/hash.h"
+#include "utils/clock_cache.h"
+#include "utils/singleton.h"
+
+namespace ustore {
+
+/**
+ * @brief A process-wide cache of chunks shared by all chunk loaders.
+ *
+ * A chunk still referred to outside the cache (e.g., by a loader whose
+ * NodeCursors are alive) is pinned, see ClockCache.
+ */
+class ChunkCache : public ClockCache<Chunk>, public Singleton<ChunkCache> {
+  friend class Singleton<ChunkCache>;
+
+ public:
+  // capacity in bytes, 0 to disable caching
+  explicit ChunkCache(size_t capacity)
+    : ClockCache<Chunk>("ChunkCache", capacity) {}
+  ~ChunkCache() = default;
+
+  // cache the chunk, and return the one cached earlier if any
+  inline std::shared_ptr<const Chunk> Put(const Hash& key,
+                                          std::shared_ptr<const Chunk> chunk) {
+    const size_t num_bytes = chunk->numBytes();
+    return ClockCache<Chunk>::Put(key, std::move(chunk), num_bytes);
+  }
+
+ private:
+  // capacity is read from config
+  ChunkCache();
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_CHUNK_CHUNK_CACHE_H_
@@ -3,10 +3,19 @@
 #ifndef USTORE_CHUNK_CHUNK_LOADER_H_
 #define USTORE_CHUNK_CHUNK_LOADER_H_
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 #include <unordered_map>
+#include <utility>
 #include <string>
+#include <vector>
 #include "chunk/chunk.h"
 #include "hash/hash.h"
+#include "spec/db.h"
 #include "spec/slice.h"
 #include "store/chunk_store.h"
 #include "utils/noncopyable.h"
@@ -18,24 +27,71 @@ class DB;
 class Partitioner;
 
 // ChunkLoader is responsible to load chunks and cache them
+// Chunks owning their data are shared with other loaders through ChunkCache
+// Chunks returned by Load() stay pinned until the loader is destroyed, while
+//   those returned by LoadShared() are kept alive by the callers, and only the
+//   last kWindow of them are kept by the loader for reuse
+// At most kWindow chunks are prefetched ahead of being loaded
 class ChunkLoader : private Noncopyable {
  public:
+  static constexpr size_t kWindow = 64;
+
   virtual ~ChunkLoader() = default;
 
   const Chunk* Load(const Hash& key);
+  // Load a chunk to be dropped once the caller is done with it, e.g., by a
+  //   NodeCursor moving on to the next node
+  std::shared_ptr<const Chunk> LoadShared(const Hash& key);
+  // Start fetching chunks in background, to be taken by later Load() calls
+  //   Do nothing if the loader cannot fetch chunks asynchronously
+  void Prefetch(const std::vector<Hash>& keys);
+
+  inline bool canPrefetch() const { return static_cast<bool>(fetcher_); }
+  // Moving average of the time to fetch a chunk, in microseconds
+  inline double fetchLatency() const { return fetch_latency_us_.load(); }
 
  protected:
+  // A function to start fetching a chunk without waiting for it, e.g., by an
+  //   asynchronous request; a failed fetch is retried by GetChunk()
+  using Fetcher = std::function<std::future<Result<Chunk>>(const Hash&)>;
+
   ChunkLoader() = default;
+  explicit ChunkLoader(Fetcher fetcher) : fetcher_(std::move(fetcher)) {}
   // Do real work for fetching a chunk, only called by Load()
   virtual Chunk GetChunk(const Hash& key) = 0;
 
-  std::unordered_map<Hash, Chunk> cache_;
+  std::unordered_map<Hash, std::shared_ptr<const Chunk>> cache_;
+
+ private:
+  // A chunk being prefetched
+  struct Prefetching {
+    // found in ChunkCache, and kept from eviction until loaded
+    std::shared_ptr<const Chunk> cached;
+    std::future<Result<Chunk>> fetching;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  // Find a chunk recently loaded by LoadShared()
+  std::shared_ptr<const Chunk> FindInWindow(const Hash& key) const;
+  // Take a prefetched chunk, or get it from ChunkCache or by GetChunk()
+  std::shared_ptr<const Chunk> Fetch(const Hash& key);
+  // Wait for a prefetched chunk, return nullptr if failed to fetch it
+  std::shared_ptr<const Chunk> Take(const Hash& key, Prefetching* pf);
+  // Share a fetched chunk with other loaders if it owns the data
+  static std::shared_ptr<const Chunk> Share(const Hash& key, Chunk&& chunk);
+  void RecordFetch(std::chrono::steady_clock::time_point start);
+
+  const Fetcher fetcher_;
+  std::atomic<double> fetch_latency_us_{0};
+  // the last chunks returned by LoadShared(), oldest first
+  std::deque<std::pair<Hash, std::shared_ptr<const Chunk>>> window_;
+  std::unordered_map<Hash, Prefetching> prefetching_;
 };
 
 // Local chunk loader load chunks from local storage
 class LocalChunkLoader : public ChunkLoader {
  public:
-  LocalChunkLoader() : cs_(store::GetChunkStore()) {}
+  LocalChunkLoader();
   ~LocalChunkLoader() = default;
 
  protected:
@@ -46,17 +102,22 @@ class LocalChunkLoader : public ChunkLoader {
 };
 
 // Partitioned chunk loader load chunks based on hash-based partitions
+//   A chunk is read from the local replica if any, and otherwise from remote
+//   ones as ChunkClient chooses
 class PartitionedChunkLoader : public ChunkLoader {
  public:
   explicit PartitionedChunkLoader(const Partitioner* ptt, ChunkClient* client)
-    : cs_(store::GetChunkStore()), ptt_(ptt), client_(client) {}
+    : PartitionedChunkLoader(ptt, client, nullptr) {}
+  // Remote chunks are prefetched by asynchronous requests of prefetch_client,
+  //   which may be shared by loaders of several threads
+  PartitionedChunkLoader(const Partitioner* ptt, ChunkClient* client,
+                         ChunkClient* prefetch_client);
   ~PartitionedChunkLoader() = default;
 
  protected:
   Chunk GetChunk(const Hash& key) override;
 
  private:
-  ChunkStore* const cs_;
   const Partitioner* const ptt_;
   ChunkClient* client_;
 };
@@ -3,6 +3,7 @@
 #ifndef USTORE_CHUNK_CHUNK_WRITER_H_
 #define USTORE_CHUNK_CHUNK_WRITER_H_
 
+#include <vector>
 #include "chunk/chunk.h"
 #include "hash/hash.h"
 #include "store/chunk_store.h"
@@ -19,6 +20,9 @@ class ChunkWriter : private Noncopyable {
   virtual ~ChunkWriter() = default;
 
   virtual bool Write(const Hash& key, const Chunk& chunk) = 0;
+  // write chunks[i] with keys[i] in one batch
+  virtual bool MultiWrite(const std::vector<Hash>& keys,
+                          const std::vector<const Chunk*>& chunks);
 
  protected:
   ChunkWriter() = default;
@@ -31,19 +35,30 @@ class LocalChunkWriter : public ChunkWriter {
   ~LocalChunkWriter() = default;
 
   bool Write(const Hash& key, const Chunk& chunk) override;
+  bool MultiWrite(const std::vector<Hash>& keys,
+                  const std::vector<const Chunk*>& chunks) override;
 
  private:
   ChunkStore* const cs_;
 };
 
 // Partitioned chunk loader write chunks based on hash-based partitions
+//   Each chunk is written to all of its replicas, see ChunkClient, and the
+//   write succeeds once the local replica or a majority of the replicas store
+//   it, so that losing a replica does not fail it
 class PartitionedChunkWriter : public ChunkWriter {
  public:
+  // max # of remote puts of a batch in flight
+  static constexpr size_t kMaxRemotePuts = 64;
+
   explicit PartitionedChunkWriter(const Partitioner* ptt, ChunkClient* client)
     : cs_(store::GetChunkStore()), ptt_(ptt), client_(client) {}
   ~PartitionedChunkWriter() = default;
 
   bool Write(const Hash& key, const Chunk& chunk) override;
+  // local chunks are put in one batch, while remote ones are sent at once
+  bool MultiWrite(const std::vector<Hash>& keys,
+                  const std::vector<const Chunk*>& chunks) override;
 
  private:
   ChunkStore* const cs_;
@@ -32,12 +32,17 @@ class Chunker {
     chunk_window_ = chunk_window;
     max_chunk_size_ = max_chunk_size;
   }
+  // NOTE: engines detect different boundaries, so a chunker must not switch
+  //       its engine on existing data
+  inline void SetRHasherEngine(RollingHasher::Engine engine) {
+    engine_ = engine;
+  }
   virtual inline std::unique_ptr<RollingHasher> GetRHasher() const {
 #ifdef TEST_NODEBUILDER
     return std::unique_ptr<RollingHasher>(RollingHasher::TestHasher());
 #else
-    return std::unique_ptr<RollingHasher>(
-        new RollingHasher(chunk_pattern_, chunk_window_, max_chunk_size_));
+    return std::unique_ptr<RollingHasher>(new RollingHasher(
+        chunk_pattern_, chunk_window_, max_chunk_size_, engine_));
 #endif
   }
 
@@ -45,6 +50,7 @@ class Chunker {
   uint32_t chunk_pattern_ = (1 << 12) - 1;  // 4KB
   size_t chunk_window_ = 256;
   size_t max_chunk_size_ = 1 << 15;  // 32KB
+  RollingHasher::Engine engine_ = RollingHasher::Engine::kBuzHash;
 };
 
 }  // namespace ustore
@@ -11,8 +11,8 @@
 #include <boost/program_options.hpp>
 #include "types/type.h"
 #include "utils/logging.h"
+#include "utils/env.h"
 #include "utils/utils.h"
-#include "net/zmq_net.h"
 
 namespace ustore {
 namespace cli {
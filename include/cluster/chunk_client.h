@@ -3,34 +3,72 @@
 #ifndef USTORE_CLUSTER_CHUNK_CLIENT_H_
 #define USTORE_CLUSTER_CHUNK_CLIENT_H_
 
+#include <future>
+#include <vector>
 #include "cluster/client.h"
 
 namespace ustore {
 
+class LatencyTracker;
 
 /**
  * The client part of chunk service, providing APIs for fetching, writing and checking
  * certain chunk hash.
  * An extension of ClientDB
+ *
+ * Each chunk is stored by chunk_replicas workers, see Partitioner::GetDestIds.
+ * Reads go to a random replica to spread the load of hot chunks, and are
+ * hedged by sending them to the next replica as well once they are slower than
+ * the hedge_percentile of recent reads, or fail. Until that percentile is
+ * known, hedge_fallback_ms is waited instead.
  */
 
 class ChunkClient : public Client {
  public:
-  ChunkClient(ResponseBlob* blob, const Partitioner* ptt)
-    : Client(blob), ptt_(ptt) {}
+  // acks of a put to wait for every replica
+  static constexpr size_t kAllReplicas = ~size_t(0);
+
+  // reads are hedged on the percentile only if a tracker of their latencies is
+  // given, and after hedge_fallback_ms otherwise
+  ChunkClient(ResponseBlob* blob, const Partitioner* ptt,
+              LatencyTracker* read_latency = nullptr);
   ~ChunkClient() = default;
 
+  // # of replicas of each chunk
+  inline size_t replicas() const { return replicas_; }
+
   ErrorCode Get(const Hash& hash, Chunk* chunk) const;
-  ErrorCode Put(const Hash& hash, const Chunk& chunk);
+  // put to all replicas at once, other than the worker of id skip, e.g., the
+  // caller storing its own replica (ids follow the same host list), and
+  // succeed once acks of them store the chunk (all by default); the replicas
+  // failed are logged to be repaired
+  ErrorCode Put(const Hash& hash, const Chunk& chunk, int skip = -1,
+                size_t acks = kAllReplicas);
+  // ask the owner, which is the first replica
   ErrorCode Exists(const Hash& hash, bool* exist) const;
 
   // only used by worker client while enable_dist_store = false
   ErrorCode Get(const Slice& key, const Hash& hash, Chunk* chunk) const;
 
+  // asynchronous APIs, see Client
+  // reads are sent to a random replica, but not hedged
+  std::future<Result<Chunk>> GetAsync(const Hash& hash) const;
+  std::future<ErrorCode> PutAsync(const Hash& hash, const Chunk& chunk,
+                                  int skip = -1, size_t acks = kAllReplicas);
+  std::future<Result<bool>> ExistsAsync(const Hash& hash) const;
+
  private:
   void CreateChunkMessage(const Hash& hash, UMessage *msg) const;
+  // replicas in the order to read them
+  std::vector<int> ReadOrder(const Hash& hash) const;
+  // send the read to the replicas in turn until one returns the chunk
+  ErrorCode HedgedGet(const Hash& hash, const std::vector<int>& replicas,
+                      Chunk* chunk) const;
 
   const Partitioner* const ptt_;
+  const size_t replicas_;
+  LatencyTracker* const read_latency_;
+  const size_t hedge_fallback_us_;
 };
 
 }  // namespace ustore
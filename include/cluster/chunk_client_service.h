@@ -3,10 +3,14 @@
 #ifndef USTORE_CLUSTER_CHUNK_CLIENT_SERVICE_H_
 #define USTORE_CLUSTER_CHUNK_CLIENT_SERVICE_H_
 
+#include <memory>
+#include <string>
+#include <vector>
 #include "cluster/chunk_client.h"
 #include "cluster/client_service.h"
 #include "cluster/partitioner.h"
 #include "utils/env.h"
+#include "utils/latency_tracker.h"
 
 namespace ustore {
 
@@ -14,14 +18,25 @@ class ChunkClientService : public ClientService {
  public:
   ChunkClientService()
     : ClientService(&ptt_),
-      ptt_(Env::Instance()->config().worker_file(), "") {}
-  ~ChunkClientService() = default;
+      ptt_(Env::Instance()->config().worker_file(), ""),
+      read_latency_(NewReadLatency()) {}
+  // connect to the workers of a host list rather than the worker file
+  explicit ChunkClientService(const std::vector<std::string>& hosts)
+    : ClientService(&ptt_), ptt_(hosts, ""),
+      read_latency_(NewReadLatency()) {}
+  // stop before the tracker goes, as late responses of reads still record
+  ~ChunkClientService() { Stop(); }
 
   void Init() override;
   ChunkClient CreateChunkClient();
 
  private:
+  // a tracker of hedge_percentile, or nullptr if reads are not hedged
+  static LatencyTracker* NewReadLatency();
+
   const ChunkPartitioner ptt_;
+  // latencies of reading chunk replicas, shared by all clients
+  const std::unique_ptr<LatencyTracker> read_latency_;
 };
 
 }  // namespace ustore
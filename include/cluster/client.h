@@ -3,8 +3,10 @@
 #ifndef USTORE_CLUSTER_CLIENT_H_
 #define USTORE_CLUSTER_CLIENT_H_
 
+#include <future>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 #include "chunk/chunk.h"
 #include "cluster/partitioner.h"
@@ -12,6 +14,7 @@
 #include "hash/hash.h"
 #include "net/net.h"
 #include "proto/messages.pb.h"
+#include "spec/db.h"
 #include "types/ucell.h"
 #include "store/chunk_store.h"
 
@@ -21,6 +24,12 @@ namespace ustore {
  * Client is an abstracted class to parse response messages from ClientService
  * into app-level data structures.
  * It contains impls for parsing all return types of response messages.
+ *
+ * Requests are either synchronous, where the calling thread waits for the
+ * response, or asynchronous, where a future is returned at once and is
+ * fulfilled by the network thread receiving the response. Either way, the
+ * request fails rather than waits forever once it expires, or the connection
+ * to its server is lost.
  */
 
 class Client {
@@ -32,6 +41,39 @@ class Client {
     : id_(blob->id), net_(blob->net), res_blob_(blob) {}
 
   bool Send(UMessage* msg, const node_id_t& node_id) const;
+  // send a request whose response is passed to the handler on a network
+  // thread, rather than waited for
+  bool SendAsync(UMessage* msg, const node_id_t& node_id,
+                 std::function<void(UMessage*)> handler) const;
+  // send a request, and return the result parsed from its response later
+  template <typename T>
+  std::future<Result<T>> Call(UMessage* msg, const node_id_t& node_id,
+      ErrorCode (*parse)(UMessage*, T*)) const {
+    auto promise = std::make_shared<std::promise<Result<T>>>();
+    SendAsync(msg, node_id, [promise, parse](UMessage* response) {
+      Result<T> result;
+      result.stat = parse(response, &result.value);
+      promise->set_value(std::move(result));
+    });
+    return promise->get_future();
+  }
+  // send a request of an empty response
+  std::future<ErrorCode> Call(UMessage* msg, const node_id_t& node_id) const;
+
+  // helper methods for parsing response, which may take over its payload
+  static ErrorCode ParseEmptyResponse(UMessage* msg);
+  static ErrorCode ParseVersionResponse(UMessage* msg, Hash* version);
+  static ErrorCode ParseUCellResponse(UMessage* msg, UCell* value);
+  static ErrorCode ParseStringListResponse(UMessage* msg,
+                                           std::vector<string>* vals);
+  static ErrorCode ParseVersionListResponse(UMessage* msg,
+                                            std::vector<Hash>* versions);
+  static ErrorCode ParseBoolResponse(UMessage* msg, bool* value);
+  static ErrorCode ParseSizeResponse(UMessage* msg, size_t* value);
+  static ErrorCode ParseChunkResponse(UMessage* msg, Chunk* chunk);
+  static ErrorCode ParseInfoResponse(UMessage* msg,
+                                     std::vector<StoreInfo>* info);
+
   // helper methods for getting response
   ErrorCode GetEmptyResponse() const;
   ErrorCode GetVersionResponse(Hash* version) const;
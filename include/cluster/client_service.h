@@ -3,13 +3,18 @@
 #ifndef USTORE_CLUSTER_CLIENT_SERVICE_H_
 #define USTORE_CLUSTER_CLIENT_SERVICE_H_
 
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include "boost/thread.hpp"
 #include "cluster/partitioner.h"
 #include "cluster/response_blob.h"
 #include "cluster/service.h"
 #include "net/net.h"
+#include "types/type.h"
 
 namespace ustore {
 
@@ -17,24 +22,40 @@ namespace ustore {
  * ClientService is an abstracted class to handle response from server.
  * A ClientService receives responses from Server and invokes corresponding
  * classes to process the message.
+ *
+ * Asynchronous requests without a response by their deadlines are failed by
+ * a background thread, and those sent to a server are failed at once if the
+ * network tells the connection is lost, so that their handlers neither leak
+ * nor leave the callers waiting.
  */
 class ClientService : public Service {
  public:
   explicit ClientService(const Partitioner* ptt)
     : nclients_(0), ptt_(ptt) {}
-  virtual ~ClientService() = default;
+  virtual ~ClientService();
 
   void Init(std::unique_ptr<CallBack> callback);
   void HandleResponse(const void *msg, int size, const node_id_t& source);
 
  protected:
   ResponseBlob* CreateResponseBlob();
+  // fail the asynchronous requests in flight that match with the status
+  void FailRequests(
+      const std::function<bool(const ResponseBlob::Pending&)>& match,
+      ErrorCode stat);
 
  private:
+  // fail requests past their deadlines until stopped
+  void ExpireRequests();
+
   int nclients_;  // how many RequestHandler thread it uses
   const Partitioner* const ptt_;
   std::vector<std::unique_ptr<ResponseBlob>> responses_;  // the response queue
   boost::shared_mutex lock_;
+  std::thread expire_thread_;
+  std::mutex expire_mtx_;
+  std::condition_variable expire_cv_;
+  bool stop_expire_ = false;
 };
 }  // namespace ustore
 
@@ -39,8 +39,8 @@ class HostService : public Service {
                Env::Instance()->config().recv_threads());
     Service::Init(std::unique_ptr<Net>(net), std::move(callback));
   }
-  inline void Send(const node_id_t& source, byte_t* ptr, int len) {
-    net_->GetNetContext(source)->Send(ptr, static_cast<size_t>(len));
+  inline void Send(const node_id_t& source, MessageBuffer msg) {
+    net_->Reply(source, std::move(msg));
   }
 
   node_id_t node_addr_;
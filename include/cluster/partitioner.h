@@ -3,8 +3,12 @@
 #ifndef USTORE_CLUSTER_PARTITIONER_H_
 #define USTORE_CLUSTER_PARTITIONER_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <string>
+#include <utility>
 #include <vector>
 #include "cluster/port_helper.h"
 #include "hash/hash.h"
@@ -15,18 +19,32 @@ namespace ustore {
 /*
  * Partitioner is responsible for guiding the destination ip for each data
  * item.
+ *
+ * Items are placed by consistent hashing. Each destination owns a number of
+ * virtual nodes, i.e., points on a ring of 64-bit hash values derived from
+ * its address, and an item belongs to the first point at or after its own
+ * hash. Adding or removing a destination thus only moves the items between
+ * the points it gains or loses, instead of nearly all of them.
  */
 class Partitioner {
  public:
+  // load the addresses listed in a host file
+  static std::vector<std::string> LoadHosts(const std::string& hostfile);
+
   virtual ~Partitioner() = default;
 
   // get dest id of a specific hash (For Chunked data types)
   inline int GetDestId(const Hash& hash) const {
     // no need to compute when having a single server
     if (dest_list_.size() == 1) return 0;
-    uint64_t idx = *reinterpret_cast<const int64_t*>(hash.value() + 9);
-    return idx % dest_list_.size();
+    auto it = std::lower_bound(ring_.begin(), ring_.end(),
+                               std::make_pair(Point(hash), 0));
+    return it == ring_.end() ? ring_.front().second : it->second;
   }
+  // get dest ids of the n replicas of a specific hash, i.e., its owner
+  // followed by the next distinct destinations on the ring, or all of the
+  // destinations if fewer than n
+  std::vector<int> GetDestIds(const Hash& hash, size_t n) const;
   // get dest id of a specific key (For UCell data type)
   inline int GetDestId(const Slice& key) const {
     return GetDestId(Hash::ComputeFrom(key.data(), key.len()));
@@ -40,7 +58,7 @@ class Partitioner {
     return id2addr(GetDestId(key));
   }
 
-  // own id
+  // own id, or -1 if not listed
   inline int id() const { return id_; }
   // own address
   inline const std::string& addr() const { return id2addr(id_); }
@@ -56,16 +74,31 @@ class Partitioner {
   // Partitioner need to know the rule for getting final port
   Partitioner(const std::string& hostfile, const std::string& self_addr,
               std::function<std::string(std::string)> f_port);
+  Partitioner(const std::vector<std::string>& hosts,
+              const std::string& self_addr,
+              std::function<std::string(std::string)> f_port);
 
  private:
+  // position of a hash on the ring
+  static inline uint64_t Point(const Hash& hash) {
+    uint64_t point;
+    std::memcpy(&point, hash.value() + 9, sizeof(point));
+    return point;
+  }
+
   int id_ = -1;
   std::vector<std::string> dest_list_;
+  // virtual nodes as (point, dest id), sorted by point
+  std::vector<std::pair<uint64_t, int>> ring_;
 };
 
 class WorkerPartitioner : public Partitioner {
  public:
   WorkerPartitioner(const std::string& hostfile, const std::string& self_addr)
       : Partitioner(hostfile, self_addr, PortHelper::WorkerPort) {}
+  WorkerPartitioner(const std::vector<std::string>& hosts,
+                    const std::string& self_addr)
+      : Partitioner(hosts, self_addr, PortHelper::WorkerPort) {}
   ~WorkerPartitioner() = default;
 };
 
@@ -73,6 +106,9 @@ class ChunkPartitioner : public Partitioner {
  public:
   ChunkPartitioner(const std::string& hostfile, const std::string& self_addr)
       : Partitioner(hostfile, self_addr, PortHelper::ChunkPort) {}
+  ChunkPartitioner(const std::vector<std::string>& hosts,
+                   const std::string& self_addr)
+      : Partitioner(hosts, self_addr, PortHelper::ChunkPort) {}
   ~ChunkPartitioner() = default;
 };
 
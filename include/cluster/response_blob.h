@@ -3,9 +3,12 @@
 #ifndef USTORE_CLUSTER_RESPONSE_BLOB_H_
 #define USTORE_CLUSTER_RESPONSE_BLOB_H_
 
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include "net/net.h"
 #include "proto/messages.pb.h"
 
@@ -19,11 +22,21 @@ using google::protobuf::Message;
  * condition to hold true. The has_msg variable will be set by the registered
  * callback method of the network thread
  *
- * This object is used under the assumption that the client issues requests in
- * a synchronous manner. As a result, the msg must be cleared before another
- * response is set.
+ * Every request carries a request id, and its response is passed to the
+ * handler registered for it, so any number of asynchronous requests may be in
+ * flight. A client issues at most one synchronous request at a time, whose
+ * handler sets the msg, so it must be cleared before another response is set.
+ * Requests without a response by their deadline, or sent to a server whose
+ * connection is lost, are failed by the ClientService.
  */
 struct ResponseBlob {
+  // an asynchronous request in flight
+  struct Pending {
+    std::function<void(UMessage*)> handler;
+    node_id_t dest;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
   int id;
   Net* net = nullptr;
   std::mutex lock;
@@ -32,6 +45,10 @@ struct ResponseBlob {
   bool has_msg;
   // message will be takeover by corresponding client, no memory leak here
   Message* message = nullptr;
+
+  // asynchronous requests in flight, by request id
+  std::unordered_map<uint64_t, Pending> handlers;
+  uint64_t next_request_id = 1;
 };
 
 }  // namespace ustore
@@ -3,6 +3,7 @@
 #ifndef USTORE_CLUSTER_WORKER_CLIENT_H_
 #define USTORE_CLUSTER_WORKER_CLIENT_H_
 
+#include <future>
 #include <string>
 #include <vector>
 #include "cluster/chunk_client_service.h"
@@ -36,6 +37,9 @@ namespace ustore {
  *    + When a UMessage response arrives, the network thread (callback)
  *      checks for the source and wakes up the corresponding ResponseBlob
  *
+ * The asynchronous APIs (*Async) instead tag each request with an id, and
+ * return a future fulfilled by the network thread, so that a thread may
+ * pipeline many requests rather than waiting for each in turn.
  */
 
 class WorkerClient : public Client, public DB {
@@ -104,6 +108,36 @@ class WorkerClient : public Client, public DB {
                      Chunk* chunk) const override;
 
   ErrorCode GetStorageInfo(std::vector<StoreInfo>* info) const override;
+  // collect garbage at every worker, see Worker::GC
+  ErrorCode GC(size_t* reclaimed);
+
+  // Asynchronous storage APIs.
+  std::future<Result<UCell>> GetAsync(const Slice& key,
+                                      const Slice& branch) const;
+  std::future<Result<UCell>> GetAsync(const Slice& key,
+                                      const Hash& version) const;
+  std::future<Result<Hash>> PutAsync(const Slice& key, const Value& value,
+                                     const Slice& branch);
+  std::future<Result<Hash>> PutAsync(const Slice& key, const Value& value,
+                                     const Hash& pre_version);
+  std::future<Result<bool>> ExistsAsync(const Slice& key,
+                                        const Slice& branch) const;
+  std::future<Result<Hash>> GetBranchHeadAsync(const Slice& key,
+                                               const Slice& branch) const;
+  std::future<ErrorCode> DeleteAsync(const Slice& key, const Slice& branch);
+
+  // Moving keys between workers, see WorkerService.
+  // ask every worker to move the keys owned by others under the new host
+  // list to them, and return once all workers have handed off their keys
+  ErrorCode Migrate(const std::vector<std::string>& hosts);
+  // store a chunk at the worker of the key
+  std::future<ErrorCode> PutChunkAsync(const Slice& route_key,
+                                       const Hash& version,
+                                       const Chunk& chunk);
+  // set the branch heads and add the latest versions at the worker of the key
+  std::future<ErrorCode> PutHeadAsync(const Slice& key,
+      const std::vector<std::string>& branches, const std::vector<Hash>& heads,
+      const std::vector<Hash>& latest);
 
  protected:
   void CreatePutMessage(const Slice& key, const Value& value, UMessage* msg)
@@ -4,6 +4,7 @@
 #define USTORE_CLUSTER_WORKER_CLIENT_SERVICE_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 #include "cluster/chunk_client_service.h"
 #include "cluster/client_service.h"
@@ -28,10 +29,14 @@ namespace ustore {
 class WorkerClientService : public ClientService {
  public:
   WorkerClientService()
-    : ClientService(&ptt_), ptt_(Env::Instance()->config().worker_file(), "") {
+    : WorkerClientService(
+        Partitioner::LoadHosts(Env::Instance()->config().worker_file())) {}
+  // connect to the workers of a host list rather than the worker file
+  explicit WorkerClientService(const std::vector<std::string>& hosts)
+    : ClientService(&ptt_), ptt_(hosts, "") {
     // only need chunk client when want to get chunk bypass worker
     if (Env::Instance()->config().get_chunk_bypass_worker())
-      ck_svc_.reset(new ChunkClientService());
+      ck_svc_.reset(new ChunkClientService(hosts));
   }
   ~WorkerClientService() = default;
 
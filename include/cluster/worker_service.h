@@ -3,8 +3,17 @@
 #ifndef USTORE_CLUSTER_WORKER_SERVICE_H_
 #define USTORE_CLUSTER_WORKER_SERVICE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include "cluster/access_logging.h"
 #include "cluster/chunk_service.h"
 #include "cluster/host_service.h"
@@ -12,6 +21,7 @@
 #include "cluster/port_helper.h"
 #include "proto/messages.pb.h"
 #include "utils/env.h"
+#include "utils/shared_lock.h"
 #include "worker/worker.h"
 
 namespace ustore {
@@ -19,28 +29,59 @@ namespace ustore {
 /**
  * The WorkerService receives requests from WorkerClientService and invokes
  * the Worker to process the message.
+ *
+ * With service_threads configured, requests are executed by a pool of
+ * service threads instead of the receiving threads, so that a slow request
+ * only holds back those queued behind it. Requests of the same key always go
+ * to the same service thread, and are thus executed in the order received.
+ *
+ * Keys are moved online when workers join or leave: on a MIGRATE request
+ * with the new host list, the keys owned by other workers under that list
+ * are streamed to them, i.e., the chunks reachable from their heads, while
+ * this worker keeps serving them. Requests of those keys are then held off
+ * briefly to send what changed meanwhile and the heads, queued aside so that
+ * other keys are still served, after which the keys are handed off: their
+ * requests are refused with kKeyMoved, and clients are to switch to the new
+ * host list. The host list is persisted along with the data, and the heads
+ * of the keys are dropped, so that GC collects their chunks. Moving keys is
+ * not supported with the distributed store.
+ *
+ * Garbage is collected by a background thread, either on GC requests or once
+ * gc_trigger_ratio of the segments of the store are used. Requests pin the
+ * store while executed, so that the chunks they read stay in place.
  */
 class WorkerService : public HostService {
  public:
-  WorkerService(const node_id_t& addr, bool persist)
-    : HostService(PortHelper::WorkerPort(addr)),
-      ptt_(Env::Instance()->config().worker_file(), addr),
-      worker_(ptt_.id(),
-              Env::Instance()->config().enable_dist_store() ? &ptt_ : nullptr,
-              persist),
-      access_(Env::Instance()->config().access_log_dir(), addr) {
-      auto& config = Env::Instance()->config();
-      // only need chunk service when other worker or client need it
-      if (config.enable_dist_store() || config.get_chunk_bypass_worker())
-        ck_svc_.reset(new ChunkService(addr));
-    }
-  ~WorkerService() = default;
+  // metrics of the executed requests
+  struct Stats {
+    size_t requests;    // # of requests executed
+    size_t queued;      // # of requests waiting in queues now
+    size_t max_queued;  // the most requests ever waiting in a queue
+    size_t wait_us;     // total time of requests waiting in queues
+    size_t service_us;  // total time of executing requests
+
+    friend std::ostream& operator<<(std::ostream& os, const Stats& obj);
+  };
+
+  WorkerService(const node_id_t& addr, bool persist);
+  ~WorkerService();
 
   void Init() override;
   void HandleRequest(const void *msg, int size, const node_id_t& source)
     override;
 
+  Stats GetStats() const;
+  inline size_t numServiceThreads() const { return executors_.size(); }
+
  private:
+  class Executor;
+
+  void StartServiceThreads(int n);
+  void StopServiceThreads();
+  // execute the request and send back the response, unless it is held off;
+  // resumed if it was held off before
+  void Execute(const UMessage& umsg, const node_id_t& source,
+               bool resumed = false);
   Value ValueFromRequest(const ValuePayload& payload);
   void HandlePutRequest(const UMessage& umsg, ResponsePayload* response);
   void HandleGetRequest(const UMessage& umsg, ResponsePayload* response);
@@ -61,12 +102,68 @@ class WorkerService : public HostService {
   void HandlePutUnkeyedRequest(const UMessage& umsg, ResponsePayload* response);
   void HandleGetChunkRequest(const UMessage& umsg, ResponsePayload* response);
   void HandleGetInfoRequest(const UMessage& umsg, UMessage* response);
+  void HandlePutChunkRequest(const UMessage& umsg, ResponsePayload* response);
+  void HandlePutHeadRequest(const UMessage& umsg, ResponsePayload* response);
+  // execute a request of clients, unless its key is moved; false if held off
+  // as its key is being handed off, and is then executed once done
+  bool ExecuteRequest(const UMessage& umsg, const node_id_t& source,
+                      bool resumed, UMessage* response);
+  // execute the requests held off, in the order received per key
+  void ResumeHeldOff();
+  // migrate in the background, and reply once done
+  void HandleMigrateRequest(const UMessage& umsg, const node_id_t& source);
+  // move the keys owned by other workers under the host list to them
+  ErrorCode Migrate(const std::vector<std::string>& hosts);
+  // reply once the next GC is done
+  void HandleGCRequest(const UMessage& umsg, const node_id_t& source);
+  // run GC on requests, or when the store fills up
+  void GCLoop();
+  // whether the key is handed off to another worker; the caller holds
+  // handoff_mtx_, unless it is the migration, which alone replaces owner_ptt_
+  bool IsMoved(const std::string& key) const;
+  // whether the key is being handed off; the caller holds handoff_mtx_
+  bool IsFenced(const std::string& key) const;
+  // the file of the host list keys are handed off under
+  std::string HandoffPath() const;
+  // drop the heads of the keys handed off
+  void RemoveMovedKeys();
 
   const ChunkPartitioner ptt_;
   Worker worker_;  // where the logic happens
+  // serialize requests executed by receiving threads
   std::mutex lock_;
   std::unique_ptr<ChunkService> ck_svc_;
   AccessLogging access_;
+  std::vector<std::unique_ptr<Executor>> executors_;
+  std::atomic<size_t> next_executor_;  // for requests without a key
+  std::atomic<size_t> requests_;
+  std::atomic<size_t> max_queued_;
+  std::atomic<size_t> wait_us_;
+  std::atomic<size_t> service_us_;
+  const bool persist_;
+  // held shared by requests of clients, and exclusively to fence keys
+  shared_mutex handoff_mtx_;
+  // workers of the host list that keys are being handed off to, if any
+  std::unique_ptr<WorkerPartitioner> fence_ptt_;
+  // workers of the host list that keys are handed off to, if any
+  std::unique_ptr<WorkerPartitioner> owner_ptt_;
+  // requests of clients held off by key, which keep later requests of the
+  // key held off too, till they are resumed
+  struct HeldOff {
+    std::unique_ptr<UMessage> request;
+    node_id_t source;
+  };
+  std::mutex held_off_mtx_;
+  std::unordered_map<std::string, std::deque<HeldOff>> held_off_;
+  std::mutex migrate_mtx_;
+  std::thread migrate_thread_;
+  bool migrating_ = false;
+  std::mutex gc_mtx_;
+  std::condition_variable gc_cv_;
+  // sources and responses of GC requests waiting for the next GC
+  std::vector<std::pair<node_id_t, UMessage>> gc_waiting_;
+  bool stop_gc_ = false;
+  std::thread gc_thread_;  // not started with distributed store
 };
 }  // namespace ustore
 
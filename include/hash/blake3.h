@@ -0,0 +1,39 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_HASH_BLAKE3_H_
+#define USTORE_HASH_BLAKE3_H_
+
+#include <cstddef>
+#include "types/type.h"
+
+namespace ustore {
+namespace blake3 {
+
+constexpr size_t kDigestLength = 32;
+// input is split into chunks of this size, which are leaves of a binary tree
+// and can be compressed independently
+constexpr size_t kChunkLength = 1024;
+
+enum class Impl : int {
+  // scalar code that runs everywhere
+  kPortable = 0,
+  // compress 8 chunks (or parent nodes) at a time in AVX2 lanes
+  kAVX2 = 1
+};
+
+// check if the implementation can run on this CPU
+bool IsSupported(Impl impl);
+// the fastest implementation supported, chosen once by CPUID
+Impl Fastest();
+
+// compute the BLAKE3 digest of data into kDigestLength bytes
+void Digest(Impl impl, const byte_t* data, size_t len, byte_t* digest);
+
+inline void Digest(const byte_t* data, size_t len, byte_t* digest) {
+  Digest(Fastest(), data, len, digest);
+}
+
+}  // namespace blake3
+}  // namespace ustore
+
+#endif  // USTORE_HASH_BLAKE3_H_
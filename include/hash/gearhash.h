@@ -0,0 +1,104 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_HASH_GEARHASH_H_
+#define USTORE_HASH_GEARHASH_H_
+
+#include <cstdint>
+
+namespace gearhash {
+
+// Random values of bytes for the gear hash: h = (h << 1) + gear[b].
+// Bit k of h depends on the last k + 1 bytes only.
+// NOTE: chunk boundaries, and thus content addresses, depend on this table,
+//       DO NOT change it
+const uint64_t gear[256] = {
+    0x7eb4cd1271fe20fd, 0x0289861ac270becc, 0xba97c64af9727318,
+    0x529148041ffc76eb, 0xffee5ee8d8674103, 0x391ddab1e083cbaf,
+    0xb88aaa42d792c4f6, 0xe80a2412b90b0e9f, 0x8c3428f9b6502a41,
+    0xb0cae11aae13995d, 0x311b7513b103018b, 0x25f180ca9a937b55,
+    0x010c49383c7b4673, 0xb5cd472ef3258945, 0xc2afe9860ed1d300,
+    0x2b9b3610e84f0d26, 0x0ade38ff9c90b7b0, 0x612dafd490952594,
+    0x9e234ef6f3be391d, 0x92e1437e1c7bc35e, 0x642e3d073fd048ab,
+    0x714372963a659b30, 0x669f43893a0e6cf0, 0x3e1cc79bab05ff5d,
+    0x09edec32b2d8f0fb, 0x2ec8287edf70f17f, 0x7b591bb00b25c9ee,
+    0xf5fe1e8cbd14ef94, 0xbaba0cfbf873b331, 0x753d37755907cb7b,
+    0xe483b4442e887955, 0x92ef937e47c2daea, 0x25993c4e02ef2696,
+    0xec0d4974e8e0f343, 0xf370502357aa8f54, 0xcf0716004bc238b2,
+    0x59997b19b20af15d, 0x2e8b1acb1860f711, 0x03b039e54d50ae3a,
+    0x8ac16a0991081b42, 0x7fd026815452150a, 0xc51afd1b1963c23b,
+    0xd5996b4b1837deef, 0x4773d56896caefe9, 0x47c1e7cf49a7da2f,
+    0x75283f6fd7e1316d, 0x785d9392879c8d6f, 0xbb5ea1773f5512a8,
+    0xad201d05b3a65479, 0x864bc6e85d019f9f, 0x659b41a918d56c40,
+    0xe546460e30a37d04, 0x6a96d2a34500d2bc, 0x176a3920d6fac575,
+    0x5a5e875ad402bc59, 0xd68f9a3595ec1ef0, 0x614b87265247606d,
+    0xb759c85a346b88e7, 0xd33658fbb379e7ea, 0x3a704ef29f4bc2c2,
+    0x1c0de14325daa426, 0x117128fea47699f6, 0x702bf4b1abff22bf,
+    0x6b4282ef9b8ab681, 0x8217a0ac00165977, 0x7b63fc463c12adc0,
+    0xd0586c1d08036f07, 0x0c4f1e6ae8265dd9, 0x09640cf0e2437e43,
+    0x9b97d676a739d0a7, 0xce679b9788e431d7, 0x2553667f8fbda38b,
+    0xa7e6505cd30cd0ad, 0x452dbc447ac68a11, 0xb59fb1e09f0fcd28,
+    0xdbaeb8fdde439962, 0x51996dfa412bbe02, 0xff1d48ef4d24331c,
+    0xa9b585e38efc95cc, 0xce3693a943a4c124, 0x61077f6bb04555e0,
+    0x477708a491e6f08f, 0x2268cd3d29fa54f5, 0x8af4429e8e166ee0,
+    0x54f85a0e737b004d, 0x14fad6b533c67c3b, 0xd3644eade976a1c8,
+    0x1021412c76a5650b, 0xee1252584293fece, 0xc5725346fd9a5560,
+    0xf6dc7082332e944f, 0x272297f93307e58a, 0xd66e541f70b7c2bf,
+    0xf7ec104892ba48d4, 0x805cd43b42933d35, 0xd331d97c972b2561,
+    0xe0a2da55edaef7af, 0xe0809fa5d4a8926b, 0xfe63bf01a96f81a1,
+    0xdb46315b3084fe0c, 0xe9fa11a75b1b03b7, 0x9fd4f4e7c69db928,
+    0x5a32750050e434aa, 0xabf6cd033340efee, 0xb18e1fcb186bc2a9,
+    0x1d29184640da22d5, 0xf8506a46ca92807f, 0xa561a72dd5d0a373,
+    0x46309e730dc348c0, 0x1736ce2fa7f7f051, 0xc74bd1710b67b5ba,
+    0x226c15fbce147bb6, 0xadebc819f8665134, 0xd7474068db32f749,
+    0xdd7b3b80ebe37d63, 0xeeb64ba72845a001, 0x2113d419ec44993c,
+    0xa58d69711b9bf911, 0x11812a133508884f, 0xe58f9eed2034d170,
+    0x7705d58b94c2ce48, 0x97f4ae3d8acd4835, 0xa901d6becd3f6426,
+    0x30abdd41b3876f2e, 0x96fe85e90aad9fce, 0xa536f0927e82eac5,
+    0x19fc201fee8e3f49, 0xc04b639713d071f5, 0x5f2a3ccd52f9a558,
+    0x21f7432e91fed2c2, 0xf7ad91307635d7b7, 0xdf55fde34d121252,
+    0x2f20a5917918b398, 0x681da8161406e514, 0x4c3fb4590c227f2a,
+    0x68e0b28dffb47db0, 0x4541e916acff0ee4, 0xdd8736ed441625c1,
+    0x7a2088cde4330a9b, 0x6a1f57c51770e050, 0x82e9c6d42a6d2e63,
+    0x0864603e1fffed6d, 0xffec94204194ff94, 0x6068ba2327340838,
+    0xa1589cc11eb3bde4, 0xd7114ea7277e14d0, 0xe8b0bf3ea679f79d,
+    0x934bd93bc027c443, 0x6e94dafac17d71da, 0x9bd04c1767c0551b,
+    0x93ba025915ab4b0e, 0xd0117f4e3963d671, 0x7293c3530c3ca40a,
+    0x56cdaa1acb38b129, 0x08f9a70bdb4e0086, 0x424ff44ba01420b2,
+    0x5ccb4d9a6577fffa, 0x11bc6f6006573e38, 0xa59c28a65954e9ec,
+    0x2c1720b80e50381a, 0x19fd90838f16e7d0, 0xaca1c88dc30dc258,
+    0x6356d8301af47bbf, 0xd3c7b2cfa5e4d0d0, 0xa68ac384b55132ac,
+    0xccff7abd7da5a043, 0xf6708281e677fc24, 0x19e2998a4f7297a9,
+    0x3c6ef4af9c61a44e, 0x342da884a9a21763, 0xea9e4b0ee7412c2f,
+    0x4e8860f39a809f33, 0x0045c7300628f9d2, 0x6328ba18d056a72b,
+    0x22f10a70f3bf36d3, 0x74067fa387f7b724, 0x50614706c96b7f79,
+    0x8b02bfd7568b9c17, 0x0d5b9f3b50415353, 0xa96f87810b4d5f3d,
+    0x435d322995c26e47, 0x107431e474b0c317, 0x8749fbafa7c41a6b,
+    0x7cb3fb717a48d32e, 0xb3b0d488ea989995, 0x7d405e5053160a6c,
+    0xad8842826e90971e, 0xb045ec80584d401d, 0x19886f33bd0c775c,
+    0xa75c7c487ec94b2c, 0x320a2de50ddeaf0d, 0x850c618c595f1dd3,
+    0x686b64c450b0764e, 0xc33a0c73b5151664, 0xb01a8dc89224e770,
+    0x5749ad261d544363, 0xe733a96e2d527ff4, 0x24778e2c12c3666b,
+    0xf5170ed08aea7c27, 0x032935f3c1b54d84, 0x4c124d42883b9268,
+    0x17d7d403dbaee6b5, 0x954ff65986d9ce03, 0xb9d8146383ab0ca4,
+    0x678eaf3cc7c876b7, 0x6599bfe8eb20bb96, 0xe0e482672cff2054,
+    0x3a6709dcbba8c157, 0xee24479977c40d59, 0x47ede8ebcfe81370,
+    0xb4f65d4de8d6fb8c, 0xd40984114661dcf5, 0x8a79b119a100fba2,
+    0xe2e5d606bd81fec7, 0xc6a035a379b34240, 0xd4e253c70a77bdca,
+    0xdde19220381d69e6, 0xb4c9a8523e8b6ff1, 0x96b19f56b4783e89,
+    0x3a90b3160eb937ba, 0x41fcc1a5c37c3a8c, 0x6afc40ba93058e7a,
+    0x44f9bb3b6a6ce6a4, 0xc3bf7ff4fc458600, 0xdc5f4944675b17f9,
+    0xf5c0b07273ea06cf, 0x79276fcc53399e95, 0x1630e18fde76a030,
+    0x5ac757e40947eba9, 0xc31d23d4352d3716, 0x1de776c72fd84ee1,
+    0x845efa9d05c354fa, 0xabfeef78c191b347, 0xce099797b60ffd38,
+    0x5b9585f26a3f73b9, 0x3d3eef022a19affb, 0x9b3041c0dbf95559,
+    0x3fba1870cc342ba3, 0x12aa1a83b495dd85, 0x1a6ad82908e7f00b,
+    0xd42a11f55fa115a2, 0xacbfadce262f72ba, 0xdd272cfb3281920a,
+    0x20b0e4f522234409, 0x85b49696d285c0c4, 0x0b31c588df676fb1,
+    0xdefc0a5f583f5481, 0xad88dcefcc11912f, 0xb45c1f3d9d884198,
+    0x41fac3224b8c3d8d, 0xc2ec53ad5b99243d, 0xb1459bda72a77f71,
+    0xe4b6d36871a34a81, 0x2776126a26b8e49e, 0xf42de4fa683eddd1,
+    0xdecbd6683e9c6178};
+
+}  // namespace gearhash
+
+#endif  // USTORE_HASH_GEARHASH_H_
@@ -31,6 +31,9 @@ class Hash {
   // if do so, must allocate own value
   static Hash ComputeFrom(const byte_t* data, size_t len);
   static Hash ComputeFrom(const std::string& data);
+  // compute hash from data into a buffer of kByteLength bytes, and return a
+  // hash using the buffer
+  static Hash ComputeFrom(const byte_t* data, size_t len, byte_t* buffer);
 
   Hash() = default;
   // movable
@@ -0,0 +1,36 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_HASH_SHA256_H_
+#define USTORE_HASH_SHA256_H_
+
+#include <cstddef>
+#include "types/type.h"
+
+namespace ustore {
+namespace sha256 {
+
+constexpr size_t kDigestLength = 32;
+
+enum class Impl : int {
+  // scalar code that runs everywhere
+  kPortable = 0,
+  // x86 SHA extensions (SHA-NI)
+  kShaNi = 1
+};
+
+// check if the implementation can run on this CPU
+bool IsSupported(Impl impl);
+// the fastest implementation supported, chosen once by CPUID
+Impl Fastest();
+
+// compute the SHA-256 digest of data into kDigestLength bytes
+void Digest(Impl impl, const byte_t* data, size_t len, byte_t* digest);
+
+inline void Digest(const byte_t* data, size_t len, byte_t* digest) {
+  Digest(Fastest(), data, len, digest);
+}
+
+}  // namespace sha256
+}  // namespace ustore
+
+#endif  // USTORE_HASH_SHA256_H_
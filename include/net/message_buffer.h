@@ -0,0 +1,50 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_NET_MESSAGE_BUFFER_H_
+#define USTORE_NET_MESSAGE_BUFFER_H_
+
+#include <cstddef>
+#include "types/type.h"
+#include "utils/noncopyable.h"
+
+namespace ustore {
+
+/**
+ * @brief A buffer of a serialized message to send.
+ *
+ * Buffers are recycled through a pool shared by all threads, as large ones
+ * would otherwise be mapped and unmapped by the heap for every message. A
+ * network may take over the buffer to send it without copying, and return it
+ * by Free() once sent, from whichever thread that is done.
+ */
+class MessageBuffer : private Moveable {
+ public:
+  // buffers up to kMaxPooledSize bytes are kept in the pool
+  static constexpr size_t kMinPooledSize = size_t(1) << 10;
+  static constexpr size_t kMaxPooledSize = size_t(1) << 24;
+
+  // return a buffer taken by Release(); the signature matches zmq_free_fn
+  static void Free(void* data, void* hint);
+
+  MessageBuffer() = default;
+  // a buffer of size bytes
+  explicit MessageBuffer(size_t size);
+  MessageBuffer(MessageBuffer&& other) noexcept;
+  MessageBuffer& operator=(MessageBuffer&& other) noexcept;
+  ~MessageBuffer();
+
+  inline bool empty() const noexcept { return data_ == nullptr; }
+  inline byte_t* data() const noexcept { return data_; }
+  inline size_t size() const noexcept { return size_; }
+
+  // give up the buffer, which is to be returned by Free()
+  byte_t* Release() noexcept;
+
+ private:
+  byte_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_NET_MESSAGE_BUFFER_H_
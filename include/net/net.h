@@ -3,9 +3,12 @@
 #ifndef USTORE_NET_NET_H_
 #define USTORE_NET_NET_H_
 
+#include <functional>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
+#include "net/message_buffer.h"
 #include "types/type.h"
 #include "utils/noncopyable.h"
 #include "utils/logging.h"
@@ -74,6 +77,16 @@ class Net : private Noncopyable {
     return netmap_.count(id) == 1 ? true : false;
   }
 
+  /**
+   * Send a response to the source of a received message.
+   * By default it is sent through the NetContext of the source, so it must be
+   * done before that context receives the next message. Networks that route
+   * responses by the source itself may reply from any thread at any time.
+   */
+  virtual ssize_t Reply(const node_id_t& source, const void* ptr, size_t len);
+  // reply with a buffer the network takes over
+  virtual ssize_t Reply(const node_id_t& source, MessageBuffer msg);
+
   /**
    * Register the callback function that will be called whenever there is new
    * data is received
@@ -88,6 +101,11 @@ class Net : private Noncopyable {
   inline void RegisterRecv(CallBack* cb) {
     cb_ = cb;
   }
+  // Register the function called once the connection to a node is lost, for
+  // the networks that can tell, e.g., to fail the requests sent to it
+  inline void RegisterClose(std::function<void(const node_id_t&)> on_close) {
+    on_close_ = std::move(on_close);
+  }
 
  protected:
   Net() {}
@@ -95,6 +113,7 @@ class Net : private Noncopyable {
   node_id_t cur_node_;
   std::unordered_map<node_id_t, NetContext*> netmap_;
   CallBack* cb_ = nullptr;
+  std::function<void(const node_id_t&)> on_close_;
   volatile bool is_running_;
 };
 
@@ -120,6 +139,13 @@ class NetContext {
    */
   virtual ssize_t Send(const void* ptr, size_t len,
                        CallBack* func = nullptr) = 0;
+  /*
+   * send the data in the buffer, which the network takes over to avoid a
+   * copy if it can, or otherwise frees after sending
+   */
+  virtual ssize_t Send(MessageBuffer msg) {
+    return Send(msg.data(), msg.size());
+  }
 
 
   // Blocking APIs (not supported)
@@ -134,6 +160,15 @@ class NetContext {
   node_id_t src_id_, dest_id_;
 };
 
+inline ssize_t Net::Reply(const node_id_t& source, const void* ptr,
+                          size_t len) {
+  return GetNetContext(source)->Send(ptr, len);
+}
+
+inline ssize_t Net::Reply(const node_id_t& source, MessageBuffer msg) {
+  return GetNetContext(source)->Send(std::move(msg));
+}
+
 namespace net {
 
   // create network instance, caller is responsible for the allocated instance
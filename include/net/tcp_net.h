@@ -0,0 +1,115 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_NET_TCP_NET_H_
+#define USTORE_NET_TCP_NET_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "net/net.h"
+#include "utils/shared_lock.h"
+
+namespace ustore {
+
+/**
+ * Network over plain TCP connections, driven by the ae event loop.
+ *
+ * Every message is framed by its length in 4 bytes of network order. A peer
+ * is served by a single connection that is shared by all threads: the
+ * connections are spread over a number of event loops, each in its own
+ * thread, which read and dispatch messages. A message is written right away
+ * by the sending thread with a gathering write of its frame header and its
+ * buffer, and is only queued for the event loop once the socket is full.
+ */
+class TcpNet : public Net {
+ public:
+  // a connection to a peer, see tcp_net.cc
+  class Connection;
+
+  ~TcpNet();
+
+  // run the first event loop, and the others in the background
+  void Start() override;
+  void Stop() override;
+  // process the received msg
+  void Dispatch(const node_id_t& source, const void* msg, int size);
+
+ protected:
+  // an event loop and the thread running it
+  class EventLoop;
+
+  TcpNet(const node_id_t& id, int nthreads);
+
+  // watch the connection in one of the event loops in turn
+  void Attach(const std::shared_ptr<Connection>& conn);
+  // called by the event loop once the connection is closed
+  virtual void OnClose(Connection* conn) {}
+
+  std::vector<std::unique_ptr<EventLoop>> loops_;
+  std::atomic<size_t> next_loop_;
+};
+
+/**
+ * Server side of the network. Connections of clients are accepted by the
+ * first event loop. The source of a dispatched message names its connection,
+ * so a response can be replied from any thread.
+ */
+class ServerTcpNet : public TcpNet {
+ public:
+  explicit ServerTcpNet(const node_id_t& id, int nthreads = 1);
+  ~ServerTcpNet();
+
+  // connections are only made by clients
+  NetContext* CreateNetContext(const node_id_t& id) override;
+  void Start() override;
+  ssize_t Reply(const node_id_t& source, const void* ptr, size_t len) override;
+  ssize_t Reply(const node_id_t& source, MessageBuffer msg) override;
+
+ protected:
+  void OnClose(Connection* conn) override;
+
+ private:
+  // accept all pending connections
+  void Accept();
+
+  int listen_fd_;
+  // connections by the source of their messages
+  std::unordered_map<node_id_t, std::shared_ptr<Connection>> conns_;
+  shared_mutex conns_mtx_;
+  size_t num_accepted_ = 0;
+};
+
+/**
+ * Client side of the network. Each TcpNetContext connects to its worker once
+ * created, which should be done before Start.
+ */
+class ClientTcpNet : public TcpNet {
+ public:
+  explicit ClientTcpNet(int nthreads = 1);
+  ~ClientTcpNet() = default;
+
+  NetContext* CreateNetContext(const node_id_t& id) override;
+
+ protected:
+  void OnClose(Connection* conn) override;
+};
+
+class TcpNetContext : public NetContext {
+ public:
+  TcpNetContext(const node_id_t& src, const node_id_t& dest,
+                std::shared_ptr<TcpNet::Connection> conn);
+  ~TcpNetContext() = default;
+
+  ssize_t Send(const void* ptr, size_t len, CallBack* func = nullptr) override;
+  ssize_t Send(MessageBuffer msg) override;
+
+ private:
+  std::shared_ptr<TcpNet::Connection> conn_;
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_NET_TCP_NET_H_
@@ -4,6 +4,7 @@
 #define USTORE_NET_ZMQ_NET_H_
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -15,41 +16,56 @@ namespace ustore {
 // Common network interface, extended by Client and Server
 class ZmqNet : public Net {
  public:
-  explicit ZmqNet(const node_id_t& id, int nthreads = 1) :
-      Net(id), nthreads_(nthreads) {}
-  ~ZmqNet() = default;
+  explicit ZmqNet(const node_id_t& id, int nthreads = 1);
+  ~ZmqNet();
 
+  // connections are only made by clients
   NetContext* CreateNetContext(const node_id_t& id) override;
   virtual void Start() {}
+  // wake up and stop all the threads polling sockets
   void Stop() override;
   // process the received msg
   void Dispatch(const node_id_t& source, const void *msg, int size);
+  inline int stopFd() const { return stop_fd_; }
 
-  std::string request_ep_, inproc_ep_;
+  std::string inproc_ep_;
  protected:
   void *recv_sock_, *backend_sock_;  // router and backend socket
-  void *request_sock_;  // inproc router socket for multi-threaded client
   int nthreads_;  // number of processing threads
+  int stop_fd_;  // event fd that turns readable once stopped
   std::vector<std::thread> backend_threads_;
 };
 
+class ZmqNetContext;
+
 /**
- * Client side of the network. One DEALER socket per connection to each
- * worker. The main thread polls these sockets and forwards messages to
- * backend socket. A number of ClientThread connects to the backend socket
- * and processes the response.
+ * Client side of the network. Each ZmqNetContext owns a DEALER socket
+ * connected directly to its worker. The connections are spread over a number
+ * of receiving threads, each polls its own connections without any timeout,
+ * and dispatches the responses. As zmq sockets are not thread-safe, a message
+ * is sent by the thread serving its connection: it is queued and the thread
+ * is woken up through an event fd.
+ * NetContexts must be created before Start.
  */
 class ClientZmqNet : public ZmqNet {
  public:
-  static size_t msg_timeout;
-  
   explicit ClientZmqNet(int nthreads = 1);
-  ~ClientZmqNet() = default;
+  ~ClientZmqNet();
 
+  NetContext* CreateNetContext(const node_id_t& id) override;
+  // run the first receiving thread, and the others in the background
   void Start() override;
-  // receive thread
-  void ClientThread();
-  std::atomic<int> request_counter_, timeout_counter_;
+  // queue a message to be sent through the connection of the context
+  ssize_t Post(ZmqNetContext* ctx, MessageBuffer msg);
+
+ private:
+  // a receiving thread and the connections it serves
+  class Shard;
+
+  void Serve(Shard* shard);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<bool> started_{false};
 };
 
 /**
@@ -60,6 +76,8 @@ class ClientZmqNet : public ZmqNet {
  * (result_ep_).
  * The main thread polls the ROUTER socket and result_ep_ socket to forward
  * messages to the backend and to the client respectively.
+ * The source of a dispatched message names the processing thread followed by
+ * the client identity, so a response can be replied from any thread.
  */
 class ServerZmqNet : public ZmqNet {
  public:
@@ -67,6 +85,8 @@ class ServerZmqNet : public ZmqNet {
   ~ServerZmqNet() = default;
 
   void Start() override;
+  ssize_t Reply(const node_id_t& source, const void* ptr, size_t len) override;
+  ssize_t Reply(const node_id_t& source, MessageBuffer msg) override;
   std::string result_ep_;  // ipc endpoint for sending results
 
  private:
@@ -76,17 +96,22 @@ class ServerZmqNet : public ZmqNet {
 // Client side's network context. Each contains a connection to a
 // remote worker
 class ZmqNetContext : public NetContext {
+  friend class ClientZmqNet;
+
  public:
-  ZmqNetContext(const node_id_t& src, const node_id_t& dest, ClientZmqNet *net);
+  ZmqNetContext(const node_id_t& src, const node_id_t& dest, ClientZmqNet *net,
+                size_t shard);
   ~ZmqNetContext();
 
   ssize_t Send(const void* ptr, size_t len, CallBack* func = nullptr) override;
+  ssize_t Send(MessageBuffer msg) override;
   void *GetSocket() { return send_sock_; }
 
  protected:
-  std::mutex send_lock_;
   void *send_sock_;
   ClientZmqNet *client_net_;
+  // index of the receiving thread that serves the connection
+  const size_t shard_;
 };
 
 // Server side's network context. Contains a processing thread, a connection
@@ -97,13 +122,18 @@ class ServerZmqNetContext : public NetContext {
           const string& ipc_ep, const string& result_ep, const string& id);
   ~ServerZmqNetContext() = default;
 
+  // send to the client of the last received message
   ssize_t Send(const void* ptr, size_t len, CallBack* func = nullptr) override;
+  ssize_t Send(MessageBuffer msg) override;
+  // send to the client of the given identity, from any thread
+  ssize_t SendTo(const std::string& client_id, MessageBuffer msg);
 
   // processing thread
   void Start(ServerZmqNet *net);
  private:
   std::mutex send_lock_;
-  void *send_sock_, *recv_sock_, *client_id_ = nullptr;
+  void *send_sock_, *recv_sock_;
+  std::string client_id_;
   string id_;
 };
 
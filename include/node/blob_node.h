@@ -19,7 +19,7 @@ class BlobChunker : public Singleton<BlobChunker>, public Chunker {
   inline bool isFixedEntryLen() const override { return true; }
 
  private:
-  BlobChunker() = default;
+  BlobChunker();
   ~BlobChunker() = default;
 };
 
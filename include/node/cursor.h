@@ -3,6 +3,7 @@
 #ifndef USTORE_NODE_CURSOR_H_
 #define USTORE_NODE_CURSOR_H_
 
+#include <chrono>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -151,6 +152,13 @@ class NodeCursor {
   NodeCursor(std::shared_ptr<const SeqNode> seq_node, size_t idx,
              ChunkLoader* chunk_loader, std::unique_ptr<NodeCursor> parent_cr);
 
+  // Called after advancing across a node boundary, where consumed is when
+  //   the previous node was used up
+  //   Once crossings are found sequential, prefetch the following nodes
+  //   from the parent MetaNode, as many as can be fetched while the
+  //   current ones are consumed
+  void ReadAhead(std::chrono::steady_clock::time_point consumed);
+
   std::unique_ptr<NodeCursor> parent_cr_;
   // the pointed sequence
   std::shared_ptr<const SeqNode> seq_node_;
@@ -158,6 +166,11 @@ class NodeCursor {
   // the index of pointed elements
   // can be -1 when pointing to seq start
   int32_t idx_;
+  // # of consecutive forward crossings of node boundary
+  size_t num_forward_crossings_ = 0;
+  // moving average of the time to consume a node, in microseconds
+  double crossing_interval_us_ = 0;
+  std::chrono::steady_clock::time_point last_crossing_;
 };
 
 }  // namespace ustore
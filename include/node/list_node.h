@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "node/node.h"
+#include "node/offset_cache.h"
 #include "utils/singleton.h"
 
 namespace ustore {
@@ -63,8 +64,9 @@ class ListNode : public LeafNode {
 
  private:
   void PrecomputeOffsets();
-  // a vector byte offset relative to chunk data
-  std::vector<size_t> offsets_;
+  // a vector byte offset relative to chunk data, shared with other nodes
+  // of the same chunk, see node/offset_cache.h
+  std::shared_ptr<const OffsetTable> table_;
 };
 
 }  // namespace ustore
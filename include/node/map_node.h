@@ -8,6 +8,7 @@
 
 #include "chunk/chunk.h"
 #include "node/node.h"
+#include "node/offset_cache.h"
 #include "utils/singleton.h"
 
 namespace ustore {
@@ -91,8 +92,9 @@ class MapNode : public LeafNode {
 
  private:
   void PrecomputeOffsets();
-  // a vector byte offset relative to chunk data
-  std::vector<size_t> offsets_;
+  // a vector byte offset relative to chunk data, shared with other nodes
+  // of the same chunk, see node/offset_cache.h
+  std::shared_ptr<const OffsetTable> table_;
 };
 }  // namespace ustore
 
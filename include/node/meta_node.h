@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "node/node.h"
+#include "node/offset_cache.h"
 #include "types/type.h"
 #include "utils/singleton.h"
 
@@ -83,7 +84,8 @@ class MetaNode : public SeqNode {
   //   in a class member vector
   void PrecomputeOffset();
 
-  std::vector<size_t> offsets_;
+  // shared with other nodes of the same chunk, see node/offset_cache.h
+  std::shared_ptr<const OffsetTable> table_;
 };
 
 }  // namespace ustore
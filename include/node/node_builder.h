@@ -6,7 +6,6 @@
 #include <list>
 #include <memory>
 #include <vector>
-#include <unordered_map>
 #include <utility>
 
 #include "chunk/chunker.h"
@@ -50,6 +49,19 @@ class NodeBuilder : private Noncopyable {
   // @return The hash (a.k.a. the key) of the newly commited root chunk.
   Hash Commit();
 
+  // Construct a fresh new POS Tree from all entries in seg at once
+  //   Leaf chunks are detected, made and hashed by num_threads threads,
+  //   while the much smaller upper levels are built as usual.
+  //   The root is identical to the one built by a single NodeBuilder.
+  // @return The hash (a.k.a. the key) of the newly commited root chunk.
+  static Hash BulkBuild(const Segment* seg, ChunkWriter* chunk_writer,
+                        const Chunker* chunker, const Chunker* parent_chunker,
+                        size_t num_threads);
+  // Same as above, with the number of threads from config,
+  //   and a single thread for small inputs
+  static Hash BulkBuild(const Segment* seg, ChunkWriter* chunk_writer,
+                        const Chunker* chunker, const Chunker* parent_chunker);
+
  private:
   // Internal constructor used to recursively construct Parent NodeBuilder
   // is_leaf shall set to FALSE
@@ -76,8 +88,13 @@ class NodeBuilder : private Noncopyable {
   // Pass the created metaentry(a segment with a single entry)
   //   to upper builders to append
   // reset the rolling hasher
-  // return the created chunk
+  // return a view of the created chunk, which is kept in pending_chunks_
+  //   until dumped
   Chunk HandleBoundary(const std::vector<const Segment*>& segments);
+
+  // Dump the pending chunks of this builder and all its parent builders
+  //   to storage in one batch
+  void DumpChunks();
   // Two things to do:
   //  * Populate the rolling hash with preceding elements before cursor point
   //      until its window size filled up
@@ -107,6 +124,8 @@ class NodeBuilder : private Noncopyable {
   std::vector<const Segment*> appended_segs_;
   // A vector to collect and own segs created by this nodebuilder
   std::vector<std::unique_ptr<const Segment>> created_segs_;
+  // Chunks created but not dumped yet
+  std::vector<Chunk> pending_chunks_;
 
   Segment* pre_cursor_seg_;
   std::unique_ptr<RollingHasher> rhasher_;
@@ -122,16 +141,13 @@ class NodeBuilder : private Noncopyable {
 class AdvancedNodeBuilder : Noncopyable  {
 /* A node builder that can support multiple operation in a single transaction
 
-AdvancedNodeBuilder applies NodeBuilder for multiple rounds for edition. However,
-it buffers the created chunks in the middle and provides access to these intermidiate chunks.
-At last, it dumps all the created chunks that only occur in the final pos tree
-to Chunk Storage. Useless intermediate chunks will be discarded.
-
-NOTE: AdvancedNodeBuilder utilizes the NodeBuilder property that any chunks read by
-a NodeBuilder during commit will NOT be included in the built pos tree from this NodeBuilder.
-
-In this way, any intermediate created chunks that are read by NodeBuilder
-in later around will NOT be dumped to final storage.
+AdvancedNodeBuilder commits all splice operations in one pass over the tree.
+Operations are sorted by position. Each level is walked once from left to
+right: chunks are only remade from the one holding an operation until a
+boundary realigns with an old chunk end, where later chunks stay unchanged.
+Remade chunks turn into operations on their parent level, which replace their
+metaentries with those of new chunks. Hence each touched node is rebuilt once,
+no matter how many operations fall into it, and no intermediate chunk is made.
 
 To construct a new pos tree:
   AdvancedNodeBuilder nb(writer);
@@ -168,71 +184,6 @@ To work on an existing pos tree:
   Hash Commit(const Chunker& chunker);
 
  private:
-  class PersistentChunker : public Chunker {
-  /* PersistentChunker is a wrapper for a normal chunker.
-
-  It persists the chunk internal bytes while
-    the created chunks points to these bytes.
-  */
-   public:
-    explicit PersistentChunker(const Chunker* chunker) noexcept :
-      chunker_(chunker) {}
-    ~PersistentChunker() = default;
-
-    inline ChunkInfo Make(const std::vector<const Segment*>& segments) const
-        override {
-      ChunkInfo chunk_info = chunker_->Make(segments);
-      created_chunks_.push_back(std::move(chunk_info.chunk));
-      Chunk new_chunk(created_chunks_.rbegin()->head());
-      return {std::move(new_chunk), std::move(chunk_info.meta_seg)};
-    }
-
-    inline std::unique_ptr<RollingHasher> GetRHasher() const override {
-      return chunker_->GetRHasher();
-    }
-    inline bool isFixedEntryLen() const override {
-      return chunker_->isFixedEntryLen();
-    }
-
-   private:
-    const Chunker* chunker_;
-    // created_chunks_ own the actual data.
-    mutable std::list<Chunk> created_chunks_;
-  };
-
-  /* ChunkCacher allows to buffer written chunks from modification sequence
-   * It helps to avoid dumping intermediate chunks
-   */
-  class ChunkCacher : public ChunkLoader, public ChunkWriter {
-   public:
-    ChunkCacher(ChunkLoader* loader, ChunkWriter* writer) noexcept :
-      loader_(loader), writer_(writer) {}
-    // Delete the cached data
-    ~ChunkCacher() = default;
-
-    inline bool Write(const Hash& key, const Chunk& chunk) override {
-      cache_[key.Clone()] = chunk.head();
-      return true;
-    }
-    // Return true if all the cached chunk with specific hash
-    //   is dumped to ChunkWriter
-    bool DumpCacheChunk(const Hash& key);
-
-    // Return true if a chunk with specific hash exist in cache
-    bool ExistInCache(const Hash& key) const;
-
-   protected:
-    // First try to find chunk from the cache
-    // If not found, find from ChunkLoader
-    Chunk GetChunk(const Hash& key) override;
-
-   private:
-    // pointers to real loader and writer
-    ChunkLoader* loader_;
-    ChunkWriter* writer_;
-    // value is a pair of (chunk head, is_read)
-    std::unordered_map<Hash, const byte_t*> cache_;
-  };
   // relevant information to perform one spliced operation
   struct SpliceOperand {
     uint64_t start_idx;
@@ -243,20 +194,30 @@ To work on an existing pos tree:
     std::vector<const Segment*> appended_segs;
   };
 
-  // Perform the preorder traversal on the final built tree
-  //   if a root node exists in cache
-  //     Dump the cached chunk to writer
-  //     Continue to examine its children
-  //   else
-  //     Do nothing and return;
-  // Return true if all dumping are successful
-  bool PreorderDump(const Hash& root, ChunkCacher* cacher);
+  // an operation on one level of the original tree
+  struct LevelOperand {
+    // point to the first entry to delete, or where to insert
+    std::unique_ptr<NodeCursor> cursor;
+    size_t num_delete;
+    std::vector<const Segment*> appended_segs;
+  };
+
+  // Apply sorted operands on the level of their cursors
+  //   Created chunks are appended to chunks, and the created segments are
+  //   kept in created_segs_
+  // @return The operands on the parent level. If this level is the root,
+  //   a single operand without cursor holding metaentries of all its chunks.
+  std::vector<LevelOperand> CommitLevel(
+      const std::vector<LevelOperand>& operands, const Chunker* chunker,
+      std::vector<Chunk>* chunks);
 
   const Hash root_;
   ChunkLoader* loader_;
   ChunkWriter* writer_;
   std::list<SpliceOperand> operands_;
   std::vector<std::unique_ptr<const Segment>> all_operand_segs_;
+  // segments created during commit
+  std::vector<std::unique_ptr<const Segment>> created_segs_;
 };
 }  // namespace ustore
 
@@ -3,6 +3,7 @@
 #ifndef USTORE_NODE_NODE_COMPARATOR_H_
 #define USTORE_NODE_NODE_COMPARATOR_H_
 
+#include <algorithm>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -11,6 +12,7 @@
 #include "hash/hash.h"
 #include "node/cursor.h"
 #include "node/meta_node.h"
+#include "spec/slice.h"
 #include "types/type.h"
 #include "utils/noncopyable.h"
 
@@ -42,6 +44,16 @@ struct IndexTrait {
   static OrderedKey MinKey() {
     return OrderedKey(0);
   }
+
+  // return the index, relative to the first element rooted under the given
+  //   seqnode, of the first element whose key is no smaller than that of
+  //   the element pointed by cursor with index idx
+  static uint64_t LowerBound(const SeqNode* node, uint64_t node_start_idx,
+                             const NodeCursor& cursor, uint64_t idx,
+                             ChunkLoader* loader) {
+    if (idx <= node_start_idx) return 0;
+    return std::min(idx - node_start_idx, node->numElements());
+  }
 };
 
 struct OrderedKeyTrait {
@@ -61,8 +73,49 @@ struct OrderedKeyTrait {
     static constexpr byte_t kEMPTY[] = "\0";
     return OrderedKey(false, kEMPTY, 1);
   }
+
+  static uint64_t LowerBound(const SeqNode* node, uint64_t node_start_idx,
+                             const NodeCursor& cursor, uint64_t idx,
+                             ChunkLoader* loader) {
+    return node->FindIndexForKey(cursor.currentKey(), loader);
+  }
 };
 
+// Place a cursor in the tree rooted at rhs, whose first element has index
+//   rhs_start_idx, at the first element not preceding the one pointed by
+//   lhs_cursor, so that rhs elements before all lhs ones are skipped rather
+//   than iterated. rhs_idx is set to the index of that element.
+template <class KeyTrait>
+NodeCursor SeekOverlap(const NodeCursor& lhs_cursor, uint64_t lhs_idx,
+                       const SeqNode* rhs, uint64_t rhs_start_idx,
+                       ChunkLoader* rloader, uint64_t* rhs_idx) {
+  uint64_t offset = lhs_cursor.isEnd() ? 0 :
+      KeyTrait::LowerBound(rhs, rhs_start_idx, lhs_cursor, lhs_idx, rloader);
+  *rhs_idx = rhs_start_idx + offset;
+  return NodeCursor(rhs->hash(), offset, rloader);
+}
+
+// If both cursors point to the first elements of nodes with identical
+//   hashes, advance them over the largest such nodes, i.e., the highest
+//   ancestors they both start at, without comparing their elements.
+//   Return the number of elements skipped, or 0 if not at identical nodes.
+inline uint64_t SkipIdentical(NodeCursor* lhs, NodeCursor* rhs) {
+  uint64_t num_elements = 0;
+  // identical nodes have identical first children, so the search stops at
+  //   the first level that differs
+  for (const NodeCursor *l = lhs, *r = rhs;
+       l != nullptr && r != nullptr && l->idx() == 0 && r->idx() == 0 &&
+       l->node()->hash() == r->node()->hash();
+       l = l->parent(), r = r->parent()) {
+    num_elements = l->node()->numElements();
+  }
+  if (num_elements > 0) {
+    lhs->AdvanceSteps(num_elements);
+    rhs->AdvanceSteps(num_elements);
+  }
+  return num_elements;
+}
+
 // THe following traits specify
 //   two procedures during two pos tree comparing and traversing.
 //   The first procedure is performed when encountering the same hashes
@@ -74,11 +127,11 @@ struct Intersector {
   typedef std::vector<IndexRange> ResultType;
   // Both lhs and rhs share the same elements due to the identical hashes
   //   Return the entire index range of lhs side
-  static ResultType IdenticalHashes(
-      const SeqNode* lhs, uint64_t lhs_start_idx,
-      const SeqNode* rhs, uint64_t rhs_start_idx) {
+  static ResultType IdenticalHashes(uint64_t lhs_start_idx,
+                                    uint64_t rhs_start_idx,
+                                    uint64_t num_elements) {
     std::vector<IndexRange> result;
-    result.push_back({lhs_start_idx, lhs->numElements()});
+    result.push_back({lhs_start_idx, num_elements});
     return result;
   }
 
@@ -88,10 +141,10 @@ struct Intersector {
     std::vector<IndexRange> results;
 
     NodeCursor lhs_cursor(lhs->hash(), 0, lloader);
-    NodeCursor rhs_cursor(rhs->hash(), 0, rloader);
-
     uint64_t lhs_idx = lhs_start_idx;
-    uint64_t rhs_idx = rhs_start_idx;
+    uint64_t rhs_idx;
+    NodeCursor rhs_cursor = SeekOverlap<KeyTrait>(
+        lhs_cursor, lhs_idx, rhs, rhs_start_idx, rloader, &rhs_idx);
 
     // if curr_cr.num_subsequent = 0,
     //   this curr_cr is invalid.
@@ -105,6 +158,16 @@ struct Intersector {
         ++rhs_idx;
         rhs_cursor.Advance(true);
       } else if (lhs_key == rhs_key) {
+        uint64_t num_skipped = SkipIdentical(&lhs_cursor, &rhs_cursor);
+        if (num_skipped > 0) {
+        // Identical subtrees
+          if (curr_cr.num_subsequent == 0) curr_cr.start_idx = lhs_idx;
+          curr_cr.num_subsequent += num_skipped;
+          lhs_idx += num_skipped;
+          rhs_idx += num_skipped;
+          continue;
+        }
+
         size_t lhs_len = lhs_cursor.numCurrentBytes();
         size_t rhs_len = rhs_cursor.numCurrentBytes();
 
@@ -158,9 +221,9 @@ lhs elements that DOES NOT occur in rhs*/
   typedef std::vector<IndexRange> ResultType;
   // Due to the identical hash, all lhs elements is contained in rhs.
   //   Return empty index range
-  static ResultType IdenticalHashes(
-      const SeqNode* lhs, uint64_t lhs_start_idx,
-      const SeqNode* rhs, uint64_t rhs_start_idx) {
+  static ResultType IdenticalHashes(uint64_t lhs_start_idx,
+                                    uint64_t rhs_start_idx,
+                                    uint64_t num_elements) {
     // Return empty result
       std::vector<IndexRange> result;
       return result;
@@ -176,10 +239,10 @@ lhs elements that DOES NOT occur in rhs*/
     std::vector<IndexRange> results;
 
     NodeCursor lhs_cursor(lhs->hash(), 0, lloader);
-    NodeCursor rhs_cursor(rhs->hash(), 0, rloader);
-
     uint64_t lhs_idx = lhs_start_idx;
-    uint64_t rhs_idx = rhs_start_idx;
+    uint64_t rhs_idx;
+    NodeCursor rhs_cursor = SeekOverlap<KeyTrait>(
+        lhs_cursor, lhs_idx, rhs, rhs_start_idx, rloader, &rhs_idx);
 
     // whether num_subsequent field = 0 in curr_cr to
     //   mark whether this curr_cr is valid or not.
@@ -193,6 +256,19 @@ lhs elements that DOES NOT occur in rhs*/
         ++rhs_idx;
         rhs_cursor.Advance(true);
       } else if (lhs_key == rhs_key) {
+        uint64_t num_skipped = SkipIdentical(&lhs_cursor, &rhs_cursor);
+        if (num_skipped > 0) {
+        // Identical subtrees,
+        //   Stop updating curr_cr if valid
+          if (curr_cr.num_subsequent != 0) {
+            results.push_back(curr_cr);
+            curr_cr.num_subsequent = 0;  // mark curr_cr is invalid
+          }  // end if
+          lhs_idx += num_skipped;
+          rhs_idx += num_skipped;
+          continue;
+        }
+
         size_t lhs_len = lhs_cursor.numCurrentBytes();
         size_t rhs_len = rhs_cursor.numCurrentBytes();
 
@@ -271,13 +347,13 @@ Mapper is used to map the index range of identical lhs elements to rhs elements
   typedef RangeMaps ResultType;
   // Both lhs and rhs share the same elements due to the identical hashes
   //   Map the entire lhs index range to the entire rhs index range
-  static ResultType IdenticalHashes(
-      const SeqNode* lhs, uint64_t lhs_start_idx,
-      const SeqNode* rhs, uint64_t rhs_start_idx) {
+  static ResultType IdenticalHashes(uint64_t lhs_start_idx,
+                                    uint64_t rhs_start_idx,
+                                    uint64_t num_elements) {
     ResultType result;
 
-    IndexRange lhs_range{lhs_start_idx, lhs->numElements()};
-    IndexRange rhs_range{rhs_start_idx, rhs->numElements()};
+    IndexRange lhs_range{lhs_start_idx, num_elements};
+    IndexRange rhs_range{rhs_start_idx, num_elements};
 
     result.push_back({lhs_range, rhs_range});
     return result;
@@ -289,10 +365,10 @@ Mapper is used to map the index range of identical lhs elements to rhs elements
     ResultType results;
 
     NodeCursor lhs_cursor(lhs->hash(), 0, lloader);
-    NodeCursor rhs_cursor(rhs->hash(), 0, rloader);
-
     uint64_t lhs_idx = lhs_start_idx;
-    uint64_t rhs_idx = rhs_start_idx;
+    uint64_t rhs_idx;
+    NodeCursor rhs_cursor = SeekOverlap<KeyTrait>(
+        lhs_cursor, lhs_idx, rhs, rhs_start_idx, rloader, &rhs_idx);
 
     // if lhs_range.num_subsequent = 0,
     //   this lhs_range is invalid.
@@ -316,6 +392,20 @@ Mapper is used to map the index range of identical lhs elements to rhs elements
         ++rhs_idx;
         rhs_cursor.Advance(true);
       } else if (lhs_key == rhs_key) {
+        uint64_t num_skipped = SkipIdentical(&lhs_cursor, &rhs_cursor);
+        if (num_skipped > 0) {
+        // Identical subtrees
+          if (lhs_range.num_subsequent == 0) {
+            lhs_range.start_idx = lhs_idx;
+            rhs_range.start_idx = rhs_idx;
+          }
+          lhs_range.num_subsequent += num_skipped;
+          rhs_range.num_subsequent += num_skipped;
+          lhs_idx += num_skipped;
+          rhs_idx += num_skipped;
+          continue;
+        }
+
         size_t lhs_len = lhs_cursor.numCurrentBytes();
         size_t rhs_len = rhs_cursor.numCurrentBytes();
 
@@ -396,6 +486,11 @@ For each lhs node in pre-order tranversal:
 
   Recursive perform the above steps for each lhs child node
 
+An lhs node is only loaded if its hash, taken from the parent MetaEntry,
+differs from that of the rhs node, and the leaf iteration starts from the
+first overlapping rhs element and skips subtrees identical on both sides.
+Hence the cost grows with the size of the difference, not of the trees.
+
 
 KeyTrait specifies the key for traversing, either can be pos index or orderedkey
 */
@@ -412,14 +507,19 @@ KeyTrait specifies the key for traversing, either can be pos index or orderedkey
 
  private:
   // This function starts to search for this deepest seq node from rhs_seq_node
+  //   Return nullptr without loading it if the node is identical to lhs
   std::shared_ptr<const SeqNode> SmallestOverlap(
+      const Hash& lhs,
       const OrderedKey& lhs_lower, const OrderedKey& lhs_upper,
       std::shared_ptr<const SeqNode> rhs_seq_node,
       uint64_t rhs_start_idx, uint64_t* return_start_idx) const;
 
   // Compare the lhs tree with rhs in preorder format
+  //   lhs is given by its hash, # of elements and key range, which are known
+  //   from the MetaEntry pointing to it
   ReturnType Compare(
-      const SeqNode* lhs, uint64_t lhs_start_idx, const OrderedKey& lhs_min_key,
+      const Hash& lhs, uint64_t lhs_start_idx, uint64_t lhs_num_elements,
+      const OrderedKey& lhs_min_key, const OrderedKey& lhs_max_key,
       ChunkLoader* lloader, std::shared_ptr<const SeqNode> rhs_root_node,
       uint64_t rhs_start_idx) const;
 
@@ -449,9 +549,11 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
   uint64_t lhs_start_idx = 0;
   uint64_t rhs_start_idx = 0;
 
-  return IndexRange::Compact(Compare(lhs_root.get(),
+  return IndexRange::Compact(Compare(lhs,
                              lhs_start_idx,
+                             lhs_root->numElements(),
                              KeyTrait::MinKey(),
+                             KeyTrait::MaxKey(lhs_root.get(), lhs_start_idx),
                              lloader,
                              rhs_root_,
                              rhs_start_idx));
@@ -460,7 +562,8 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
 template <class KeyTrait, template<class> class Traverser>
 typename NodeComparator<KeyTrait, Traverser>::ReturnType
   NodeComparator<KeyTrait, Traverser>::Compare(
-    const SeqNode* lhs, uint64_t lhs_start_idx, const OrderedKey& lhs_min_key,
+    const Hash& lhs, uint64_t lhs_start_idx, uint64_t lhs_num_elements,
+    const OrderedKey& lhs_min_key, const OrderedKey& lhs_max_key,
     ChunkLoader* lloader,
     const std::shared_ptr<const SeqNode> rhs_node,
     uint64_t rhs_start_idx) const {
@@ -479,8 +582,9 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
   // the index of the first element rooted at rhs_closest_node
   uint64_t deepest_start_idx = 0;
   // share_ptr to seqnode
-  auto rhs_deepest_node = SmallestOverlap(lhs_min_key,
-                                          KeyTrait::MaxKey(lhs, lhs_start_idx),
+  auto rhs_deepest_node = SmallestOverlap(lhs,
+                                          lhs_min_key,
+                                          lhs_max_key,
                                           rhs_node,
                                           rhs_start_idx,
                                           &deepest_start_idx);
@@ -488,14 +592,18 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
   // DLOG(INFO) << "Closest Overlap: \n"
   //            << "Hash: " << rhs_closest_node->hash()
   //            << " Start Idx: " << closest_start_idx;
-  if (lhs->hash() == rhs_deepest_node->hash()) {
-    return Traverser<KeyTrait>::IdenticalHashes(lhs, lhs_start_idx,
-                                                rhs_deepest_node.get(),
-                                                deepest_start_idx);
+  // identical subtrees are pruned without loading either side
+  if (rhs_deepest_node == nullptr || lhs == rhs_deepest_node->hash()) {
+    return Traverser<KeyTrait>::IdenticalHashes(lhs_start_idx,
+                                                deepest_start_idx,
+                                                lhs_num_elements);
   }
 
-  if (lhs->isLeaf() || rhs_deepest_node->isLeaf()) {
-    return Traverser<KeyTrait>::IterateLeaves(lhs, lhs_start_idx, lloader,
+  std::unique_ptr<const SeqNode> lhs_node =
+      SeqNode::CreateFromChunk(lloader->Load(lhs));
+  if (lhs_node->isLeaf() || rhs_deepest_node->isLeaf()) {
+    return Traverser<KeyTrait>::IterateLeaves(lhs_node.get(), lhs_start_idx,
+                                              lloader,
                                               rhs_deepest_node.get(),
                                               deepest_start_idx,
                                               rloader_);
@@ -505,17 +613,18 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
   uint64_t lhs_child_start_idx = lhs_start_idx;
   OrderedKey lhs_child_min_key = lhs_min_key;
 
-  const MetaNode* lhs_meta = dynamic_cast<const MetaNode*>(lhs);
-  for (size_t i = 0; i < lhs->numEntries(); i++) {
+  const MetaNode* lhs_meta = dynamic_cast<const MetaNode*>(lhs_node.get());
+  for (size_t i = 0; i < lhs_node->numEntries(); i++) {
     MetaEntry lhs_me(lhs_meta->data(i));
-
-    std::unique_ptr<const SeqNode> lhs_child_node =
-        SeqNode::CreateFromChunk(lloader->Load(lhs_me.targetHash()));
+    OrderedKey lhs_child_max_key = KeyTrait::MaxKey(&lhs_me,
+                                                    lhs_child_start_idx);
 
     ReturnType child_results =
-        Compare(lhs_child_node.get(),
+        Compare(lhs_me.targetHash(),
                 lhs_child_start_idx,
+                lhs_me.numElements(),
                 lhs_child_min_key,
+                lhs_child_max_key,
                 lloader,
                 rhs_deepest_node,
                 deepest_start_idx);
@@ -524,9 +633,7 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
     results.insert(results.end(), child_results.begin(), child_results.end());
 
 // Prepare for next iteration
-    lhs_child_min_key = KeyTrait::MaxKey(lhs_child_node.get(),
-                                          lhs_child_start_idx);
-
+    lhs_child_min_key = lhs_child_max_key;
     lhs_child_start_idx += lhs_me.numElements();
   }
   return results;
@@ -535,6 +642,7 @@ typename NodeComparator<KeyTrait, Traverser>::ReturnType
 template <class KeyTrait, template<class> class Traverser>
 std::shared_ptr<const SeqNode>
 NodeComparator<KeyTrait, Traverser>::SmallestOverlap(
+                                            const Hash& lhs,
                                             const OrderedKey& lhs_lower,
                                             const OrderedKey& lhs_upper,
                                             std::shared_ptr<const SeqNode>
@@ -563,12 +671,17 @@ NodeComparator<KeyTrait, Traverser>::SmallestOverlap(
       rhs_me_upper = KeyTrait::MaxKey(&rhs_me, rhs_me_start_idx);
 
       if (i == numEntries - 1 || rhs_me_upper >= lhs_upper) {
+        if (rhs_me.targetHash() == lhs) {
+          *closest_start_idx = rhs_me_start_idx;
+          return nullptr;
+        }
         // Find a deeper overlap
         const Chunk* rhs_child_chunk = rloader_->Load(rhs_me.targetHash());
         std::shared_ptr<const SeqNode> rhs_child =
                          SeqNode::CreateFromChunk(rhs_child_chunk);
 
-        return SmallestOverlap(lhs_lower,
+        return SmallestOverlap(lhs,
+                               lhs_lower,
                                lhs_upper,
                                rhs_child,
                                rhs_me_start_idx,
@@ -599,6 +712,12 @@ class LevenshteinMapper : private Noncopyable {
  LevenshteinMapper maps the elements bewtween two pos trees based on the minimum
  edit distance.
 
+ Entries are mapped level by level from the root, so that identical subtrees
+ are matched by their MetaEntries, and only the elements under different
+ entries are mapped on the lower level. Within such a window, the common
+ prefix and suffix are matched directly, and a window too large for the edit
+ matrix is split at the entries occurring exactly once on both sides, as in
+ patience diff. A large window without such entries is left unmapped.
 */
  public:
 // loader is used for both lhs and rhs
@@ -624,6 +743,18 @@ class LevenshteinMapper : private Noncopyable {
     EditMarker marker;
     uint64_t edit_distance;
   };
+
+  // An entry of the sequences to map
+  struct SeqEntry {
+    Slice data;
+    // the index of the first element rooted at the entry
+    uint64_t start_idx;
+    uint64_t num_elements;
+  };
+
+  // Max # of cells of the edit matrix for a window
+  static constexpr size_t kMaxEditMatrixSize = 1 << 20;
+
   // Map the elements in recursive manner from top to bottom
   // Args:
   //   lhs_cr: cursor pointing to the first entry of lhs
@@ -642,6 +773,30 @@ class LevenshteinMapper : private Noncopyable {
   RangeMaps SeqMap(std::unique_ptr<NodeCursor> lhs_cr, IndexRange lhs_range,
       std::unique_ptr<NodeCursor> rhs_cr, IndexRange rhs_range) const;
 
+  // Map the entries in [lhs_begin, lhs_end) to rhs in [rhs_begin, rhs_end)
+  //   Append the maps of matched entries to result in order
+  static void MapWindow(const std::vector<SeqEntry>& lhs, size_t lhs_begin,
+                        size_t lhs_end, const std::vector<SeqEntry>& rhs,
+                        size_t rhs_begin, size_t rhs_end, RangeMaps* result);
+
+  // Map a window of entries based on the edit matrix
+  static void EditDistanceMap(const std::vector<SeqEntry>& lhs,
+                              size_t lhs_begin, size_t lhs_end,
+                              const std::vector<SeqEntry>& rhs,
+                              size_t rhs_begin, size_t rhs_end,
+                              RangeMaps* result);
+
+  // Map the entries occurring exactly once in both windows, and keep the
+  //   longest increasing sequence of them
+  static std::vector<std::pair<size_t, size_t>> UniqueAnchors(
+      const std::vector<SeqEntry>& lhs, size_t lhs_begin, size_t lhs_end,
+      const std::vector<SeqEntry>& rhs, size_t rhs_begin, size_t rhs_end);
+
+  // Move the cursor pointing to the entry rooting element cursor_idx forward,
+  //   to the entry whose first element is idx
+  static void SeekElement(NodeCursor* cursor, uint64_t* cursor_idx,
+                          uint64_t idx);
+
   // return the number of elements rooted at the entry pointed by cursor
   static uint64_t numElementsByCursor(const NodeCursor& cursor);
 
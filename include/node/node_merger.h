@@ -73,12 +73,16 @@ template <class Mapper>
 class NodeMerger : private Noncopyable {
 /* NodeMerger performs the three-way merging based on the following algorithm
 
+If any two of base, node 1 and node 2 are identical, the result is known
+  without mapping.
+
 For each node to be merge:
   Compare it with base to get index range maps of identical elements
   (How to map is specified by mapper.)
   Flip the index range maps to get the different part
 
-Edit the base node based on the different parts of merged nodes sequentially
+Edit the base node based on the different parts of merged nodes sequentially,
+  and rebuild it in one pass
 
 e.g,
 
@@ -246,8 +250,8 @@ bool NodeMerger<Mapper>::IsIdenticalContents(
     size_t rhs_remaining_len = (*rhs_seg_it)->numBytes() - rhs_idx;
 
     if (lhs_remaining_len < rhs_remaining_len) {
-      if (std::memcmp((*lhs_seg_it)->data(),
-                      (*lhs_seg_it)->data(),
+      if (std::memcmp((*lhs_seg_it)->data() + lhs_idx,
+                      (*rhs_seg_it)->data() + rhs_idx,
                       lhs_remaining_len) != 0) {
         is_identical = false;
         break;
@@ -256,8 +260,8 @@ bool NodeMerger<Mapper>::IsIdenticalContents(
       lhs_idx = 0;
       rhs_idx += lhs_remaining_len;
     } else if (lhs_remaining_len == rhs_remaining_len) {
-      if (std::memcmp((*lhs_seg_it)->data(),
-                      (*lhs_seg_it)->data(),
+      if (std::memcmp((*lhs_seg_it)->data() + lhs_idx,
+                      (*rhs_seg_it)->data() + rhs_idx,
                       rhs_remaining_len) != 0) {
         is_identical = false;
         break;
@@ -267,8 +271,8 @@ bool NodeMerger<Mapper>::IsIdenticalContents(
       ++rhs_seg_it;
       rhs_idx = 0;
     } else {
-      if (std::memcmp((*lhs_seg_it)->data(),
-                      (*lhs_seg_it)->data(),
+      if (std::memcmp((*lhs_seg_it)->data() + lhs_idx,
+                      (*rhs_seg_it)->data() + rhs_idx,
                       rhs_remaining_len) != 0) {
         is_identical = false;
         break;
@@ -354,6 +358,10 @@ uint64_t NodeMerger<Mapper>::numElements(const Hash& hash) const {
 template <class Mapper>
 Hash NodeMerger<Mapper>::Merge(const Hash& node1, const Hash& node2,
                                const Chunker& chunker) const {
+  // Trees identical by hash need no mapping
+  if (node1 == node2 || node2 == base_) return node1.Clone();
+  if (node1 == base_) return node2.Clone();
+
   uint64_t base_num_elements = numElements(base_);
   uint64_t node1_num_elements = numElements(node1);
   uint64_t node2_num_elements = numElements(node2);
@@ -0,0 +1,136 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_NODE_OFFSET_CACHE_H_
+#define USTORE_NODE_OFFSET_CACHE_H_
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "chunk/chunk.h"
+#include "hash/hash.h"
+#include "node/orderedkey.h"
+#include "utils/clock_cache.h"
+#include "utils/singleton.h"
+
+namespace ustore {
+
+/**
+ * @brief Entries of a node located by decoding its chunk.
+ *
+ * Nodes of ordered keys also index a fixed-width prefix of every key, taken
+ * after the bytes that all keys of the node share, so that a search mostly
+ * compares integers and only compares full keys among equal prefixes.
+ */
+struct OffsetTable {
+  // byte offsets of entries relative to chunk data
+  std::vector<size_t> offsets;
+  // # of elements before each entry, and in total at the end; meta nodes only
+  std::vector<uint64_t> elements;
+  // see OrderedKey::prefix(); nodes of ordered keys only
+  std::vector<uint64_t> prefixes;
+  // # of leading bytes shared by all keys
+  size_t prefix_skip = 0;
+
+  inline size_t numBytes() const {
+    return sizeof(OffsetTable) + offsets.size() * sizeof(size_t) +
+           (elements.size() + prefixes.size()) * sizeof(uint64_t);
+  }
+
+  // index the keys of all entries, which are in ascending order
+  template <typename KeyAt>
+  void IndexKeys(KeyAt key_at) {
+    const size_t n = offsets.size();
+    prefixes.clear();
+    prefix_skip = 0;
+    if (n == 0) return;
+    const OrderedKey first = key_at(0), last = key_at(n - 1);
+    if (!first.byValue()) {
+      // keys in between share the common prefix of the first and the last
+      const size_t len = std::min(first.numBytes(), last.numBytes());
+      while (prefix_skip < len &&
+             first.data()[prefix_skip] == last.data()[prefix_skip])
+        ++prefix_skip;
+    }
+    prefixes.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+      prefixes.push_back(key_at(i).prefix(prefix_skip));
+  }
+
+  // index of the first entry whose key is no smaller than the given one, or
+  // # of entries if none
+  template <typename KeyAt>
+  size_t LowerBound(const OrderedKey& key, KeyAt key_at) const {
+    const size_t n = prefixes.size();
+    if (n == 0) return 0;
+    if (prefix_skip > 0) {
+      const OrderedKey first = key_at(0);
+      const size_t len = std::min(key.numBytes(), prefix_skip);
+      int cmp = std::memcmp(key.data(), first.data(), len);
+      if (cmp < 0 || (cmp == 0 && len < prefix_skip)) return 0;
+      if (cmp > 0) return n;
+    }
+    const uint64_t target = key.prefix(prefix_skip);
+    // branch-free binary search: entries before base are all smaller
+    const uint64_t* base = prefixes.data();
+    for (size_t len = n; len > 1;) {
+      const size_t half = len / 2;
+      base = base[half] < target ? base + half : base;
+      len -= half;
+    }
+    size_t lo = base - prefixes.data() + (*base < target);
+    size_t hi = std::upper_bound(prefixes.begin() + lo, prefixes.end(),
+                                 target) - prefixes.begin();
+    // entries of an equal prefix are told apart by their full keys
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (key_at(mid) < key) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+};
+
+/**
+ * @brief A process-wide cache of the entry offsets decoded from chunks.
+ *
+ * Every SeqNode of variable-sized entries scans its chunk to locate them
+ * once created, and nodes are created anew for each cursor and request. As
+ * the offsets only depend on chunk content, they are shared by chunk hash,
+ * so a hot node is decoded once no matter how many loaders view its chunk.
+ * Offsets held by live nodes are pinned, see ClockCache.
+ */
+class OffsetCache : public ClockCache<OffsetTable>,
+                    public Singleton<OffsetCache> {
+  friend class Singleton<OffsetCache>;
+
+ public:
+  // fill in the table of all entries in a chunk
+  using Decoder = std::function<void(OffsetTable*)>;
+
+  // capacity in bytes, 0 to disable caching
+  explicit OffsetCache(size_t capacity)
+    : ClockCache<OffsetTable>("OffsetCache", capacity) {}
+  ~OffsetCache() = default;
+
+  /**
+   * @brief return the offset table of the chunk, decoding it on a miss
+   *
+   * Chunks whose hash is not computed yet are decoded without caching, as
+   * hashing a chunk costs more than scanning it.
+   */
+  std::shared_ptr<const OffsetTable> Get(const Chunk& chunk,
+                                         const Decoder& decode);
+
+ private:
+  // capacity is read from config
+  OffsetCache();
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_NODE_OFFSET_CACHE_H_
@@ -40,6 +40,11 @@ class OrderedKey {
   // given buffer capacity > numBytes
   size_t Encode(byte_t* buffer) const;
   inline bool byValue() const { return by_value_; }
+  // an integer of the (up to) 8 bytes following the first skip bytes, padded
+  // with zeros, or the value of a by-value key; among keys sharing the first
+  // skip bytes, a smaller prefix means a smaller key, while equal prefixes
+  // need the full keys to be compared
+  uint64_t prefix(size_t skip = 0) const;
 
   bool operator>(const OrderedKey& otherKey) const;
   bool operator<(const OrderedKey& otherKey) const;
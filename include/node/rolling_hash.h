@@ -13,6 +13,17 @@ namespace ustore {
 
 class RollingHasher : private Noncopyable {
  public:
+  // algorithms to detect chunk boundaries
+  enum class Engine : byte_t {
+    // buzhash over a sliding window, a boundary is found where the hash
+    // matches the chunk pattern
+    kBuzHash = 0,
+    // FastCDC: gear hash with normalized chunking, which skips the first
+    // quarter of the expected chunk size and checks a stricter pattern
+    // before the expected size than after it
+    kFastCDC = 1
+  };
+
   // NOTE: these default values are not used by chunkers,
   //       as they have own default values
   // 4KB -- expect boundary pattern
@@ -33,9 +44,16 @@ class RollingHasher : private Noncopyable {
 #endif  // TEST_NODEBUILDER
 
   RollingHasher();
-  RollingHasher(uint32_t chunk_pattern, size_t window_size, size_t max_size);
+  // chunk_pattern determines the expected chunk size, while no boundary is
+  // detected in the first window_size bytes of a chunk
+  RollingHasher(uint32_t chunk_pattern, size_t window_size, size_t max_size,
+                Engine engine = Engine::kBuzHash);
 
   inline void HashByte(byte_t b) {
+    if (engine_ == Engine::kFastCDC) {
+      TryHashBytesFastCDC(&b, 1);
+      return;
+    }
     ++byte_hashed_;
     buz_.HashByte(b);
     crossed_boundary_ = (byte_hashed_ >= window_size_) &&
@@ -45,21 +63,38 @@ class RollingHasher : private Noncopyable {
   }
 
   void HashBytes(const byte_t* data, size_t numBytes);
+  // hash bytes until a boundary is crossed
+  // return the position of the byte crossing the boundary, or numBytes if
+  // no boundary is found
   size_t TryHashBytes(const byte_t* data, size_t numBytes);
   inline void ClearLastBoundary() {
     crossed_boundary_ = false;
     byte_hashed_ = 0;
+    gear_ = 0;
   }
   inline void ResetBoundary() { crossed_boundary_ = false; }
   inline bool CrossedBoundary() { return crossed_boundary_; }
   inline size_t window_size() { return window_size_; }
   inline size_t byte_hashed() { return byte_hashed_; }
+  inline Engine engine() { return engine_; }
 
  private:
+  // # of bytes that make up the high bits of a gear hash
+  static constexpr size_t kGearWindow = 63;
+
+  size_t TryHashBytesFastCDC(const byte_t* data, size_t numBytes);
+
+  const Engine engine_;
   uint32_t chunk_pattern_;
   size_t window_size_, max_size_, byte_hashed_ = 0;
   bool crossed_boundary_ = false;
   buzhash::BuzHash buz_;
+  // FastCDC states
+  // chunks are cut only in [min_size_, max_size_], with mask_small_ before
+  // normal_size_ and mask_large_ after it
+  size_t min_size_, normal_size_;
+  uint64_t mask_small_, mask_large_;
+  uint64_t gear_ = 0;
 };
 }  // namespace ustore
 
@@ -15,6 +15,12 @@
 
 namespace ustore {
 
+template <typename T>
+struct Result {
+  T value;
+  ErrorCode stat;
+};
+
 class DB {
  public:
   /**
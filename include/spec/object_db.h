@@ -13,12 +13,6 @@
 
 namespace ustore {
 
-template <typename T>
-struct Result {
-  T value;
-  ErrorCode stat;
-};
-
 // Used by end-user
 class ObjectDB {
  public:
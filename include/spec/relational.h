@@ -209,7 +209,8 @@ class ColumnStore {
     const std::string& ref_col_name, const std::string& ref_val,
     const Row& row,
     const std::function<void(
-      Column*, size_t row_idx, const std::string&)> f_manip_col,
+      Column*, const std::vector<uint64_t>& row_indices,
+      const std::string&)> f_manip_col,
     size_t* n_rows_affected);
 
   ErrorCode InsertRow(const Slice& table, const Slice& branch, const Row& row);
@@ -3,12 +3,16 @@
 #ifndef USTORE_STORE_CHUNK_STORE_H_
 #define USTORE_STORE_CHUNK_STORE_H_
 
+#include <cstdint>
+#include <functional>
 #include <ostream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include "chunk/chunk.h"
 #include "store/iterator.h"
 #include "types/type.h"
+#include "utils/noncopyable.h"
 
 namespace ustore {
 
@@ -47,12 +51,53 @@ class ChunkStore {
   virtual bool Exists(const Hash& key) = 0;
   virtual StoreInfo GetInfo() = 0;
 
+  /*
+   * batched versions of Get/Put/Exists, with one result per key.
+   * the default implementations fall back to the single-key calls.
+   */
+  virtual std::vector<Chunk> MultiGet(const std::vector<Hash>& keys);
+  // chunks[i] is stored under keys[i]
+  virtual bool MultiPut(const std::vector<Hash>& keys,
+                        const std::vector<const Chunk*>& chunks);
+  virtual std::vector<bool> MultiExists(const std::vector<Hash>& keys);
+
+  // tells whether a chunk is still referred to
+  using LivenessFunc = std::function<bool(const Hash&)>;
+  /**
+   * @brief reclaim the space of chunks that are no longer live
+   *
+   * @param mark called once the store is ready to collect, which returns the
+   *        liveness of chunks; chunks put during the collection are kept
+   * @return # of bytes reclaimed, less those of the live chunks relocated
+   */
+  virtual size_t GC(const std::function<LivenessFunc()>& mark) { return 0; }
+
+  /*
+   * readers holding chunks got from the store pin it meanwhile, as GC reuses
+   * the storage of collected chunks only after the readers pinned before are
+   * gone. returns the epoch to unpin.
+   */
+  virtual uint64_t Pin() { return 0; }
+  virtual void Unpin(uint64_t epoch) {}
+
   virtual StoreIterator begin() const = 0;
   virtual StoreIterator cbegin() const = 0;
   virtual StoreIterator end() const = 0;
   virtual StoreIterator cend() const = 0;
 };
 
+// pins the store within a scope, e.g., while serving a request
+class ReadGuard : private Noncopyable {
+ public:
+  explicit ReadGuard(ChunkStore* store)
+    : store_(store), epoch_(store->Pin()) {}
+  ~ReadGuard() { store_->Unpin(epoch_); }
+
+ private:
+  ChunkStore* const store_;
+  const uint64_t epoch_;
+};
+
 // wrap global functions inside a namespace
 namespace store {
 
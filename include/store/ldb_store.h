@@ -5,6 +5,7 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 #include "leveldb/db.h"
 #include "chunk/chunk.h"
 #include "hash/hash.h"
@@ -29,6 +30,9 @@ class LDBStore
   bool Put(const Hash& key, const Chunk& chunk) override;
   bool Exists(const Hash& key) override;
   const StoreInfo& GetInfo() override;
+  // written as a single leveldb::WriteBatch
+  bool MultiPut(const std::vector<Hash>& keys,
+                const std::vector<const Chunk*>& chunks) override;
 
  private:
   LDBStore();
@@ -8,13 +8,21 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <future>
 #include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <stdexcept>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "chunk/chunk.h"
 #include "hash/hash.h"
@@ -40,6 +48,12 @@ constexpr offset_t kSegmentSize = (1<<22);
 constexpr offset_t kMetaSegmentSize = 2 * sizeof(offset_t);
 constexpr size_t kMaxPendingSyncChunks = 1024;
 constexpr uint64_t kMaxSyncTimeoutMilliseconds = 3000;
+// # of independently locked partitions of the chunk index
+constexpr size_t kNumIndexShards = 64;
+// # of segments that can be appended concurrently
+constexpr size_t kNumAppendLanes = 8;
+// period for the resident segments to be adjusted to recent accesses
+constexpr uint64_t kResidencyIntervalMilliseconds = 100;
 
 struct LSTHash {
   const byte_t* hash_;
@@ -74,6 +88,65 @@ struct LSTChunk {
   LSTChunk(const byte_t* ptr) noexcept: chunk_(ptr) {}  // NOLINT
 };
 
+/**
+ * @brief chunk index partitioned by the first byte of the chunk hash. Each
+ * shard owns a reader-writer lock, so that lookups and insertions of chunks
+ * falling into different shards never contend.
+ */
+template <typename MapType, size_t N>
+class LSTIndex : private Noncopyable {
+  static_assert(N > 0 && 256 % N == 0, "# of shards must divide 256");
+
+ public:
+  using key_type = typename MapType::key_type;
+  using mapped_type = typename MapType::mapped_type;
+  static constexpr size_t kNumShards = N;
+
+  struct Shard {
+    mutable shared_mutex mtx_;
+    MapType map_;
+  };
+
+  static inline size_t ShardId(const key_type& key) {
+    return key.hash_[0] % N;
+  }
+  inline Shard& shard(const key_type& key) { return shards_[ShardId(key)]; }
+  inline const Shard& shard(const key_type& key) const {
+    return shards_[ShardId(key)];
+  }
+  inline Shard& shard_at(size_t id) { return shards_[id]; }
+
+  size_t count(const key_type& key) const {
+    const Shard& s = shard(key);
+    shared_lock<shared_mutex> lock(s.mtx_);
+    return s.map_.count(key);
+  }
+
+  bool emplace(const key_type& key, const mapped_type& value) {
+    Shard& s = shard(key);
+    std::lock_guard<shared_mutex> lock(s.mtx_);
+    return s.map_.emplace(key, value).second;
+  }
+
+  size_t erase(const key_type& key) {
+    Shard& s = shard(key);
+    std::lock_guard<shared_mutex> lock(s.mtx_);
+    return s.map_.erase(key);
+  }
+
+  size_t size() const {
+    size_t total = 0;
+    for (const Shard& s : shards_) {
+      shared_lock<shared_mutex> lock(s.mtx_);
+      total += s.map_.size();
+    }
+    return total;
+  }
+
+ private:
+  std::array<Shard, N> shards_;
+};
+
 /**
  * @brief layout: 8-byte prev offset | 8-byte next offset | [20-byte hash,
  * chunks] | 20-byte hash which is the same as the hash of the first chunk
@@ -110,6 +183,118 @@ static inline ChunkType PtrToChunkType(const byte_t* byte) {
       byte + Chunk::kChunkTypeOffset);
 }
 
+/**
+ * @brief open-addressing hash map from chunk hashes to chunks in the log.
+ * Each slot packs a 24-bit fingerprint of the hash with the 40-bit offset of
+ * the chunk relative to LSTSegment::base_addr_ into 8 bytes, so that a lookup
+ * costs one probe sequence over a flat array plus a single access to the log
+ * to confirm the full hash on a fingerprint match.
+ * Only the lookup and update interface used by LSTIndex is provided.
+ */
+class LSTFlatMap {
+ public:
+  using key_type = LSTHash;
+  using mapped_type = LSTChunk;
+  using value_type = std::pair<LSTHash, LSTChunk>;
+
+  static constexpr size_t kOffsetBits = 40;
+  static constexpr uint64_t kMaxOffset = (uint64_t(1) << kOffsetBits) - 1;
+
+  class const_iterator {
+   public:
+    const_iterator(size_t slot, const byte_t* chunk) noexcept
+      : slot_(slot), value_(chunk ? chunk + PtrToChunkLength(chunk) : nullptr,
+                            chunk) {}
+
+    inline const value_type& operator*() const noexcept { return value_; }
+    inline const value_type* operator->() const noexcept { return &value_; }
+    inline bool operator==(const const_iterator& other) const noexcept {
+      return slot_ == other.slot_;
+    }
+    inline bool operator!=(const const_iterator& other) const noexcept {
+      return slot_ != other.slot_;
+    }
+
+   private:
+    size_t slot_;
+    value_type value_;
+  };
+  using iterator = const_iterator;
+
+  LSTFlatMap() = default;
+  ~LSTFlatMap() = default;
+
+  inline size_t size() const noexcept { return size_; }
+  inline bool empty() const noexcept { return size_ == 0; }
+  // bytes occupied by the slot array
+  inline size_t memory() const noexcept {
+    return slots_.capacity() * sizeof(uint64_t);
+  }
+
+  inline const_iterator end() const noexcept {
+    return const_iterator(kNotFound, nullptr);
+  }
+  const_iterator find(const key_type& key) const;
+  inline size_t count(const key_type& key) const {
+    return Find(key) == kNotFound ? 0 : 1;
+  }
+  /**
+   * @brief index a chunk already written into the log; the key must point to
+   * the hash stored right after the chunk
+   */
+  std::pair<iterator, bool> emplace(const key_type& key,
+                                    const mapped_type& value);
+  size_t erase(const key_type& key);
+  void reserve(size_t n);
+  void clear();
+
+  // raw slots, which refer to chunks by log offsets and thus can be persisted
+  inline const std::vector<uint64_t>& slots() const noexcept { return slots_; }
+  /**
+   * @brief restore from raw slots previously obtained via slots()
+   *
+   * @return false if the slots are malformed
+   */
+  bool Assign(std::vector<uint64_t>&& slots, size_t size);
+
+ private:
+  static constexpr uint64_t kEmpty = 0;
+  // the log meta block occupies offset 1, which is never a chunk
+  static constexpr uint64_t kDeleted = 1;
+  static constexpr size_t kNotFound = std::numeric_limits<size_t>::max();
+  static constexpr size_t kMinCapacity = 16;
+
+  static inline uint64_t Home(const byte_t* hash) noexcept {
+    // byte 0 selects the LSTIndex shard, use the following ones
+    uint64_t home;
+    std::memcpy(&home, hash + 1, sizeof(home));
+    return home;
+  }
+  static inline uint64_t Tag(const byte_t* hash) noexcept {
+    return uint64_t(hash[9]) | uint64_t(hash[10]) << 8
+           | uint64_t(hash[11]) << 16;
+  }
+  static inline uint64_t Offset(uint64_t slot) noexcept {
+    return slot & kMaxOffset;
+  }
+  static inline const byte_t* ChunkPtr(uint64_t slot) noexcept {
+    return reinterpret_cast<const byte_t*>(LSTSegment::base_addr_)
+           + Offset(slot);
+  }
+  static inline const byte_t* HashPtr(uint64_t slot) noexcept {
+    const byte_t* chunk = ChunkPtr(slot);
+    return chunk + PtrToChunkLength(chunk);
+  }
+
+  size_t Find(const key_type& key) const;
+  void Rehash(size_t capacity);
+
+  // power of two number of slots
+  std::vector<uint64_t> slots_;
+  size_t size_ = 0;
+  size_t deleted_ = 0;
+};
+
 template <typename MapType,
          template<typename> class CheckPolicy = NoCheckPolicy>
 class LSTStoreIterator : public StoreIteratorBase,
@@ -135,7 +320,8 @@ class LSTStoreIterator : public StoreIteratorBase,
 
     do {
       ptr_ = GetPtrToNextChunk(ptr_);
-      if (IsEndChunk(PtrToChunkType(ptr_)) && segment_->next_ != nullptr) {
+      // skip the end of every segment, including segments still empty
+      while (IsEndChunk(PtrToChunkType(ptr_)) && segment_->next_ != nullptr) {
         segment_ = segment_->next_;
         ptr_ = GetFirstChunkPtr(segment_);
       }
@@ -204,39 +390,58 @@ class LSTStore : public ChunkStore
                  , public Singleton<LSTStore, ClassLevelLockable>
                  , public ObjectLevelLockable<LSTStore> {
   friend class Singleton<LSTStore, ClassLevelLockable>;
+  // guards the segment lists and the log meta block
   using Lock = typename ObjectLevelLockable<LSTStore>::Lock;
 
  public:
-  using MapType = std::unordered_map<LSTHash, LSTChunk>;
+  using MapType = LSTFlatMap;
+  using IndexType = LSTIndex<MapType, kNumIndexShards>;
 
   // normal iterators
-  using iterator = LSTStoreIterator<MapType, CheckExistPolicy>;
-  using const_iterator = LSTStoreIterator<MapType, CheckExistPolicy>;
-  using unsafe_iterator = LSTStoreIterator<MapType, NoCheckPolicy>;
-  using unsafe_const_iterator = LSTStoreIterator<MapType, NoCheckPolicy>;
+  using iterator = LSTStoreIterator<IndexType, CheckExistPolicy>;
+  using const_iterator = LSTStoreIterator<IndexType, CheckExistPolicy>;
+  using unsafe_iterator = LSTStoreIterator<IndexType, NoCheckPolicy>;
+  using unsafe_const_iterator = LSTStoreIterator<IndexType, NoCheckPolicy>;
 
   // type iterators
   template <typename ChunkType, ChunkType T>
-    using type_iterator = LSTStoreTypeIterator<MapType, ChunkType, T,
+    using type_iterator = LSTStoreTypeIterator<IndexType, ChunkType, T,
                                                CheckExistPolicy>;
   template <typename ChunkType, ChunkType T>
-    using const_type_iterator = LSTStoreTypeIterator<MapType, ChunkType, T,
+    using const_type_iterator = LSTStoreTypeIterator<IndexType, ChunkType, T,
                                                      CheckExistPolicy>;
   template <typename ChunkType, ChunkType T>
-    using unsafe_type_iterator = LSTStoreTypeIterator<MapType, ChunkType, T,
+    using unsafe_type_iterator = LSTStoreTypeIterator<IndexType, ChunkType, T,
                                                       NoCheckPolicy>;
   template <typename ChunkType, ChunkType T>
-    using unsafe_const_type_iterator = LSTStoreTypeIterator<MapType, ChunkType,
-                                                            T, NoCheckPolicy>;
+    using unsafe_const_type_iterator = LSTStoreTypeIterator<IndexType,
+                                         ChunkType, T, NoCheckPolicy>;
 
   void Sync() const;
   Chunk Get(const Hash& key) override;
   bool Exists(const Hash& key) override {
-    shared_lock<shared_mutex> lock(chunk_map_mutex_);
-    return chunk_map_.find(key.value()) != chunk_map_.end();
+    return chunk_index_.count(key.value()) != 0;
   }
   bool Put(const Hash& key, const Chunk& chunk) override;
+  // batches lock every index shard once, and a batch put under group commit
+  // waits for durability only once
+  std::vector<Chunk> MultiGet(const std::vector<Hash>& keys) override;
+  bool MultiPut(const std::vector<Hash>& keys,
+                const std::vector<const Chunk*>& chunks) override;
+  std::vector<bool> MultiExists(const std::vector<Hash>& keys) override;
+  /**
+   * @brief compact the sealed segments whose fraction of live bytes is no more
+   * than gc_live_ratio: live chunks are copied to the tail of the log at a
+   * rate of gc_rate_mb, and the segments are returned to the free list.
+   * Concurrent puts and gets are allowed, but not iterators. The segments are
+   * reclaimed only once the readers pinned before the relocation are gone, as
+   * chunks they got may be in there.
+   */
+  size_t GC(const std::function<LivenessFunc()>& mark) override;
+  uint64_t Pin() override;
+  void Unpin(uint64_t epoch) override;
   StoreInfo GetInfo() override {
+    std::lock_guard<std::mutex> lock(info_mutex_);
     return storeInfo;
   }
 
@@ -247,8 +452,14 @@ class LSTStore : public ChunkStore
 
   template <typename Iterator = iterator>
   StoreIterator begin() const {
-    const byte_t* ptr = major_list_ ? GetFirstChunkPtr(major_list_) : nullptr;
-    return StoreIterator(new Iterator(chunk_map_, major_list_, ptr));
+    Lock lock(this);
+    // skip segments that are allocated to a lane but still empty
+    const LSTSegment* first = major_list_;
+    while (first != nullptr && first->next_ != nullptr
+           && IsEndChunk(PtrToChunkType(GetFirstChunkPtr(first))))
+      first = first->next_;
+    const byte_t* ptr = first ? GetFirstChunkPtr(first) : nullptr;
+    return StoreIterator(new Iterator(chunk_index_, first, ptr));
   }
 
   template <typename Iterator = iterator>
@@ -258,10 +469,12 @@ class LSTStore : public ChunkStore
 
   template <typename Iterator = iterator>
   StoreIterator end() const {
+    Lock lock(this);
     const byte_t* ptr = current_major_segment_ ?
-      (const byte_t*)current_major_segment_->segment_ + major_segment_offset_
+      (const byte_t*)current_major_segment_->segment_ + GetTailOffset()
       : nullptr;
-    return StoreIterator(new Iterator(chunk_map_, current_major_segment_, ptr));
+    return StoreIterator(new Iterator(chunk_index_, current_major_segment_,
+                                      ptr));
   }
 
   template <typename Iterator = iterator>
@@ -282,48 +495,219 @@ class LSTStore : public ChunkStore
     kCompleted
   };
 
+  /**
+   * @brief an append cursor into its own major segment. Writer threads are
+   * spread over the lanes, so that concurrent puts copy chunks into the log
+   * in parallel while each segment is still filled sequentially.
+   */
+  struct AppendLane {
+    std::mutex mtx_;
+    LSTSegment* segment_ = nullptr;
+    std::atomic<offset_t> offset_{0};
+    size_t to_sync_chunks_ = 0;
+    Timer sync_timer_;
+    Timer* write_timer_ = nullptr;
+    // start of the bytes not yet flushed by group commit
+    const byte_t* dirty_begin_ = nullptr;
+    // other dirty ranges, e.g., tails of segments sealed by this lane
+    std::vector<std::pair<const byte_t*, const byte_t*>> dirty_ranges_;
+  };
+
   LSTStore() : LSTStore(".", "ustore_default", false) {}
   LSTStore(const std::string& dir, const std::string& file, bool persist)
     : max_segments_(Env::Instance()->config().max_segments())
       , max_log_size_(kSegmentSize * max_segments_ + kMetaLogSize)
-      , thread_status_(ThreadStatus::kUnscheduled)
-      , sync_timer_(TimerPool::GetTimer("Sync Store"))
-      , write_timer_(TimerPool::GetTimer("Write Chunk")) {
+      , group_commit_(Env::Instance()->config().durability()
+                      == Config::GROUP_COMMIT)
+      , commit_window_(Env::Instance()->config().group_commit_window_us())
+      , resident_budget_(Env::Instance()->config().resident_memory_mb() == 0
+          ? 0 : std::max(kNumAppendLanes + 1,
+                         (size_t(1) << 20) *
+                         Env::Instance()->config().resident_memory_mb()
+                         / kSegmentSize))
+      , thread_status_(ThreadStatus::kUnscheduled) {
+    for (size_t i = 0; i < kNumAppendLanes; ++i)
+      lanes_[i].write_timer_ =
+        &TimerPool::GetTimer("Write Chunk (lane " + std::to_string(i) + ")");
     MmapUstoreLogFile(dir, file, persist);
+    if (group_commit_) flusher_ = std::thread(&LSTStore::FlushLoop, this);
+    if (resident_budget_)
+      residency_thread_ = std::thread(&LSTStore::ResidencyLoop, this);
   }
   ~LSTStore() noexcept(false);
 
-  inline offset_t GetFreeSpaceMajor() {
-    return kSegmentSize - major_segment_offset_ -
+  static inline offset_t GetFreeSpace(const AppendLane& lane) {
+    return kSegmentSize - lane.offset_.load() -
       Hash::kByteLength - Chunk::kMetaLength;
   }
+  // lane assigned to the calling thread in a round-robin manner
+  static size_t GetLaneId();
+
+  // chunks found by a loading thread, grouped by index shard
+  using LoadBuckets = std::array<std::vector<const byte_t*>,
+                                 IndexType::kNumShards>;
+  // how much of a segment is covered by the index checkpoint
+  struct SegmentRecord {
+    offset_t covered_;
+    bool sealed_;
+  };
 
-  void GC() {}
   void Load(void*);
-  offset_t LoadFromValidSegment(LSTSegment*);
-  offset_t LoadFromLastSegment(LSTSegment*);
+  offset_t LoadFromValidSegment(LSTSegment*, offset_t start, LoadBuckets*);
+  offset_t LoadFromOpenSegment(LSTSegment*, offset_t start, LoadBuckets*);
+  offset_t LoadFromLastSegment(LSTSegment*, offset_t start, LoadBuckets*);
+  /**
+   * @brief index the loaded chunks in the order of the major list, with one
+   * thread per group of shards
+   */
+  void MergeLoaded(const std::vector<LoadBuckets>& buckets, size_t n_threads);
+  /**
+   * @brief persist the chunk index together with the fill offsets of all
+   * segments in the major list, so that the next load only scans chunks
+   * appended afterwards
+   */
+  void WriteCheckpoint();
+  /**
+   * @brief restore the chunk index from the checkpoint, if it matches the
+   * given major list
+   *
+   * @return false if there is no valid checkpoint
+   */
+  bool ReadCheckpoint(const std::vector<LSTSegment*>& major,
+                      std::unordered_map<offset_t, SegmentRecord>* covered);
+  // write a checkpoint in background if enough segments have been sealed
+  void MaybeScheduleCheckpoint();
+  /**
+   * @brief group commit: repeatedly wait for puts, let more puts join within
+   * the commit window, then flush the dirty ranges of all lanes at once
+   */
+  void FlushLoop();
+  // msync the dirty ranges of all lanes
+  void FlushDirty();
+  /**
+   * @brief append the chunk into the log if absent
+   *
+   * @return ticket of the put that appended the chunk, or that of the latest
+   * put if the chunk already exists
+   */
+  uint64_t PutUnsynced(const Hash& key, const Chunk& chunk);
+  // PutUnsynced() with the lock of the key's shard held
+  uint64_t PutLocked(IndexType::Shard* shard, const Hash& key,
+                     const Chunk& chunk);
+  /**
+   * @brief call f(shard, first, last) for every index shard touched by keys,
+   * where [first, last) is the range of the given order holding the positions
+   * of the keys in that shard
+   */
+  template <typename F>
+  void ForEachShard(const std::vector<Hash>& keys, std::vector<size_t>* order,
+                    F f);
+  /**
+   * @brief append a chunk to the log through the lane of the calling thread
+   * and index it in the given shard, whose lock must be held
+   *
+   * @return ticket of this append
+   */
+  uint64_t Append(IndexType::Shard* shard, const byte_t* chunk,
+                  const byte_t* hash);
+  // whether the segment is being appended by a lane
+  bool IsAppending(const LSTSegment*) const;
+  // move a sealed segment from the major list to the free list
+  void Reclaim(LSTSegment*);
+  // zero the chunks of a reclaimed segment
+  void Clear(LSTSegment*);
+  // index of the segment containing the given address
+  static inline size_t SegmentId(const void* ptr) {
+    return (uintptr_t(ptr) - uintptr_t(LSTSegment::base_addr_) - kMetaLogSize)
+           / kSegmentSize;
+  }
+  // record an access to the segment containing the chunk
+  inline void Touch(const byte_t* chunk) {
+    if (resident_budget_)
+      referenced_[SegmentId(chunk)].store(true, std::memory_order_relaxed);
+  }
+  /**
+   * @brief keep the segments being appended and those recently accessed locked
+   * in memory within the budget, and page out others. Segments accessed since
+   * the last period are admitted; victims are chosen by the CLOCK algorithm.
+   */
+  void ResidencyLoop();
+  // lock a segment in memory
+  void Admit(size_t id);
+  // make room for one more resident segment; false if all are in use
+  bool Evict(const std::vector<char>& appending);
+  // block until the put with the given ticket has been flushed
+  void WaitDurable(uint64_t ticket);
   void* MmapUstoreLogFile(const std::string& dir, const std::string& file,
                           bool persist);
   LSTSegment* Allocate(LSTSegment*);
-  LSTSegment* AllocateMajor();
+  LSTSegment* AllocateMajor(AppendLane*);
   LSTSegment* AllocateMinor();
+  /**
+   * @brief write the validation hash of a full segment
+   */
+  void Seal(LSTSegment*);
+  // fill offset of the last segment in the major list
+  offset_t GetTailOffset() const;
   /**
    * @brief enlarge the log
    */
   void Enlarge();
   void UpdateStore();
 
-  MapType chunk_map_;
+  IndexType chunk_index_;
   LSTSegment *free_list_, *major_list_;
+  // the last segment in the major list
   LSTSegment *current_major_segment_;
   LSTSegment *last_free_segment_;
 
-  offset_t major_segment_offset_;
+  std::array<AppendLane, kNumAppendLanes> lanes_;
   const size_t max_segments_ = 64;
   const offset_t max_log_size_ = kSegmentSize * max_segments_ + kMetaLogSize;
   const offset_t segment_increment_ = 16;  // # of segments to allocate
 
   int fd_;  // mmaped file descriptor
+  std::string checkpoint_path_;
+  std::future<void> checkpoint_future_;
+  std::atomic<bool> checkpointing_{false};
+  size_t sealed_since_checkpoint_ = 0;
+
+  // group commit
+  const bool group_commit_;
+  const std::chrono::microseconds commit_window_;
+  // tickets of appended puts and of puts already on disk
+  std::atomic<uint64_t> write_seq_{0};
+  std::atomic<uint64_t> durable_seq_{0};
+  std::mutex commit_mutex_;
+  // wakes up the flusher and the writers, respectively
+  std::condition_variable flush_cv_;
+  std::condition_variable durable_cv_;
+  bool stop_flusher_ = false;
+  std::thread flusher_;
+
+  // segments resident in memory; all if the budget is 0
+  const size_t resident_budget_;
+  // reference bits of all segments, set by accesses and cleared by the clock
+  std::unique_ptr<std::atomic<bool>[]> referenced_;
+  // accessed by the residency thread only
+  std::vector<char> resident_;
+  size_t num_resident_ = 0;
+  size_t clock_hand_ = 0;
+  std::mutex residency_mutex_;
+  std::condition_variable residency_cv_;
+  bool stop_residency_ = false;
+  std::thread residency_thread_;
+
+  // whether a GC is running, and chunks deduplicated by puts meanwhile in
+  // each shard (guarded by the shard lock)
+  std::atomic<bool> gc_tracking_{false};
+  std::array<std::unordered_set<Hash>, IndexType::kNumShards> gc_touched_;
+  // # of readers pinned in each epoch; the epoch is advanced by GC to wait
+  // for the readers pinned before
+  std::mutex epoch_mutex_;
+  std::condition_variable epoch_cv_;
+  uint64_t epoch_ = 0;
+  std::map<uint64_t, size_t> pinned_;
 
   StoreInfo storeInfo;
   SyncBlock sync_block_;
@@ -331,12 +715,7 @@ class LSTStore : public ChunkStore
   std::atomic<ThreadStatus> thread_status_;
 
   // for thread safety
-  shared_mutex chunk_map_mutex_;
-
-  // for persistence
-  Timer& sync_timer_;
-  Timer& write_timer_;
-  size_t to_sync_chunks_ = 0;
+  std::mutex info_mutex_;
 };
 
 }  // namespace lst_store
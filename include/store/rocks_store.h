@@ -5,6 +5,7 @@
 
 #include <mutex>
 #include <string>
+#include <vector>
 #include "chunk/chunk.h"
 #include "hash/hash.h"
 #include "store/chunk_store.h"
@@ -27,6 +28,11 @@ class RocksStore
   bool Put(const Hash& key, const Chunk& chunk) override;
   StoreInfo GetInfo() override;
 
+  std::vector<Chunk> MultiGet(const std::vector<Hash>& keys) override;
+  bool MultiPut(const std::vector<Hash>& keys,
+                const std::vector<const Chunk*>& chunks) override;
+  std::vector<bool> MultiExists(const std::vector<Hash>& keys) override;
+
   StoreIterator begin() const override;
   StoreIterator cbegin() const override;
   StoreIterator end() const override;
@@ -25,9 +25,22 @@ class VList : public UList, public VObject {
   Hash Splice(uint64_t start_idx, uint64_t num_to_delete,
               const std::vector<Slice>& entries) const override;
 
+  Hash Set(const std::vector<uint64_t>& indices,
+           const std::vector<Slice>& entries) const override;
+
+  using UList::Delete;
+  Hash Delete(const std::vector<uint64_t>& indices) const override;
+
  protected:
   // Load an existing VList
   VList(std::shared_ptr<ChunkLoader>, const Hash& root_hash) noexcept;
+
+ private:
+  // Buffer indices as keys, each of which is a uint64_t
+  void BufferIndices(const std::vector<uint64_t>& indices,
+                     const std::vector<Slice>& entries) const;
+
+  mutable std::vector<uint64_t> indices_;
 };
 
 }  // namespace ustore
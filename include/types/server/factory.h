@@ -26,6 +26,8 @@ class ChunkableTypeFactory : private Noncopyable {
       // start chunk client service
       client_svc_.Run();
       cli_.push_back(client_svc_.CreateChunkClient());
+      // a separate client for loaders to prefetch remote chunks
+      cli_.push_back(client_svc_.CreateChunkClient());
       writer_.reset(new PartitionedChunkWriter(ptt, &cli_[0]));
     } else {
       writer_.reset(new LocalChunkWriter());
@@ -47,7 +49,8 @@ class ChunkableTypeFactory : private Noncopyable {
 
   inline std::shared_ptr<ChunkLoader> loader() {
     if (ptt_)
-      return std::make_shared<PartitionedChunkLoader>(ptt_, &cli_[0]);
+      return std::make_shared<PartitionedChunkLoader>(ptt_, &cli_[0],
+                                                      &cli_[1]);
     else
       return std::make_shared<LocalChunkLoader>();
   }
@@ -23,6 +23,12 @@ class SList : public UList {
   Hash Splice(uint64_t start_idx, uint64_t num_to_delete,
               const std::vector<Slice>& entries) const override;
 
+  Hash Set(const std::vector<uint64_t>& indices,
+           const std::vector<Slice>& entries) const override;
+
+  using UList::Delete;
+  Hash Delete(const std::vector<uint64_t>& indices) const override;
+
   // Use this List as base to perform three-way merging
   //   return empty hash when merging fails
   Hash Merge(const SList& node1, const SList& node2) const;
@@ -36,6 +42,11 @@ class SList : public UList {
         const std::vector<Slice>& elements) noexcept;
 
  private:
+  // Splice one element at each index, with the corresponding entry if any
+  //   An index given more than once is spliced once, with its last entry
+  Hash MultiSplice(const std::vector<uint64_t>& indices,
+                   const std::vector<Slice>& entries) const;
+
   ChunkWriter* chunk_writer_;
 };
 }  // namespace ustore
@@ -84,6 +84,8 @@ enum class ErrorCode : byte_t {
   kBranchNotExists = 14,
   kReferringVersionNotExist = 15,
   kInconsistentKey = 16,
+  kKeyMoved = 17,
+  kFailedMigrate = 18,
   // type
   kInvalidValue = 20,
   kTypeUnsupported = 21,
@@ -107,6 +109,9 @@ enum class ErrorCode : byte_t {
   kChunkNotExists = 40,
   kFailedCreateChunk = 41,
   kStoreInfoUnavailable = 42,
+  kFailedGC = 43,
+  kRequestTimeout = 44,
+  kConnectionLost = 45,
   // relational
   kTypeMismatch = 50,
   kTableNotExists = 51,
@@ -49,6 +49,13 @@ class UList : public ChunkableType {
   virtual Hash Splice(uint64_t start_idx, uint64_t num_to_delete,
                       const std::vector<Slice>& entries) const = 0;
   Hash Delete(uint64_t start_idx, uint64_t num_to_delete) const;
+  // Replace the element at each index with the entry at the same position,
+  //   committing all of them at once; the last entry of an index given more
+  //   than once wins
+  virtual Hash Set(const std::vector<uint64_t>& indices,
+                   const std::vector<Slice>& entries) const = 0;
+  // Remove the element at each index, committing all of them at once
+  virtual Hash Delete(const std::vector<uint64_t>& indices) const = 0;
   Hash Insert(uint64_t start_idx, const std::vector<Slice>& entries) const;
   Hash Append(const std::vector<Slice>& entries) const;
   // Return an iterator that scan from List Start
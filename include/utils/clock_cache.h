@@ -0,0 +1,187 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_UTILS_CLOCK_CACHE_H_
+#define USTORE_UTILS_CLOCK_CACHE_H_
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include "hash/hash.h"
+#include "utils/noncopyable.h"
+
+namespace ustore {
+
+/**
+ * @brief A bounded cache of immutable values keyed by hash, shared by threads.
+ *
+ * Values are split into shards by hash, and each shard holds at most its
+ * share of the capacity, evicting with a CLOCK policy. A value still referred
+ * to outside the cache is pinned and skipped by eviction, so a shard may
+ * exceed its share while all its values are in use.
+ */
+template <typename T>
+class ClockCache : private Noncopyable {
+ public:
+  static constexpr size_t kNumShards = 16;
+
+  struct Stats {
+    const char* name;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+
+    friend std::ostream& operator<<(std::ostream& os, const Stats& obj) {
+      os << "[" << obj.name << "] hits: " << obj.hits << ", misses: "
+         << obj.misses << ", evictions: " << obj.evictions << ", entries: "
+         << obj.entries << ", bytes: " << obj.bytes;
+      return os;
+    }
+  };
+
+  // capacity in bytes, 0 to disable caching; name is shown in stats
+  ClockCache(const char* name, size_t capacity)
+    : name_(name), capacity_(capacity), hits_(0), misses_(0),
+      evictions_(0) {}
+  ~ClockCache() = default;
+
+  // return nullptr if the value is not cached
+  std::shared_ptr<const T> Get(const Hash& key);
+  // cache the value taking the given bytes, and return the one cached
+  // earlier if any
+  std::shared_ptr<const T> Put(const Hash& key, std::shared_ptr<const T> value,
+                               size_t num_bytes);
+  // drop all values
+  void Clear();
+
+  Stats GetStats() const;
+  inline size_t capacity() const { return capacity_; }
+
+ private:
+  struct Entry {
+    Hash key;
+    std::shared_ptr<const T> value;
+    size_t num_bytes;
+    bool referenced;
+  };
+
+  struct Shard {
+    mutable std::mutex mtx_;
+    // entries in clock order, new ones are inserted right behind the hand
+    std::list<Entry> clock_;
+    typename std::list<Entry>::iterator hand_ = clock_.end();
+    // keys refer to the hashes owned by entries
+    std::unordered_map<Hash, typename std::list<Entry>::iterator> index_;
+    size_t bytes_ = 0;
+  };
+
+  inline Shard& shard(const Hash& key) {
+    return shards_[key.value()[0] % kNumShards];
+  }
+  // evict unpinned values until the shard fits in its share
+  void Evict(Shard* shard);
+
+  const char* const name_;
+  const size_t capacity_;
+  std::array<Shard, kNumShards> shards_;
+  std::atomic<size_t> hits_;
+  std::atomic<size_t> misses_;
+  std::atomic<size_t> evictions_;
+};
+
+template <typename T>
+constexpr size_t ClockCache<T>::kNumShards;
+
+template <typename T>
+std::shared_ptr<const T> ClockCache<T>::Get(const Hash& key) {
+  if (capacity_ == 0) return nullptr;
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mtx_);
+  auto it = s.index_.find(key);
+  if (it == s.index_.end()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  it->second->referenced = true;
+  return it->second->value;
+}
+
+template <typename T>
+std::shared_ptr<const T> ClockCache<T>::Put(const Hash& key,
+    std::shared_ptr<const T> value, size_t num_bytes) {
+  if (capacity_ == 0) return value;
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mtx_);
+  auto it = s.index_.find(key);
+  if (it != s.index_.end()) return it->second->value;
+
+  auto entry = s.clock_.insert(s.hand_,
+                               Entry{key.Clone(), value, num_bytes, false});
+  s.index_.emplace(Hash(entry->key.value()), entry);
+  s.bytes_ += num_bytes;
+  Evict(&s);
+  return value;
+}
+
+template <typename T>
+void ClockCache<T>::Evict(Shard* shard) {
+  const size_t share = capacity_ / kNumShards;
+  // every value is passed at most twice: once to clear its reference bit,
+  // and once more to evict it
+  for (size_t n = 2 * shard->clock_.size();
+       shard->bytes_ > share && n > 0; --n) {
+    if (shard->hand_ == shard->clock_.end())
+      shard->hand_ = shard->clock_.begin();
+    Entry& entry = *shard->hand_;
+    if (entry.value.use_count() > 1) {
+      // pinned by its users
+      ++shard->hand_;
+    } else if (entry.referenced) {
+      entry.referenced = false;
+      ++shard->hand_;
+    } else {
+      shard->bytes_ -= entry.num_bytes;
+      shard->index_.erase(entry.key);
+      shard->hand_ = shard->clock_.erase(shard->hand_);
+      evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+template <typename T>
+void ClockCache<T>::Clear() {
+  for (Shard& s : shards_) {
+    std::lock_guard<std::mutex> lock(s.mtx_);
+    s.index_.clear();
+    s.clock_.clear();
+    s.hand_ = s.clock_.end();
+    s.bytes_ = 0;
+  }
+}
+
+template <typename T>
+typename ClockCache<T>::Stats ClockCache<T>::GetStats() const {
+  Stats stats;
+  stats.name = name_;
+  stats.hits = hits_.load();
+  stats.misses = misses_.load();
+  stats.evictions = evictions_.load();
+  stats.entries = 0;
+  stats.bytes = 0;
+  for (const Shard& s : shards_) {
+    std::lock_guard<std::mutex> lock(s.mtx_);
+    stats.entries += s.index_.size();
+    stats.bytes += s.bytes_;
+  }
+  return stats;
+}
+
+}  // namespace ustore
+
+#endif  // USTORE_UTILS_CLOCK_CACHE_H_
@@ -0,0 +1,59 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_UTILS_CPU_FEATURES_H_
+#define USTORE_UTILS_CPU_FEATURES_H_
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define USTORE_X86 1
+#endif
+
+namespace ustore {
+
+/**
+ * @brief Instruction set extensions of the running CPU.
+ *
+ * Detected once by CPUID, so that accelerated code paths compiled with
+ * function-level target attributes can be chosen at runtime while the rest of
+ * the binary stays portable.
+ */
+struct CpuFeatures {
+  bool ssse3 = false;
+  bool sse41 = false;
+  bool avx2 = false;
+  bool sha = false;
+
+  static const CpuFeatures& Get() {
+    static const CpuFeatures features = Detect();
+    return features;
+  }
+
+ private:
+  static CpuFeatures Detect() {
+    CpuFeatures f;
+#ifdef USTORE_X86
+    unsigned eax, ebx, ecx, edx;
+    unsigned max_leaf = __get_cpuid_max(0, nullptr);
+    if (max_leaf < 1) return f;
+    __cpuid(1, eax, ebx, ecx, edx);
+    f.ssse3 = ecx & (1u << 9);
+    f.sse41 = ecx & (1u << 19);
+    // the OS must save the ymm registers on context switches
+    bool avx_os = false;
+    if ((ecx & (1u << 27)) && (ecx & (1u << 28))) {
+      unsigned xcr0_lo, xcr0_hi;
+      __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+      avx_os = (xcr0_lo & 0x6) == 0x6;
+    }
+    if (max_leaf < 7) return f;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    f.avx2 = avx_os && (ebx & (1u << 5));
+    f.sha = ebx & (1u << 29);
+#endif  // USTORE_X86
+    return f;
+  }
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_UTILS_CPU_FEATURES_H_
@@ -0,0 +1,48 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#ifndef USTORE_UTILS_LATENCY_TRACKER_H_
+#define USTORE_UTILS_LATENCY_TRACKER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "utils/noncopyable.h"
+
+namespace ustore {
+
+/**
+ * Percentile of the latencies of recent operations, e.g., to tell when a
+ * request is slow enough to be hedged.
+ *
+ * The last kWindow latencies are kept, and the percentile is recomputed over
+ * them once every kInterval records, so that it follows the load and is cheap
+ * to read on every request.
+ */
+class LatencyTracker : private Noncopyable {
+ public:
+  static constexpr size_t kWindow = 1024;
+  static constexpr size_t kInterval = 64;
+
+  // track the given percentile, in (0, 100]
+  explicit LatencyTracker(double percentile);
+  ~LatencyTracker() = default;
+
+  void Record(size_t us);
+  // latency at the percentile in microseconds, or 0 until kInterval latencies
+  // are recorded
+  inline size_t percentileUs() const {
+    return percentile_us_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const double percentile_;
+  std::mutex mtx_;
+  std::vector<size_t> window_;  // a ring of the recent latencies
+  size_t recorded_ = 0;
+  std::atomic<size_t> percentile_us_{0};
+};
+
+}  // namespace ustore
+
+#endif  // USTORE_UTILS_LATENCY_TRACKER_H_
@@ -32,7 +32,7 @@ class CheckExistPolicy {
   template <typename... T,
       typename = enable_if_t<std::is_constructible<key_type, T...>::value>>
   constexpr bool check(const MapType& map, T&&... keyArgs) {
-    return (map.end() != map.find(key_type{std::forward<T>(keyArgs)...}));
+    return map.count(key_type{std::forward<T>(keyArgs)...}) != 0;
   }
 
   template <typename T,
@@ -40,7 +40,7 @@ class CheckExistPolicy {
              std::is_same<remove_cv_t<remove_reference_t<key_type>>,
                   remove_cv_t<remove_reference_t<T>>>::value>>
   constexpr bool check(const MapType& map, T&& key) {
-    return (map.end() != map.find(std::forward<T>(key)));
+    return map.count(std::forward<T>(key)) != 0;
   }
 };
 
@@ -5,6 +5,7 @@
 
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include "net/message_buffer.h"
 #include "proto/messages.pb.h"
 #include "utils/logging.h"
 
@@ -27,6 +28,14 @@ class MessageParser {
     if (!success) LOG(ERROR) << "Fail to consume entire message";
     return success;
   }
+
+  // serialize the message into a buffer to send
+  static MessageBuffer Serialize(const UMessage& umsg) {
+    // sizes are computed once, and cached for serializing
+    MessageBuffer buf(umsg.ByteSize());
+    umsg.SerializeWithCachedSizesToArray(buf.data());
+    return buf;
+  }
 };
 
 }  // namespace ustore
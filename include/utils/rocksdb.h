@@ -95,6 +95,12 @@ class RocksDB : private Noncopyable {
     return db_->Write(db_write_opts_, updates).ok();
   }
 
+  inline std::vector<rocksdb::Status> DBMultiGet(
+      const std::vector<rocksdb::Slice>& keys,
+      std::vector<std::string>* values) const {
+    return db_->MultiGet(db_read_opts_, keys, values);
+  }
+
   inline bool DBExists(const rocksdb::Slice& key) const {
     rocksdb::PinnableSlice pin_val;
     return DBGet(key, &pin_val);
@@ -4,6 +4,7 @@
 #define USTORE_UTILS_TIMER_H_
 
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <ratio>
 #include <string>
@@ -37,6 +37,9 @@ class HeadVersion : private Noncopyable {
   virtual void RenameBranch(const Slice& key, const Slice& old_branch,
                             const Slice& new_branch) = 0;
 
+  // remove all branches and latest versions of the key
+  virtual void RemoveKey(const Slice& key) = 0;
+
   virtual bool Exists(const Slice& key) const = 0;
 
   virtual bool Exists(const Slice& key, const Slice& branch) const = 0;
@@ -52,6 +52,8 @@ class RocksLatestVersionDB : public RocksDB {
   bool Merge(const Slice& key, const Hash& prev_ver1, const Hash& prev_ver2,
              const Hash& ver);
 
+  bool Delete(const Slice& key);
+
   std::vector<std::string> GetKeys() const;
 
  private:
@@ -98,6 +100,8 @@ class RocksHeadVersion : public HeadVersion {
   void RenameBranch(const Slice& key, const Slice& old_branch,
                     const Slice& new_branch) override;
 
+  void RemoveKey(const Slice& key) override;
+
   inline bool Exists(const Slice& key) const override {
     return latest_db_.Exists(key);
   }
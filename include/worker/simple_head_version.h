@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include "utils/shared_lock.h"
 #include "worker/head_version.h"
 
 namespace ustore {
@@ -15,7 +16,8 @@ namespace ustore {
 /**
  * @brief Table of head versions of data.
  *
- * This class should only be instantiated by Worker.
+ * This class should only be instantiated by Worker. The table may be read
+ * and updated concurrently; updates of the same key are ordered by callers.
  */
 class SimpleHeadVersion : public HeadVersion {
  public:
@@ -42,7 +44,10 @@ class SimpleHeadVersion : public HeadVersion {
   void RenameBranch(const Slice& key, const Slice& old_branch,
                     const Slice& new_branch) override;
 
+  void RemoveKey(const Slice& key) override;
+
   inline bool Exists(const Slice& key) const override {
+    shared_lock<shared_mutex> lock(mtx_);
     return latest_ver_.find(key) != latest_ver_.end();
   }
 
@@ -52,7 +57,9 @@ class SimpleHeadVersion : public HeadVersion {
 
   inline bool IsBranchHead(const Slice& key, const Slice& branch,
                            const Hash& ver) const override {
-    return Exists(key, branch) ? branch_ver_.at(key).at(branch) == ver : false;
+    shared_lock<shared_mutex> lock(mtx_);
+    const Hash* head = FindBranch(key, branch);
+    return head != nullptr && *head == ver;
   }
 
   std::vector<std::string> ListKey() const override;
@@ -68,6 +75,10 @@ class SimpleHeadVersion : public HeadVersion {
   // }
 
  private:
+  // head of the branch, or nullptr if not exists; the caller holds the lock
+  const Hash* FindBranch(const Slice& key, const Slice& branch) const;
+
+  mutable shared_mutex mtx_;
   // use std::map for branch to preserve branch order
   std::unordered_map<PSlice, std::map<PSlice, Hash>> branch_ver_;
   std::unordered_map<PSlice, std::unordered_set<Hash>> latest_ver_;
@@ -3,8 +3,10 @@
 #ifndef USTORE_WORKER_WORKER_H_
 #define USTORE_WORKER_WORKER_H_
 
+#include <array>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -14,6 +16,7 @@
 #include "types/server/factory.h"
 #include "types/ucell.h"
 #include "utils/noncopyable.h"
+#include "utils/shared_lock.h"
 
 #if defined(USE_SIMPLE_HEAD_VERSION)
 #include "worker/simple_head_version.h"
@@ -228,6 +231,60 @@ class Worker : public DB, private StoreInitializer, private Noncopyable {
 
   ErrorCode GetStorageInfo(std::vector<StoreInfo>* info) const override;
 
+  /**
+   * @brief Store a chunk as is, e.g., one moved in from another worker.
+   *
+   * @param ver   Hash of the chunk.
+   * @param chunk The chunk.
+   * @return      Error code. (ErrorCode::kOK for success)
+   */
+  ErrorCode PutChunk(const Hash& ver, const Chunk& chunk);
+
+  /**
+   * @brief Set the head version of a branch as is, without checking the
+   *        version, e.g., when the key is moved in from another worker.
+   */
+  ErrorCode PutBranchHead(const Slice& key, const Slice& branch,
+                          const Hash& ver);
+
+  /**
+   * @brief Add a latest version of a key as is, e.g., when the key is moved
+   *        in from another worker.
+   */
+  ErrorCode PutLatestVersion(const Slice& key, const Hash& ver);
+
+  /**
+   * @brief Remove the branches and latest versions of a key, e.g., once the
+   *        key is moved to another worker, so that GC collects its chunks.
+   */
+  inline void RemoveKey(const Slice& key) { head_ver_.RemoveKey(key); }
+
+  /**
+   * @brief Collect the chunks reachable from the given versions, following
+   *        both the data and the previous versions of each version.
+   *
+   * @param roots   Versions to start from.
+   * @param visited Chunks collected already, which are not followed again.
+   *                Newly collected chunks are added.
+   * @param found   (Optional) newly collected chunks are appended.
+   */
+  void CollectChunks(std::vector<Hash> roots, std::unordered_set<Hash>* visited,
+                     std::vector<Hash>* found = nullptr) const;
+
+  /**
+   * @brief Reclaim the storage of chunks unreachable from the branch heads
+   *        and the latest versions of all keys, following both the data and
+   *        the previous versions of each version.
+   *        Writes are held off only while the roots are taken; versions
+   *        published afterwards keep the chunks they refer to alive.
+   *        Chunks got from the store must not be held across a GC, unless
+   *        the store is pinned by a ReadGuard.
+   *
+   * @param reclaimed Returned # of bytes reclaimed.
+   * @return          Error code. (ErrorCode::kOK for success)
+   */
+  ErrorCode GC(size_t* reclaimed);
+
   ErrorCode ListKeys(std::vector<std::string>* keys) const override;
 
   ErrorCode ListBranches(const Slice& key,
@@ -356,6 +413,55 @@ class Worker : public DB, private StoreInitializer, private Noncopyable {
   ErrorCode WriteMap(const Value& val, Hash* ver);
   ErrorCode WriteSet(const Value& val, Hash* ver);
 
+  // chunks live in a GC, split into shards by hash, so that writers keeping
+  // chunks alive seldom wait for the GC marking, or growing, a shard
+  class LiveSet : private Noncopyable {
+   public:
+    static constexpr size_t kNumShards = 64;
+
+    // false if the chunk is marked already
+    inline bool Insert(const Hash& hash) {
+      Shard& s = shard(hash);
+      std::lock_guard<std::mutex> lock(s.mtx_);
+      return s.set_.insert(hash.Clone()).second;
+    }
+    inline bool Contains(const Hash& hash) const {
+      const Shard& s = shard(hash);
+      std::lock_guard<std::mutex> lock(s.mtx_);
+      return s.set_.count(hash) != 0;
+    }
+    size_t size() const {
+      size_t total = 0;
+      for (const Shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mtx_);
+        total += s.set_.size();
+      }
+      return total;
+    }
+
+   private:
+    struct Shard {
+      mutable std::mutex mtx_;
+      std::unordered_set<Hash> set_;
+    };
+
+    inline Shard& shard(const Hash& hash) {
+      return shards_[hash.value()[0] % kNumShards];
+    }
+    inline const Shard& shard(const Hash& hash) const {
+      return shards_[hash.value()[0] % kNumShards];
+    }
+
+    std::array<Shard, kNumShards> shards_;
+  };
+
+  // keep the chunks reachable from a version to be published alive, if a GC
+  // is running; the caller holds publish_mtx_ shared
+  bool KeepAlive(const Hash& ver);
+  // mark the chunks reachable from the given ones live in the running GC,
+  // skipping those marked already; false if any chunk is missing
+  bool MarkLive(std::vector<Hash> hashes);
+
   inline void UpdateLatestVersion(const UCell& ucell) {
     const auto& prev_ver1 = ucell.preHash();
     const auto& prev_ver2 = ucell.preHash(true);
@@ -365,6 +471,12 @@ class Worker : public DB, private StoreInitializer, private Noncopyable {
 
   const WorkerID id_;
   ChunkableTypeFactory factory_;
+  // held shared to write new versions, and exclusively by GC to take the
+  // roots to mark from
+  shared_mutex publish_mtx_;
+  // chunks live in the running GC, if any, set under publish_mtx_
+  LiveSet* gc_live_ = nullptr;
+  std::mutex gc_mtx_;  // one GC at a time
 };
 
 }  // namespace ustore
@@ -2,18 +2,47 @@
 
 #include "chunk/chunk.h"
 
+#include <algorithm>
 #include <utility>
+#include "utils/env.h"
 
 namespace ustore {
 
-Chunk::Chunk(ChunkType type, uint32_t capacity)
-    : own_(new byte_t[kMetaLength + capacity]) {
+Chunk::Chunk(ChunkType type, uint32_t capacity) : hash_inline_(true) {
+  const size_t num_bytes = kMetaLength + capacity + Hash::kByteLength;
+  if (Env::Instance()->config().chunk_arena()) {
+    ChunkArena::Block* block;
+    byte_t* buffer = ChunkArena::ThisThread()->Allocate(num_bytes, &block);
+    own_ = std::unique_ptr<byte_t[], BufferDeleter>(buffer,
+                                                    BufferDeleter(block));
+  } else {
+    own_.reset(new byte_t[num_bytes]);
+  }
   head_ = own_.get();
   *reinterpret_cast<uint32_t*>(&own_[kNumBytesOffset]) = kMetaLength + capacity;
   *reinterpret_cast<ChunkType*>(&own_[kChunkTypeOffset]) = type;
 }
 
-Chunk::Chunk(std::unique_ptr<byte_t[]> head) noexcept : own_(std::move(head)) {
+void Chunk::LeaveArena() {
+  if (!inArena()) return;
+  const size_t num_bytes = numBytes() + Hash::kByteLength;
+  std::unique_ptr<byte_t[]> copy(new byte_t[num_bytes]);
+  std::copy(head_, head_ + num_bytes, copy.get());
+  // releases the arena buffer
+  own_ = std::unique_ptr<byte_t[], BufferDeleter>(copy.release());
+  head_ = own_.get();
+  // the hash computed inline is copied along
+  if (hashed()) hash_ = Hash(&own_[numBytes()]);
+}
+
+Chunk::Chunk(std::unique_ptr<byte_t[]> head) noexcept : own_(head.release()) {
+  head_ = own_.get();
+}
+
+Chunk::Chunk(std::unique_ptr<std::string> bytes) noexcept
+  : own_(reinterpret_cast<byte_t*>(&(*bytes)[0]),
+         BufferDeleter(bytes.get())) {
+  bytes.release();
   head_ = own_.get();
 }
 
@@ -0,0 +1,51 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "chunk/chunk_arena.h"
+
+#include <atomic>
+
+namespace ustore {
+
+class ChunkArena::Block {
+ public:
+  // buffers in use, plus one if the block is still being filled
+  std::atomic<size_t> refs{1};
+  alignas(kAlignment) byte_t data[kBlockSize];
+};
+
+ChunkArena* ChunkArena::ThisThread() {
+  static thread_local ChunkArena arena;
+  return &arena;
+}
+
+void ChunkArena::Release(Block* block) noexcept {
+  if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete block;
+}
+
+ChunkArena::~ChunkArena() {
+  if (current_ != nullptr) Release(current_);
+}
+
+byte_t* ChunkArena::Allocate(size_t n, Block** block) {
+  if (n > kMaxBufferSize) {
+    *block = nullptr;
+    return new byte_t[n];
+  }
+  n = (n + kAlignment - 1) & ~(kAlignment - 1);
+  // no buffer is left in the block, and only this thread may add one
+  if (current_ != nullptr &&
+      current_->refs.load(std::memory_order_acquire) == 1)
+    used_ = 0;
+  if (current_ == nullptr || used_ + n > kBlockSize) {
+    if (current_ != nullptr) Release(current_);
+    current_ = new Block;
+    used_ = 0;
+  }
+  current_->refs.fetch_add(1, std::memory_order_relaxed);
+  byte_t* buffer = current_->data + used_;
+  used_ += n;
+  *block = current_;
+  return buffer;
+}
+
+}  // namespace ustore
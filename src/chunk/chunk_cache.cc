@@ -0,0 +1,12 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "chunk/chunk_cache.h"
+
+#include "utils/env.h"
+
+namespace ustore {
+
+ChunkCache::ChunkCache()
+  : ChunkCache(size_t(Env::Instance()->config().chunk_cache_mb()) << 20) {}
+
+}  // namespace ustore
@@ -1,36 +1,177 @@
 // Copyright (c) 2017 The Ustore Authors.
 
 #include "chunk/chunk_loader.h"
+
+#include <algorithm>
+#include <utility>
+#include "chunk/chunk_cache.h"
 #include "cluster/chunk_client.h"
 #include "cluster/partitioner.h"
 #include "spec/db.h"
 
 namespace ustore {
 
+constexpr size_t ChunkLoader::kWindow;
+
+// A future holding a chunk at hand
+static std::future<Result<Chunk>> MakeReady(Chunk&& chunk) {
+  std::promise<Result<Chunk>> ready;
+  ready.set_value({std::move(chunk), ErrorCode::kOK});
+  return ready.get_future();
+}
+
+static inline bool IsReady(const std::future<Result<Chunk>>& future) {
+  return future.wait_for(std::chrono::seconds(0))
+         == std::future_status::ready;
+}
+
 const Chunk* ChunkLoader::Load(const Hash& key) {
   CHECK(!key.empty());
   auto it = cache_.find(key);
-  if (it != cache_.end()) return &(it->second);
-  cache_.emplace(key.Clone(), GetChunk(key));
-  return &cache_[key];
+  if (it != cache_.end()) return it->second.get();
+  auto chunk = FindInWindow(key);
+  if (chunk == nullptr) chunk = Fetch(key);
+  const Chunk* ptr = chunk.get();
+  cache_.emplace(key.Clone(), std::move(chunk));
+  return ptr;
+}
+
+std::shared_ptr<const Chunk> ChunkLoader::LoadShared(const Hash& key) {
+  CHECK(!key.empty());
+  auto it = cache_.find(key);
+  if (it != cache_.end()) return it->second;
+  auto chunk = FindInWindow(key);
+  if (chunk != nullptr) return chunk;
+  chunk = Fetch(key);
+  window_.emplace_back(key.Clone(), chunk);
+  if (window_.size() > kWindow) window_.pop_front();
+  return chunk;
+}
+
+std::shared_ptr<const Chunk> ChunkLoader::FindInWindow(const Hash& key) const {
+  // the latest ones are the most likely to be loaded again
+  for (auto it = window_.rbegin(); it != window_.rend(); ++it)
+    if (it->first == key) return it->second;
+  return nullptr;
+}
+
+std::shared_ptr<const Chunk> ChunkLoader::Fetch(const Hash& key) {
+  std::shared_ptr<const Chunk> chunk;
+  auto pf = prefetching_.find(key);
+  if (pf != prefetching_.end()) {
+    chunk = Take(key, &pf->second);
+    prefetching_.erase(pf);
+  } else {
+    chunk = ChunkCache::Instance()->Get(key);
+  }
+  if (chunk == nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    chunk = Share(key, GetChunk(key));
+    RecordFetch(start);
+  }
+  return chunk;
 }
 
+std::shared_ptr<const Chunk> ChunkLoader::Take(const Hash& key,
+                                               Prefetching* pf) {
+  if (pf->cached != nullptr) return std::move(pf->cached);
+  // the latency is known if waited for, or recorded when started
+  bool waited = !IsReady(pf->fetching);
+  Result<Chunk> fetched = pf->fetching.get();
+  if (fetched.stat != ErrorCode::kOK) return nullptr;
+  if (waited) RecordFetch(pf->start);
+  return Share(key, std::move(fetched.value));
+}
+
+void ChunkLoader::Prefetch(const std::vector<Hash>& keys) {
+  if (!fetcher_) return;
+  ChunkCache* shared = ChunkCache::Instance();
+  for (const Hash& key : keys) {
+    if (cache_.count(key) || prefetching_.count(key)) continue;
+    if (FindInWindow(key) != nullptr) continue;
+    if (prefetching_.size() >= kWindow) {
+      // drop those fetched but never loaded, e.g., by cursors gone
+      for (auto it = prefetching_.begin(); it != prefetching_.end();) {
+        if (it->second.cached != nullptr || IsReady(it->second.fetching))
+          it = prefetching_.erase(it);
+        else
+          ++it;
+      }
+      if (prefetching_.size() >= kWindow) return;
+    }
+    Prefetching pf;
+    pf.cached = shared->Get(key);
+    if (pf.cached == nullptr) {
+      pf.start = std::chrono::steady_clock::now();
+      pf.fetching = fetcher_(key);
+      if (IsReady(pf.fetching)) RecordFetch(pf.start);
+    }
+    prefetching_.emplace(key.Clone(), std::move(pf));
+  }
+}
+
+std::shared_ptr<const Chunk> ChunkLoader::Share(const Hash& key,
+                                                Chunk&& chunk) {
+  auto ptr = std::make_shared<const Chunk>(std::move(chunk));
+  // chunks viewing the local storage are cheap to get again
+  if (!ptr->own()) return ptr;
+  // compute the hash before sharing, as it is lazily computed
+  ptr->hash();
+  return ChunkCache::Instance()->Put(key, std::move(ptr));
+}
+
+void ChunkLoader::RecordFetch(std::chrono::steady_clock::time_point start) {
+  static constexpr double kWeight = 0.2;
+  double us = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - start).count();
+  double avg = fetch_latency_us_.load();
+  fetch_latency_us_.store(avg == 0 ? us : avg + kWeight * (us - avg));
+}
+
+LocalChunkLoader::LocalChunkLoader()
+  : ChunkLoader([](const Hash& key) {
+      return MakeReady(store::GetChunkStore()->Get(key));
+    }),
+    cs_(store::GetChunkStore()) {}
+
 Chunk LocalChunkLoader::GetChunk(const Hash& key) {
   return cs_->Get(key);
 }
 
-Chunk PartitionedChunkLoader::GetChunk(const Hash& key) {
-  int id = ptt_->GetDestId(key);
-  if (id == ptt_->id()) {
-    return cs_->Get(key);
-  } else {
+// Read the local replica of a chunk if it is enough, i.e., found or the only
+//   replica
+static bool ReadLocalReplica(const Partitioner* ptt, ChunkClient* client,
+                             const Hash& key, Chunk* chunk) {
+  auto replicas = ptt->GetDestIds(key, client->replicas());
+  if (std::find(replicas.begin(), replicas.end(), ptt->id())
+      == replicas.end()) return false;
+  *chunk = store::GetChunkStore()->Get(key);
+  // others may have the chunk, e.g., stored before replicas are added
+  return !chunk->empty() || replicas.size() == 1;
+}
+
+// Start fetching chunks through a client shared by loaders
+static std::function<std::future<Result<Chunk>>(const Hash&)>
+    PartitionedFetcher(const Partitioner* ptt, ChunkClient* client) {
+  if (client == nullptr) return nullptr;
+  return [ptt, client](const Hash& key) {
     Chunk c;
-    auto stat = client_->Get(key, &c);
-    CHECK(stat == ErrorCode::kOK) << "Failed to load remote chunk " << key;
-    return c;
-  }
-  LOG(FATAL) << "Failed to load chunk";
-  return Chunk();
+    if (ReadLocalReplica(ptt, client, key, &c)) return MakeReady(std::move(c));
+    return client->GetAsync(key);
+  };
+}
+
+PartitionedChunkLoader::PartitionedChunkLoader(const Partitioner* ptt,
+    ChunkClient* client, ChunkClient* prefetch_client)
+  : ChunkLoader(PartitionedFetcher(ptt, prefetch_client)),
+    ptt_(ptt), client_(client) {}
+
+Chunk PartitionedChunkLoader::GetChunk(const Hash& key) {
+  Chunk c;
+  if (ReadLocalReplica(ptt_, client_, key, &c)) return c;
+  auto stat = client_->Get(key, &c);
+  CHECK(stat == ErrorCode::kOK) << "Failed to load remote chunk " << key;
+  return c;
 }
 
 Chunk ClientChunkLoader::GetChunk(const Hash& key) {
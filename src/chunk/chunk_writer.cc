@@ -1,34 +1,94 @@
 // Copyright (c) 2017 The Ustore Authors.
 
 #include "chunk/chunk_writer.h"
+
+#include <algorithm>
+#include <deque>
+#include <future>
 #include "cluster/chunk_client.h"
 #include "cluster/partitioner.h"
+#include "utils/logging.h"
+#include "utils/utils.h"
 
 namespace ustore {
 
+// # of remote replicas to store a chunk before the write succeeds: none more
+// if it is stored locally, or a majority of them otherwise
+static inline size_t RemoteAcks(size_t replicas, bool local) {
+  return local ? 0 : replicas / 2 + 1;
+}
+
+bool ChunkWriter::MultiWrite(const std::vector<Hash>& keys,
+                             const std::vector<const Chunk*>& chunks) {
+  CHECK_EQ(keys.size(), chunks.size());
+  bool success = true;
+  for (size_t i = 0; i < keys.size(); ++i)
+    success = Write(keys[i], *chunks[i]) && success;
+  return success;
+}
+
 bool LocalChunkWriter::Write(const Hash& key, const Chunk& chunk) {
   return cs_->Put(key, chunk);
 }
 
+bool LocalChunkWriter::MultiWrite(const std::vector<Hash>& keys,
+                                  const std::vector<const Chunk*>& chunks) {
+  return cs_->MultiPut(keys, chunks);
+}
+
 bool PartitionedChunkWriter::Write(const Hash& key, const Chunk& chunk) {
-  int id = ptt_->GetDestId(key);
-  if (id == ptt_->id()) {
-    return cs_->Put(key, chunk);
-  } else {
-    // check if already exist
-    // TODO(wangsh): net overhead is high now, not worth checking existence
-    // bool exists;
-    // auto stat = client_->Exists(key, &exists);
-    // CHECK(stat == ErrorCode::kOK) << "Failed to check remote chunk";
-    // if (exists) return true;
-
-    // send chunk
-    auto stat = client_->Put(key, chunk);
-    CHECK(stat == ErrorCode::kOK) << "Failed to put remote chunk";
-    return true;
-  }
-  LOG(FATAL) << "Failed to write chunk";
+  auto replicas = ptt_->GetDestIds(key, client_->replicas());
+  bool local = std::find(replicas.begin(), replicas.end(), ptt_->id())
+               != replicas.end();
+  if (local && !cs_->Put(key, chunk)) return false;
+  if (replicas.size() == size_t(local)) return true;
+  // check if already exist
+  // TODO(wangsh): net overhead is high now, not worth checking existence
+  // bool exists;
+  // auto stat = client_->Exists(key, &exists);
+  // CHECK(stat == ErrorCode::kOK) << "Failed to check remote chunk";
+  // if (exists) return true;
+
+  // send chunk to the other replicas, those failed are logged to be repaired
+  auto stat = client_->Put(key, chunk, ptt_->id(),
+                           RemoteAcks(replicas.size(), local));
+  if (stat == ErrorCode::kOK) return true;
+  LOG(WARNING) << "Failed to put chunk " << key << " to enough replicas: "
+               << Utils::ToString(stat);
   return false;
 }
 
+bool PartitionedChunkWriter::MultiWrite(
+    const std::vector<Hash>& keys, const std::vector<const Chunk*>& chunks) {
+  CHECK_EQ(keys.size(), chunks.size());
+  std::vector<Hash> local_keys;
+  std::vector<const Chunk*> local_chunks;
+  std::deque<std::future<ErrorCode>> remote;
+  size_t remote_failed = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto replicas = ptt_->GetDestIds(keys[i], client_->replicas());
+    bool local = std::find(replicas.begin(), replicas.end(), ptt_->id())
+                 != replicas.end();
+    if (local) {
+      local_keys.push_back(keys[i]);
+      local_chunks.push_back(chunks[i]);
+    }
+    if (replicas.size() == size_t(local)) continue;
+    if (remote.size() == kMaxRemotePuts) {
+      if (remote.front().get() != ErrorCode::kOK) ++remote_failed;
+      remote.pop_front();
+    }
+    remote.push_back(client_->PutAsync(keys[i], *chunks[i], ptt_->id(),
+                                       RemoteAcks(replicas.size(), local)));
+  }
+  bool success = local_keys.empty() || cs_->MultiPut(local_keys, local_chunks);
+  for (auto& put : remote)
+    if (put.get() != ErrorCode::kOK) ++remote_failed;
+  if (remote_failed) {
+    LOG(WARNING) << "Failed to put " << remote_failed
+                 << " chunks to enough replicas";
+  }
+  return success && !remote_failed;
+}
+
 }  // namespace ustore
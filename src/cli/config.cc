@@ -157,7 +157,8 @@ bool Config::ParseCmdArgs(int argc, char* argv[]) {
 
     auto arg_msg_timeout = vm["msg-timeout"].as<int32_t>();
     GUARD(CheckArgGT(arg_msg_timeout, 0, "Message Timeout"));
-    ustore::ClientZmqNet::msg_timeout = static_cast<size_t>(arg_msg_timeout);
+    // in ticks of 10 ms
+    Env::Instance()->m_config().set_request_timeout_ms(arg_msg_timeout * 10);
   } catch (std::exception& e) {
     std::cerr << BOLD_RED("[ERROR] ") << e.what() << std::endl;
     return false;
@@ -225,7 +226,7 @@ bool Config::ParseCmdArgs(int argc, char* argv[], po::variables_map* vm) {
   ("blobstore-batch-size", po::value<int32_t>()->default_value(800),
    "batch size for csv loading in blobstore")
   ("msg-timeout", po::value<int32_t>()->default_value(3000),
-   "message timeout");
+   "message timeout, in ticks of 10 ms");
 
   po::positional_options_description pos_opts;
   pos_opts.add("command", 1);
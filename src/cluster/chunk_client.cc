@@ -1,11 +1,59 @@
 // Copyright (c) 2017 The Ustore Authors.
 
 #include "cluster/chunk_client.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <utility>
 #include "proto/messages.pb.h"
+#include "utils/env.h"
+#include "utils/latency_tracker.h"
 #include "utils/logging.h"
+#include "utils/utils.h"
 
 namespace ustore {
 
+namespace {
+
+// a put sent to several replicas, acknowledged once all of them respond, and
+// successful if enough of them store the chunk
+struct ReplicatedPut {
+  std::mutex mtx;
+  size_t pending;
+  size_t acks;  // # of stores needed
+  size_t stored = 0;
+  ErrorCode stat = ErrorCode::kOK;  // the first failure if any
+  std::promise<ErrorCode> promise;
+};
+
+// a read sent to several replicas, done once any of them returns the chunk
+struct HedgedRead {
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool done = false;
+  size_t failed = 0;
+  ErrorCode stat = ErrorCode::kOK;  // the last failure if any
+  Chunk chunk;
+};
+
+}  // namespace
+
+ChunkClient::ChunkClient(ResponseBlob* blob, const Partitioner* ptt,
+                         LatencyTracker* read_latency)
+  : Client(blob), ptt_(ptt),
+    replicas_(Env::Instance()->config().chunk_replicas()),
+    read_latency_(read_latency),
+    hedge_fallback_us_(std::max(
+        Env::Instance()->config().hedge_fallback_ms(), 0) * 1000) {
+  CHECK_GT(Env::Instance()->config().chunk_replicas(), 0)
+      << "Each chunk needs a replica at least";
+}
+
 void ChunkClient::CreateChunkMessage(const Hash& hash, UMessage *msg) const {
   // request
   auto request = msg->mutable_request_payload();
@@ -13,6 +61,7 @@ void ChunkClient::CreateChunkMessage(const Hash& hash, UMessage *msg) const {
 }
 
 ErrorCode ChunkClient::Get(const Hash& hash, Chunk* chunk) const {
+  if (replicas_ > 1) return HedgedGet(hash, ReadOrder(hash), chunk);
   UMessage msg;
   // header
   msg.set_type(UMessage::GET_CHUNK_REQUEST);
@@ -35,7 +84,13 @@ ErrorCode ChunkClient::Get(const Slice& key, const Hash& hash, Chunk* chunk)
   return GetChunkResponse(chunk);
 }
 
-ErrorCode ChunkClient::Put(const Hash& hash, const Chunk& chunk) {
+constexpr size_t ChunkClient::kAllReplicas;
+
+ErrorCode ChunkClient::Put(const Hash& hash, const Chunk& chunk, int skip,
+                           size_t acks) {
+  // send to all replicas at once
+  if (replicas_ > 1) return PutAsync(hash, chunk, skip, acks).get();
+  if (ptt_->GetDestId(hash) == skip) return ErrorCode::kOK;
   UMessage msg;
   // header
   msg.set_type(UMessage::PUT_CHUNK_REQUEST);
@@ -59,4 +114,136 @@ ErrorCode ChunkClient::Exists(const Hash& hash, bool* exist) const {
   return GetBoolResponse(exist);
 }
 
+std::future<Result<Chunk>> ChunkClient::GetAsync(const Hash& hash) const {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::GET_CHUNK_REQUEST);
+  // request
+  CreateChunkMessage(hash, &msg);
+  // send
+  return Call(&msg, ptt_->id2addr(ReadOrder(hash).front()),
+              &ParseChunkResponse);
+}
+
+std::future<ErrorCode> ChunkClient::PutAsync(const Hash& hash,
+    const Chunk& chunk, int skip, size_t acks) {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::PUT_CHUNK_REQUEST);
+  // request
+  CreateChunkMessage(hash, &msg);
+  auto payload = msg.mutable_value_payload();
+  payload->set_base(chunk.head(), chunk.numBytes());
+  std::vector<int> dests;
+  for (int id : ptt_->GetDestIds(hash, replicas_))
+    if (id != skip) dests.push_back(id);
+  // send
+  acks = std::min(acks, dests.size());
+  if (dests.size() == 1 && acks == 1)
+    return Call(&msg, ptt_->id2addr(dests[0]));
+  auto put = std::make_shared<ReplicatedPut>();
+  put->pending = dests.size();
+  put->acks = acks;
+  auto future = put->promise.get_future();
+  if (dests.empty()) put->promise.set_value(ErrorCode::kOK);
+  // the hash may be gone by the time of the responses
+  const std::string name = hash.ToBase32();
+  for (int id : dests) {
+    const node_id_t& dest = ptt_->id2addr(id);
+    SendAsync(&msg, dest, [put, name, dest](UMessage* response) {
+      ErrorCode stat = ParseEmptyResponse(response);
+      if (stat != ErrorCode::kOK) {
+        LOG(WARNING) << "Replica of chunk " << name << " at " << dest
+                     << " needs repair: " << Utils::ToString(stat);
+      }
+      std::lock_guard<std::mutex> lock(put->mtx);
+      if (stat == ErrorCode::kOK)
+        ++put->stored;
+      else if (put->stat == ErrorCode::kOK)
+        put->stat = stat;
+      if (--put->pending) return;
+      put->promise.set_value(put->stored >= put->acks ? ErrorCode::kOK
+                                                     : put->stat);
+    });
+  }
+  return future;
+}
+
+std::future<Result<bool>> ChunkClient::ExistsAsync(const Hash& hash) const {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::EXISTS_CHUNK_REQUEST);
+  // request
+  CreateChunkMessage(hash, &msg);
+  // send
+  return Call(&msg, ptt_->GetDestAddr(hash), &ParseBoolResponse);
+}
+
+std::vector<int> ChunkClient::ReadOrder(const Hash& hash) const {
+  // start from a random replica, so that reads of a hot chunk are spread
+  static thread_local std::minstd_rand rand(std::random_device{}());
+  std::vector<int> replicas = ptt_->GetDestIds(hash, replicas_);
+  std::rotate(replicas.begin(), replicas.begin() + rand() % replicas.size(),
+              replicas.end());
+  return replicas;
+}
+
+ErrorCode ChunkClient::HedgedGet(const Hash& hash,
+    const std::vector<int>& replicas, Chunk* chunk) const {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::GET_CHUNK_REQUEST);
+  // request
+  CreateChunkMessage(hash, &msg);
+  auto read = std::make_shared<HedgedRead>();
+  LatencyTracker* tracker = read_latency_;
+  auto send = [this, &msg, &read, tracker](int id) {
+    auto start = std::chrono::steady_clock::now();
+    SendAsync(&msg, ptt_->id2addr(id), [read, tracker, start](UMessage* res) {
+      Chunk c;
+      ErrorCode stat = ParseChunkResponse(res, &c);
+      // late responses count too, or slow replicas would never show
+      if (stat == ErrorCode::kOK && tracker != nullptr) {
+        tracker->Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+      }
+      std::lock_guard<std::mutex> lock(read->mtx);
+      if (read->done) return;
+      if (stat == ErrorCode::kOK) {
+        read->done = true;
+        read->chunk = std::move(c);
+      } else {
+        ++read->failed;
+        read->stat = stat;
+      }
+      read->cv.notify_all();
+    });
+  };
+  // fail over after a fixed delay until enough reads are seen
+  size_t hedge_us = tracker ? tracker->percentileUs() : 0;
+  if (!hedge_us) hedge_us = hedge_fallback_us_;
+  size_t sent = 0;
+  send(replicas[sent++]);
+  std::unique_lock<std::mutex> lock(read->mtx);
+  auto settled = [&read, &sent]() {
+    return read->done || read->failed == sent;
+  };
+  while (!read->done && sent < replicas.size()) {
+    // go on to the next replica once the outstanding ones are slow or failed
+    if (hedge_us)
+      read->cv.wait_for(lock, std::chrono::microseconds(hedge_us), settled);
+    else
+      read->cv.wait(lock, settled);
+    if (read->done) break;
+    lock.unlock();
+    send(replicas[sent++]);
+    lock.lock();
+  }
+  // bounded as every request is answered, expired or failed with its connection
+  read->cv.wait(lock, settled);
+  if (!read->done) return read->stat;
+  *chunk = std::move(read->chunk);
+  return ErrorCode::kOK;
+}
+
 }  // namespace ustore
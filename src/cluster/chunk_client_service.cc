@@ -21,7 +21,12 @@ void ChunkClientService::Init() {
 ChunkClient ChunkClientService::CreateChunkClient() {
   // adding a new response blob
   ResponseBlob* resblob = CreateResponseBlob();
-  return ChunkClient(resblob, &ptt_);
+  return ChunkClient(resblob, &ptt_, read_latency_.get());
+}
+
+LatencyTracker* ChunkClientService::NewReadLatency() {
+  int percentile = Env::Instance()->config().hedge_percentile();
+  return percentile > 0 ? new LatencyTracker(percentile) : nullptr;
 }
 
 }  // namespace ustore
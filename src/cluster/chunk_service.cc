@@ -29,6 +29,7 @@ void ChunkService::HandleRequest(const void *msg, int size,
   UMessage response;
   response.set_type(UMessage::RESPONSE);
   response.set_source(umsg.source());
+  if (umsg.has_request_id()) response.set_request_id(umsg.request_id());
   // execute request
   switch (umsg.type()) {
     case UMessage::PUT_CHUNK_REQUEST:
@@ -45,17 +46,13 @@ void ChunkService::HandleRequest(const void *msg, int size,
       break;
   }
   // send response back
-  byte_t *serialized = new byte_t[response.ByteSize()];
-  response.SerializeToArray(serialized, response.ByteSize());
-  Send(source, serialized, response.ByteSize());
-  // clean up
-  delete[] serialized;
+  Send(source, MessageParser::Serialize(response));
 }
 
 void ChunkService::HandlePutChunkRequest(const UMessage& umsg,
                                          ResponsePayload* response) {
-  auto request = umsg.request_payload();
-  auto value = umsg.value_payload().base();
+  const auto& request = umsg.request_payload();
+  const auto& value = umsg.value_payload().base();
   Hash hash(request.version());
   Chunk c(reinterpret_cast<const byte_t*>(value.data()));
   if (store_->Put(hash, c))
@@ -66,8 +63,9 @@ void ChunkService::HandlePutChunkRequest(const UMessage& umsg,
 
 void ChunkService::HandleGetChunkRequest(const UMessage& umsg,
                                          ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   Hash hash(request.version());
+  ReadGuard guard(store_);
   Chunk c = store_->Get(hash);
   if (c.empty()) {
     response->set_stat(static_cast<int>(ErrorCode::kChunkNotExists));
@@ -79,7 +77,7 @@ void ChunkService::HandleGetChunkRequest(const UMessage& umsg,
 
 void ChunkService::HandleExistChunkRequest(const UMessage& umsg,
                                            ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   Hash hash(request.version());
   response->set_stat(static_cast<int>(ErrorCode::kOK));
   response->set_bvalue(store_->Exists(hash));
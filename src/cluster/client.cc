@@ -1,7 +1,11 @@
 // Copyright (c) 2017 The Ustore Authors.
 
 #include "cluster/client.h"
+
+#include <chrono>
+#include "utils/env.h"
 #include "utils/logging.h"
+#include "utils/message_parser.h"
 
 namespace ustore {
 
@@ -19,30 +23,74 @@ std::unique_ptr<UMessage> Client::WaitForResponse() const {
 }
 
 bool Client::Send(UMessage* msg, const node_id_t& node_id) const {
-  // set source id
+  {
+    // cleared before sending, as the response may come at once
+    std::lock_guard<std::mutex> lck(res_blob_->lock);
+    res_blob_->has_msg = false;
+  }
+  // tracked as an asynchronous request, so that it is failed the same way once
+  // expired or lost along with its connection
+  ResponseBlob* blob = res_blob_;
+  return SendAsync(msg, node_id, [blob](UMessage* response) {
+    UMessage* message = new UMessage();
+    message->Swap(response);
+    std::lock_guard<std::mutex> lck(blob->lock);
+    blob->message = message;
+    blob->has_msg = true;
+    blob->condition.notify_all();
+  });
+}
+
+bool Client::SendAsync(UMessage* msg, const node_id_t& node_id,
+                       std::function<void(UMessage*)> handler) const {
   msg->set_source(id_);
-  // serialize and send
-  int msg_size = msg->ByteSize();
-  byte_t *serialized = new byte_t[msg_size];
-  msg->SerializeToArray(serialized, msg_size);
-  std::unique_lock<std::mutex> lck(res_blob_->lock);
+  const int timeout_ms = Env::Instance()->config().request_timeout_ms();
+  auto deadline = timeout_ms > 0
+      ? std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms)
+      : std::chrono::steady_clock::time_point::max();
+  uint64_t request_id;
+  {
+    // register the handler before sending, as the response may come at once
+    std::lock_guard<std::mutex> lck(res_blob_->lock);
+    request_id = res_blob_->next_request_id++;
+    res_blob_->handlers.emplace(request_id, ResponseBlob::Pending{
+        std::move(handler), node_id, deadline});
+  }
+  msg->set_request_id(request_id);
   CHECK(net_->GetNetContext(node_id));
-  net_->GetNetContext(node_id)->Send(serialized, msg_size);
-  res_blob_->has_msg = false;
-  delete[] serialized;
-  return true;
+  if (net_->GetNetContext(node_id)->Send(MessageParser::Serialize(*msg)) >= 0)
+    return true;
+  // fail the request, unless it is failed along with the connection already
+  std::unique_lock<std::mutex> lck(res_blob_->lock);
+  auto it = res_blob_->handlers.find(request_id);
+  if (it == res_blob_->handlers.end()) return false;
+  handler = std::move(it->second.handler);
+  res_blob_->handlers.erase(it);
+  lck.unlock();
+  UMessage response;
+  response.mutable_response_payload()->set_stat(
+      static_cast<int>(ErrorCode::kConnectionLost));
+  handler(&response);
+  return false;
 }
 
-ErrorCode Client::GetEmptyResponse() const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+std::future<ErrorCode> Client::Call(UMessage* msg,
+                                    const node_id_t& node_id) const {
+  auto promise = std::make_shared<std::promise<ErrorCode>>();
+  SendAsync(msg, node_id, [promise](UMessage* response) {
+    promise->set_value(ParseEmptyResponse(response));
+  });
+  return promise->get_future();
+}
+
+ErrorCode Client::ParseEmptyResponse(UMessage* msg) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   return err;
 }
 
-ErrorCode Client::GetVersionResponse(Hash* version) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseVersionResponse(UMessage* msg, Hash* version) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
     *version = Hash(response.value()).Clone();
@@ -50,36 +98,33 @@ ErrorCode Client::GetVersionResponse(Hash* version) const {
   return err;
 }
 
-ErrorCode Client::GetUCellResponse(UCell* meta) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseUCellResponse(UMessage* msg, UCell* meta) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
-    // make a copy of the Slice object
-    std::unique_ptr<byte_t[]> buf(new byte_t[response.value().length()]);
-    std::memcpy(buf.get(), response.value().data(), response.value().length());
-    Chunk c(std::move(buf));
-    *meta = UCell(std::move(c));
+    // take over the received bytes rather than copying them
+    std::unique_ptr<std::string> bytes(
+        msg->mutable_response_payload()->release_value());
+    *meta = UCell(Chunk(std::move(bytes)));
   }
   return err;
 }
 
-ErrorCode Client::GetChunkResponse(Chunk* chunk) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseChunkResponse(UMessage* msg, Chunk* chunk) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
-    // make a copy of the Slice object
-    std::unique_ptr<byte_t[]> buf(new byte_t[response.value().length()]);
-    std::memcpy(buf.get(), response.value().data(), response.value().length());
-    *chunk = Chunk(std::move(buf));
+    // take over the received bytes rather than copying them
+    std::unique_ptr<std::string> bytes(
+        msg->mutable_response_payload()->release_value());
+    *chunk = Chunk(std::move(bytes));
   }
   return err;
 }
 
-ErrorCode Client::GetStringListResponse(vector<string>* vals) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseStringListResponse(UMessage* msg,
+                                          vector<string>* vals) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
     size_t size = response.lvalue_size();
@@ -89,9 +134,9 @@ ErrorCode Client::GetStringListResponse(vector<string>* vals) const {
   return err;
 }
 
-ErrorCode Client::GetVersionListResponse(vector<Hash>* versions) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseVersionListResponse(UMessage* msg,
+                                           vector<Hash>* versions) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
     size_t size = response.lvalue_size();
@@ -101,9 +146,8 @@ ErrorCode Client::GetVersionListResponse(vector<Hash>* versions) const {
   return err;
 }
 
-ErrorCode Client::GetBoolResponse(bool *value) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseBoolResponse(UMessage* msg, bool *value) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
     *value = response.bvalue();
@@ -111,12 +155,21 @@ ErrorCode Client::GetBoolResponse(bool *value) const {
   return err;
 }
 
-ErrorCode Client::GetInfoResponse(std::vector<StoreInfo>* stores) const {
-  auto msg = WaitForResponse();
-  auto response = msg->response_payload();
+ErrorCode Client::ParseSizeResponse(UMessage* msg, size_t* value) {
+  const auto& response = msg->response_payload();
+  ErrorCode err = static_cast<ErrorCode>(response.stat());
+  if (err == ErrorCode::kOK) {
+    *value = response.ivalue();
+  }
+  return err;
+}
+
+ErrorCode Client::ParseInfoResponse(UMessage* msg,
+                                    std::vector<StoreInfo>* stores) {
+  const auto& response = msg->response_payload();
   ErrorCode err = static_cast<ErrorCode>(response.stat());
   if (err == ErrorCode::kOK) {
-    auto info = msg->info_payload();
+    const auto& info = msg->info_payload();
     StoreInfo v;
     v.chunks = info.chunks();
     v.chunkBytes = info.chunk_bytes();
@@ -140,4 +193,36 @@ ErrorCode Client::GetInfoResponse(std::vector<StoreInfo>* stores) const {
   return err;
 }
 
+ErrorCode Client::GetEmptyResponse() const {
+  return ParseEmptyResponse(WaitForResponse().get());
+}
+
+ErrorCode Client::GetVersionResponse(Hash* version) const {
+  return ParseVersionResponse(WaitForResponse().get(), version);
+}
+
+ErrorCode Client::GetUCellResponse(UCell* meta) const {
+  return ParseUCellResponse(WaitForResponse().get(), meta);
+}
+
+ErrorCode Client::GetChunkResponse(Chunk* chunk) const {
+  return ParseChunkResponse(WaitForResponse().get(), chunk);
+}
+
+ErrorCode Client::GetStringListResponse(vector<string>* vals) const {
+  return ParseStringListResponse(WaitForResponse().get(), vals);
+}
+
+ErrorCode Client::GetVersionListResponse(vector<Hash>* versions) const {
+  return ParseVersionListResponse(WaitForResponse().get(), versions);
+}
+
+ErrorCode Client::GetBoolResponse(bool *value) const {
+  return ParseBoolResponse(WaitForResponse().get(), value);
+}
+
+ErrorCode Client::GetInfoResponse(std::vector<StoreInfo>* stores) const {
+  return ParseInfoResponse(WaitForResponse().get(), stores);
+}
+
 }  // namespace ustore
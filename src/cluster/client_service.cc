@@ -2,9 +2,13 @@
 
 #include "cluster/client_service.h"
 
+#include <algorithm>
+#include <chrono>
+#include <utility>
 #include "utils/env.h"
 #include "utils/logging.h"
 #include "utils/message_parser.h"
+#include "utils/utils.h"
 
 namespace ustore {
 
@@ -14,23 +18,95 @@ void ClientService::Init(std::unique_ptr<CallBack> callback) {
   // NOTE(wangsh):
   // client service need to init context before connect to host service
   net_->CreateNetContexts(ptt_->destAddrs());
+  net_->RegisterClose([this](const node_id_t& dest) {
+    FailRequests([&dest](const ResponseBlob::Pending& request) {
+      return request.dest == dest;
+    }, ErrorCode::kConnectionLost);
+  });
+  if (Env::Instance()->config().request_timeout_ms() > 0)
+    expire_thread_ = std::thread(&ClientService::ExpireRequests, this);
+}
+
+ClientService::~ClientService() {
+  if (!expire_thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(expire_mtx_);
+    stop_expire_ = true;
+  }
+  expire_cv_.notify_one();
+  expire_thread_.join();
+}
+
+void ClientService::ExpireRequests() {
+  // check a few times within a timeout, and at least once a second
+  const auto interval = std::chrono::milliseconds(std::min(
+      Env::Instance()->config().request_timeout_ms() / 4 + 1, 1000));
+  std::unique_lock<std::mutex> lock(expire_mtx_);
+  while (!expire_cv_.wait_for(lock, interval, [this] { return stop_expire_; })) {
+    lock.unlock();
+    auto now = std::chrono::steady_clock::now();
+    FailRequests([now](const ResponseBlob::Pending& request) {
+      return request.deadline <= now;
+    }, ErrorCode::kRequestTimeout);
+    lock.lock();
+  }
+}
+
+void ClientService::FailRequests(
+    const std::function<bool(const ResponseBlob::Pending&)>& match,
+    ErrorCode stat) {
+  std::vector<ResponseBlob::Pending> failed;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(lock_);
+    for (auto& res_blob : responses_) {
+      std::lock_guard<std::mutex> lck(res_blob->lock);
+      for (auto it = res_blob->handlers.begin();
+           it != res_blob->handlers.end();) {
+        if (match(it->second)) {
+          LOG(WARNING) << "Fail request " << it->first << " to "
+                       << it->second.dest << ": " << Utils::ToString(stat);
+          failed.push_back(std::move(it->second));
+          it = res_blob->handlers.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+  // handlers run out of the locks, as for responses, and each may take over
+  // its response
+  for (auto& request : failed) {
+    UMessage response;
+    response.mutable_response_payload()->set_stat(static_cast<int>(stat));
+    request.handler(&response);
+  }
 }
 
 void ClientService::HandleResponse(const void *msg, int size,
                                    const node_id_t& source) {
   // parse the request
-  UMessage *ustore_msg = new UMessage();
-  MessageParser::Parse(msg, size, ustore_msg);
+  UMessage response;
+  MessageParser::Parse(msg, size, &response);
   ResponseBlob* res_blob;
   {
     boost::shared_lock<boost::shared_mutex> lock(lock_);
-    res_blob = responses_[ustore_msg->source()].get();
+    res_blob = responses_[response.source()].get();
   }
 
   std::unique_lock<std::mutex> lck(res_blob->lock);
-  res_blob->message = ustore_msg;
-  res_blob->has_msg = true;
-  res_blob->condition.notify_all();
+  // the request may be failed already, e.g., once expired
+  auto it = res_blob->handlers.find(response.request_id());
+  if (it == res_blob->handlers.end()) {
+    LOG(WARNING) << "Drop response of unknown request "
+                 << response.request_id();
+    return;
+  }
+  // complete the request out of the lock, so that its handler may issue more
+  // requests
+  auto handler = std::move(it->second.handler);
+  res_blob->handlers.erase(it);
+  lck.unlock();
+  handler(&response);
 }
 
 ResponseBlob* ClientService::CreateResponseBlob() {
@@ -6,18 +6,53 @@
 
 namespace ustore {
 
+std::vector<std::string> Partitioner::LoadHosts(const std::string& hostfile) {
+  std::vector<std::string> hosts;
+  std::ifstream fin(hostfile);
+  std::string dest_addr;
+  while (fin >> dest_addr) hosts.push_back(dest_addr);
+  fin.close();
+  return hosts;
+}
+
 Partitioner::Partitioner(const std::string& hostfile,
+                         const std::string& self_addr,
+                         std::function<std::string(std::string)> f_port)
+  : Partitioner(LoadHosts(hostfile), self_addr, f_port) {}
+
+Partitioner::Partitioner(const std::vector<std::string>& hosts,
                          const std::string& self_addr,
                          std::function<std::string(std::string)> f_port) {
-  // load worker file
-  std::ifstream fin(hostfile);
-  std::string dest_addr;
-  for (int id = 0; fin >> dest_addr; ++id) {
-    if (dest_addr == self_addr) id_ = id;
-    dest_list_.push_back(f_port(dest_addr));
+  const int vnodes = Env::Instance()->config().partition_vnodes();
+  CHECK_GT(vnodes, 0) << "Each destination needs a virtual node at least";
+  for (size_t id = 0; id < hosts.size(); ++id) {
+    if (hosts[id] == self_addr) id_ = id;
+    dest_list_.push_back(f_port(hosts[id]));
+    // place by the listed address, so that the ring is the same whatever the
+    // service port and the order of hosts
+    for (int i = 0; i < vnodes; ++i) {
+      Hash point = Hash::ComputeFrom(hosts[id] + "#" + std::to_string(i));
+      ring_.emplace_back(Point(point), id);
+    }
   }
-  fin.close();
   CHECK(dest_list_.size()) << "IP:PORT list cannot be empty";
+  std::sort(ring_.begin(), ring_.end());
+}
+
+std::vector<int> Partitioner::GetDestIds(const Hash& hash, size_t n) const {
+  std::vector<int> ids{GetDestId(hash)};
+  n = std::min(n, dest_list_.size());
+  if (ids.size() >= n) return ids;
+  // walk clockwise from the owner, skipping virtual nodes of chosen ones
+  auto it = std::lower_bound(ring_.begin(), ring_.end(),
+                             std::make_pair(Point(hash), 0));
+  while (ids.size() < n) {
+    if (it == ring_.end()) it = ring_.begin();
+    if (std::find(ids.begin(), ids.end(), it->second) == ids.end())
+      ids.push_back(it->second);
+    ++it;
+  }
+  return ids;
 }
 
 }  // namespace ustore
@@ -425,6 +425,142 @@ ErrorCode WorkerClient::GetChunk(const Slice& route_key, const Hash& version,
   }
 }
 
+std::future<Result<UCell>> WorkerClient::GetAsync(const Slice& key,
+    const Slice& branch) const {
+  UMessage msg;
+  CreateGetMessage(key, &msg);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_branch(branch.data(), branch.len());
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key), &ParseUCellResponse);
+}
+
+std::future<Result<UCell>> WorkerClient::GetAsync(const Slice& key,
+    const Hash& version) const {
+  UMessage msg;
+  CreateGetMessage(key, &msg);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_version(version.value(), Hash::kByteLength);
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key), &ParseUCellResponse);
+}
+
+std::future<Result<Hash>> WorkerClient::PutAsync(const Slice& key,
+    const Value& value, const Slice& branch) {
+  UMessage msg;
+  CreatePutMessage(key, value, &msg);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_branch(branch.data(), branch.len());
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key), &ParseVersionResponse);
+}
+
+std::future<Result<Hash>> WorkerClient::PutAsync(const Slice& key,
+    const Value& value, const Hash& pre_version) {
+  UMessage msg;
+  CreatePutMessage(key, value, &msg);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_version(pre_version.value(), Hash::kByteLength);
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key), &ParseVersionResponse);
+}
+
+std::future<Result<bool>> WorkerClient::ExistsAsync(const Slice& key,
+    const Slice& branch) const {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::EXISTS_REQUEST);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_key(key.data(), key.len());
+  request->set_branch(branch.data(), branch.len());
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key), &ParseBoolResponse);
+}
+
+std::future<Result<Hash>> WorkerClient::GetBranchHeadAsync(const Slice& key,
+    const Slice& branch) const {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::GET_BRANCH_HEAD_REQUEST);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_key(key.data(), key.len());
+  request->set_branch(branch.data(), branch.len());
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key), &ParseVersionResponse);
+}
+
+std::future<ErrorCode> WorkerClient::DeleteAsync(const Slice& key,
+                                                 const Slice& branch) {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::DELETE_REQUEST);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_key(key.data(), key.len());
+  request->set_branch(branch.data(), branch.len());
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key));
+}
+
+ErrorCode WorkerClient::Migrate(const std::vector<std::string>& hosts) {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::MIGRATE_REQUEST);
+  // request
+  auto payload = msg.mutable_migrate_payload();
+  for (const auto& host : hosts) payload->add_hosts(host);
+  // all workers migrate at the same time
+  std::vector<std::future<ErrorCode>> rets;
+  for (const auto& dest : ptt_->destAddrs()) rets.push_back(Call(&msg, dest));
+  ErrorCode err = ErrorCode::kOK;
+  for (auto& ret : rets) {
+    ErrorCode code = ret.get();
+    if (code != ErrorCode::kOK) err = code;
+  }
+  return err;
+}
+
+std::future<ErrorCode> WorkerClient::PutChunkAsync(const Slice& route_key,
+    const Hash& version, const Chunk& chunk) {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::PUT_CHUNK_REQUEST);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_key(route_key.data(), route_key.len());
+  request->set_version(version.value(), Hash::kByteLength);
+  auto payload = msg.mutable_value_payload();
+  payload->set_base(chunk.head(), chunk.numBytes());
+  // send
+  return Call(&msg, ptt_->GetDestAddr(route_key));
+}
+
+std::future<ErrorCode> WorkerClient::PutHeadAsync(const Slice& key,
+    const std::vector<std::string>& branches, const std::vector<Hash>& heads,
+    const std::vector<Hash>& latest) {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::PUT_HEAD_REQUEST);
+  // request
+  auto request = msg.mutable_request_payload();
+  request->set_key(key.data(), key.len());
+  auto payload = msg.mutable_head_payload();
+  for (size_t i = 0; i < branches.size(); ++i) {
+    payload->add_branches(branches[i]);
+    payload->add_heads(heads[i].value(), Hash::kByteLength);
+  }
+  for (const auto& ver : latest)
+    payload->add_latest(ver.value(), Hash::kByteLength);
+  // send
+  return Call(&msg, ptt_->GetDestAddr(key));
+}
+
 ErrorCode WorkerClient::GetStorageInfo(std::vector<StoreInfo>* info) const {
   UMessage msg;
   // header
@@ -438,4 +574,24 @@ ErrorCode WorkerClient::GetStorageInfo(std::vector<StoreInfo>* info) const {
   return ErrorCode::kOK;
 }
 
+ErrorCode WorkerClient::GC(size_t* reclaimed) {
+  UMessage msg;
+  // header
+  msg.set_type(UMessage::GC_REQUEST);
+  // all workers collect at the same time
+  std::vector<std::future<Result<size_t>>> rets;
+  for (const auto& dest : ptt_->destAddrs())
+    rets.push_back(Call(&msg, dest, &ParseSizeResponse));
+  ErrorCode err = ErrorCode::kOK;
+  *reclaimed = 0;
+  for (auto& ret : rets) {
+    Result<size_t> result = ret.get();
+    if (result.stat == ErrorCode::kOK)
+      *reclaimed += result.value;
+    else
+      err = result.stat;
+  }
+  return err;
+}
+
 }  // namespace ustore
@@ -4,11 +4,26 @@
 
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "chunk/chunk_cache.h"
+#include "cluster/worker_client_service.h"
 #include "hash/hash.h"
 #include "net/net.h"
 #include "spec/slice.h"
 #include "utils/message_parser.h"
 #include "utils/logging.h"
+#include "utils/utils.h"
 
 namespace ustore {
 
@@ -21,6 +36,159 @@ class WorkerServiceCallBack : public CallBack {
   }
 };
 
+std::ostream& operator<<(std::ostream& os, const WorkerService::Stats& obj) {
+  size_t requests = obj.requests > 0 ? obj.requests : 1;
+  os << "[WorkerService] requests: " << obj.requests << ", queued: "
+     << obj.queued << ", max queued: " << obj.max_queued
+     << ", avg wait (us): " << obj.wait_us / requests
+     << ", avg service (us): " << obj.service_us / requests;
+  return os;
+}
+
+/**
+ * A service thread executing the requests in its queue one by one.
+ */
+class WorkerService::Executor {
+ public:
+  struct Task {
+    std::unique_ptr<UMessage> request;
+    node_id_t source;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  explicit Executor(WorkerService* service)
+    : service_(service), thread_(&Executor::Run, this) {}
+  ~Executor() { Stop(); }
+
+  // return # of tasks in the queue including the new one, or 0 if stopped
+  size_t Add(Task&& task) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stop_) return 0;
+    queue_.push_back(std::move(task));
+    cv_.notify_one();
+    return queue_.size();
+  }
+
+  // drop the queued tasks, and wait for the running one to finish
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (stop_) return;
+      stop_ = true;
+      if (!queue_.empty())
+        LOG(WARNING) << "Drop " << queue_.size() << " queued requests";
+      queue_.clear();
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  size_t numQueued() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return queue_.size();
+  }
+
+ private:
+  void Run() {
+    for (;;) {
+      Task task;
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+        task = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      auto waited = std::chrono::steady_clock::now() - task.arrival;
+      service_->wait_us_.fetch_add(
+          std::chrono::duration_cast<std::chrono::microseconds>(waited)
+              .count(), std::memory_order_relaxed);
+      service_->Execute(*task.request, task.source);
+    }
+  }
+
+  WorkerService* const service_;
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<Task> queue_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+WorkerService::WorkerService(const node_id_t& addr, bool persist)
+  : HostService(PortHelper::WorkerPort(addr)),
+    ptt_(Env::Instance()->config().worker_file(), addr),
+    worker_(ptt_.id(),
+            Env::Instance()->config().enable_dist_store() ? &ptt_ : nullptr,
+            persist),
+    access_(Env::Instance()->config().access_log_dir(), addr),
+    next_executor_(0), requests_(0), max_queued_(0), wait_us_(0),
+    service_us_(0), persist_(persist) {
+  auto& config = Env::Instance()->config();
+  // keys handed off before stay so, and the heads of those recovered from
+  // the store are dropped again
+  if (persist_ && boost::filesystem::exists(HandoffPath())) {
+    owner_ptt_.reset(new WorkerPartitioner(HandoffPath(), ""));
+    RemoveMovedKeys();
+  }
+  // only need chunk service when other worker or client need it
+  if (config.enable_dist_store() || config.get_chunk_bypass_worker())
+    ck_svc_.reset(new ChunkService(addr));
+  StartServiceThreads(config.service_threads());
+  // chunks of the distributed store are not collected
+  if (!config.enable_dist_store())
+    gc_thread_ = std::thread(&WorkerService::GCLoop, this);
+}
+
+WorkerService::~WorkerService() {
+  // let the migration complete, which replies through the network
+  std::thread migrate_thread;
+  {
+    std::lock_guard<std::mutex> lock(migrate_mtx_);
+    migrate_thread.swap(migrate_thread_);
+  }
+  if (migrate_thread.joinable()) migrate_thread.join();
+  if (gc_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(gc_mtx_);
+      stop_gc_ = true;
+    }
+    gc_cv_.notify_one();
+    gc_thread_.join();
+  }
+  // no more requests once the network stops
+  Stop();
+  StopServiceThreads();
+  LOG(INFO) << ChunkCache::Instance()->GetStats();
+}
+
+void WorkerService::StartServiceThreads(int n) {
+  if (n > 0 && Env::Instance()->config().enable_dist_store()) {
+    // remote chunks are written through a chunk client shared by the worker
+    LOG(WARNING) << "Service threads are not supported with distributed "
+                 << "store, requests are executed on receiving threads";
+    n = 0;
+  }
+  for (int i = 0; i < n; ++i) executors_.emplace_back(new Executor(this));
+}
+
+void WorkerService::StopServiceThreads() {
+  if (executors_.empty()) return;
+  for (auto& executor : executors_) executor->Stop();
+  LOG(INFO) << GetStats();
+}
+
+WorkerService::Stats WorkerService::GetStats() const {
+  Stats stats;
+  stats.requests = requests_.load();
+  stats.queued = 0;
+  for (const auto& executor : executors_) stats.queued += executor->numQueued();
+  stats.max_queued = max_queued_.load();
+  stats.wait_us = wait_us_.load();
+  stats.service_us = service_us_.load();
+  return stats;
+}
+
 void WorkerService::Init() {
   CallBack* callback = new WorkerServiceCallBack(this);
   HostService::Init(std::unique_ptr<CallBack>(callback));
@@ -31,69 +199,172 @@ void WorkerService::Init() {
 void WorkerService::HandleRequest(const void *msg, int size,
                                   const node_id_t &source) {
   // parse the request
-  UMessage umsg;
-  MessageParser::Parse(msg, size, &umsg);
+  std::unique_ptr<UMessage> umsg(new UMessage());
+  MessageParser::Parse(msg, size, umsg.get());
+  switch (umsg->type()) {
+    case UMessage::MIGRATE_REQUEST:
+      HandleMigrateRequest(*umsg, source);
+      return;
+    case UMessage::GC_REQUEST:
+      HandleGCRequest(*umsg, source);
+      return;
+    case UMessage::PUT_CHUNK_REQUEST:
+    case UMessage::PUT_HEAD_REQUEST:
+      // keys moved in by other workers are not served here yet, so need not
+      // be ordered with requests of clients
+      Execute(*umsg, source);
+      return;
+    default:
+      break;
+  }
+  if (executors_.empty()) {
+    std::lock_guard<std::mutex> lock(lock_);
+    Execute(*umsg, source);
+    return;
+  }
+  // requests of the same key are queued to the same service thread
+  const auto& request = umsg->request_payload();
+  size_t idx = request.has_key()
+    ? std::hash<std::string>()(request.key())
+    : next_executor_.fetch_add(1, std::memory_order_relaxed);
+  Executor::Task task{std::move(umsg), source,
+                      std::chrono::steady_clock::now()};
+  size_t queued = executors_[idx % executors_.size()]->Add(std::move(task));
+  if (queued == 0) {
+    LOG(WARNING) << "Drop request as service threads are stopped";
+    return;
+  }
+  size_t max_queued = max_queued_.load(std::memory_order_relaxed);
+  while (queued > max_queued &&
+         !max_queued_.compare_exchange_weak(max_queued, queued,
+                                            std::memory_order_relaxed)) {}
+}
+
+void WorkerService::Execute(const UMessage& umsg, const node_id_t& source,
+                            bool resumed) {
+  auto start = std::chrono::steady_clock::now();
   // init response
   UMessage response;
   response.set_type(UMessage::RESPONSE);
   response.set_source(umsg.source());
+  if (umsg.has_request_id()) response.set_request_id(umsg.request_id());
   // execute request
+  switch (umsg.type()) {
+    case UMessage::PUT_CHUNK_REQUEST:
+      HandlePutChunkRequest(umsg, response.mutable_response_payload());
+      break;
+    case UMessage::PUT_HEAD_REQUEST:
+      HandlePutHeadRequest(umsg, response.mutable_response_payload());
+      break;
+    default:
+      if (!ExecuteRequest(umsg, source, resumed, &response)) return;
+      break;
+  }
+  // send response back
+  Send(source, MessageParser::Serialize(response));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  requests_.fetch_add(1, std::memory_order_relaxed);
+  service_us_.fetch_add(
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+}
+
+bool WorkerService::ExecuteRequest(const UMessage& umsg,
+                                   const node_id_t& source, bool resumed,
+                                   UMessage* res) {
+  static const auto chunk_store = store::GetChunkStore();
+  const auto& request = umsg.request_payload();
+  shared_lock<shared_mutex> lock(handoff_mtx_);
+  // queued aside while the key is handed off, or behind the requests of the
+  // key queued before, instead of holding up the thread
+  if (request.has_key() && !resumed) {
+    std::lock_guard<std::mutex> held_lock(held_off_mtx_);
+    if (IsFenced(request.key()) || held_off_.count(request.key())) {
+      held_off_[request.key()].push_back(
+          {std::unique_ptr<UMessage>(new UMessage(umsg)), source});
+      return false;
+    }
+  }
+  // chunks read stay in place till the response is built
+  ReadGuard guard(chunk_store);
+  if (request.has_key() && IsMoved(request.key())) {
+    res->mutable_response_payload()->set_stat(
+        static_cast<int>(ErrorCode::kKeyMoved));
+    return true;
+  }
   switch (umsg.type()) {
     case UMessage::PUT_REQUEST:
-      HandlePutRequest(umsg, response.mutable_response_payload());
+      HandlePutRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::GET_REQUEST:
-      HandleGetRequest(umsg, response.mutable_response_payload());
+      HandleGetRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::MERGE_REQUEST:
-      HandleMergeRequest(umsg, response.mutable_response_payload());
+      HandleMergeRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::LIST_REQUEST:
-      HandleListRequest(umsg, response.mutable_response_payload());
+      HandleListRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::EXISTS_REQUEST:
-      HandleExistsRequest(umsg, response.mutable_response_payload());
+      HandleExistsRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::GET_BRANCH_HEAD_REQUEST:
-      HandleGetBranchHeadRequest(umsg, response.mutable_response_payload());
+      HandleGetBranchHeadRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::IS_BRANCH_HEAD_REQUEST:
-      HandleIsBranchHeadRequest(umsg, response.mutable_response_payload());
+      HandleIsBranchHeadRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::GET_LATEST_VERSION_REQUEST:
-      HandleGetLatestVersionRequest(umsg, response.mutable_response_payload());
+      HandleGetLatestVersionRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::IS_LATEST_VERSION_REQUEST:
-      HandleIsLatestVersionRequest(umsg, response.mutable_response_payload());
+      HandleIsLatestVersionRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::BRANCH_REQUEST:
-      HandleBranchRequest(umsg, response.mutable_response_payload());
+      HandleBranchRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::RENAME_REQUEST:
-      HandleRenameRequest(umsg, response.mutable_response_payload());
+      HandleRenameRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::DELETE_REQUEST:
-      HandleDeleteRequest(umsg, response.mutable_response_payload());
+      HandleDeleteRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::PUT_UNKEYED_REQUEST:
-      HandlePutUnkeyedRequest(umsg, response.mutable_response_payload());
+      HandlePutUnkeyedRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::GET_CHUNK_REQUEST:
-      HandleGetChunkRequest(umsg, response.mutable_response_payload());
+      HandleGetChunkRequest(umsg, res->mutable_response_payload());
       break;
     case UMessage::GET_INFO_REQUEST:
-      HandleGetInfoRequest(umsg, &response);
+      HandleGetInfoRequest(umsg, res);
       break;
     default:
       LOG(WARNING) << "Unrecognized request type: " << umsg.type();
       break;
   }
-  // send response back
-  byte_t *serialized = new byte_t[response.ByteSize()];
-  response.SerializeToArray(serialized, response.ByteSize());
-  Send(source, serialized, response.ByteSize());
-  // clean up
-  delete[] serialized;
+  return true;
+}
+
+void WorkerService::ResumeHeldOff() {
+  std::unique_lock<std::mutex> lock(held_off_mtx_);
+  while (!held_off_.empty()) {
+    // the request stays queued till executed, so that the requests of the
+    // key arriving meanwhile are queued behind it
+    auto it = held_off_.begin();
+    const std::string key = it->first;
+    const HeldOff& held = it->second.front();
+    lock.unlock();
+    {
+      // ordered with the requests executed by receiving threads
+      std::unique_lock<std::mutex> exec_lock(lock_, std::defer_lock);
+      if (executors_.empty()) exec_lock.lock();
+      Execute(*held.request, held.source, true);
+    }
+    lock.lock();
+    it = held_off_.find(key);
+    it->second.pop_front();
+    if (it->second.empty()) held_off_.erase(it);
+  }
 }
 
 Value WorkerService::ValueFromRequest(const ValuePayload& payload) {
@@ -121,16 +392,14 @@ static const std::string empty = "null";
 
 void WorkerService::HandlePutRequest(const UMessage& umsg,
                                      ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   Value value = ValueFromRequest(umsg.value_payload());
   Hash new_version;
-  lock_.lock();
   ErrorCode code = request.has_branch()
     ? worker_.Put(Slice(request.key()), value, Slice(request.branch()),
                   &new_version)
     : worker_.Put(Slice(request.key()), value, Hash(request.version()),
                   &new_version);
-  lock_.unlock();
   access_.Append("PUT", request.key(), request.has_branch() ? request.branch()
       : Hash(request.version()).ToBase32(), new_version.ToBase32());
   response->set_stat(static_cast<int>(code));
@@ -140,13 +409,11 @@ void WorkerService::HandlePutRequest(const UMessage& umsg,
 
 void WorkerService::HandleGetRequest(const UMessage& umsg,
                                      ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   UCell val;
-  lock_.lock();
   ErrorCode code = request.has_branch()
     ? worker_.Get(Slice(request.key()), Slice(request.branch()), &val)
     : worker_.Get(Slice(request.key()), Hash(request.version()), &val);
-  lock_.unlock();
   access_.Append("GET", request.key(), request.has_branch() ? request.branch()
       : Hash(request.version()).ToBase32(), empty);
   response->set_stat(static_cast<int>(code));
@@ -156,10 +423,9 @@ void WorkerService::HandleGetRequest(const UMessage& umsg,
 
 void WorkerService::HandleMergeRequest(const UMessage& umsg,
                                        ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   Value value = ValueFromRequest(umsg.value_payload());
   Hash new_version;
-  lock_.lock();
   ErrorCode code = request.has_version()
     ? worker_.Merge(Slice(request.key()), value,
                     Hash(request.version()),
@@ -169,7 +435,6 @@ void WorkerService::HandleMergeRequest(const UMessage& umsg,
           Hash(request.ref_version()), &new_version)
         : worker_.Merge(Slice(request.key()), value, Slice(request.branch()),
           Slice(request.ref_branch()), &new_version));
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_value(new_version.value(), Hash::kByteLength);
@@ -177,28 +442,29 @@ void WorkerService::HandleMergeRequest(const UMessage& umsg,
 
 void WorkerService::HandleListRequest(const UMessage& umsg,
                                       ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   std::vector<std::string> vals;
-  lock_.lock();
   ErrorCode code = request.has_key()
     ? worker_.ListBranches(Slice(request.key()), &vals)
     : worker_.ListKeys(&vals);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
+  // keys handed off are listed by their new workers
+  if (!request.has_key()) {
+    vals.erase(std::remove_if(vals.begin(), vals.end(),
+        [this](const std::string& key) { return IsMoved(key); }), vals.end());
+  }
   for (auto& v : vals)
     response->add_lvalue(v.data(), v.length());
 }
 
 void WorkerService::HandleExistsRequest(const UMessage& umsg,
                                         ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   bool exists;
-  lock_.lock();
   ErrorCode code = request.has_branch()
     ? worker_.Exists(Slice(request.key()), Slice(request.branch()), &exists)
     : worker_.Exists(Slice(request.key()), &exists);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_bvalue(exists);
@@ -206,12 +472,10 @@ void WorkerService::HandleExistsRequest(const UMessage& umsg,
 
 void WorkerService::HandleGetBranchHeadRequest(const UMessage& umsg,
                                                ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   Hash version;
-  lock_.lock();
   ErrorCode code = worker_.GetBranchHead(Slice(request.key()),
                                          Slice(request.branch()), &version);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_value(version.value(), Hash::kByteLength);
@@ -219,12 +483,10 @@ void WorkerService::HandleGetBranchHeadRequest(const UMessage& umsg,
 
 void WorkerService::HandleIsBranchHeadRequest(const UMessage& umsg,
                                               ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   bool is_head;
-  lock_.lock();
   ErrorCode code = worker_.IsBranchHead(Slice(request.key()),
       Slice(request.branch()), Hash(request.version()), &is_head);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_bvalue(is_head);
@@ -232,11 +494,9 @@ void WorkerService::HandleIsBranchHeadRequest(const UMessage& umsg,
 
 void WorkerService::HandleGetLatestVersionRequest(const UMessage& umsg,
                                                   ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   std::vector<Hash> versions;
-  lock_.lock();
   ErrorCode code = worker_.GetLatestVersions(Slice(request.key()), &versions);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   for (auto& k : versions)
@@ -245,12 +505,10 @@ void WorkerService::HandleGetLatestVersionRequest(const UMessage& umsg,
 
 void WorkerService::HandleIsLatestVersionRequest(const UMessage& umsg,
                                                  ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   bool is_latest;
-  lock_.lock();
   ErrorCode code = worker_.IsLatestVersion(Slice(request.key()),
       Hash(request.version()), &is_latest);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_bvalue(is_latest);
@@ -258,14 +516,12 @@ void WorkerService::HandleIsLatestVersionRequest(const UMessage& umsg,
 
 void WorkerService::HandleBranchRequest(const UMessage& umsg,
                                         ResponsePayload* response) {
-  auto request = umsg.request_payload();
-  lock_.lock();
+  const auto& request = umsg.request_payload();
   ErrorCode code = request.has_ref_branch()
     ? worker_.Branch(Slice(request.key()), Slice(request.ref_branch()),
                      Slice(request.branch()))
     : worker_.Branch(Slice(request.key()), Hash(request.ref_version()),
                      Slice(request.branch()));
-  lock_.unlock();
   access_.Append("BRANCH", request.key(), request.has_ref_branch()
       ? request.ref_branch() : Hash(request.ref_version()).ToBase32(),
       request.branch());
@@ -274,11 +530,9 @@ void WorkerService::HandleBranchRequest(const UMessage& umsg,
 
 void WorkerService::HandleRenameRequest(const UMessage& umsg,
                                         ResponsePayload* response) {
-  auto request = umsg.request_payload();
-  lock_.lock();
+  const auto& request = umsg.request_payload();
   ErrorCode code = worker_.Rename(Slice(request.key()),
       Slice(request.ref_branch()), Slice(request.branch()));
-  lock_.unlock();
   access_.Append("RENAME", request.key(), request.ref_branch(),
       request.branch());
   response->set_stat(static_cast<int>(code));
@@ -286,11 +540,9 @@ void WorkerService::HandleRenameRequest(const UMessage& umsg,
 
 void WorkerService::HandleDeleteRequest(const UMessage& umsg,
                                         ResponsePayload* response) {
-  auto request = umsg.request_payload();
-  lock_.lock();
+  const auto& request = umsg.request_payload();
   ErrorCode code = worker_.Delete(Slice(request.key()),
                                   Slice(request.branch()));
-  lock_.unlock();
   access_.Append("DELETE", request.key(), request.branch(), empty);
   response->set_stat(static_cast<int>(code));
 }
@@ -299,9 +551,7 @@ void WorkerService::HandlePutUnkeyedRequest(const UMessage& umsg,
                                             ResponsePayload* response) {
   Value value = ValueFromRequest(umsg.value_payload());
   Hash new_version;
-  lock_.lock();
   ErrorCode code = worker_.PutUnkeyed(Slice(), value, &new_version);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_value(new_version.value(), Hash::kByteLength);
@@ -309,11 +559,9 @@ void WorkerService::HandlePutUnkeyedRequest(const UMessage& umsg,
 
 void WorkerService::HandleGetChunkRequest(const UMessage& umsg,
                                           ResponsePayload* response) {
-  auto request = umsg.request_payload();
+  const auto& request = umsg.request_payload();
   Chunk c;
-  lock_.lock();
   ErrorCode code = worker_.GetChunk(Slice(), Hash(request.version()), &c);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   response->set_value(c.head(), c.numBytes());
@@ -323,9 +571,7 @@ void WorkerService::HandleGetInfoRequest(const UMessage& umsg,
                                          UMessage* res) {
   auto response = res->mutable_response_payload();
   std::vector<StoreInfo> store;
-  lock_.lock();
   ErrorCode code = worker_.GetStorageInfo(&store);
-  lock_.unlock();
   response->set_stat(static_cast<int>(code));
   if (code != ErrorCode::kOK) return;
   auto info = res->mutable_info_payload();
@@ -346,4 +592,277 @@ void WorkerService::HandleGetInfoRequest(const UMessage& umsg,
   info->set_node_id(node_addr_);
 }
 
+void WorkerService::HandlePutChunkRequest(const UMessage& umsg,
+                                          ResponsePayload* response) {
+  const auto& request = umsg.request_payload();
+  const auto& value = umsg.value_payload().base();
+  Chunk c(reinterpret_cast<const byte_t*>(value.data()));
+  ErrorCode code = worker_.PutChunk(Hash(request.version()), c);
+  response->set_stat(static_cast<int>(code));
+}
+
+void WorkerService::HandlePutHeadRequest(const UMessage& umsg,
+                                         ResponsePayload* response) {
+  const auto& request = umsg.request_payload();
+  const auto& heads = umsg.head_payload();
+  Slice key(request.key());
+  ErrorCode code = ErrorCode::kOK;
+  for (int i = 0; i < heads.branches_size() && code == ErrorCode::kOK; ++i)
+    code = worker_.PutBranchHead(key, Slice(heads.branches(i)),
+                                 Hash(heads.heads(i)));
+  for (int i = 0; i < heads.latest_size() && code == ErrorCode::kOK; ++i)
+    code = worker_.PutLatestVersion(key, Hash(heads.latest(i)));
+  response->set_stat(static_cast<int>(code));
+}
+
+void WorkerService::HandleGCRequest(const UMessage& umsg,
+                                    const node_id_t& source) {
+  UMessage response;
+  response.set_type(UMessage::RESPONSE);
+  response.set_source(umsg.source());
+  if (umsg.has_request_id()) response.set_request_id(umsg.request_id());
+  if (!gc_thread_.joinable()) {
+    LOG(WARNING) << "Cannot collect garbage with distributed store";
+    response.mutable_response_payload()->set_stat(
+        static_cast<int>(ErrorCode::kFailedGC));
+    Send(source, MessageParser::Serialize(response));
+    return;
+  }
+  std::lock_guard<std::mutex> lock(gc_mtx_);
+  gc_waiting_.emplace_back(source, std::move(response));
+  gc_cv_.notify_one();
+}
+
+void WorkerService::GCLoop() {
+  static const auto chunk_store = store::GetChunkStore();
+  const double trigger_ratio = Env::Instance()->config().gc_trigger_ratio();
+  // segments used when the last GC reclaimed nothing; it is not triggered
+  // again until more are used
+  size_t fruitless_used = 0;
+  std::unique_lock<std::mutex> lock(gc_mtx_);
+  for (;;) {
+    gc_cv_.wait_for(lock, std::chrono::seconds(1),
+                    [this] { return stop_gc_ || !gc_waiting_.empty(); });
+    if (stop_gc_) break;
+    std::vector<std::pair<node_id_t, UMessage>> waiting;
+    waiting.swap(gc_waiting_);
+    StoreInfo info = chunk_store->GetInfo();
+    bool triggered = trigger_ratio > 0 && info.usedSegments > fruitless_used
+        && info.usedSegments >= trigger_ratio * info.maxSegments;
+    if (waiting.empty() && !triggered) continue;
+    lock.unlock();
+    size_t reclaimed = 0;
+    ErrorCode code = worker_.GC(&reclaimed);
+    fruitless_used = reclaimed ? 0 : info.usedSegments;
+    for (auto& req : waiting) {
+      auto response = req.second.mutable_response_payload();
+      response->set_stat(static_cast<int>(code));
+      response->set_ivalue(reclaimed);
+      Send(req.first, MessageParser::Serialize(req.second));
+    }
+    lock.lock();
+  }
+  for (auto& req : gc_waiting_) {
+    req.second.mutable_response_payload()->set_stat(
+        static_cast<int>(ErrorCode::kFailedGC));
+    Send(req.first, MessageParser::Serialize(req.second));
+  }
+}
+
+bool WorkerService::IsMoved(const std::string& key) const {
+  return owner_ptt_ && owner_ptt_->GetDestAddr(Slice(key)) != node_addr_;
+}
+
+bool WorkerService::IsFenced(const std::string& key) const {
+  return fence_ptt_ && fence_ptt_->GetDestAddr(Slice(key)) != node_addr_
+         && !IsMoved(key);
+}
+
+std::string WorkerService::HandoffPath() const {
+  const auto& config = Env::Instance()->config();
+  return config.data_dir() + "/" + config.data_file_pattern() + "_"
+         + std::to_string(ptt_.id()) + ".handoff";
+}
+
+void WorkerService::RemoveMovedKeys() {
+  std::vector<std::string> keys;
+  worker_.ListKeys(&keys);
+  size_t nremoved = 0;
+  for (const auto& key : keys) {
+    if (!IsMoved(key)) continue;
+    worker_.RemoveKey(Slice(key));
+    ++nremoved;
+  }
+  if (nremoved) LOG(INFO) << "Dropped the heads of " << nremoved
+                          << " keys handed off";
+}
+
+void WorkerService::HandleMigrateRequest(const UMessage& umsg,
+                                         const node_id_t& source) {
+  UMessage response;
+  response.set_type(UMessage::RESPONSE);
+  response.set_source(umsg.source());
+  if (umsg.has_request_id()) response.set_request_id(umsg.request_id());
+  const auto& payload = umsg.migrate_payload();
+  std::vector<std::string> hosts(payload.hosts().begin(),
+                                 payload.hosts().end());
+  std::lock_guard<std::mutex> lock(migrate_mtx_);
+  if (migrating_ || hosts.empty()
+      || Env::Instance()->config().enable_dist_store()) {
+    LOG(WARNING) << "Cannot migrate keys while migrating, to no workers, or "
+                 << "with distributed store";
+    response.mutable_response_payload()->set_stat(
+        static_cast<int>(ErrorCode::kFailedMigrate));
+    Send(source, MessageParser::Serialize(response));
+    return;
+  }
+  // the last migration is done already
+  if (migrate_thread_.joinable()) migrate_thread_.join();
+  migrating_ = true;
+  migrate_thread_ = std::thread([this, hosts, source, response]() mutable {
+    ErrorCode code = Migrate(hosts);
+    response.mutable_response_payload()->set_stat(static_cast<int>(code));
+    Send(source, MessageParser::Serialize(response));
+    std::lock_guard<std::mutex> lock(migrate_mtx_);
+    migrating_ = false;
+  });
+}
+
+namespace {
+
+// branch heads and latest versions of a key
+struct KeyHeads {
+  std::vector<std::string> branches;
+  std::vector<Hash> heads;
+  std::vector<Hash> latest;
+
+  KeyHeads(const Worker& worker, const Slice& key) {
+    worker.ListBranches(key, &branches);
+    for (const auto& branch : branches) {
+      Hash head;
+      worker.GetBranchHead(key, Slice(branch), &head);
+      heads.push_back(head.Clone());
+    }
+    worker.GetLatestVersions(key, &latest);
+  }
+
+  // versions to collect chunks from
+  std::vector<Hash> roots() const {
+    std::vector<Hash> vers;
+    for (const auto& ver : heads) vers.push_back(ver.Clone());
+    for (const auto& ver : latest) vers.push_back(ver.Clone());
+    return vers;
+  }
+};
+
+// most chunks sent without responses yet
+constexpr size_t kMigrateWindow = 64;
+
+}  // namespace
+
+ErrorCode WorkerService::Migrate(const std::vector<std::string>& hosts) {
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<WorkerPartitioner> next(new WorkerPartitioner(hosts, ""));
+  // keys owned here now but by another worker of the host list
+  auto moving_keys = [this, &next]() {
+    std::vector<std::string> keys;
+    worker_.ListKeys(&keys);
+    keys.erase(std::remove_if(keys.begin(), keys.end(),
+        [this, &next](const std::string& key) {
+          return IsMoved(key) || next->GetDestAddr(Slice(key)) == node_addr_;
+        }), keys.end());
+    return keys;
+  };
+
+  WorkerClientService svc(hosts);
+  svc.Run();
+  WorkerClient client = svc.CreateWorkerClient();
+  ErrorCode err = ErrorCode::kOK;
+  std::deque<std::future<ErrorCode>> pending;
+  auto wait = [&err, &pending](size_t limit) {
+    while (pending.size() > limit) {
+      ErrorCode code = pending.front().get();
+      pending.pop_front();
+      if (code != ErrorCode::kOK) err = code;
+    }
+  };
+  // chunks sent to each worker
+  std::unordered_map<std::string, std::unordered_set<Hash>> sent;
+  size_t nchunks = 0;
+  // send the chunks of the key not sent to its new worker yet
+  auto send_chunks = [&](const std::string& key, const KeyHeads& heads) {
+    ReadGuard guard(store::GetChunkStore());
+    Slice route_key(key);
+    std::vector<Hash> found;
+    worker_.CollectChunks(heads.roots(), &sent[next->GetDestAddr(route_key)],
+                          &found);
+    for (const auto& hash : found) {
+      Chunk chunk;
+      if (worker_.GetChunk(route_key, hash, &chunk) != ErrorCode::kOK)
+        continue;
+      wait(kMigrateWindow - 1);
+      pending.push_back(client.PutChunkAsync(route_key, hash, chunk));
+    }
+    nchunks += found.size();
+  };
+
+  // stream the chunks while serving the keys
+  std::vector<std::string> keys = moving_keys();
+  for (const auto& key : keys) send_chunks(key, KeyHeads(worker_, Slice(key)));
+  wait(0);
+  size_t nstreamed = nchunks;
+
+  if (err == ErrorCode::kOK) {
+    // hold off requests of the moving keys, once those in progress are done
+    {
+      std::lock_guard<shared_mutex> lock(handoff_mtx_);
+      fence_ptt_.reset(new WorkerPartitioner(hosts, ""));
+    }
+    // send the updates since then and the heads, while serving other keys
+    keys = moving_keys();
+    std::vector<KeyHeads> heads;
+    for (const auto& key : keys) {
+      heads.emplace_back(worker_, Slice(key));
+      send_chunks(key, heads.back());
+    }
+    // heads only refer to chunks the new workers have
+    wait(0);
+    for (size_t i = 0; i < keys.size() && err == ErrorCode::kOK; ++i) {
+      wait(kMigrateWindow - 1);
+      pending.push_back(client.PutHeadAsync(Slice(keys[i]), heads[i].branches,
+                                            heads[i].heads, heads[i].latest));
+    }
+    wait(0);
+    // keys are handed off before the heads are dropped, and a restart finds
+    // the host list before the heads are recovered
+    if (err == ErrorCode::kOK && persist_) {
+      const std::string path = HandoffPath();
+      {
+        std::ofstream ofs(path + ".tmp", std::ios::out | std::ios::trunc);
+        for (const auto& host : hosts) ofs << host << "\n";
+      }
+      boost::filesystem::rename(path + ".tmp", path);
+    }
+    {
+      std::lock_guard<shared_mutex> lock(handoff_mtx_);
+      if (err == ErrorCode::kOK) owner_ptt_ = std::move(next);
+      fence_ptt_.reset();
+    }
+    ResumeHeldOff();
+    if (err == ErrorCode::kOK) RemoveMovedKeys();
+  }
+  svc.Stop();
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  if (err != ErrorCode::kOK) {
+    LOG(WARNING) << "Failed to migrate keys: " << Utils::ToString(err);
+    return ErrorCode::kFailedMigrate;
+  }
+  LOG(INFO) << "Handed off " << keys.size() << " keys with " << nchunks
+            << " chunks (" << nchunks - nstreamed << " during hand-off) in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+               .count() << " ms";
+  return ErrorCode::kOK;
+}
+
 }  // namespace ustore
@@ -0,0 +1,383 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "hash/blake3.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "utils/cpu_features.h"
+#include "utils/logging.h"
+
+#ifdef USTORE_X86
+#include <immintrin.h>
+#endif
+
+namespace ustore {
+namespace blake3 {
+
+namespace {
+
+constexpr size_t kBlockLength = 64;
+constexpr size_t kCvLength = 32;
+
+enum Flag : uint32_t {
+  kChunkStart = 1 << 0,
+  kChunkEnd = 1 << 1,
+  kParent = 1 << 2,
+  kRoot = 1 << 3
+};
+
+const uint32_t kIV[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// message word order in each of the 7 rounds
+const uint8_t kMsgSchedule[7][16] = {
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+  {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+  {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+  {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+  {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+  {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+};
+
+// hash each of the inputs, all made of num_blocks full blocks, into a
+// chaining value; input i uses counter + i if increment_counter is set
+using HashManyFunc = void (*)(const byte_t* const* inputs, size_t num_inputs,
+                              size_t num_blocks, const uint32_t key[8],
+                              uint64_t counter, bool increment_counter,
+                              uint32_t flags, uint32_t flags_start,
+                              uint32_t flags_end, byte_t* out);
+
+inline uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t LoadLE32(const byte_t* p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+inline void StoreLE32(uint32_t x, byte_t* p) {
+  p[0] = byte_t(x);
+  p[1] = byte_t(x >> 8);
+  p[2] = byte_t(x >> 16);
+  p[3] = byte_t(x >> 24);
+}
+
+inline void G(uint32_t* s, int a, int b, int c, int d, uint32_t x,
+              uint32_t y) {
+  s[a] = s[a] + s[b] + x;
+  s[d] = Rotr(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = Rotr(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + y;
+  s[d] = Rotr(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = Rotr(s[b] ^ s[c], 7);
+}
+
+// compress a block into 16 output words, of which the first 8 are the new
+// chaining value
+void Compress(const uint32_t cv[8], const byte_t block[kBlockLength],
+              uint32_t block_len, uint64_t counter, uint32_t flags,
+              uint32_t out[16]) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; ++i) m[i] = LoadLE32(block + 4 * i);
+  uint32_t s[16] = {
+    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+    kIV[0], kIV[1], kIV[2], kIV[3],
+    uint32_t(counter), uint32_t(counter >> 32), block_len, flags
+  };
+  for (const uint8_t* r : kMsgSchedule) {
+    G(s, 0, 4, 8, 12, m[r[0]], m[r[1]]);
+    G(s, 1, 5, 9, 13, m[r[2]], m[r[3]]);
+    G(s, 2, 6, 10, 14, m[r[4]], m[r[5]]);
+    G(s, 3, 7, 11, 15, m[r[6]], m[r[7]]);
+    G(s, 0, 5, 10, 15, m[r[8]], m[r[9]]);
+    G(s, 1, 6, 11, 12, m[r[10]], m[r[11]]);
+    G(s, 2, 7, 8, 13, m[r[12]], m[r[13]]);
+    G(s, 3, 4, 9, 14, m[r[14]], m[r[15]]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    out[i] = s[i] ^ s[i + 8];
+    out[i + 8] = s[i + 8] ^ cv[i];
+  }
+}
+
+void HashManyPortable(const byte_t* const* inputs, size_t num_inputs,
+                      size_t num_blocks, const uint32_t key[8],
+                      uint64_t counter, bool increment_counter,
+                      uint32_t flags, uint32_t flags_start,
+                      uint32_t flags_end, byte_t* out) {
+  uint32_t cv[8], words[16];
+  for (size_t i = 0; i < num_inputs; ++i, out += kCvLength) {
+    std::memcpy(cv, key, kCvLength);
+    for (size_t b = 0; b < num_blocks; ++b) {
+      uint32_t block_flags = flags | (b == 0 ? flags_start : 0) |
+                             (b + 1 == num_blocks ? flags_end : 0);
+      Compress(cv, inputs[i] + b * kBlockLength, kBlockLength, counter,
+               block_flags, words);
+      std::memcpy(cv, words, kCvLength);
+    }
+    for (int w = 0; w < 8; ++w) StoreLE32(cv[w], out + 4 * w);
+    if (increment_counter) ++counter;
+  }
+}
+
+#ifdef USTORE_X86
+__attribute__((target("avx2")))
+inline __m256i Rotr256(__m256i x, int n) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+__attribute__((target("avx2")))
+inline void G8(__m256i* v, int a, int b, int c, int d, __m256i x, __m256i y) {
+  const __m256i kRot16 = _mm256_set_epi8(
+      13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+      13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+  const __m256i kRot8 = _mm256_set_epi8(
+      12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+      12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1);
+  v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+  v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), kRot16);
+  v[c] = _mm256_add_epi32(v[c], v[d]);
+  v[b] = Rotr256(_mm256_xor_si256(v[b], v[c]), 12);
+  v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+  v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), kRot8);
+  v[c] = _mm256_add_epi32(v[c], v[d]);
+  v[b] = Rotr256(_mm256_xor_si256(v[b], v[c]), 7);
+}
+
+// transpose 8x8 words, so that rows become lanes and vice versa
+__attribute__((target("avx2")))
+inline void Transpose8x8(__m256i* r) {
+  __m256i t[8], u[8];
+  for (int i = 0; i < 8; i += 2) {
+    t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+    t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+  }
+  for (int i = 0; i < 8; i += 4) {
+    u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+    u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+    u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+    u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+  }
+  for (int i = 0; i < 4; ++i) {
+    r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+    r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+  }
+}
+
+// hash 8 inputs at once, one in each lane
+__attribute__((target("avx2")))
+void HashEightAVX2(const byte_t* const* inputs, size_t num_blocks,
+                   const uint32_t key[8], uint64_t counter,
+                   bool increment_counter, uint32_t flags,
+                   uint32_t flags_start, uint32_t flags_end, byte_t* out) {
+  __m256i h[8], m[16], v[16];
+  for (int i = 0; i < 8; ++i) h[i] = _mm256_set1_epi32(key[i]);
+  uint32_t lo[8], hi[8];
+  for (int i = 0; i < 8; ++i) {
+    uint64_t c = counter + (increment_counter ? i : 0);
+    lo[i] = uint32_t(c);
+    hi[i] = uint32_t(c >> 32);
+  }
+  const __m256i counter_lo =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lo));
+  const __m256i counter_hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hi));
+
+  for (size_t b = 0; b < num_blocks; ++b) {
+    uint32_t block_flags = flags | (b == 0 ? flags_start : 0) |
+                           (b + 1 == num_blocks ? flags_end : 0);
+    for (int half = 0; half < 2; ++half) {
+      for (int i = 0; i < 8; ++i) {
+        m[8 * half + i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+            inputs[i] + b * kBlockLength + 32 * half));
+      }
+      Transpose8x8(m + 8 * half);
+    }
+    for (int i = 0; i < 8; ++i) v[i] = h[i];
+    for (int i = 0; i < 4; ++i) v[8 + i] = _mm256_set1_epi32(kIV[i]);
+    v[12] = counter_lo;
+    v[13] = counter_hi;
+    v[14] = _mm256_set1_epi32(kBlockLength);
+    v[15] = _mm256_set1_epi32(block_flags);
+    for (const uint8_t* r : kMsgSchedule) {
+      G8(v, 0, 4, 8, 12, m[r[0]], m[r[1]]);
+      G8(v, 1, 5, 9, 13, m[r[2]], m[r[3]]);
+      G8(v, 2, 6, 10, 14, m[r[4]], m[r[5]]);
+      G8(v, 3, 7, 11, 15, m[r[6]], m[r[7]]);
+      G8(v, 0, 5, 10, 15, m[r[8]], m[r[9]]);
+      G8(v, 1, 6, 11, 12, m[r[10]], m[r[11]]);
+      G8(v, 2, 7, 8, 13, m[r[12]], m[r[13]]);
+      G8(v, 3, 4, 9, 14, m[r[14]], m[r[15]]);
+    }
+    for (int i = 0; i < 8; ++i) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+  }
+  // x86 is little-endian, so lanes can be stored as they are
+  Transpose8x8(h);
+  for (int i = 0; i < 8; ++i) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + kCvLength * i),
+                        h[i]);
+  }
+}
+
+void HashManyAVX2(const byte_t* const* inputs, size_t num_inputs,
+                  size_t num_blocks, const uint32_t key[8], uint64_t counter,
+                  bool increment_counter, uint32_t flags,
+                  uint32_t flags_start, uint32_t flags_end, byte_t* out) {
+  for (; num_inputs >= 8; num_inputs -= 8) {
+    HashEightAVX2(inputs, num_blocks, key, counter, increment_counter, flags,
+                  flags_start, flags_end, out);
+    inputs += 8;
+    out += 8 * kCvLength;
+    if (increment_counter) counter += 8;
+  }
+  HashManyPortable(inputs, num_inputs, num_blocks, key, counter,
+                   increment_counter, flags, flags_start, flags_end, out);
+}
+#endif  // USTORE_X86
+
+HashManyFunc GetHashMany(Impl impl) {
+  switch (impl) {
+#ifdef USTORE_X86
+    case Impl::kAVX2:
+      return HashManyAVX2;
+#endif  // USTORE_X86
+    default:
+      return HashManyPortable;
+  }
+}
+
+// the last compression of a node, delayed so that the root can be flagged
+struct Output {
+  uint32_t cv[8];
+  byte_t block[kBlockLength];
+  uint32_t block_len;
+  uint64_t counter;
+  uint32_t flags;
+
+  void ChainingValue(byte_t* cv_out) const {
+    uint32_t words[16];
+    Compress(cv, block, block_len, counter, flags, words);
+    for (int i = 0; i < 8; ++i) StoreLE32(words[i], cv_out + 4 * i);
+  }
+};
+
+Output ChunkOutput(const byte_t* data, size_t len, uint64_t counter) {
+  Output output;
+  std::memcpy(output.cv, kIV, kCvLength);
+  uint32_t words[16];
+  uint32_t start = kChunkStart;
+  for (; len > kBlockLength; data += kBlockLength, len -= kBlockLength) {
+    Compress(output.cv, data, kBlockLength, counter, start, words);
+    std::memcpy(output.cv, words, kCvLength);
+    start = 0;
+  }
+  std::memset(output.block, 0, kBlockLength);
+  std::memcpy(output.block, data, len);
+  output.block_len = uint32_t(len);
+  output.counter = counter;
+  output.flags = start | kChunkEnd;
+  return output;
+}
+
+Output ParentOutput(const byte_t* left_and_right_cvs) {
+  Output output;
+  std::memcpy(output.cv, kIV, kCvLength);
+  std::memcpy(output.block, left_and_right_cvs, kBlockLength);
+  output.block_len = kBlockLength;
+  output.counter = 0;
+  output.flags = kParent;
+  return output;
+}
+
+// bytes in the left subtree: the largest power of 2 of full chunks that
+// leaves at least one byte to the right
+size_t LeftLength(size_t len) {
+  size_t full_chunks = (len - 1) / kChunkLength;
+  size_t n = 1;
+  while (n * 2 <= full_chunks) n *= 2;
+  return n * kChunkLength;
+}
+
+void SubtreeChainingValue(HashManyFunc hash_many, const byte_t* data,
+                          size_t len, uint64_t counter, byte_t* cv_out) {
+  if (len <= kChunkLength) {
+    ChunkOutput(data, len, counter).ChainingValue(cv_out);
+    return;
+  }
+  size_t num_chunks = len / kChunkLength;
+  if (len % kChunkLength == 0 && (num_chunks & (num_chunks - 1)) == 0) {
+    // a complete subtree: hash all chunks, then each level of parents, as
+    // many at a time as the implementation can
+    std::vector<const byte_t*> inputs(num_chunks);
+    std::vector<byte_t> cvs(num_chunks * kCvLength);
+    for (size_t i = 0; i < num_chunks; ++i)
+      inputs[i] = data + i * kChunkLength;
+    hash_many(inputs.data(), num_chunks, kChunkLength / kBlockLength, kIV,
+              counter, true, 0, kChunkStart, kChunkEnd, cvs.data());
+    // parents overwrite the front of the level they are computed from
+    for (size_t n = num_chunks / 2; n > 0; n /= 2) {
+      for (size_t i = 0; i < n; ++i)
+        inputs[i] = cvs.data() + i * kBlockLength;
+      hash_many(inputs.data(), n, 1, kIV, 0, false, kParent, 0, 0,
+                cvs.data());
+    }
+    std::memcpy(cv_out, cvs.data(), kCvLength);
+    return;
+  }
+  size_t left_len = LeftLength(len);
+  byte_t children[2 * kCvLength];
+  SubtreeChainingValue(hash_many, data, left_len, counter, children);
+  SubtreeChainingValue(hash_many, data + left_len, len - left_len,
+                       counter + left_len / kChunkLength,
+                       children + kCvLength);
+  ParentOutput(children).ChainingValue(cv_out);
+}
+
+}  // namespace
+
+bool IsSupported(Impl impl) {
+  const CpuFeatures& cpu = CpuFeatures::Get();
+  switch (impl) {
+    case Impl::kPortable:
+      return true;
+    case Impl::kAVX2:
+      return cpu.avx2;
+    default:
+      return false;
+  }
+}
+
+Impl Fastest() {
+  static const Impl impl =
+      IsSupported(Impl::kAVX2) ? Impl::kAVX2 : Impl::kPortable;
+  return impl;
+}
+
+void Digest(Impl impl, const byte_t* data, size_t len, byte_t* digest) {
+  CHECK(IsSupported(impl)) << "BLAKE3 implementation "
+                           << static_cast<int>(impl) << " is not supported";
+  HashManyFunc hash_many = GetHashMany(impl);
+  Output root;
+  if (len <= kChunkLength) {
+    root = ChunkOutput(data, len, 0);
+  } else {
+    size_t left_len = LeftLength(len);
+    byte_t children[2 * kCvLength];
+    SubtreeChainingValue(hash_many, data, left_len, 0, children);
+    SubtreeChainingValue(hash_many, data + left_len, len - left_len,
+                         left_len / kChunkLength, children + kCvLength);
+    root = ParentOutput(children);
+  }
+  uint32_t words[16];
+  Compress(root.cv, root.block, root.block_len, root.counter,
+           root.flags | kRoot, words);
+  for (int i = 0; i < 8; ++i) StoreLE32(words[i], digest + 4 * i);
+}
+
+}  // namespace blake3
+}  // namespace ustore
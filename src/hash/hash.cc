@@ -9,7 +9,9 @@
 #include <utility>
 #include "utils/logging.h"
 
-#ifdef USE_CRYPTOPP
+#ifdef USE_BLAKE3
+#include "hash/blake3.h"
+#elif defined(USE_CRYPTOPP) && (defined(USE_SHA256) || defined(USE_BLAKE2b))
 #include "cryptopp/cryptlib.h"
 #ifdef USE_SHA256
 #include "cryptopp/sha.h"
@@ -17,7 +19,7 @@
 #include "cryptopp/blake2.h"
 #endif
 #else
-#include "hash/sha2.h"
+#include "hash/sha256.h"
 #endif
 
 namespace ustore {
@@ -129,38 +131,45 @@ void Hash::Alloc() {
   }
 }
 
-#ifdef USE_CRYPTOPP
-#ifdef USE_SHA256
-Hash Hash::ComputeFrom(const byte_t* data, size_t len) {
+#ifdef USE_BLAKE3
+Hash Hash::ComputeFrom(const byte_t* data, size_t len, byte_t* buffer) {
+  byte_t fullhash[blake3::kDigestLength];
+  blake3::Digest(data, len, fullhash);
+  std::copy(fullhash, fullhash + kByteLength, buffer);
+  return Hash(buffer);
+}
+#elif defined(USE_CRYPTOPP) && defined(USE_SHA256)
+Hash Hash::ComputeFrom(const byte_t* data, size_t len, byte_t* buffer) {
   byte_t fullhash[CryptoPP::SHA256::DIGESTSIZE];
-  Hash h;
-  h.Alloc();
   CryptoPP::SHA256 hash_gen;
   hash_gen.CalculateDigest(fullhash, data, len);
-  std::copy(fullhash, fullhash + kByteLength, h.own_.get());
-  return h;
+  std::copy(fullhash, fullhash + kByteLength, buffer);
+  return Hash(buffer);
 }
-#elif USE_BLAKE2b
-Hash Hash::ComputeFrom(const byte_t* data, size_t len) {
+#elif defined(USE_CRYPTOPP) && defined(USE_BLAKE2b)
+Hash Hash::ComputeFrom(const byte_t* data, size_t len, byte_t* buffer) {
   byte_t fullhash[CryptoPP::BLAKE2b::DIGESTSIZE];
-  Hash h;
-  h.Alloc();
   CryptoPP::BLAKE2b hash_gen;
   hash_gen.CalculateDigest(fullhash, data, len);
-  std::copy(fullhash, fullhash + kByteLength, h.own_.get());
-  return h;
+  std::copy(fullhash, fullhash + kByteLength, buffer);
+  return Hash(buffer);
 }
-#endif  // USE_SHA256
 #else
+// built-in SHA-256, using SHA-NI when the CPU has it
+Hash Hash::ComputeFrom(const byte_t* data, size_t len, byte_t* buffer) {
+  byte_t fullhash[sha256::kDigestLength];
+  sha256::Digest(data, len, fullhash);
+  std::copy(fullhash, fullhash + kByteLength, buffer);
+  return Hash(buffer);
+}
+#endif  // USE_BLAKE3
+
 Hash Hash::ComputeFrom(const byte_t* data, size_t len) {
-  byte_t fullhash[Hash::kBase32Length];
   Hash h;
   h.Alloc();
-  picosha2::hash256(data, data + len, fullhash, fullhash + kBase32Length);
-  std::copy(fullhash, fullhash + kByteLength, h.own_.get());
+  ComputeFrom(data, len, h.own_.get());
   return h;
 }
-#endif  // USE_CRYPTOPP
 
 Hash Hash::ComputeFrom(const std::string& data) {
   return Hash::ComputeFrom(reinterpret_cast<const byte_t*>(data.c_str()),
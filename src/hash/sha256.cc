@@ -0,0 +1,218 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "hash/sha256.h"
+
+#include <cstdint>
+#include <cstring>
+#include "utils/cpu_features.h"
+#include "utils/logging.h"
+
+#ifdef USTORE_X86
+#include <immintrin.h>
+#endif
+
+namespace ustore {
+namespace sha256 {
+
+namespace {
+
+constexpr size_t kBlockLength = 64;
+
+using CompressFunc = void (*)(uint32_t state[8], const byte_t* blocks,
+                              size_t num_blocks);
+
+alignas(16) const uint32_t kRoundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t kInitState[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+inline uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t LoadBE32(const byte_t* p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline void StoreBE32(uint32_t x, byte_t* p) {
+  p[0] = byte_t(x >> 24);
+  p[1] = byte_t(x >> 16);
+  p[2] = byte_t(x >> 8);
+  p[3] = byte_t(x);
+}
+
+void CompressPortable(uint32_t state[8], const byte_t* blocks,
+                      size_t num_blocks) {
+  uint32_t w[64];
+  for (; num_blocks > 0; --num_blocks, blocks += kBlockLength) {
+    for (int i = 0; i < 16; ++i) w[i] = LoadBE32(blocks + 4 * i);
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+      uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef USTORE_X86
+// Each group of four rounds consumes four message words. The schedule for
+// group g >= 4 is derived in place from the previous four groups.
+#define USTORE_SHA256_GROUP(g)                                               \
+  do {                                                                       \
+    if (g >= 4) {                                                            \
+      __m128i t = _mm_sha256msg1_epu32(msg[g & 3], msg[(g + 1) & 3]);        \
+      t = _mm_add_epi32(t, _mm_alignr_epi8(msg[(g + 3) & 3],                 \
+                                           msg[(g + 2) & 3], 4));            \
+      msg[g & 3] = _mm_sha256msg2_epu32(t, msg[(g + 3) & 3]);                \
+    }                                                                        \
+    __m128i wk = _mm_add_epi32(msg[g & 3], _mm_load_si128(                   \
+        reinterpret_cast<const __m128i*>(kRoundConstants + 4 * g)));         \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);                            \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));   \
+  } while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void CompressShaNi(uint32_t state[8], const byte_t* blocks,
+                   size_t num_blocks) {
+  const __m128i kByteSwap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  // the instructions keep the state as {a, b, e, f} and {c, d, g, h}
+  __m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+  __m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+  __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+  __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+  __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+  __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+
+  __m128i msg[4];
+  for (; num_blocks > 0; --num_blocks, blocks += kBlockLength) {
+    const __m128i abef_saved = abef;
+    const __m128i cdgh_saved = cdgh;
+    for (int i = 0; i < 4; ++i) {
+      msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(blocks + 16 * i)), kByteSwap);
+    }
+    USTORE_SHA256_GROUP(0);
+    USTORE_SHA256_GROUP(1);
+    USTORE_SHA256_GROUP(2);
+    USTORE_SHA256_GROUP(3);
+    USTORE_SHA256_GROUP(4);
+    USTORE_SHA256_GROUP(5);
+    USTORE_SHA256_GROUP(6);
+    USTORE_SHA256_GROUP(7);
+    USTORE_SHA256_GROUP(8);
+    USTORE_SHA256_GROUP(9);
+    USTORE_SHA256_GROUP(10);
+    USTORE_SHA256_GROUP(11);
+    USTORE_SHA256_GROUP(12);
+    USTORE_SHA256_GROUP(13);
+    USTORE_SHA256_GROUP(14);
+    USTORE_SHA256_GROUP(15);
+    abef = _mm_add_epi32(abef, abef_saved);
+    cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+  }
+
+  __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+  __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+  dcba = _mm_blend_epi16(feba, dchg, 0xf0);
+  hgfe = _mm_alignr_epi8(dchg, feba, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), dcba);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), hgfe);
+}
+
+#undef USTORE_SHA256_GROUP
+#endif  // USTORE_X86
+
+CompressFunc GetCompress(Impl impl) {
+  switch (impl) {
+#ifdef USTORE_X86
+    case Impl::kShaNi:
+      return CompressShaNi;
+#endif  // USTORE_X86
+    default:
+      return CompressPortable;
+  }
+}
+
+}  // namespace
+
+bool IsSupported(Impl impl) {
+  const CpuFeatures& cpu = CpuFeatures::Get();
+  switch (impl) {
+    case Impl::kPortable:
+      return true;
+    case Impl::kShaNi:
+      return cpu.sha && cpu.sse41 && cpu.ssse3;
+    default:
+      return false;
+  }
+}
+
+Impl Fastest() {
+  static const Impl impl =
+      IsSupported(Impl::kShaNi) ? Impl::kShaNi : Impl::kPortable;
+  return impl;
+}
+
+void Digest(Impl impl, const byte_t* data, size_t len, byte_t* digest) {
+  CHECK(IsSupported(impl)) << "SHA-256 implementation "
+                           << static_cast<int>(impl) << " is not supported";
+  CompressFunc compress = GetCompress(impl);
+  uint32_t state[8];
+  std::memcpy(state, kInitState, sizeof(state));
+  size_t num_blocks = len / kBlockLength;
+  compress(state, data, num_blocks);
+  // pad the tail with 0x80, zeros and the bit length in one or two blocks
+  byte_t tail[2 * kBlockLength] = {};
+  size_t rest = len - num_blocks * kBlockLength;
+  std::memcpy(tail, data + num_blocks * kBlockLength, rest);
+  tail[rest] = 0x80;
+  size_t tail_len = rest + 9 > kBlockLength ? 2 * kBlockLength : kBlockLength;
+  uint64_t bits = uint64_t(len) << 3;
+  StoreBE32(uint32_t(bits >> 32), tail + tail_len - 8);
+  StoreBE32(uint32_t(bits), tail + tail_len - 4);
+  compress(state, tail, tail_len / kBlockLength);
+  for (int i = 0; i < 8; ++i) StoreBE32(state[i], digest + 4 * i);
+}
+
+}  // namespace sha256
+}  // namespace ustore
@@ -0,0 +1,122 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "net/message_buffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace ustore {
+
+namespace {
+
+// a header before each buffer records where it comes from, and keeps the
+// buffer aligned as allocated
+constexpr size_t kHeaderSize = 16;
+constexpr uint32_t kHeapClass = UINT32_MAX;
+// most bytes of free buffers kept for each size class
+constexpr size_t kMaxFreeBytes = MessageBuffer::kMaxPooledSize;
+
+class Pool {
+ public:
+  static Pool* Instance() {
+    // never destroyed, as buffers may be freed by network threads at exit
+    static Pool* pool = new Pool();
+    return pool;
+  }
+
+  byte_t* Acquire(size_t size) {
+    const uint32_t cls = SizeClass(size);
+    byte_t* raw = nullptr;
+    if (cls == kHeapClass) {
+      raw = new byte_t[kHeaderSize + size];
+    } else {
+      Bucket& b = buckets_[cls];
+      {
+        std::lock_guard<std::mutex> lock(b.mtx);
+        if (!b.free.empty()) {
+          raw = b.free.back();
+          b.free.pop_back();
+        }
+      }
+      if (raw == nullptr) raw = new byte_t[kHeaderSize + ClassSize(cls)];
+    }
+    *reinterpret_cast<uint32_t*>(raw) = cls;
+    return raw + kHeaderSize;
+  }
+
+  void Return(byte_t* data) {
+    byte_t* raw = data - kHeaderSize;
+    const uint32_t cls = *reinterpret_cast<uint32_t*>(raw);
+    if (cls != kHeapClass) {
+      Bucket& b = buckets_[cls];
+      std::lock_guard<std::mutex> lock(b.mtx);
+      if (b.free.size() < std::max(size_t(1), kMaxFreeBytes / ClassSize(cls))) {
+        b.free.push_back(raw);
+        return;
+      }
+    }
+    delete[] raw;
+  }
+
+ private:
+  static constexpr size_t kNumClasses = 15;
+  static_assert(MessageBuffer::kMinPooledSize << (kNumClasses - 1) ==
+                MessageBuffer::kMaxPooledSize, "size classes mismatch");
+
+  struct Bucket {
+    std::mutex mtx;
+    std::vector<byte_t*> free;
+  };
+
+  // the smallest class of powers of two that fits the size
+  static inline uint32_t SizeClass(size_t size) {
+    if (size > MessageBuffer::kMaxPooledSize) return kHeapClass;
+    uint32_t cls = 0;
+    while (ClassSize(cls) < size) ++cls;
+    return cls;
+  }
+  static inline size_t ClassSize(uint32_t cls) {
+    return MessageBuffer::kMinPooledSize << cls;
+  }
+
+  Pool() = default;
+
+  Bucket buckets_[kNumClasses];
+};
+
+}  // namespace
+
+void MessageBuffer::Free(void* data, void* hint) {
+  if (data != nullptr) Pool::Instance()->Return(static_cast<byte_t*>(data));
+}
+
+MessageBuffer::MessageBuffer(size_t size)
+  : data_(Pool::Instance()->Acquire(size)), size_(size) {}
+
+MessageBuffer::MessageBuffer(MessageBuffer&& other) noexcept
+  : data_(other.data_), size_(other.size_) {
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+MessageBuffer& MessageBuffer::operator=(MessageBuffer&& other) noexcept {
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  return *this;
+}
+
+MessageBuffer::~MessageBuffer() {
+  Free(data_, nullptr);
+}
+
+byte_t* MessageBuffer::Release() noexcept {
+  byte_t* data = data_;
+  data_ = nullptr;
+  size_ = 0;
+  return data;
+}
+
+}  // namespace ustore
@@ -7,7 +7,9 @@
 #ifdef USE_RDMA
 #include "net/rdma_net.h"
 #else
+#include "net/tcp_net.h"
 #include "net/zmq_net.h"
+#include "utils/env.h"
 #endif  // USE_RDMA
 
 namespace ustore {
@@ -37,12 +39,24 @@ void Net::CreateNetContexts(const std::vector<node_id_t>& nodes) {
 
 void Net::DeleteNetContext(NetContext* ctx) { delete ctx; }
 
+ssize_t NetContext::SyncSend(const void *ptr, size_t len) {
+  // not implemented for now
+  return 0;
+}
+
+ssize_t NetContext::SyncRecv(const void *ptr, size_t len) {
+  // not implemented for now
+  return 0;
+}
+
 namespace net {
 
 Net* CreateServerNetwork(const node_id_t& id, int n_threads) {
 #ifdef USE_RDMA
   return new RdmaNet(id, n_threads);
 #else
+  if (Env::Instance()->config().net_backend() == Config::TCP)
+    return new ServerTcpNet(id, n_threads);
   return new ServerZmqNet(id, n_threads);
 #endif
   LOG(FATAL) << "Failed to create network instance";
@@ -53,6 +67,8 @@ Net* CreateClientNetwork(int n_threads) {
 #ifdef USE_RDMA
   return new RdmaNet("", n_threads);
 #else
+  if (Env::Instance()->config().net_backend() == Config::TCP)
+    return new ClientTcpNet(n_threads);
   return new ClientZmqNet(n_threads);
 #endif
   LOG(FATAL) << "Failed to create network instance";
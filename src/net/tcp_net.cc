@@ -0,0 +1,491 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "net/tcp_net.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "net/ae.h"
+#include "net/anet.h"
+#include "utils/logging.h"
+
+namespace ustore {
+
+constexpr int kSocketBindTimeout = 1;
+constexpr int kSocketTrials = 20;
+constexpr int kListenBacklog = 511;
+// initial # of fds tracked by an event loop, which grows on demand
+constexpr int kEventLoopSetSize = 1024;
+// bytes of the length before each message
+constexpr size_t kFrameHeaderSize = sizeof(uint32_t);
+// bytes read from a socket at a time, unless a larger message is expected
+constexpr size_t kReadBufferSize = 64 << 10;
+// most buffers gathered by a write
+constexpr int kMaxIov = 64;
+
+// split "host:port" of a node id
+static void SplitAddress(const node_id_t& id, std::string* host, int* port) {
+  size_t split = id.rfind(':');
+  CHECK_NE(split, std::string::npos) << "invalid address " << id;
+  *host = id.substr(0, split);
+  *port = std::stoi(id.substr(split + 1));
+}
+
+class TcpNet::EventLoop {
+ public:
+  EventLoop() : el_(aeCreateEventLoop(kEventLoopSetSize)) {
+    CHECK(el_) << "Failed to create event loop";
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_GE(wakeup_fd_, 0) << "Failed to create event fd";
+    auto wakeup = [](aeEventLoop*, int, void* data, int) {
+      static_cast<EventLoop*>(data)->RunTasks();
+    };
+    CHECK_EQ(aeCreateFileEvent(el_, wakeup_fd_, AE_READABLE, wakeup, this),
+             AE_OK);
+  }
+  ~EventLoop() {
+    aeDeleteEventLoop(el_);
+    close(wakeup_fd_);
+  }
+
+  // run until stopped
+  void Run() { aeMain(el_); }
+  void Stop() { Post([this] { aeStop(el_); }); }
+
+  // run the task in the loop, from any thread
+  void Post(std::function<void()> task) {
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      idle = tasks_.empty();
+      tasks_.push_back(std::move(task));
+    }
+    if (idle) {
+      uint64_t one = 1;
+      CHECK_EQ(write(wakeup_fd_, &one, sizeof(one)), ssize_t(sizeof(one)));
+    }
+  }
+
+  // watch the fd, growing the set of fds if needed; loop thread only
+  bool Watch(int fd, int mask, aeFileProc* proc, void* data) {
+    if (fd >= aeGetSetSize(el_) &&
+        aeResizeSetSize(el_, std::max(fd + 1, 2 * aeGetSetSize(el_)))
+          != AE_OK)
+      return false;
+    return aeCreateFileEvent(el_, fd, mask, proc, data) == AE_OK;
+  }
+  void Unwatch(int fd, int mask) { aeDeleteFileEvent(el_, fd, mask); }
+
+  // run the posted tasks; loop thread only
+  void RunTasks() {
+    uint64_t count;
+    // reset the event fd before taking tasks, so none is missed
+    if (read(wakeup_fd_, &count, sizeof(count)) < 0) {}
+    std::vector<std::function<void()>> tasks;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      tasks.swap(tasks_);
+    }
+    for (auto& task : tasks) task();
+  }
+
+ private:
+  aeEventLoop* const el_;
+  int wakeup_fd_;
+  std::mutex mtx_;
+  std::vector<std::function<void()>> tasks_;
+};
+
+class TcpNet::Connection : public std::enable_shared_from_this<Connection> {
+ public:
+  // source: of the messages received through the connection
+  Connection(int fd, const node_id_t& source, TcpNet* net, EventLoop* loop)
+    : fd_(fd), source_(source), net_(net), loop_(loop),
+      rbuf_(kReadBufferSize) {}
+  ~Connection() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  inline const node_id_t& source() const { return source_; }
+  inline EventLoop* loop() const { return loop_; }
+
+  // write the message from any thread, queuing what the socket cannot take
+  ssize_t Send(MessageBuffer msg) {
+    const size_t len = msg.size();
+    CHECK_LE(len, UINT32_MAX) << "Message is too large to frame";
+    bool ok;
+    {
+      std::lock_guard<std::mutex> lock(send_mtx_);
+      if (fd_ < 0 || failed_) return -1;
+      const bool idle = outq_.empty();
+      outq_.push_back({htonl(static_cast<uint32_t>(len)), std::move(msg), 0});
+      // otherwise the event loop is waiting to write earlier messages
+      if (!idle) return len;
+      ok = Flush();
+      if (ok && outq_.empty()) return len;
+      if (!ok) failed_ = true;
+    }
+    // let the event loop write the rest, or close the connection
+    auto self = shared_from_this();
+    if (!ok) {
+      loop_->Post([self] { self->Close(); });
+      return -1;
+    }
+    loop_->Post([self] { self->WatchWritable(); });
+    return len;
+  }
+
+  // loop thread only
+  void Open() {
+    auto read = [](aeEventLoop*, int, void* data, int) {
+      static_cast<Connection*>(data)->OnReadable();
+    };
+    if (!loop_->Watch(fd_, AE_READABLE, read, this)) {
+      LOG(ERROR) << "Failed to watch connection " << source_;
+      Close();
+    }
+  }
+
+  // stop watching and close the fd; loop thread only
+  void Close() {
+    // the net may drop the last reference
+    auto self = shared_from_this();
+    {
+      std::lock_guard<std::mutex> lock(send_mtx_);
+      if (fd_ < 0) return;
+      loop_->Unwatch(fd_, AE_READABLE | AE_WRITABLE);
+      // no more writes may reach the fd once it is closed and reused
+      close(fd_);
+      fd_ = -1;
+      outq_.clear();
+    }
+    net_->OnClose(this);
+  }
+
+ private:
+  struct Frame {
+    uint32_t header;
+    MessageBuffer body;
+    // bytes of header and body sent
+    size_t sent;
+  };
+
+  // read and dispatch all complete messages
+  void OnReadable() {
+    for (;;) {
+      const size_t avail = rbuf_.size() - rlen_;
+      ssize_t n = read(fd_, &rbuf_[rlen_], avail);
+      if (n > 0) {
+        rlen_ += n;
+        Consume();
+        // the socket is drained
+        if (size_t(n) < avail) return;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      } else {
+        if (n < 0) LOG(WARNING) << "Read from " << source_ << " failed: "
+                                << std::strerror(errno);
+        Close();
+        return;
+      }
+    }
+  }
+
+  void OnWritable() {
+    {
+      std::lock_guard<std::mutex> lock(send_mtx_);
+      if (fd_ < 0) return;
+      const bool ok = Flush();
+      if (ok && !outq_.empty()) return;
+      loop_->Unwatch(fd_, AE_WRITABLE);
+      watching_writable_ = false;
+      if (ok) return;
+      failed_ = true;
+    }
+    Close();
+  }
+
+  void WatchWritable() {
+    auto write = [](aeEventLoop*, int, void* data, int) {
+      static_cast<Connection*>(data)->OnWritable();
+    };
+    {
+      std::lock_guard<std::mutex> lock(send_mtx_);
+      if (fd_ < 0 || watching_writable_ || outq_.empty()) return;
+      if (loop_->Watch(fd_, AE_WRITABLE, write, this)) {
+        watching_writable_ = true;
+        return;
+      }
+      failed_ = true;
+    }
+    Close();
+  }
+
+  // write queued frames until the socket is full, false on failure; called
+  // with send_mtx_ held
+  bool Flush() {
+    struct iovec iov[kMaxIov];
+    struct msghdr hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    while (!outq_.empty()) {
+      int n = 0;
+      for (auto it = outq_.begin(); it != outq_.end() && n + 2 <= kMaxIov;
+           ++it) {
+        size_t sent = it->sent;
+        if (sent < kFrameHeaderSize) {
+          iov[n].iov_base = reinterpret_cast<byte_t*>(&it->header) + sent;
+          iov[n++].iov_len = kFrameHeaderSize - sent;
+          sent = 0;
+        } else {
+          sent -= kFrameHeaderSize;
+        }
+        if (it->body.size() > sent) {
+          iov[n].iov_base = it->body.data() + sent;
+          iov[n++].iov_len = it->body.size() - sent;
+        }
+      }
+      hdr.msg_iov = iov;
+      hdr.msg_iovlen = n;
+      // sendmsg gathers like writev, without raising SIGPIPE
+      ssize_t written = sendmsg(fd_, &hdr, MSG_NOSIGNAL);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        LOG(WARNING) << "Write to " << source_ << " failed: "
+                     << std::strerror(errno);
+        return false;
+      }
+      // drop the frames fully written
+      size_t left = written;
+      while (left > 0) {
+        Frame& f = outq_.front();
+        const size_t remain = kFrameHeaderSize + f.body.size() - f.sent;
+        if (left < remain) {
+          f.sent += left;
+          break;
+        }
+        left -= remain;
+        outq_.pop_front();
+      }
+    }
+    return true;
+  }
+
+  // dispatch complete messages in the read buffer
+  void Consume() {
+    size_t pos = 0;
+    // bytes of the next message with its header
+    size_t need = kFrameHeaderSize;
+    while (rlen_ - pos >= kFrameHeaderSize) {
+      uint32_t len;
+      std::memcpy(&len, &rbuf_[pos], kFrameHeaderSize);
+      need = kFrameHeaderSize + ntohl(len);
+      if (rlen_ - pos < need) break;
+      net_->Dispatch(source_, &rbuf_[pos + kFrameHeaderSize],
+                     need - kFrameHeaderSize);
+      pos += need;
+      need = kFrameHeaderSize;
+    }
+    rlen_ -= pos;
+    if (pos > 0 && rlen_ > 0) std::memmove(&rbuf_[0], &rbuf_[pos], rlen_);
+    // make room for the next message at once, and give back the room of a
+    // large one once done
+    const size_t size = std::max(need, kReadBufferSize);
+    if (rbuf_.size() < size) {
+      rbuf_.resize(size);
+    } else if (rbuf_.size() > 2 * size) {
+      std::vector<byte_t>(rbuf_.begin(), rbuf_.begin() + size).swap(rbuf_);
+    }
+  }
+
+  int fd_;
+  const node_id_t source_;
+  TcpNet* const net_;
+  EventLoop* const loop_;
+
+  std::mutex send_mtx_;
+  std::deque<Frame> outq_;
+  bool watching_writable_ = false;
+  // a write failed, and the connection is to be closed
+  bool failed_ = false;
+
+  std::vector<byte_t> rbuf_;
+  size_t rlen_ = 0;
+};
+
+TcpNet::TcpNet(const node_id_t& id, int nthreads)
+    : Net(id), next_loop_(0) {
+  for (int i = 0; i < std::max(nthreads, 1); ++i)
+    loops_.emplace_back(new EventLoop());
+  is_running_ = true;
+}
+
+TcpNet::~TcpNet() = default;
+
+void TcpNet::Start() {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < loops_.size(); ++i)
+    threads.emplace_back(&EventLoop::Run, loops_[i].get());
+  loops_[0]->Run();
+  for (auto& t : threads) t.join();
+}
+
+void TcpNet::Stop() {
+  is_running_ = false;
+  for (auto& loop : loops_) loop->Stop();
+}
+
+void TcpNet::Dispatch(const node_id_t& source, const void* msg, int size) {
+  (*cb_)(msg, size, source);
+}
+
+void TcpNet::Attach(const std::shared_ptr<Connection>& conn) {
+  conn->loop()->Post([conn] { conn->Open(); });
+}
+
+ServerTcpNet::ServerTcpNet(const node_id_t& id, int nthreads)
+    : TcpNet(id, nthreads) {
+  std::string host;
+  int port;
+  SplitAddress(id, &host, &port);
+  char err[ANET_ERR_LEN];
+  int ntries = kSocketTrials;
+  while ((listen_fd_ = anetTcpServer(err, port, &host[0], kListenBacklog))
+         == ANET_ERR && ntries--) {
+    LOG(WARNING) << "Failed to listen at " << id << ": " << err;
+    sleep(kSocketBindTimeout);
+  }
+  CHECK_GE(listen_fd_, 0) << "Failed to listen at " << id;
+  CHECK_EQ(anetNonBlock(err, listen_fd_), ANET_OK) << err;
+}
+
+ServerTcpNet::~ServerTcpNet() {
+  conns_.clear();
+  close(listen_fd_);
+}
+
+NetContext* ServerTcpNet::CreateNetContext(const node_id_t& id) {
+  LOG(FATAL) << "Cannot connect from a server network";
+  return nullptr;
+}
+
+void ServerTcpNet::Start() {
+  auto accept = [](aeEventLoop*, int, void* data, int) {
+    static_cast<ServerTcpNet*>(data)->Accept();
+  };
+  CHECK(loops_[0]->Watch(listen_fd_, AE_READABLE, accept, this));
+  TcpNet::Start();
+}
+
+void ServerTcpNet::Accept() {
+  char err[ANET_ERR_LEN];
+  char ip[INET6_ADDRSTRLEN];
+  int port;
+  int fd;
+  while ((fd = anetTcpAccept(err, listen_fd_, ip, sizeof(ip), &port))
+         != ANET_ERR) {
+    if (anetNonBlock(err, fd) != ANET_OK ||
+        anetEnableTcpNoDelay(err, fd) != ANET_OK) {
+      LOG(WARNING) << "Failed to set up connection: " << err;
+      close(fd);
+      continue;
+    }
+    // sources stay unique even if fds are reused
+    node_id_t source = std::to_string(num_accepted_++);
+    EventLoop* loop = loops_[next_loop_++ % loops_.size()].get();
+    auto conn = std::make_shared<Connection>(fd, source, this, loop);
+    {
+      std::lock_guard<shared_mutex> lock(conns_mtx_);
+      conns_.emplace(source, conn);
+    }
+    Attach(conn);
+  }
+}
+
+void ServerTcpNet::OnClose(Connection* conn) {
+  std::lock_guard<shared_mutex> lock(conns_mtx_);
+  conns_.erase(conn->source());
+}
+
+ssize_t ServerTcpNet::Reply(const node_id_t& source, const void* ptr,
+                            size_t len) {
+  MessageBuffer msg(len);
+  std::memcpy(msg.data(), ptr, len);
+  return Reply(source, std::move(msg));
+}
+
+ssize_t ServerTcpNet::Reply(const node_id_t& source, MessageBuffer msg) {
+  if (!is_running_) return -1;
+  std::shared_ptr<Connection> conn;
+  {
+    shared_lock<shared_mutex> lock(conns_mtx_);
+    auto it = conns_.find(source);
+    // the client is gone
+    if (it == conns_.end()) return -1;
+    conn = it->second;
+  }
+  return conn->Send(std::move(msg));
+}
+
+ClientTcpNet::ClientTcpNet(int nthreads) : TcpNet("", nthreads) {}
+
+NetContext* ClientTcpNet::CreateNetContext(const node_id_t& id) {
+  if (netmap_.count(id)) return netmap_[id];
+  std::string host;
+  int port;
+  SplitAddress(id, &host, &port);
+  char err[ANET_ERR_LEN];
+  int fd;
+  int ntries = kSocketTrials;
+  while ((fd = anetTcpConnect(err, &host[0], port)) == ANET_ERR && ntries--) {
+    LOG(WARNING) << "Failed to connect to " << id << ": " << err;
+    sleep(kSocketBindTimeout);
+  }
+  CHECK_GE(fd, 0) << "Failed to connect to " << id;
+  CHECK_EQ(anetNonBlock(err, fd), ANET_OK) << err;
+  CHECK_EQ(anetEnableTcpNoDelay(err, fd), ANET_OK) << err;
+  // responses are dispatched as from the worker
+  EventLoop* loop = loops_[next_loop_++ % loops_.size()].get();
+  auto conn = std::make_shared<Connection>(fd, id, this, loop);
+  Attach(conn);
+  auto ctx = new TcpNetContext(cur_node_, id, conn);
+  netmap_[id] = ctx;
+  return ctx;
+}
+
+void ClientTcpNet::OnClose(Connection* conn) {
+  if (is_running_)
+    LOG(WARNING) << "Connection to " << conn->source() << " is closed";
+  // no response is coming through the connection any more
+  if (on_close_) on_close_(conn->source());
+}
+
+TcpNetContext::TcpNetContext(const node_id_t& src, const node_id_t& dest,
+                             std::shared_ptr<TcpNet::Connection> conn)
+  : NetContext(src, dest), conn_(std::move(conn)) {}
+
+ssize_t TcpNetContext::Send(const void* ptr, size_t len, CallBack* func) {
+  MessageBuffer msg(len);
+  std::memcpy(msg.data(), ptr, len);
+  return Send(std::move(msg));
+}
+
+ssize_t TcpNetContext::Send(MessageBuffer msg) {
+  return conn_->Send(std::move(msg));
+}
+
+}  // namespace ustore
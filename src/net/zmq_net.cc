@@ -6,11 +6,16 @@
 #include <gflags/gflags.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
 #include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <string>
 #include <set>
 #include <thread>
+#include <utility>
 #include "utils/logging.h"
 
 namespace ustore {
@@ -19,11 +24,10 @@ namespace ustore {
  * Implementation of Network communication via ZeroMQ
  */
 
-// total wait time for socket: kWaitInterval*kPollRetries
-constexpr int kWaitInterval = 10;
 constexpr int kSocketBindTimeout = 1;
 constexpr int kSocketTrials = 20;
-size_t ClientZmqNet::msg_timeout = 20000;
+// separates the processing thread and the client identity in a source
+constexpr char kSourceSep = '/';
 
 using std::string;
 using std::vector;
@@ -31,16 +35,80 @@ using std::unordered_map;
 // server thread to process messages
 void ServerThread(void *args);
 
+// copy the data into a buffer to send
+static MessageBuffer CopyToBuffer(const void* ptr, size_t len) {
+  MessageBuffer msg(len);
+  std::memcpy(msg.data(), ptr, len);
+  return msg;
+}
+
+// send the message after a frame of the source id, handing its buffer over
+// to zmq which frees it once sent
+static ssize_t SendFrames(void* sock, const string& src_id,
+                          MessageBuffer msg) {
+  const size_t len = msg.size();
+  byte_t* data = msg.Release();
+  zmq_msg_t frame;
+  if (zmq_msg_init_data(&frame, data, len, MessageBuffer::Free, nullptr)) {
+    MessageBuffer::Free(data, nullptr);
+    return -1;
+  }
+  if (zmq_send(sock, src_id.data(), src_id.size(), ZMQ_SNDMORE) < 0 ||
+      zmq_msg_send(&frame, sock, 0) < 0) {
+    zmq_msg_close(&frame);
+    return -1;
+  }
+  return len;
+}
+
+// create a socket without high-water marks, at which ROUTER sockets drop
+// messages silently and DEALER ones block the polling threads; the queues are
+// bounded by the requests the clients keep in flight instead
+static zsock_t* NewSocket(int type) {
+  zsock_t* sock = zsock_new(type);
+  zsock_set_sndhwm(sock, 0);
+  zsock_set_rcvhwm(sock, 0);
+  return sock;
+}
+
+// poll item of an event fd
+static inline zmq_pollitem_t FdPollItem(int fd) {
+  return {nullptr, fd, ZMQ_POLLIN, 0};
+}
+
+static inline void Notify(int fd) {
+  uint64_t one = 1;
+  CHECK_EQ(write(fd, &one, sizeof(one)), ssize_t(sizeof(one)));
+}
+
+ZmqNet::ZmqNet(const node_id_t& id, int nthreads)
+    : Net(id), nthreads_(nthreads) {
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  CHECK_GE(stop_fd_, 0) << "Failed to create event fd";
+}
+
+ZmqNet::~ZmqNet() {
+  close(stop_fd_);
+}
+
 void ZmqNet::Stop() {
   is_running_ = false;
+  // never read, so that every polling thread sees it
+  Notify(stop_fd_);
+}
+
+NetContext* ZmqNet::CreateNetContext(const node_id_t& id) {
+  LOG(FATAL) << "Cannot connect from a server network";
+  return nullptr;
 }
 
 ZmqNetContext::ZmqNetContext(const node_id_t& src, const node_id_t& dest,
-    ClientZmqNet *net) : NetContext(src, dest), client_net_(net) {
-  // start connection to the remote host
-  send_sock_ = zsock_new(ZMQ_DEALER);
-  zsock_connect((zsock_t *)send_sock_, "%s",
-      client_net_->request_ep_.c_str());
+    ClientZmqNet *net, size_t shard)
+    : NetContext(src, dest), client_net_(net), shard_(shard) {
+  // connect to the remote host directly, which zmq completes in background
+  send_sock_ = NewSocket(ZMQ_DEALER);
+  string host = "tcp://" + dest;
+  CHECK_EQ(zsock_connect((zsock_t *)send_sock_, "%s", host.c_str()), 0);
 }
 
 ZmqNetContext::~ZmqNetContext() {
@@ -49,17 +117,11 @@ ZmqNetContext::~ZmqNetContext() {
 }
 
 ssize_t ZmqNetContext::Send(const void *ptr, size_t len, CallBack* func) {
-  zframe_t* frame = zframe_new(ptr, len);
-  // free((char*) ptr);
-  zframe_t* id = zframe_new(src_id_.c_str(), src_id_.length());
-  zmsg_t* msg = zmsg_new();
-  zmsg_pushstr(msg, dest_id_.c_str());
-  zmsg_append(msg, &id);
-  zmsg_append(msg, &frame);
-  send_lock_.lock();
-  int st = zmsg_send(&msg, (zsock_t *)send_sock_) == 0 ? len : -1;
-  send_lock_.unlock();
-  return st;
+  return Send(CopyToBuffer(ptr, len));
+}
+
+ssize_t ZmqNetContext::Send(MessageBuffer msg) {
+  return client_net_->Post(this, std::move(msg));
 }
 
 void ZmqNet::Dispatch(const node_id_t& source, const void *msg, int size) {
@@ -75,160 +137,124 @@ void ZmqNet::Dispatch(const node_id_t& source, const void *msg, int size) {
   // recv_lock_.unlock();
 }
 
-ssize_t NetContext::SyncSend(const void *ptr, size_t len) {
-  // not implemented for now
-  return 0;
-}
-
-ssize_t NetContext::SyncRecv(const void *ptr, size_t len) {
-  // not implemented for now
-  return 0;
-}
-
-
-// ClientZMQ constructor
-ClientZmqNet::ClientZmqNet(int nthreads) : ZmqNet("", nthreads) {
-  int status;
-  int ntries = kSocketTrials;
-  srand(time(NULL));
-  int port = rand() % 0xffffff;
-  inproc_ep_ = "inproc://"  + std::to_string(port);
+class ClientZmqNet::Shard {
+ public:
+  Shard() {
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_GE(wakeup_fd_, 0) << "Failed to create event fd";
+  }
+  ~Shard() { close(wakeup_fd_); }
+
+  // queue the message, and wake up the thread if it may be waiting
+  void Push(ZmqNetContext* ctx, MessageBuffer msg) {
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      idle = outbox_.empty();
+      outbox_.emplace_back(ctx, std::move(msg));
+    }
+    if (idle) Notify(wakeup_fd_);
+  }
 
-  // make sure that the ipc socket binds successfully
-  backend_sock_ = zsock_new(ZMQ_DEALER);
-  ntries = kSocketTrials;
-  while ((status = zsock_bind((zsock_t *)backend_sock_, "%s",
-          inproc_ep_.c_str())) && ntries--) {
-    sleep(kSocketBindTimeout);
-    port = rand() & 0xffffff;
-    inproc_ep_ = "inproc://"  + std::to_string(port);
+  // take all queued messages
+  void Pop(vector<std::pair<ZmqNetContext*, MessageBuffer>>* msgs) {
+    uint64_t count;
+    // reset the event fd before taking messages, so none is missed
+    if (read(wakeup_fd_, &count, sizeof(count)) < 0) {}
+    std::lock_guard<std::mutex> lock(mtx_);
+    msgs->swap(outbox_);
   }
-  CHECK_EQ(status, 0);
 
-  // request_sock_
-  port = rand() % 0xffffff;
-  request_ep_ = "inproc://"  + std::to_string(port);
+  inline int wakeupFd() const { return wakeup_fd_; }
 
-  // make sure that the ipc socket binds successfully
-  request_sock_ = zsock_new(ZMQ_ROUTER);
-  ntries = kSocketTrials;
-  while ((status = zsock_bind((zsock_t *)request_sock_, "%s",
-          request_ep_.c_str())) && ntries--) {
-    sleep(kSocketBindTimeout);
-    port = rand() & 0xffffff;
-    request_ep_ = "inproc://"  + std::to_string(port);
-  }
-  CHECK_EQ(status, 0);
+  // connections served by the thread
+  vector<ZmqNetContext*> contexts;
+
+ private:
+  std::mutex mtx_;
+  vector<std::pair<ZmqNetContext*, MessageBuffer>> outbox_;
+  int wakeup_fd_;
+};
 
+// ClientZMQ constructor
+ClientZmqNet::ClientZmqNet(int nthreads) : ZmqNet("", std::max(nthreads, 1)) {
+  for (int i = 0; i < nthreads_; ++i) shards_.emplace_back(new Shard());
   is_running_ = true;
-  timeout_counter_ = ClientZmqNet::msg_timeout;
-  request_counter_ = 0;
 }
 
-NetContext* ZmqNet::CreateNetContext(const node_id_t& id) {
-  ZmqNetContext* ctx = nullptr;
+ClientZmqNet::~ClientZmqNet() = default;
+
+NetContext* ClientZmqNet::CreateNetContext(const node_id_t& id) {
   if (!netmap_.count(id)) {
-    ctx = new ZmqNetContext(cur_node_, id,
-                      reinterpret_cast<ClientZmqNet *>(this));
+    // the receiving threads only poll the connections made before
+    CHECK(!started_) << "Cannot connect to " << id << " after start";
+    // spread the connections over receiving threads in turn
+    size_t shard = netmap_.size() % shards_.size();
+    auto ctx = new ZmqNetContext(cur_node_, id, this, shard);
+    shards_[shard]->contexts.push_back(ctx);
     netmap_[id] = ctx;
   }
   CHECK(netmap_[id]) << "Creating netcontext failed";
   return netmap_[id];
 }
 
+ssize_t ClientZmqNet::Post(ZmqNetContext* ctx, MessageBuffer msg) {
+  if (!is_running_) return -1;
+  ssize_t len = msg.size();
+  shards_[ctx->shard_]->Push(ctx, std::move(msg));
+  return len;
+}
+
 void ClientZmqNet::Start() {
-  // start backend thread
-  for (int i = 0; i < nthreads_; i++)
-    backend_threads_.emplace_back(&ClientZmqNet::ClientThread, this);
-
-  int pollsize = netmap_.size() + 1;
-  zmq_pollitem_t items[pollsize];
-  items[0] = {zsock_resolve(request_sock_), 0, ZMQ_POLLIN, 0};
-  // start DEALER socket to other
-  unordered_map<node_id_t, void*> out_socks;
-  int counter = 0;
-  for (auto n : netmap_) {
-    void *sock_ = zsock_new(ZMQ_DEALER);
-    string host = "tcp://" + n.first;
-    CHECK_EQ(zsock_connect((zsock_t *)sock_, "%s", host.c_str()), 0);
-    out_socks[n.first] = sock_;
-    // zpoller_add(zpoller, sock_);
-    items[++counter] = {zsock_resolve(sock_), 0, ZMQ_POLLIN, 0};
-  }
+  started_ = true;
+  for (size_t i = 1; i < shards_.size(); ++i)
+    backend_threads_.emplace_back(&ClientZmqNet::Serve, this,
+                                  shards_[i].get());
+  Serve(shards_[0].get());
+  for (auto& t : backend_threads_) t.join();
+  backend_threads_.clear();
+}
 
+void ClientZmqNet::Serve(Shard* shard) {
+  const vector<ZmqNetContext*>& contexts = shard->contexts;
+  // the connections, followed by the wakeup and the stop event fds
+  vector<zmq_pollitem_t> items;
+  for (auto ctx : contexts)
+    items.push_back({zsock_resolve(ctx->send_sock_), 0, ZMQ_POLLIN, 0});
+  const size_t wakeup = items.size();
+  items.push_back(FdPollItem(shard->wakeupFd()));
+  items.push_back(FdPollItem(stop_fd_));
+
+  vector<std::pair<ZmqNetContext*, MessageBuffer>> outbox;
+  // requests without responses are expired by the client service, see
+  // request_timeout_ms
   while (is_running_) {
-    int rc = zmq_poll(items, pollsize, kWaitInterval);
+    int rc = zmq_poll(items.data(), static_cast<int>(items.size()), -1);
     // error
     if (rc < 0) break;
 
-    // expired
-    if (rc == 0 && is_running_ && !(timeout_counter_--)
-        && request_counter_)
-       LOG(FATAL) << "Connection timed out. \
-                      Server may not be ready yet or has crashed!";
-
-    // all well
-    if (items[0].revents & ZMQ_POLLIN) {
-      zmsg_t *msg = zmsg_recv(request_sock_);
-      if (!msg) break;
-      zmsg_pop(msg);
-      char *dest_id = zmsg_popstr(msg);
-      zmsg_send(&msg, out_socks[dest_id]);
-      request_counter_++;
-      timeout_counter_ = ClientZmqNet::msg_timeout;
+    if (items[wakeup].revents & ZMQ_POLLIN) {
+      shard->Pop(&outbox);
+      for (auto& m : outbox)
+        SendFrames(zsock_resolve(m.first->send_sock_), m.first->srcID(),
+                   std::move(m.second));
+      outbox.clear();
     }
-    for (int i = 1; i < pollsize; i++) {
-      if (items[i].revents & ZMQ_POLLIN) {
-        zmsg_t *msg = zmsg_recv(items[i].socket);
-        if (!msg) break;
-        zmsg_send(&msg, backend_sock_);
-        request_counter_--;
-        timeout_counter_ = ClientZmqNet::msg_timeout;
-      }
-    }
-  }
-  // Stop when ^C
-  zsock_destroy((zsock_t **)&backend_sock_);
-  zsock_destroy((zsock_t **)&request_sock_);
-  for (auto s : out_socks)
-    zsock_destroy((zsock_t **)&s.second);
-
-  Stop();
-  // zpoller_destroy(&zpoller);
-  for (size_t i=0; i < backend_threads_.size(); i++)
-    backend_threads_[i].join();
-}
-
-void ClientZmqNet::ClientThread() {
-  // create and connect to the frontend's dealer socket
-  void *frontend = zsock_new(ZMQ_DEALER);
-  CHECK_EQ(zsock_connect((zsock_t *)frontend,
-           "%s", inproc_ep_.c_str()), 0);
-  zmq_pollitem_t items[1];
-  items[0] = {zsock_resolve(frontend), 0, ZMQ_POLLIN, 0};
-  while (IsRunning()) {
-    int rc = zmq_poll(items, 1, kWaitInterval);
-    if (rc < 0)
-      break;
-
-    if (items[0].revents & ZMQ_POLLIN) {
-      zmsg_t *msg = zmsg_recv(frontend);
-      if (!msg)
-        break;
-
-      // message processing
+    for (size_t i = 0; i < contexts.size(); ++i) {
+      if (!(items[i].revents & ZMQ_POLLIN)) continue;
+      zmsg_t *msg = zmsg_recv(items[i].socket);
+      if (!msg) break;
       // first frame is connection ID
       // final frame is the message itself
-      char *connection_id = zmsg_popstr(msg);
-
+      zframe_t *id = zmsg_pop(msg);
       zframe_t *content = zmsg_pop(msg);
-      Dispatch(string(connection_id),
-          zframe_data(content), zframe_size(content));
+      Dispatch(contexts[i]->destID(), zframe_data(content),
+               zframe_size(content));
       zframe_destroy(&content);
-      free(connection_id);
+      zframe_destroy(&id);
+      zmsg_destroy(&msg);
     }
   }
-  zsock_destroy((zsock_t **)&frontend);
 }
 
 ServerZmqNet::ServerZmqNet(const node_id_t& id, int nthreads)
@@ -237,7 +263,7 @@ ServerZmqNet::ServerZmqNet(const node_id_t& id, int nthreads)
   int ntries = kSocketTrials;
 
   // start router socket
-  recv_sock_ = zsock_new(ZMQ_ROUTER);
+  recv_sock_ = NewSocket(ZMQ_ROUTER);
 
   int split = id.find(':');
   string hostname = id.substr(0, split);
@@ -261,7 +287,7 @@ ServerZmqNet::ServerZmqNet(const node_id_t& id, int nthreads)
   inproc_ep_ = "inproc://"  + std::to_string(iport);
 
   // backend socket
-  backend_sock_ = zsock_new(ZMQ_DEALER);
+  backend_sock_ = NewSocket(ZMQ_DEALER);
   ntries = kSocketTrials;
   while ((status = zsock_bind((zsock_t *)backend_sock_, "%s",
           inproc_ep_.c_str())) && ntries--) {
@@ -276,7 +302,7 @@ ServerZmqNet::ServerZmqNet(const node_id_t& id, int nthreads)
   result_ep_ = "inproc://" + std::to_string(iport);
 
   // result socket
-  result_sock_ = zsock_new(ZMQ_DEALER);
+  result_sock_ = NewSocket(ZMQ_DEALER);
   ntries = kSocketTrials;
   while ((status = zsock_bind((zsock_t *)result_sock_, "%s",
           result_ep_.c_str())) && ntries--) {
@@ -302,13 +328,13 @@ void ServerZmqNet::Start() {
 
   // zpoller_t *zpoller = zpoller_new(recv_sock_, result_sock_, NULL);
   // CHECK_NOTNULL(zpoller);
-  zmq_pollitem_t items[2];
+  zmq_pollitem_t items[3];
   items[0] = {zsock_resolve(recv_sock_), 0, ZMQ_POLLIN, 0};
   items[1] = {zsock_resolve(result_sock_), 0, ZMQ_POLLIN, 0};
+  items[2] = FdPollItem(stop_fd_);
 
   while (is_running_) {
-    // void *sock = zpoller_wait(zpoller, kWaitInterval);
-    int rc = zmq_poll(items, 2, kWaitInterval);
+    int rc = zmq_poll(items, 3, -1);
     if (rc < 0) break;
     // LOG(ERROR) << "Got client message ";
     if (items[0].revents & ZMQ_POLLIN) {
@@ -334,45 +360,62 @@ void ServerZmqNet::Start() {
     backend_threads_[i].join();
 }
 
+ssize_t ServerZmqNet::Reply(const node_id_t& source, const void* ptr,
+                            size_t len) {
+  return Reply(source, CopyToBuffer(ptr, len));
+}
+
+ssize_t ServerZmqNet::Reply(const node_id_t& source, MessageBuffer msg) {
+  if (!is_running_) return -1;
+  size_t split = source.find(kSourceSep);
+  CHECK_NE(split, string::npos) << "source without client identity";
+  auto ctx = static_cast<ServerZmqNetContext*>(
+      GetNetContext(source.substr(0, split)));
+  return ctx->SendTo(source.substr(split + 1), std::move(msg));
+}
+
 ServerZmqNetContext::ServerZmqNetContext(const node_id_t& src,
     const node_id_t& dest, const string& ipc_ep, const string& result_ep,
     const string& id) : NetContext(src, dest), id_(id) {
-  recv_sock_ = zsock_new(ZMQ_DEALER);
+  recv_sock_ = NewSocket(ZMQ_DEALER);
   CHECK_EQ(zsock_connect((zsock_t *)recv_sock_, "%s", ipc_ep.c_str()), 0);
-  send_sock_ = zsock_new(ZMQ_DEALER);
+  send_sock_ = NewSocket(ZMQ_DEALER);
   CHECK_EQ(zsock_connect((zsock_t *)send_sock_, "%s", result_ep.c_str()), 0);
 }
 
 ssize_t ServerZmqNetContext::Send(const void *ptr, size_t len, CallBack* func) {
-  // append id frame
-  CHECK_NOTNULL(client_id_);
-
-  zframe_t* frame = zframe_new(ptr, len);
-  // free((char*) ptr);
-  zframe_t* id = zframe_new(src_id_.c_str(), src_id_.length());
-  zmsg_t* msg = zmsg_new();
-  zmsg_append(msg, &id);
-  zmsg_append(msg, &frame);
-
-  zmsg_prepend(msg, reinterpret_cast<zframe_t**>(&client_id_));
-  send_lock_.lock();
-  int st = zmsg_send(&msg, (zsock_t *)send_sock_) == 0 ? len : -1;
-  send_lock_.unlock();
-  return st;
+  return Send(CopyToBuffer(ptr, len));
+}
+
+ssize_t ServerZmqNetContext::Send(MessageBuffer msg) {
+  CHECK(!client_id_.empty());
+  return SendTo(client_id_, std::move(msg));
+}
+
+ssize_t ServerZmqNetContext::SendTo(const std::string& client_id,
+                                    MessageBuffer msg) {
+  std::lock_guard<std::mutex> lock(send_lock_);
+  // the socket is gone once the processing thread stops
+  if (!send_sock_) return -1;
+  void* sock = zsock_resolve(send_sock_);
+  // route to the client by its identity
+  if (zmq_send(sock, client_id.data(), client_id.size(), ZMQ_SNDMORE) < 0)
+    return -1;
+  return SendFrames(sock, src_id_, std::move(msg));
 }
 
 void ServerZmqNetContext::Start(ServerZmqNet *net) {
   // listen from  recv_sock_
   // zpoller_t *zpoller = zpoller_new(recv_sock_, NULL);
-  zmq_pollitem_t items[1];
+  zmq_pollitem_t items[2];
   items[0] = {zsock_resolve(recv_sock_), 0, ZMQ_POLLIN, 0};
+  items[1] = FdPollItem(net->stopFd());
   while (net->IsRunning()) {
-    // void *sock = zpoller_wait(zpoller, kWaitInterval);
-    int rc = zmq_poll(items, 1, kWaitInterval);
+    int rc = zmq_poll(items, 2, -1);
     if (rc < 0)
       break;
 
-    if (items[0].revents && ZMQ_POLLIN) {
+    if (items[0].revents & ZMQ_POLLIN) {
       zmsg_t *msg = zmsg_recv(items[0].socket);
       if (!msg)
         break;
@@ -381,18 +424,26 @@ void ServerZmqNetContext::Start(ServerZmqNet *net) {
       // first frame is the identity (from router)
       // next contain connection ID
       // final frame is the message itself
-      client_id_ = zmsg_pop(msg);
+      zframe_t *client_id = zmsg_pop(msg);
+      client_id_.assign(reinterpret_cast<char*>(zframe_data(client_id)),
+                        zframe_size(client_id));
+      zframe_destroy(&client_id);
 
       char *connection_id = zmsg_popstr(msg);
 
       zframe_t *content = zmsg_pop(msg);
-      // if there's a response, it will be forwarded by this thread
-      net->Dispatch(id_, zframe_data(content), zframe_size(content));
+      // the response may be sent by this thread, or later by any other
+      // thread via ServerZmqNet::Reply
+      net->Dispatch(id_ + kSourceSep + client_id_, zframe_data(content),
+                    zframe_size(content));
       zframe_destroy(&content);
       free(connection_id);
     }
   }
-  zsock_destroy((zsock_t **)&send_sock_);
+  {
+    std::lock_guard<std::mutex> lock(send_lock_);
+    zsock_destroy((zsock_t **)&send_sock_);
+  }
   zsock_destroy((zsock_t **)&recv_sock_);
 }
 
@@ -3,10 +3,16 @@
 #include "node/blob_node.h"
 
 #include <cstring>  // for memcpy
+#include "utils/env.h"
 #include "utils/logging.h"
 
 namespace ustore {
 
+BlobChunker::BlobChunker() {
+  if (Env::Instance()->config().blob_chunking() == Config::FAST_CDC)
+    SetRHasherEngine(RollingHasher::Engine::kFastCDC);
+}
+
 ChunkInfo BlobChunker::Make(const std::vector<const Segment*>& segments)
     const {
   size_t chunk_num_bytes = 0;
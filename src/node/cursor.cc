@@ -2,14 +2,29 @@
 
 #include "node/cursor.h"
 
+#include <algorithm>
+#include <cmath>
 #include "hash/hash.h"
 #include "node/blob_node.h"
 #include "node/list_node.h"
 #include "node/map_node.h"
 #include "node/meta_node.h"
+#include "utils/env.h"
 #include "utils/logging.h"
 
 namespace ustore {
+
+// Create the node of a chunk, which is kept alive as long as the node, so
+//   that the loader drops it once cursors move past the node
+static std::shared_ptr<const SeqNode> LoadNode(ChunkLoader* loader,
+                                               const Hash& hash) {
+  std::shared_ptr<const Chunk> chunk = loader->LoadShared(hash);
+  const SeqNode* node = SeqNode::CreateFromChunk(chunk.get()).release();
+  return std::shared_ptr<const SeqNode>(node, [chunk](const SeqNode* node) {
+    delete node;
+  });
+}
+
 std::vector<IndexRange> IndexRange::Compact(
     const std::vector<IndexRange>& ranges) {
   if (ranges.size() == 0) return ranges;
@@ -82,9 +97,7 @@ NodeCursor::NodeCursor(const Hash& hash, size_t idx,
   NodeCursor* parent_cursor = nullptr;
   size_t element_idx = idx;
   size_t entry_idx = 0;
-  const Chunk* chunk = ch_loader->Load(hash);
-
-  std::shared_ptr<const SeqNode> seq_node(SeqNode::CreateFromChunk(chunk));
+  std::shared_ptr<const SeqNode> seq_node = LoadNode(ch_loader, hash);
   if (idx <= seq_node->numElements()) {
     while (!seq_node->isLeaf()) {
       const MetaNode* mnode = dynamic_cast<const MetaNode*>(seq_node.get());
@@ -100,8 +113,7 @@ NodeCursor::NodeCursor(const Hash& hash, size_t idx,
       parent_cursor = new NodeCursor(seq_node, entry_idx, ch_loader,
                             std::unique_ptr<NodeCursor>(parent_cursor));
       element_idx -= mnode->numElementsUntilEntry(entry_idx);
-      chunk = ch_loader->Load(child_hash);
-      seq_node = SeqNode::CreateFromChunk(chunk);
+      seq_node = LoadNode(ch_loader, child_hash);
     }
     // if the element_idx > num of elements at leaf
     //   make cursor point to the end of leaf
@@ -126,8 +138,7 @@ NodeCursor::NodeCursor(const Hash& hash, const OrderedKey& key,
                        ChunkLoader* ch_loader) noexcept {
   NodeCursor* parent_cursor = nullptr;
   size_t entry_idx = 0;
-  const Chunk* chunk = ch_loader->Load(hash);
-  std::shared_ptr<const SeqNode> seq_node(SeqNode::CreateFromChunk(chunk));
+  std::shared_ptr<const SeqNode> seq_node = LoadNode(ch_loader, hash);
 
   while (!seq_node->isLeaf()) {
     const MetaNode* mnode = dynamic_cast<const MetaNode*>(seq_node.get());
@@ -142,8 +153,7 @@ NodeCursor::NodeCursor(const Hash& hash, const OrderedKey& key,
     }
     parent_cursor = new NodeCursor(seq_node, entry_idx, ch_loader,
                           std::unique_ptr<NodeCursor>(parent_cursor));
-    chunk = ch_loader->Load(child_hash);
-    seq_node = SeqNode::CreateFromChunk(chunk);
+    seq_node = LoadNode(ch_loader, child_hash);
   }
   // if the element_idx > num of elements at leaf
   //   make cursor point to the end of leaf
@@ -195,11 +205,12 @@ bool NodeCursor::Advance(bool cross_boundary) {
   //   will be retreated by child cursor
   if (parent_cr_ == nullptr) return false;
   if (parent_cr_->Advance(true)) {
+    auto consumed = std::chrono::steady_clock::now();
     MetaEntry me(parent_cr_->current());
-    const Chunk* chunk = chunk_loader_->Load(me.targetHash());
-    seq_node_ = SeqNode::CreateFromChunk(chunk);
+    seq_node_ = LoadNode(chunk_loader_, me.targetHash());
     DCHECK_GT(seq_node_->numEntries(), size_t(0));
     idx_ = 0;  // point the first element
+    ReadAhead(consumed);
     return true;
   } else {
     // curent parent cursor now points the seq end, (idx = numEntries())
@@ -209,6 +220,35 @@ bool NodeCursor::Advance(bool cross_boundary) {
   }
 }
 
+void NodeCursor::ReadAhead(std::chrono::steady_clock::time_point consumed) {
+  // no read-ahead if fetching is not slower than dispatching a prefetch
+  static constexpr double kMinFetchLatencyUs = 50;
+  static constexpr double kWeight = 0.2;
+  if (!chunk_loader_->canPrefetch()) return;
+  // time spent on the previous node, excluding that waiting for this one
+  double interval = std::chrono::duration<double, std::micro>(
+      consumed - last_crossing_).count();
+  last_crossing_ = std::chrono::steady_clock::now();
+  if (++num_forward_crossings_ < 2) return;
+  crossing_interval_us_ = num_forward_crossings_ == 2 ? interval :
+      crossing_interval_us_ + kWeight * (interval - crossing_interval_us_);
+
+  double latency = chunk_loader_->fetchLatency();
+  size_t max_read_ahead = Env::Instance()->config().max_read_ahead();
+  if (latency < kMinFetchLatencyUs || max_read_ahead == 0) return;
+  size_t n = std::min(max_read_ahead, static_cast<size_t>(
+      std::ceil(latency / std::max(crossing_interval_us_, 1.0))));
+  const SeqNode* parent = parent_cr_->node();
+  size_t first = parent_cr_->idx() + 1;
+  size_t last = std::min(parent->numEntries(), first + n);
+  if (first >= last) return;
+  const MetaNode* mnode = dynamic_cast<const MetaNode*>(parent);
+  std::vector<Hash> keys;
+  for (size_t i = first; i < last; ++i)
+    keys.push_back(mnode->GetChildHashByEntry(i));
+  chunk_loader_->Prefetch(keys);
+}
+
 bool NodeCursor::Retreat(bool cross_boundary) {
   if (idx_ >= 0) --idx_;
   if (idx_ >= 0) return true;
@@ -220,10 +260,10 @@ bool NodeCursor::Retreat(bool cross_boundary) {
   if (parent_cr_ == nullptr) return false;
   if (parent_cr_->Retreat(true)) {
     MetaEntry me(parent_cr_->current());
-    const Chunk* chunk = chunk_loader_->Load(me.targetHash());
-    seq_node_ = SeqNode::CreateFromChunk(chunk);
+    seq_node_ = LoadNode(chunk_loader_, me.targetHash());
     DCHECK_GT(seq_node_->numEntries(), size_t(0));
     idx_ = seq_node_->numEntries() - 1;  // point to the last element
+    num_forward_crossings_ = 0;
     return true;
   } else {
     // parent cursor now points the seq start, (idx = -1)
@@ -372,7 +412,7 @@ uint64_t NodeCursor::AdvanceSteps(uint64_t step) {
 
   // Load this cursor seqnode from the entry pointed by parent cursor
   MetaEntry me(parent_cr_->current());
-  seq_node_ = SeqNode::CreateFromChunk(chunk_loader_->Load(me.targetHash()));
+  seq_node_ = LoadNode(chunk_loader_, me.targetHash());
   DCHECK_GT(seq_node_->numEntries(), size_t(0));
 
   if (endParent) {
@@ -496,7 +536,7 @@ uint64_t NodeCursor::RetreatSteps(uint64_t step) {
 
   // Load this cursor seqnode from the entry pointed by parent cursor
   MetaEntry me(parent_cr_->current());
-  seq_node_ = SeqNode::CreateFromChunk(chunk_loader_->Load(me.targetHash()));
+  seq_node_ = LoadNode(chunk_loader_, me.targetHash());
   DCHECK_GT(seq_node_->numEntries(), size_t(0));
 
   if (headParent) {
@@ -80,7 +80,7 @@ Slice ListNode::Decode(const byte_t* data) {
 
 const byte_t* ListNode::data(size_t idx) const {
   CHECK_LT(idx, numEntries());
-  size_t offset = offsets_[idx];
+  size_t offset = table_->offsets[idx];
   return chunk_->data() + offset;
 }
 
@@ -90,9 +90,9 @@ size_t ListNode::len(size_t idx) const {
   if (idx == numEntries() - 1) {
     preOffset = chunk_->capacity();
   } else {
-    preOffset = offsets_[idx + 1];
+    preOffset = table_->offsets[idx + 1];
   }
-  return preOffset - offsets_[idx];
+  return preOffset - table_->offsets[idx];
 }
 
 size_t ListNode::numEntries() const {
@@ -101,16 +101,19 @@ size_t ListNode::numEntries() const {
 }
 
 void ListNode::PrecomputeOffsets() {
-  CHECK(offsets_.empty());
-  // iterate all entries in ListNode and accumulate offset
-  // Skip num_entries field (4 bytes) at ListNode head
-  size_t byte_offset = sizeof(uint32_t);
-  for (size_t i = 0; i < numEntries(); i++) {
-    offsets_.push_back(byte_offset);
-    size_t entry_num_bytes = static_cast<size_t>(
-         *reinterpret_cast<const uint32_t*>(chunk_->data() + byte_offset));
-    byte_offset += entry_num_bytes;
-  }
+  table_ = OffsetCache::Instance()->Get(*chunk_,
+      [this](OffsetTable* table) {
+    // iterate all entries in ListNode and accumulate offset
+    // Skip num_entries field (4 bytes) at ListNode head
+    size_t byte_offset = sizeof(uint32_t);
+    table->offsets.reserve(numEntries());
+    for (size_t i = 0; i < numEntries(); i++) {
+      table->offsets.push_back(byte_offset);
+      size_t entry_num_bytes = static_cast<size_t>(
+           *reinterpret_cast<const uint32_t*>(chunk_->data() + byte_offset));
+      byte_offset += entry_num_bytes;
+    }
+  });
 }
 
 OrderedKey ListNode::key(size_t idx) const {
@@ -148,7 +148,7 @@ std::unique_ptr<const Segment> MapNode::Encode(
 
 const byte_t* MapNode::data(size_t idx) const {
   CHECK_LT(idx, numEntries());
-  size_t offset = offsets_[idx];
+  size_t offset = table_->offsets[idx];
   return chunk_->data() + offset;
 }
 
@@ -158,9 +158,9 @@ size_t MapNode::len(size_t idx) const {
   if (idx == numEntries() - 1) {
     preOffset = chunk_->capacity();
   } else {
-    preOffset = offsets_[idx + 1];
+    preOffset = table_->offsets[idx + 1];
   }
-  return preOffset - offsets_[idx];
+  return preOffset - table_->offsets[idx];
 }
 
 OrderedKey MapNode::key(size_t idx) const {
@@ -169,19 +169,9 @@ OrderedKey MapNode::key(size_t idx) const {
 
 uint64_t MapNode::FindIndexForKey(const OrderedKey& key,
                                   ChunkLoader* loader) const {
-  size_t idx = 0;
-  for (const size_t offset : offsets_) {
-    size_t keyNumBytes = 0;
-    const byte_t* keyData = MapNode::key(chunk_->data() + offset, &keyNumBytes);
-    OrderedKey currKey(false, keyData, keyNumBytes);
-    if (currKey == key) {
-      return idx;
-    } else if (currKey > key) {
-      return idx;
-    }
-    ++idx;
-  }
-  return idx;
+  return table_->LowerBound(key, [this](size_t idx) {
+    return MapNode::orderedKey(chunk_->data() + table_->offsets[idx]);
+  });
 }
 
 size_t MapNode::numEntries() const {
@@ -190,22 +180,28 @@ size_t MapNode::numEntries() const {
 }
 
 void MapNode::PrecomputeOffsets() {
-  CHECK(offsets_.empty());
-  // iterate all KVItems in MapNode and accumulate offset
-  // Skip num_entries field (4 bytes) at MapNode head
-  size_t byte_offset = sizeof(uint32_t);
-  OrderedKey preKey;
-  for (size_t i = 0; i < numEntries(); i++) {
-    offsets_.push_back(byte_offset);
-    size_t item_num_bytes;
-    MapNode::kvitem(chunk_->data() + byte_offset, &item_num_bytes);
-
-    // Check in strict increasing order key
-    OrderedKey currKey = MapNode::orderedKey(chunk_->data() + byte_offset);
-    if (i > 0) {CHECK(preKey < currKey); }
-    preKey = currKey;
-    byte_offset += item_num_bytes;
-  }
+  table_ = OffsetCache::Instance()->Get(*chunk_,
+      [this](OffsetTable* table) {
+    // iterate all KVItems in MapNode and accumulate offset
+    // Skip num_entries field (4 bytes) at MapNode head
+    size_t byte_offset = sizeof(uint32_t);
+    OrderedKey preKey;
+    table->offsets.reserve(numEntries());
+    for (size_t i = 0; i < numEntries(); i++) {
+      table->offsets.push_back(byte_offset);
+      size_t item_num_bytes;
+      MapNode::kvitem(chunk_->data() + byte_offset, &item_num_bytes);
+
+      // Check in strict increasing order key
+      OrderedKey currKey = MapNode::orderedKey(chunk_->data() + byte_offset);
+      if (i > 0) {CHECK(preKey < currKey); }
+      preKey = currKey;
+      byte_offset += item_num_bytes;
+    }
+    table->IndexKeys([this, table](size_t idx) {
+      return MapNode::orderedKey(chunk_->data() + table->offsets[idx]);
+    });
+  });
 }
 size_t MapNode::Copy(size_t start, size_t num_bytes, byte_t* buffer) const {
   LOG(FATAL) << "Not Supported Yet";
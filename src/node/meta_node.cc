@@ -2,6 +2,8 @@
 
 #include "node/meta_node.h"
 
+#include <algorithm>
+
 namespace ustore {
 
 ChunkInfo MetaChunker::Make(const std::vector<const Segment*>& segments)
@@ -69,17 +71,7 @@ uint32_t MetaNode::numLeaves() const {
 uint64_t MetaNode::numElementsUntilEntry(size_t entry_idx) const {
   CHECK_GE(entry_idx, size_t(0));
   CHECK_LE(entry_idx, numEntries());
-  // iterate all MetaEntries in MetaNode and sum up their elements
-  // Skip num_entries field (4 bytes) at MetaNode head
-  size_t byte_offset = sizeof(uint32_t);
-  uint64_t total_num_elements = 0;
-  for (size_t i = 0; i < entry_idx; i++) {
-    MetaEntry entry(chunk_->data() + byte_offset);
-    total_num_elements += entry.numElements();
-    size_t entry_len = entry.numBytes();
-    byte_offset += entry_len;
-  }
-  return total_num_elements;
+  return table_->elements[entry_idx];
 }
 
 const byte_t* MetaNode::data(size_t idx) const {
@@ -106,17 +98,13 @@ size_t MetaNode::len(size_t idx) const {
 
 uint64_t MetaNode::FindIndexForKey(const OrderedKey& key,
                                    ChunkLoader* loader) const {
-  uint64_t num_elements_sum = 0;
-  for (const size_t offset : offsets_) {
-    MetaEntry entry(chunk_->data() + offset);
-    if (key <= entry.orderedKey()) {
-       const Chunk* chunk = loader->Load(entry.targetHash());
-       auto seq_node = SeqNode::CreateFromChunk(chunk);
-       return num_elements_sum + seq_node->FindIndexForKey(key, loader);
-    }
-    num_elements_sum += entry.numElements();
-  }
-  return num_elements_sum;
+  size_t entry_idx;
+  Hash child_hash = GetChildHashByKey(key, &entry_idx);
+  if (child_hash.empty()) return numElements();
+  const Chunk* chunk = loader->Load(child_hash);
+  auto seq_node = SeqNode::CreateFromChunk(chunk);
+  return table_->elements[entry_idx] +
+         seq_node->FindIndexForKey(key, loader);
 }
 
 uint64_t MetaNode::entryOffset(size_t idx) const {
@@ -124,39 +112,41 @@ uint64_t MetaNode::entryOffset(size_t idx) const {
   CHECK_GE(idx, size_t(0));
   CHECK_LT(idx, numEntries());
 
-  return offsets_[idx];
+  return table_->offsets[idx];
 }
 
 void MetaNode::PrecomputeOffset() {
-  CHECK(offsets_.empty());
-  // iterate all MetaEntries in MetaNode and accumulate offset
-  // Skip num_entries field (4 bytes) at MetaNode head
-  size_t byte_offset = sizeof(uint32_t);
-  for (size_t i = 0; i < numEntries(); i++) {
-    offsets_.push_back(byte_offset);
-    MetaEntry entry(chunk_->data() + byte_offset);
-    byte_offset += entry.numBytes();
-  }
+  table_ = OffsetCache::Instance()->Get(*chunk_,
+      [this](OffsetTable* table) {
+    // iterate all MetaEntries in MetaNode and accumulate offset
+    // Skip num_entries field (4 bytes) at MetaNode head
+    size_t byte_offset = sizeof(uint32_t);
+    uint64_t num_elements = 0;
+    table->offsets.reserve(numEntries());
+    table->elements.reserve(numEntries() + 1);
+    for (size_t i = 0; i < numEntries(); i++) {
+      table->offsets.push_back(byte_offset);
+      table->elements.push_back(num_elements);
+      MetaEntry entry(chunk_->data() + byte_offset);
+      num_elements += entry.numElements();
+      byte_offset += entry.numBytes();
+    }
+    table->elements.push_back(num_elements);
+    table->IndexKeys([this, table](size_t idx) {
+      return MetaEntry(chunk_->data() + table->offsets[idx]).orderedKey();
+    });
+  });
 }
 
 Hash MetaNode::GetChildHashByIndex(size_t element_idx,
                                          size_t* entry_idx) const {
   CHECK_GT(numEntries(), size_t(0));
-  // Skip num_entries field (4 bytes) at MetaNode head
-  size_t byte_offset = sizeof(uint32_t);
-  uint64_t total_num_elements = 0;
-  for (size_t i = 0; i < numEntries(); i++) {
-    MetaEntry entry(chunk_->data() + byte_offset);
-    total_num_elements += entry.numElements();
-    if (element_idx < total_num_elements) {
-      *entry_idx = i;
-      return entry.targetHash();
-    }
-    size_t entry_len = entry.numBytes();
-    byte_offset += entry_len;
-  }
-  *entry_idx = numEntries();
-  return Hash();
+  // the first entry whose elements end after the element
+  const std::vector<uint64_t>& elements = table_->elements;
+  *entry_idx = std::upper_bound(elements.begin() + 1, elements.end(),
+                                element_idx) - elements.begin() - 1;
+  if (*entry_idx == numEntries()) return Hash();
+  return GetChildHashByEntry(*entry_idx);
 }
 
 Hash MetaNode::GetChildHashByEntry(size_t entry_idx) const {
@@ -169,19 +159,11 @@ Hash MetaNode::GetChildHashByEntry(size_t entry_idx) const {
 Hash MetaNode::GetChildHashByKey(const OrderedKey& key,
                                  size_t* entry_idx) const {
   CHECK_GT(numEntries(), size_t(0));
-  // Skip num_entries field (4 bytes) at MetaNode head
-  size_t byte_offset = sizeof(uint32_t);
-  for (size_t i = 0; i < numEntries(); i++) {
-    MetaEntry entry(chunk_->data() + byte_offset);
-    if (key <= entry.orderedKey()) {
-      *entry_idx = i;
-      return entry.targetHash();
-    }
-    size_t entry_len = entry.numBytes();
-    byte_offset += entry_len;
-  }
-  *entry_idx = numEntries();
-  return Hash();
+  *entry_idx = table_->LowerBound(key, [this](size_t idx) {
+    return MetaEntry(chunk_->data() + table_->offsets[idx]).orderedKey();
+  });
+  if (*entry_idx == numEntries()) return Hash();
+  return GetChildHashByEntry(*entry_idx);
 }
 
 
@@ -4,14 +4,34 @@
 
 #include <algorithm>  // for memcpy
 #include <cstring>  // for memcpy
+#include <limits>
+#include <thread>
 #include "hash/hash.h"
 #include "node/meta_node.h"
 #include "node/orderedkey.h"
 
 #include "utils/debug.h"
+#include "utils/env.h"
 #include "utils/logging.h"
 
 namespace ustore {
+// Max number of chunks a builder buffers before dumping them to storage
+static constexpr size_t kMaxPendingChunks = 1024;
+// Inputs smaller than this are not worth the threads of a bulk build
+static constexpr size_t kMinBulkBuildBytes = 1 << 20;
+// Returned by NextBoundary if no boundary is detected
+static constexpr size_t kNoBoundary = std::numeric_limits<size_t>::max();
+
+// Collect the keys and pointers of chunks for ChunkWriter::MultiWrite
+static void AddToBatch(const std::vector<Chunk>& pending,
+                       std::vector<Hash>* keys,
+                       std::vector<const Chunk*>* chunks) {
+  for (const Chunk& c : pending) {
+    keys->push_back(c.hash());
+    chunks->push_back(&c);
+  }
+}
+
 NodeBuilder::NodeBuilder(const Hash& root_hash, const OrderedKey& key,
   ChunkLoader* chunk_loader, ChunkWriter* chunk_writer, const Chunker* chunker,
   const Chunker* parent_chunker) noexcept
@@ -195,17 +215,38 @@ Chunk NodeBuilder::HandleBoundary(const std::vector<const Segment*>& segments) {
   ChunkInfo chunk_info = chunker_->Make(segments);
 
   Chunk& chunk = chunk_info.chunk;
-  // Dump chunk into storage here
-  chunk_writer_->Write(chunk.hash(), chunk);
+  // Buffer chunk to dump it into storage at commit
+  //   Dump the earlier ones if too many, but never the returned one
+  if (pending_chunks_.size() >= kMaxPendingChunks) {
+    std::vector<Hash> keys;
+    std::vector<const Chunk*> chunks;
+    AddToBatch(pending_chunks_, &keys, &chunks);
+    chunk_writer_->MultiWrite(keys, chunks);
+    pending_chunks_.clear();
+  }
+  Chunk view(chunk.head(), chunk.hash().value());
+  pending_chunks_.push_back(std::move(chunk));
 
   parent_builder()->AppendSegmentEntries(chunk_info.meta_seg.get());
   created_segs_.push_back(std::move(chunk_info.meta_seg));
   rhasher_->ClearLastBoundary();
-  return std::move(chunk);
+  return view;
+}
+
+void NodeBuilder::DumpChunks() {
+  // Children are placed before their parents
+  std::vector<Hash> keys;
+  std::vector<const Chunk*> chunks;
+  for (NodeBuilder* nb = this; nb; nb = nb->parent_builder_.get())
+    AddToBatch(nb->pending_chunks_, &keys, &chunks);
+  if (!keys.empty()) chunk_writer_->MultiWrite(keys, chunks);
+  for (NodeBuilder* nb = this; nb; nb = nb->parent_builder_.get())
+    nb->pending_chunks_.clear();
 }
 
 Hash NodeBuilder::Commit() {
   Hash root = RecursiveCommit();
+  DumpChunks();
   if (cursor_) {
     //  The tree is NOT constructed from scratch but updated on an existing tree
     //  It is possible that its height shall be reduced for removing elements.
@@ -411,6 +452,158 @@ Segment* NodeBuilder::SegAtCursor() {
   return seg;
 }
 
+// Byte offset of the idx-th entry in seg, or the segment end
+static inline size_t EntryOffset(const Segment* seg, size_t idx) {
+  return idx < seg->numEntries() ? seg->entry(idx) - seg->data()
+                                 : seg->numBytes();
+}
+
+// Detect the boundary of a chunk starting at the begin-th entry of seg
+//   by bytes before end_offset
+// @return The index of the entry next to the boundary, or kNoBoundary
+static size_t NextBoundary(const Segment* seg, size_t begin, size_t end_offset,
+                           RollingHasher* rhasher) {
+  // a boundary only depends on bytes from the chunk start, so a used
+  //   rolling hasher behaves the same as a new one once cleared
+  rhasher->ClearLastBoundary();
+  size_t offset = EntryOffset(seg, begin);
+  size_t pos = rhasher->TryHashBytes(seg->data() + offset, end_offset - offset);
+  if (!rhasher->CrossedBoundary()) return kNoBoundary;
+  return seg->PosToIdx(offset + pos) + 1;
+}
+
+// Create a segment viewing entries [begin, end) of seg
+static std::unique_ptr<const Segment> SubSegment(const Segment* seg,
+    size_t begin, size_t end, bool fixed_entry_len) {
+  size_t begin_offset = EntryOffset(seg, begin);
+  size_t num_bytes = EntryOffset(seg, end) - begin_offset;
+  const byte_t* data = seg->data() + begin_offset;
+  if (fixed_entry_len) {
+    return std::unique_ptr<const Segment>(
+        new FixedSegment(data, num_bytes, seg->entryNumBytes(begin)));
+  }
+  std::vector<size_t> offsets;
+  offsets.reserve(end - begin);
+  for (size_t i = begin; i < end; ++i)
+    offsets.push_back(EntryOffset(seg, i) - begin_offset);
+  return std::unique_ptr<const Segment>(
+      new VarSegment(data, num_bytes, std::move(offsets)));
+}
+
+// Run func(tid, begin, end) on num_threads threads,
+//   each for a contiguous range of [0, n)
+template <typename Func>
+static void ParallelFor(size_t num_threads, size_t n, const Func& func) {
+  size_t step = (n + num_threads - 1) / num_threads;
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads && t * step < n; ++t)
+    threads.emplace_back(func, t, t * step, std::min(n, (t + 1) * step));
+  func(0, 0, std::min(n, step));
+  for (auto& t : threads) t.join();
+}
+
+Hash NodeBuilder::BulkBuild(const Segment* seg, ChunkWriter* chunk_writer,
+    const Chunker* chunker, const Chunker* parent_chunker) {
+  size_t num_threads = Env::Instance()->config().build_threads();
+  if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+  if (seg->numBytes() < kMinBulkBuildBytes) num_threads = 1;
+  return BulkBuild(seg, chunk_writer, chunker, parent_chunker, num_threads);
+}
+
+Hash NodeBuilder::BulkBuild(const Segment* seg, ChunkWriter* chunk_writer,
+    const Chunker* chunker, const Chunker* parent_chunker,
+    size_t num_threads) {
+  const size_t num_entries = seg->numEntries();
+  num_threads = std::min(num_threads, num_entries);
+  if (num_threads <= 1) {
+    NodeBuilder nb(chunk_writer, chunker, parent_chunker);
+    nb.SpliceElements(0, seg);
+    return nb.Commit();
+  }
+
+  // First, each thread detects boundaries in its own range of entries,
+  //   as if a chunk started at the range start.
+  //   starts[t] holds the chunk starts found in range t,
+  //   the last of which may be the start of range t + 1.
+  std::vector<std::vector<size_t>> starts(num_threads);
+  std::vector<size_t> range_begin(num_threads);
+  size_t step = (num_entries + num_threads - 1) / num_threads;
+  ParallelFor(num_threads, num_entries,
+              [&](size_t tid, size_t begin, size_t end) {
+    std::unique_ptr<RollingHasher> rhasher = chunker->GetRHasher();
+    size_t end_offset = EntryOffset(seg, end);
+    range_begin[tid] = begin;
+    starts[tid].push_back(begin);
+    for (size_t idx = begin; idx < end;) {
+      idx = NextBoundary(seg, idx, end_offset, rhasher.get());
+      if (idx == kNoBoundary) break;
+      starts[tid].push_back(idx);
+    }
+  });
+  // ParallelFor may leave trailing threads idle if step is large
+  num_threads = (num_entries + step - 1) / step;
+
+  // Second, stitch the ranges from the sequence start. Once a true chunk
+  //   start is also found in a range, all later ones in that range are true.
+  //   Otherwise, detect the next boundary from the last true start.
+  std::vector<size_t> boundaries;
+  std::unique_ptr<RollingHasher> rhasher = chunker->GetRHasher();
+  size_t tid = 0;
+  for (size_t start = 0; start < num_entries;) {
+    while (tid + 1 < num_threads && range_begin[tid + 1] <= start) ++tid;
+    const std::vector<size_t>& range_starts = starts[tid];
+    auto it = std::lower_bound(range_starts.begin(), range_starts.end(),
+                               start);
+    if (it != range_starts.end() && *it == start &&
+        it + 1 != range_starts.end()) {
+      boundaries.insert(boundaries.end(), it + 1, range_starts.end());
+      start = range_starts.back();
+      continue;
+    }
+    start = NextBoundary(seg, start, seg->numBytes(), rhasher.get());
+    // the last chunk ends at the sequence end without a boundary
+    if (start == kNoBoundary) start = num_entries;
+    boundaries.push_back(start);
+  }
+
+  // Third, make and hash leaf chunks in parallel, and dump them in batches
+  std::vector<std::unique_ptr<const Segment>> meta_segs;
+  Hash last_hash;
+  const bool fixed_entry_len = chunker->isFixedEntryLen();
+  for (size_t batch = 0; batch < boundaries.size();
+       batch += kMaxPendingChunks) {
+    size_t batch_size = std::min(kMaxPendingChunks, boundaries.size() - batch);
+    std::vector<ChunkInfo> chunk_infos(batch_size);
+    ParallelFor(num_threads, batch_size,
+                [&](size_t tid, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        size_t first = batch + i == 0 ? 0 : boundaries[batch + i - 1];
+        std::unique_ptr<const Segment> chunk_seg =
+            SubSegment(seg, first, boundaries[batch + i], fixed_entry_len);
+        chunk_infos[i] = chunker->Make({chunk_seg.get()});
+      }
+    });
+    std::vector<Hash> keys;
+    std::vector<const Chunk*> chunks;
+    for (ChunkInfo& chunk_info : chunk_infos) {
+      keys.push_back(chunk_info.chunk.hash());
+      chunks.push_back(&chunk_info.chunk);
+      meta_segs.push_back(std::move(chunk_info.meta_seg));
+    }
+    chunk_writer->MultiWrite(keys, chunks);
+    last_hash = chunk_infos.back().chunk.hash().Clone();
+  }
+
+  // A single leaf chunk is the root itself
+  if (meta_segs.size() == 1) return last_hash;
+  // Finally, build upper levels from metaentries of leaf chunks
+  std::vector<const Segment*> entry_segs;
+  for (const auto& meta_seg : meta_segs) entry_segs.push_back(meta_seg.get());
+  NodeBuilder nb(chunk_writer, parent_chunker, parent_chunker);
+  nb.SpliceElements(0, entry_segs);
+  return nb.Commit();
+}
+
 /////////////////////////////////////////////////////////
 // Advanced Node Builder
 
@@ -453,6 +646,14 @@ AdvancedNodeBuilder& AdvancedNodeBuilder::Splice(
     all_operand_segs_.push_back(std::move(*seg_it));
   }  // end for
 
+  // Splices are mostly made in order, e.g., by NodeMerger,
+  //   so append those after all the others without searching the list
+  if (operands_.empty() || (operands_.back().start_idx < start_idx &&
+      operands_.back().start_idx + operands_.back().num_delete <= start_idx)) {
+    operands_.push_back({start_idx, num_delete, std::move(operand_segs)});
+    return *this;
+  }
+
   /* Each SpliceOperand defines an closed-open working interval,
    * e.g, [1, 3) [3, 5),
    * we need to find a slot between two sorted intervals in operands
@@ -511,6 +712,113 @@ AdvancedNodeBuilder& AdvancedNodeBuilder::Splice(
   return *this;
 }
 
+// Whether two cursors on the same level point into the same node
+static bool InSameNode(const NodeCursor& lhs, const NodeCursor& rhs) {
+  if (lhs.parent() == nullptr || rhs.parent() == nullptr)
+    return lhs.parent() == rhs.parent();
+  return *lhs.parent() == *rhs.parent();
+}
+
+std::vector<AdvancedNodeBuilder::LevelOperand>
+AdvancedNodeBuilder::CommitLevel(const std::vector<LevelOperand>& operands,
+                                 const Chunker* chunker,
+                                 std::vector<Chunk>* chunks) {
+  std::vector<LevelOperand> parent_operands;
+  std::unique_ptr<RollingHasher> rhasher = chunker->GetRHasher();
+  // segments of the chunk in making
+  std::vector<const Segment*> chunk_segs;
+  // metaentries of chunks made for the current operand
+  std::vector<const Segment*> meta_segs;
+
+  auto keep = [this](std::unique_ptr<const Segment> seg) {
+    created_segs_.push_back(std::move(seg));
+    return created_segs_.back().get();
+  };
+  auto make_chunk = [&]() {
+    ChunkInfo chunk_info = chunker->Make(chunk_segs);
+    chunks->push_back(std::move(chunk_info.chunk));
+    meta_segs.push_back(keep(std::move(chunk_info.meta_seg)));
+    chunk_segs.clear();
+    rhasher->ClearLastBoundary();
+  };
+  // Append entries to the chunk in making
+  //   Make a chunk whenever a boundary is detected
+  auto append = [&](const Segment* seg) {
+    while (!seg->empty()) {
+      size_t boundary_pos = rhasher->TryHashBytes(seg->data(), seg->numBytes());
+      if (!rhasher->CrossedBoundary()) {
+        chunk_segs.push_back(seg);
+        return;
+      }
+      auto splitted_segs = seg->Split(seg->PosToIdx(boundary_pos) + 1);
+      chunk_segs.push_back(keep(std::move(splitted_segs.first)));
+      make_chunk();
+      seg = keep(std::move(splitted_segs.second));
+    }
+  };
+
+  for (size_t i = 0; i < operands.size();) {
+    NodeCursor cursor(*operands[i].cursor);
+    const bool is_root = cursor.parent() == nullptr;
+    // the parent entry of the first remade chunk
+    std::unique_ptr<NodeCursor> parent_cursor(
+        is_root ? nullptr : new NodeCursor(*cursor.parent()));
+    // # of old chunks remade, and whether the one at cursor is counted
+    size_t num_remade = 0;
+    bool counted = false;
+    auto remake = [&]() {
+      if (!counted) ++num_remade;
+      counted = true;
+    };
+    auto next_node = [&]() {
+      if (cursor.Advance(true)) counted = false;
+    };
+
+    meta_segs.clear();
+    rhasher->ClearLastBoundary();
+    // start from the head of the node
+    if (cursor.idx() > 0) {
+      remake();
+      append(keep(cursor.node()->GetSegment(0, cursor.idx())));
+    }
+    while (true) {
+      if (i < operands.size() && *operands[i].cursor == cursor) {
+        const LevelOperand& operand = operands[i++];
+        for (size_t n = operand.num_delete; n > 0 && !cursor.isEnd();) {
+          remake();
+          size_t step = std::min(n, cursor.node()->numEntries() - cursor.idx());
+          cursor.seek(cursor.idx() + step);
+          n -= step;
+          if (cursor.isEnd()) next_node();
+        }
+        for (const Segment* seg : operand.appended_segs) append(seg);
+        continue;
+      }
+      if (cursor.isEnd()) break;
+      // A boundary realigns with the start of an old chunk,
+      //   so later chunks stay unchanged until the next operand.
+      //   The root is always remade as a whole.
+      if (!is_root && cursor.idx() == 0 && chunk_segs.empty()) break;
+      // Rehash old entries until the next operand or the node end
+      size_t end = cursor.node()->numEntries();
+      if (i < operands.size() && InSameNode(*operands[i].cursor, cursor)) {
+        CHECK_GT(operands[i].cursor->idx(), cursor.idx());
+        end = operands[i].cursor->idx();
+      }
+      remake();
+      append(keep(cursor.node()->GetSegment(cursor.idx(),
+                                            end - cursor.idx())));
+      cursor.seek(end);
+      if (cursor.isEnd()) next_node();
+    }
+    // the last chunk of the sequence has no boundary
+    if (!chunk_segs.empty()) make_chunk();
+    parent_operands.push_back({std::move(parent_cursor), num_remade,
+                               meta_segs});
+  }
+  return parent_operands;
+}
+
 // Return the root hash of the updated tree
 //   the hash owns its internal data
 Hash AdvancedNodeBuilder::Commit(const Chunker& chunker) {
@@ -535,69 +843,74 @@ Hash AdvancedNodeBuilder::Commit(const Chunker& chunker) {
     }  // end if operands.size() == 0
   }  // end if root_.empty()
 
-  PersistentChunker persistentMetaChunker(MetaChunker::Instance());
-  PersistentChunker persistentLeafChunker(&chunker);
-
-  ChunkCacher chunk_cacher(loader_, writer_);
-
-  Hash base = root_;
-  for (auto operand_it = operands_.rbegin();
-       operand_it != operands_.rend();
-       operand_it++) {
-    // Traverse the list in reverse order
-    NodeBuilder nb(base, operand_it->start_idx,
-                   &chunk_cacher, &chunk_cacher,
-                   &persistentLeafChunker, &persistentMetaChunker);
-
-    nb.SpliceElements(operand_it->num_delete, operand_it->appended_segs);
-    base = nb.Commit();
-  }  // end for
-
-  PreorderDump(base, &chunk_cacher);
-  operands_.clear();
-  all_operand_segs_.clear();
-  CHECK(base.own());
-  return base;
-}
+  // operands on leaves, excluding those with nothing to do
+  std::vector<LevelOperand> level_operands;
+  for (const auto& operand : operands_) {
+    if (operand.num_delete == 0 && operand.appended_segs.empty()) continue;
+    std::unique_ptr<NodeCursor> cursor(
+        new NodeCursor(root_, operand.start_idx, loader_));
+    // point to the head of next node rather than the end of this one
+    if (cursor->isEnd()) cursor->Advance(true);
+    level_operands.push_back({std::move(cursor), operand.num_delete,
+                              operand.appended_segs});
+  }
 
-Chunk AdvancedNodeBuilder::ChunkCacher::GetChunk(const Hash& key) {
-  auto cache_it = cache_.find(key);
-  // read from write cache
-  if (cache_it != cache_.end()) {
-    return Chunk(cache_it->second);
+  // Commit level by level, until the root is remade
+  //   or an upper level is not affected
+  std::vector<Chunk> chunks;
+  const Chunker* level_chunker = &chunker;
+  bool root_remade = false;
+  while (!level_operands.empty() && !root_remade) {
+    root_remade = level_operands[0].cursor->parent() == nullptr;
+    level_operands = CommitLevel(level_operands, level_chunker, &chunks);
+    level_chunker = MetaChunker::Instance();
+    if (root_remade) break;
+    level_operands.erase(std::remove_if(level_operands.begin(),
+        level_operands.end(), [](const LevelOperand& operand) {
+      return operand.num_delete == 0 && operand.appended_segs.empty();
+    }), level_operands.end());
   }
-  // read from chunk loader
-  return Chunk(loader_->Load(key)->head());
-}
-bool AdvancedNodeBuilder::ChunkCacher::ExistInCache(const Hash& key) const {
-  auto cache_it = cache_.find(key);
-  return cache_it != cache_.end();
-}
 
-bool AdvancedNodeBuilder::ChunkCacher::DumpCacheChunk(const Hash& key) {
-  auto cache_it = cache_.find(key);
-  if (cache_it != cache_.end()) {
-    return writer_->Write(cache_it->first, Chunk(cache_it->second));
+  Hash root;
+  if (!root_remade) {
+    root = root_.Clone();
   } else {
-    return false;
+    // Children are placed before their parents
+    std::vector<Hash> keys;
+    std::vector<const Chunk*> chunk_ptrs;
+    AddToBatch(chunks, &keys, &chunk_ptrs);
+    if (!keys.empty()) writer_->MultiWrite(keys, chunk_ptrs);
+
+    const std::vector<const Segment*>& top_segs =
+        level_operands[0].appended_segs;
+    if (top_segs.empty()) {
+      // all elements are removed
+      NodeBuilder nb(writer_, &chunker, MetaChunker::Instance());
+      nb.SpliceElements(0, {});
+      root = nb.Commit();
+    } else if (top_segs.size() == 1) {
+      root = MetaEntry(top_segs[0]->entry(0)).targetHash().Clone();
+    } else {
+      // the root splits, grow the tree with new levels
+      NodeBuilder nb(writer_, MetaChunker::Instance(), MetaChunker::Instance());
+      nb.SpliceElements(0, top_segs);
+      root = nb.Commit();
+    }
+    // Prune the root nodes with a single metaentry,
+    //   as the tree may shrink for removed elements
+    auto root_node = SeqNode::CreateFromChunk(loader_->Load(root));
+    while (!root_node->isLeaf() && root_node->numEntries() == 1) {
+      const MetaNode* mnode = dynamic_cast<const MetaNode*>(root_node.get());
+      root = mnode->GetChildHashByEntry(0).Clone();
+      root_node = SeqNode::CreateFromChunk(loader_->Load(root));
+    }
   }
-}
 
-bool AdvancedNodeBuilder::PreorderDump(const Hash& root, ChunkCacher* cacher) {
-  bool result = true;
-  if (cacher->ExistInCache(root)) {
-    result = cacher->DumpCacheChunk(root);
-    const Chunk* chunk = cacher->Load(root);
-    auto seq_node = SeqNode::CreateFromChunk(chunk);
-    if (!seq_node->isLeaf()) {
-      auto meta_node = dynamic_cast<const MetaNode*>(seq_node.get());
-      for (size_t i = 0; i < meta_node->numEntries(); ++i) {
-        Hash child_hash = meta_node->GetChildHashByEntry(i);
-        result = result & PreorderDump(child_hash, cacher);
-      }  // end for
-    }  // end if seq_node
-  }  // end if cacher
-  return result;
+  operands_.clear();
+  all_operand_segs_.clear();
+  created_segs_.clear();
+  CHECK(root.own());
+  return root;
 }
 
 }  // namespace ustore
@@ -1,5 +1,6 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <algorithm>
+#include <unordered_map>
 #ifdef DEBUG
 #include <iomanip>
 #include <sstream>
@@ -51,6 +52,11 @@ RangeMaps LevenshteinMapper::map(
     DLOG(INFO) << "===========================================================";
     uint64_t lhs_last_element_idx = 0;
     uint64_t rhs_last_element_idx = 0;
+    // Cursors moved forward to the first entry of each gap
+    NodeCursor lhs_gap_cr(*lhs_cr);
+    NodeCursor rhs_gap_cr(*rhs_cr);
+    uint64_t lhs_gap_cr_idx = 0;
+    uint64_t rhs_gap_cr_idx = 0;
     for (std::pair<IndexRange, IndexRange> upper_map : upper_maps) {
       IndexRange lhs_range = upper_map.first;
       IndexRange rhs_range = upper_map.second;
@@ -65,17 +71,10 @@ RangeMaps LevenshteinMapper::map(
         DLOG(INFO) << "Gap Range: "
                    << IndexRange::to_str({lhs_gap_range, rhs_gap_range});
 #endif
-        // Copy current cursor for both LHS and RHS
-        std::unique_ptr<NodeCursor> lhs_cr_cpy(new NodeCursor(*lhs_cr));
-        std::unique_ptr<NodeCursor> rhs_cr_cpy(new NodeCursor(*rhs_cr));
-
-        uint64_t lhs_actual_steps =
-            lhs_cr_cpy->AdvanceSteps(lhs_last_element_idx);
-        DCHECK_EQ(lhs_actual_steps, lhs_last_element_idx);
-
-        uint64_t rhs_actual_steps =
-            rhs_cr_cpy->AdvanceSteps(rhs_last_element_idx);
-        DCHECK_EQ(rhs_actual_steps, rhs_last_element_idx);
+        SeekElement(&lhs_gap_cr, &lhs_gap_cr_idx, lhs_last_element_idx);
+        SeekElement(&rhs_gap_cr, &rhs_gap_cr_idx, rhs_last_element_idx);
+        std::unique_ptr<NodeCursor> lhs_cr_cpy(new NodeCursor(lhs_gap_cr));
+        std::unique_ptr<NodeCursor> rhs_cr_cpy(new NodeCursor(rhs_gap_cr));
 
         RangeMaps cur_map = SeqMap(std::move(lhs_cr_cpy), lhs_gap_range,
                                    std::move(rhs_cr_cpy), rhs_gap_range);
@@ -105,23 +104,14 @@ RangeMaps LevenshteinMapper::map(
       IndexRange rhs_gap_range{rhs_last_element_idx,
                                rhs_end_element_idx - rhs_last_element_idx};
 
-      // Copy current cursor for both LHS and RHS
-      std::unique_ptr<NodeCursor> lhs_cr_cpy(new NodeCursor(*lhs_cr));
-      std::unique_ptr<NodeCursor> rhs_cr_cpy(new NodeCursor(*rhs_cr));
 #ifdef DEBUG
       DLOG(INFO) << "Final Gap Range: "
                  << IndexRange::to_str({lhs_gap_range, rhs_gap_range});
 #endif
-      uint64_t lhs_actual_steps =
-          lhs_cr_cpy->AdvanceSteps(lhs_last_element_idx);
-      CHECK_EQ(lhs_actual_steps, lhs_last_element_idx);
-
-      uint64_t rhs_actual_steps =
-          rhs_cr_cpy->AdvanceSteps(rhs_last_element_idx);
-      CHECK_EQ(rhs_actual_steps, rhs_last_element_idx);
-
-      DCHECK_EQ(0, lhs_cr_cpy->idx());
-      DCHECK_EQ(0, rhs_cr_cpy->idx());
+      SeekElement(&lhs_gap_cr, &lhs_gap_cr_idx, lhs_last_element_idx);
+      SeekElement(&rhs_gap_cr, &rhs_gap_cr_idx, rhs_last_element_idx);
+      std::unique_ptr<NodeCursor> lhs_cr_cpy(new NodeCursor(lhs_gap_cr));
+      std::unique_ptr<NodeCursor> rhs_cr_cpy(new NodeCursor(rhs_gap_cr));
 
       RangeMaps cur_map = SeqMap(std::move(lhs_cr_cpy), lhs_gap_range,
                                  std::move(rhs_cr_cpy), rhs_gap_range);
@@ -145,24 +135,18 @@ RangeMaps LevenshteinMapper::SeqMap(
 #ifdef DEBUG
   DLOG(INFO) << "Perform Sequence Map on "
              << IndexRange::to_str({lhs_range, rhs_range});
-  NodeCursor lhs_cr_cpy(*lhs_cr);
-  NodeCursor rhs_cr_cpy(*rhs_cr);
-
-  DCHECK_EQ(0, lhs_cr->idx());
-  DCHECK_EQ(0, rhs_cr->idx());
 #endif
 
-  std::vector<uint64_t> lhs_entry_elements;
-  std::vector<uint64_t> rhs_entry_elements;
-
-  std::vector<uint64_t> lhs_prefix_acc_elements;
-  std::vector<uint64_t> rhs_prefix_acc_elements;
+  // Entries point into chunks cached by the loader, which outlive the map
+  std::vector<SeqEntry> lhs_entries;
+  std::vector<SeqEntry> rhs_entries;
 
   uint64_t lhs_acc_count = 0;
   while (lhs_acc_count < lhs_range.num_subsequent) {
-    lhs_prefix_acc_elements.push_back(lhs_acc_count);
     uint64_t numCursorElements = numElementsByCursor(*lhs_cr);
-    lhs_entry_elements.push_back(numCursorElements);
+    lhs_entries.push_back({Slice(lhs_cr->current(), lhs_cr->numCurrentBytes()),
+                           lhs_range.start_idx + lhs_acc_count,
+                           numCursorElements});
     lhs_acc_count += numCursorElements;
     bool isSeqEnd = !lhs_cr->Advance(true);
     DCHECK(!isSeqEnd || lhs_acc_count == lhs_range.num_subsequent)
@@ -173,54 +157,151 @@ RangeMaps LevenshteinMapper::SeqMap(
 
   uint64_t rhs_acc_count = 0;
   while (rhs_acc_count < rhs_range.num_subsequent) {
-    rhs_prefix_acc_elements.push_back(rhs_acc_count);
     uint64_t numCursorElements = numElementsByCursor(*rhs_cr);
-    rhs_entry_elements.push_back(numCursorElements);
+    rhs_entries.push_back({Slice(rhs_cr->current(), rhs_cr->numCurrentBytes()),
+                           rhs_range.start_idx + rhs_acc_count,
+                           numCursorElements});
     rhs_acc_count += numCursorElements;
     bool isSeqEnd = !rhs_cr->Advance(true);
     DCHECK(!isSeqEnd || rhs_acc_count == rhs_range.num_subsequent);
   }
   CHECK_EQ(rhs_acc_count, rhs_range.num_subsequent);
 
-  size_t lhs_entry_count = lhs_entry_elements.size();
-  size_t rhs_entry_count = rhs_entry_elements.size();
+  MapWindow(lhs_entries, 0, lhs_entries.size(),
+            rhs_entries, 0, rhs_entries.size(), &result);
+  return IndexRange::Compact(result);
+}
 
-  size_t lhs_entry_retreat = lhs_cr->RetreatEntry(lhs_entry_count);
-  size_t rhs_entry_retreat = rhs_cr->RetreatEntry(rhs_entry_count);
+void LevenshteinMapper::MapWindow(const std::vector<SeqEntry>& lhs,
+                                  size_t lhs_begin, size_t lhs_end,
+                                  const std::vector<SeqEntry>& rhs,
+                                  size_t rhs_begin, size_t rhs_end,
+                                  RangeMaps* result) {
+  // Match the common prefix
+  while (lhs_begin < lhs_end && rhs_begin < rhs_end &&
+         lhs[lhs_begin].data == rhs[rhs_begin].data) {
+    const SeqEntry& lhs_entry = lhs[lhs_begin];
+    const SeqEntry& rhs_entry = rhs[rhs_begin];
+    result->push_back({{lhs_entry.start_idx, lhs_entry.num_elements},
+                       {rhs_entry.start_idx, rhs_entry.num_elements}});
+    ++lhs_begin;
+    ++rhs_begin;
+  }
 
-  CHECK_EQ(lhs_entry_retreat, lhs_entry_count);
-  CHECK_EQ(rhs_entry_retreat, rhs_entry_count);
-#ifdef DEBUG
-  DCHECK(lhs_cr_cpy == *lhs_cr);
-  DCHECK(rhs_cr_cpy == *rhs_cr);
+  // Match the common suffix after the rest
+  size_t num_suffix = 0;
+  while (lhs_begin < lhs_end - num_suffix && rhs_begin < rhs_end - num_suffix
+         && lhs[lhs_end - num_suffix - 1].data ==
+            rhs[rhs_end - num_suffix - 1].data) {
+    ++num_suffix;
+  }
+  lhs_end -= num_suffix;
+  rhs_end -= num_suffix;
+
+  size_t lhs_count = lhs_end - lhs_begin;
+  size_t rhs_count = rhs_end - rhs_begin;
+  if (lhs_count == 0 || rhs_count == 0) {
+    // Pure insertion or deletion
+  } else if ((lhs_count + 1) * (rhs_count + 1) <= kMaxEditMatrixSize) {
+    EditDistanceMap(lhs, lhs_begin, lhs_end, rhs, rhs_begin, rhs_end, result);
+  } else {
+    auto anchors = UniqueAnchors(lhs, lhs_begin, lhs_end,
+                                 rhs, rhs_begin, rhs_end);
+    DLOG(INFO) << "Split window of " << lhs_count << " x " << rhs_count
+               << " entries at " << anchors.size() << " anchors";
+    for (const auto& anchor : anchors) {
+      MapWindow(lhs, lhs_begin, anchor.first, rhs, rhs_begin, anchor.second,
+                result);
+      result->push_back(
+          {{lhs[anchor.first].start_idx, lhs[anchor.first].num_elements},
+           {rhs[anchor.second].start_idx, rhs[anchor.second].num_elements}});
+      lhs_begin = anchor.first + 1;
+      rhs_begin = anchor.second + 1;
+    }
+    // Without any anchor, the window is left unmapped
+    if (!anchors.empty()) {
+      MapWindow(lhs, lhs_begin, lhs_end, rhs, rhs_begin, rhs_end, result);
+    }
+  }
 
-  std::ostringstream lhs_entry_elements_str;
-  std::ostringstream rhs_entry_elements_str;
-  std::ostringstream lhs_prefix_acc_elements_str;
-  std::ostringstream rhs_prefix_acc_elements_str;
+  for (size_t i = 0; i < num_suffix; ++i) {
+    result->push_back({{lhs[lhs_end + i].start_idx,
+                        lhs[lhs_end + i].num_elements},
+                       {rhs[rhs_end + i].start_idx,
+                        rhs[rhs_end + i].num_elements}});
+  }
+}
 
-  for (size_t i = 0; i < lhs_entry_count; ++i) {
-    lhs_entry_elements_str << lhs_entry_elements[i] << ", ";
-    lhs_prefix_acc_elements_str << lhs_prefix_acc_elements[i] << ", ";
+std::vector<std::pair<size_t, size_t>> LevenshteinMapper::UniqueAnchors(
+    const std::vector<SeqEntry>& lhs, size_t lhs_begin, size_t lhs_end,
+    const std::vector<SeqEntry>& rhs, size_t rhs_begin, size_t rhs_end) {
+  struct Occurrence {
+    size_t lhs_count;
+    size_t rhs_count;
+    size_t lhs_pos;
+    size_t rhs_pos;
+  };
+  std::unordered_map<Slice, Occurrence> occurrences;
+  for (size_t i = lhs_begin; i < lhs_end; ++i) {
+    Occurrence& occ = occurrences[lhs[i].data];
+    ++occ.lhs_count;
+    occ.lhs_pos = i;
+  }
+  for (size_t j = rhs_begin; j < rhs_end; ++j) {
+    auto it = occurrences.find(rhs[j].data);
+    if (it == occurrences.end()) continue;
+    ++it->second.rhs_count;
+    it->second.rhs_pos = j;
   }
 
-  for (size_t j = 0; j < rhs_entry_count; ++j) {
-    rhs_entry_elements_str << rhs_entry_elements[j] << ", ";
-    rhs_prefix_acc_elements_str << rhs_prefix_acc_elements[j] << ", ";
+  // Unique pairs in lhs order
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t i = lhs_begin; i < lhs_end; ++i) {
+    const Occurrence& occ = occurrences[lhs[i].data];
+    if (occ.lhs_count == 1 && occ.rhs_count == 1) {
+      pairs.emplace_back(i, occ.rhs_pos);
+    }
   }
 
-  DLOG(INFO) << "LHS Entry Elements: " << lhs_entry_elements_str.str();
-  DLOG(INFO) << "RHS Entry Elements: " << rhs_entry_elements_str.str();
-  DLOG(INFO) << "LHS Prefix Entry Elements: "
-             << lhs_prefix_acc_elements_str.str();
-  DLOG(INFO) << "RHS Prefix Entry Elements: "
-             << rhs_prefix_acc_elements_str.str();
-#endif
+  // Longest increasing sequence of rhs positions by patience sorting
+  //   tails[k]: the pair ending the best sequence of length k + 1
+  std::vector<size_t> tails;
+  std::vector<size_t> prev(pairs.size());
+  for (size_t p = 0; p < pairs.size(); ++p) {
+    auto it = std::lower_bound(tails.begin(), tails.end(), pairs[p].second,
+        [&pairs](size_t q, size_t rhs_pos) {
+          return pairs[q].second < rhs_pos;
+        });
+    prev[p] = it == tails.begin() ? pairs.size() : *(it - 1);
+    if (it == tails.end()) {
+      tails.push_back(p);
+    } else {
+      *it = p;
+    }
+  }
+
+  std::vector<std::pair<size_t, size_t>> anchors(tails.size());
+  size_t p = tails.empty() ? pairs.size() : tails.back();
+  for (size_t k = tails.size(); k > 0; --k) {
+    anchors[k - 1] = pairs[p];
+    p = prev[p];
+  }
+  return anchors;
+}
+
+void LevenshteinMapper::EditDistanceMap(const std::vector<SeqEntry>& lhs,
+                                        size_t lhs_begin, size_t lhs_end,
+                                        const std::vector<SeqEntry>& rhs,
+                                        size_t rhs_begin, size_t rhs_end,
+                                        RangeMaps* result) {
+  size_t lhs_entry_count = lhs_end - lhs_begin;
+  size_t rhs_entry_count = rhs_end - rhs_begin;
 
 // Construct the edit matrix based on Levenshtein Formular
   size_t num_row = static_cast<size_t>(lhs_entry_count + 1);
   size_t num_col = static_cast<size_t>(rhs_entry_count + 1);
-  Entry* edit_matrix = new Entry[(num_row) * (num_col)];
+  std::unique_ptr<Entry[]> edit_matrix_buf(new Entry[(num_row) * (num_col)]);
+  Entry* edit_matrix = edit_matrix_buf.get();
 
   *edit_matrix = {EditMarker::kNull, 0};  // Entry 0, 0
   for (size_t i = 1; i <= lhs_entry_count; ++i) {
@@ -238,6 +319,7 @@ RangeMaps LevenshteinMapper::SeqMap(
   }
 
   for (size_t i = 1; i <= lhs_entry_count; ++i) {
+    const Slice& lhs_data = lhs[lhs_begin + i - 1].data;
     for (size_t j = 1; j <= rhs_entry_count; ++j) {
       Entry* cur_entry = edit_matrix + i * num_col + j;  // Entry (i, j)
       cur_entry->marker = EditMarker::kNull;
@@ -261,30 +343,20 @@ RangeMaps LevenshteinMapper::SeqMap(
       // Diagonal Entry (i-1, j-1)
       size_t offset = (i - 1) * num_col  + (j - 1);
       Entry* dgn_entry = edit_matrix + offset;
-      if (lhs_cr->numCurrentBytes() == rhs_cr->numCurrentBytes() &&
-          std::memcmp(lhs_cr->current(), rhs_cr->current(),
-                      lhs_cr->numCurrentBytes()) == 0) {
+      if (lhs_data == rhs[rhs_begin + j - 1].data) {
         achievable_distance = dgn_entry->edit_distance;
         if (achievable_distance <= cur_entry->edit_distance) {
           cur_entry->marker = EditMarker::kMatch;
           cur_entry->edit_distance = achievable_distance;
         }  // end if
       } else {
-        achievable_distance = achievable_distance + 1;
         achievable_distance = dgn_entry->edit_distance + 1;
         if (achievable_distance <= cur_entry->edit_distance) {
           cur_entry->marker = EditMarker::kSubstitution;
           cur_entry->edit_distance = achievable_distance;
         }  // end if
-      }  // end if lhs_cr and rhs_cr
-      rhs_cr->Advance(true);
+      }  // end if lhs_data and rhs data
     }  // end for j
-    // Revert back the RHS cursor
-    lhs_cr->Advance(true);
-    rhs_cr->RetreatEntry(rhs_entry_count);
-#ifdef DEBUG
-    DCHECK(rhs_cr_cpy == *rhs_cr);
-#endif
   }  // end for i
 
 #ifdef DEBUG
@@ -318,18 +390,15 @@ RangeMaps LevenshteinMapper::SeqMap(
   size_t lhs_idx = lhs_entry_count;
   size_t rhs_idx = rhs_entry_count;
 
+  RangeMaps window_maps;
   while (lhs_idx > 0 && rhs_idx > 0) {
     Entry* cur_entry = edit_matrix + lhs_idx * num_col + rhs_idx;
     if (cur_entry->marker == EditMarker::kMatch) {
-        CHECK_EQ(lhs_entry_elements[lhs_idx - 1],
-                 rhs_entry_elements[rhs_idx - 1]);
-        IndexRange seq_lhs_range{lhs_range.start_idx
-                             + lhs_prefix_acc_elements[lhs_idx - 1],
-                             lhs_entry_elements[lhs_idx - 1]};
-        IndexRange seq_rhs_range{rhs_range.start_idx
-                             + rhs_prefix_acc_elements[rhs_idx - 1],
-                             rhs_entry_elements[rhs_idx - 1]};
-        result.push_back({seq_lhs_range, seq_rhs_range});
+        const SeqEntry& lhs_entry = lhs[lhs_begin + lhs_idx - 1];
+        const SeqEntry& rhs_entry = rhs[rhs_begin + rhs_idx - 1];
+        CHECK_EQ(lhs_entry.num_elements, rhs_entry.num_elements);
+        window_maps.push_back({{lhs_entry.start_idx, lhs_entry.num_elements},
+                               {rhs_entry.start_idx, rhs_entry.num_elements}});
     }  // end if
 
     switch (cur_entry->marker) {
@@ -345,9 +414,24 @@ RangeMaps LevenshteinMapper::SeqMap(
     }  // end switch
   }  // end while
 
-  std::reverse(result.begin(), result.end());
-  delete[] edit_matrix;
-  return IndexRange::Compact(result);
+  result->insert(result->end(), window_maps.rbegin(), window_maps.rend());
+}
+
+void LevenshteinMapper::SeekElement(NodeCursor* cursor, uint64_t* cursor_idx,
+                                    uint64_t idx) {
+  DCHECK_LE(*cursor_idx, idx);
+  if (cursor->node()->isLeaf()) {
+    uint64_t actual_steps = cursor->AdvanceSteps(idx - *cursor_idx);
+    CHECK_EQ(actual_steps, idx - *cursor_idx);
+    *cursor_idx = idx;
+    return;
+  }
+  // AdvanceSteps on a meta cursor counts from the end of the current entry
+  while (*cursor_idx < idx) {
+    *cursor_idx += numElementsByCursor(*cursor);
+    cursor->Advance(true);
+  }
+  CHECK_EQ(*cursor_idx, idx);
 }
 
 uint64_t LevenshteinMapper::numElementsByCursor(const NodeCursor& cursor) {
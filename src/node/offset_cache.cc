@@ -0,0 +1,27 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "node/offset_cache.h"
+
+#include <utility>
+#include "utils/env.h"
+
+namespace ustore {
+
+OffsetCache::OffsetCache()
+  : OffsetCache(size_t(Env::Instance()->config().offset_cache_mb()) << 20) {}
+
+std::shared_ptr<const OffsetTable> OffsetCache::Get(const Chunk& chunk,
+                                                    const Decoder& decode) {
+  if (capacity() > 0 && chunk.hashed()) {
+    auto table = ClockCache<OffsetTable>::Get(chunk.hash());
+    if (table != nullptr) return table;
+  }
+  // keep the table cached by others meanwhile if any
+  auto table = std::make_shared<OffsetTable>();
+  decode(table.get());
+  if (!chunk.hashed()) return table;
+  const size_t num_bytes = table->numBytes();
+  return Put(chunk.hash(), std::move(table), num_bytes);
+}
+
+}  // namespace ustore
@@ -29,6 +29,15 @@ size_t OrderedKey::Encode(byte_t* buffer) const {
   return numBytes();
 }
 
+uint64_t OrderedKey::prefix(size_t skip) const {
+  if (by_value_) return value_;
+  uint64_t prefix = 0;
+  const size_t len = slice_.len();
+  for (size_t i = skip; i < skip + sizeof(uint64_t); ++i)
+    prefix = (prefix << 8) | (i < len ? slice_.data()[i] : 0);
+  return prefix;
+}
+
 bool OrderedKey::operator>(const OrderedKey& otherKey) const {
   CHECK_EQ(by_value_, otherKey.by_value_);
   return by_value_ ? value_ > otherKey.value_ : slice_ > otherKey.slice_;
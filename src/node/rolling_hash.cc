@@ -2,26 +2,93 @@
 
 #include "node/rolling_hash.h"
 
+#include <algorithm>
+#include "hash/gearhash.h"
+
 namespace ustore {
 
+namespace {
+
+// a mask of n bits ending at bit 62, the highest bits that are covered by
+// kGearWindow bytes
+inline uint64_t GearMask(int n) {
+  n = std::max(1, std::min(n, 62));
+  return ((uint64_t(1) << n) - 1) << (63 - n);
+}
+
+// gear hash bytes in [begin, end), and return the position of the first one
+// after which the hash has no bits of the mask set, or end if none
+inline size_t ScanGear(const byte_t* data, size_t begin, size_t end,
+                       uint64_t mask, uint64_t* hash) {
+  uint64_t h = *hash;
+  size_t i = begin;
+  // roll two bytes each time: after the first byte, h holds the hash shifted
+  // by one bit, which is checked against the mask shifted likewise
+  const uint64_t mask_shifted = mask << 1;
+  for (; i + 1 < end; i += 2) {
+    h = (h << 2) + (gearhash::gear[data[i]] << 1);
+    if (!(h & mask_shifted)) {
+      *hash = h >> 1;
+      return i;
+    }
+    h += gearhash::gear[data[i + 1]];
+    if (!(h & mask)) {
+      *hash = h;
+      return i + 1;
+    }
+  }
+  if (i < end) {
+    h = (h << 1) + gearhash::gear[data[i]];
+    if (!(h & mask)) {
+      *hash = h;
+      return i;
+    }
+    ++i;
+  }
+  *hash = h;
+  return end;
+}
+
+}  // namespace
+
 RollingHasher::RollingHasher()
     : RollingHasher(kDefaultChunkPattern, kDefaultChunkWindow,
                     kDefaultMaxChunkSize) {}
 
 RollingHasher::RollingHasher(uint32_t chunk_pattern, size_t window_size,
-                             size_t max_size)
-    : chunk_pattern_{chunk_pattern},
+                             size_t max_size, Engine engine)
+    : engine_{engine},
+      chunk_pattern_{chunk_pattern},
       window_size_{window_size},
       max_size_{max_size},
-      buz_{unsigned(window_size)} {}
+      buz_{unsigned(window_size)} {
+  const size_t expected_size = size_t(chunk_pattern) + 1;
+  // FastCDC skips the first quarter of the expected size, but never cuts
+  // within the window, as buzhash does
+  min_size_ = std::min(std::max(window_size, expected_size / 4), max_size);
+  normal_size_ = std::min(std::max(expected_size, min_size_), max_size);
+  // normalized chunking: two more bits before the expected size, and two
+  // less bits after it
+  int pattern_bits = 0;
+  for (uint32_t p = chunk_pattern; p; p >>= 1) pattern_bits += p & 1;
+  mask_small_ = GearMask(pattern_bits + 2);
+  mask_large_ = GearMask(pattern_bits - 2);
+}
 
 void RollingHasher::HashBytes(const byte_t* data, size_t numBytes) {
+  if (engine_ == Engine::kFastCDC) {
+    // boundaries are sticky, bytes after the first one are only counted
+    size_t pos = TryHashBytesFastCDC(data, numBytes);
+    if (pos < numBytes) byte_hashed_ += numBytes - pos - 1;
+    return;
+  }
   for (size_t i = 0; i < numBytes; i++) {
     HashByte(*(data + i));
   }
 }
 
 size_t RollingHasher::TryHashBytes(const byte_t* data, size_t numBytes) {
+  if (engine_ == Engine::kFastCDC) return TryHashBytesFastCDC(data, numBytes);
   for (size_t i = 0; i < numBytes; i++) {
     HashByte(*(data + i));
     if (crossed_boundary_) return i;
@@ -29,4 +96,43 @@ size_t RollingHasher::TryHashBytes(const byte_t* data, size_t numBytes) {
   return numBytes;
 }
 
+size_t RollingHasher::TryHashBytesFastCDC(const byte_t* data,
+                                          size_t numBytes) {
+  if (numBytes == 0) return 0;
+  if (crossed_boundary_) {
+    ++byte_hashed_;
+    return 0;
+  }
+  const size_t start = byte_hashed_;
+  // position of the count-th byte of the chunk in data
+  auto pos = [start, numBytes](size_t count) {
+    return count > start ? std::min(count - start - 1, numBytes) : 0;
+  };
+  // bytes earlier than a window before the minimum size cannot affect the
+  // hash at any possible boundary, skip them
+  size_t skipped = min_size_ > kGearWindow ? min_size_ - kGearWindow : 0;
+  size_t i = pos(skipped + 1);
+  uint64_t h = gear_;
+  for (size_t end = pos(min_size_); i < end; ++i)
+    h = (h << 1) + gearhash::gear[data[i]];
+  size_t end = pos(normal_size_);
+  i = ScanGear(data, i, end, mask_small_, &h);
+  if (i == end) {
+    end = pos(max_size_);
+    i = ScanGear(data, i, end, mask_large_, &h);
+    if (i == end && i < numBytes) {
+      // reach the maximum chunk size
+      h = (h << 1) + gearhash::gear[data[i]];
+    } else if (i == numBytes) {
+      byte_hashed_ = start + numBytes;
+      gear_ = h;
+      return numBytes;
+    }
+  }
+  crossed_boundary_ = true;
+  byte_hashed_ = start + i + 1;
+  gear_ = h;
+  return i;
+}
+
 }  // namespace ustore
@@ -764,7 +764,8 @@ ErrorCode ColumnStore::ManipRows(
   const std::string& table_name, const std::string& branch_name,
   const std::string& ref_col_name, const std::string& ref_val,
   const Row& row, const std::function<void(
-    Column*, size_t row_idx, const std::string&)> f_manip_col,
+    Column*, const std::vector<uint64_t>& row_indices,
+    const std::string&)> f_manip_col,
   size_t* n_rows_affected) {
   if (n_rows_affected != nullptr) *n_rows_affected = 0;
   if (ref_col_name.empty()) {
@@ -776,13 +777,13 @@ ErrorCode ColumnStore::ManipRows(
     return ErrorCode::kInvalidParameter;
   }
   // search for row indices
-  std::list<size_t> indices;
+  std::vector<uint64_t> indices;
   {
     Column ref_col;
     USTORE_GUARD(
       GetColumn(table_name, branch_name, ref_col_name, &ref_col));
     for (auto it = ref_col.Scan(); !it.end(); it.next()) {
-      if (it.value() == ref_val) indices.emplace_front(it.index());
+      if (it.value() == ref_val) indices.emplace_back(it.index());
     }
   }
   if (indices.empty()) return ErrorCode::kRowNotExists;
@@ -794,24 +795,21 @@ ErrorCode ColumnStore::ManipRows(
     Table tab;
     USTORE_GUARD(
       ReadTable(table, branch, &tab));
-    auto col_ver = Utils::ToHash(tab.Get(Slice(col_name)));
+    const auto col_ver = Utils::ToHash(tab.Get(Slice(col_name)));
     auto col_key_str = GlobalKey(table_name, col_name);
     Slice col_key(col_key_str);
-    // update column values
-    for (auto& i : indices) {
-      // retrive column corresponding to the field
-      Column col;
-      USTORE_GUARD(
-        ReadColumn(col_key, col_ver, &col));
-      // manipulate field value of the column
-      f_manip_col(&col, i, field_value);
-      // write the new column into storage
-      auto col_rst = odb_.Put(col_key, col, branch);
-      USTORE_GUARD(col_rst.stat);
-      col_ver = col_rst.value.Clone();
-    }
+    // retrive column corresponding to the field
+    Column col;
+    USTORE_GUARD(
+      ReadColumn(col_key, col_ver, &col));
+    // manipulate field values of all rows in a single version
+    f_manip_col(&col, indices, field_value);
+    // write the new column into storage
+    auto col_rst = odb_.Put(col_key, col, branch);
+    USTORE_GUARD(col_rst.stat);
+    const auto col_ver_new = col_rst.value.Clone();
     // update column entry in the table
-    tab.Set(Slice(col_name), Utils::ToSlice(col_ver));
+    tab.Set(Slice(col_name), Utils::ToSlice(col_ver_new));
     USTORE_GUARD(
       odb_.Put(table, tab, branch).stat);
   }
@@ -829,8 +827,10 @@ ErrorCode ColumnStore::UpdateRow(const std::string& table_name,
     Validate(row, table_name, branch_name, &n_fields_not_covered));
 
   return ManipRows(table_name, branch_name, ref_col_name, ref_val, row,
-  [](Column * col, size_t row_idx, const std::string & field_value) {
-    col->Splice(row_idx, 1, {Slice(field_value)});
+  [](Column * col, const std::vector<uint64_t>& row_indices,
+     const std::string & field_value) {
+    col->Set(row_indices,
+             std::vector<Slice>(row_indices.size(), Slice(field_value)));
   }, n_rows_affected);
 }
 
@@ -907,8 +907,9 @@ ErrorCode ColumnStore::DeleteRow(const std::string& table_name,
     GetTableSchema(table_name, branch_name, &row));
 
   return ManipRows(table_name, branch_name, ref_col_name, ref_val, row,
-  [](Column * col, size_t row_idx, const std::string & field_value) {
-    col->Delete(row_idx, 1);
+  [](Column * col, const std::vector<uint64_t>& row_indices,
+     const std::string & field_value) {
+    col->Delete(row_indices);
   }, n_rows_deleted);
 }
 
@@ -93,6 +93,29 @@ std::ostream& operator<<(std::ostream& os, const StoreInfo& obj) {
   return os;
 }
 
+std::vector<Chunk> ChunkStore::MultiGet(const std::vector<Hash>& keys) {
+  std::vector<Chunk> chunks;
+  chunks.reserve(keys.size());
+  for (const Hash& key : keys) chunks.push_back(Get(key));
+  return chunks;
+}
+
+bool ChunkStore::MultiPut(const std::vector<Hash>& keys,
+                          const std::vector<const Chunk*>& chunks) {
+  CHECK_EQ(keys.size(), chunks.size());
+  bool success = true;
+  for (size_t i = 0; i < keys.size(); ++i)
+    success = Put(keys[i], *chunks[i]) && success;
+  return success;
+}
+
+std::vector<bool> ChunkStore::MultiExists(const std::vector<Hash>& keys) {
+  std::vector<bool> exists;
+  exists.reserve(keys.size());
+  for (const Hash& key : keys) exists.push_back(Exists(key));
+  return exists;
+}
+
 namespace store {
 
 ChunkStore* InitChunkStore(const std::string& dir, const std::string& file,
@@ -5,7 +5,9 @@
 #include "store/ldb_store.h"
 
 #include <algorithm>
+#include <unordered_set>
 #include "leveldb/slice.h"
+#include "leveldb/write_batch.h"
 #include "utils/logging.h"
 
 namespace ustore {
@@ -85,6 +87,27 @@ bool LDBStore::Exists(const Hash& key) {
   return false;
 }
 
+bool LDBStore::MultiPut(const std::vector<Hash>& keys,
+                        const std::vector<const Chunk*>& chunks) {
+  CHECK_EQ(keys.size(), chunks.size());
+  std::unordered_set<Hash> batched;
+  leveldb::WriteBatch batch;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    CHECK(keys[i] == chunks[i]->hash());
+    if (Exists(keys[i]) || !batched.insert(keys[i]).second) continue;
+    batch.Put(
+        leveldb::Slice(
+            reinterpret_cast<char*>(const_cast<byte_t*>(keys[i].value())),
+            Hash::kByteLength),
+        leveldb::Slice(
+            reinterpret_cast<char*>(const_cast<byte_t*>(chunks[i]->head())),
+            chunks[i]->numBytes()));
+  }
+  auto ws = db_->Write(wr_opt_, &batch);
+  CHECK(ws.ok()) << "Leveldb chunck storage internal error: " << ws.ToString();
+  return true;
+}
+
 const StoreInfo& LDBStore::GetInfo() {
   static StoreInfo info;
   return info;
@@ -3,13 +3,21 @@
 #include "store/lst_store.h"
 
 #include <fcntl.h>
+#include <linux/falloc.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <numeric>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "utils/chars.h"
 #include "utils/enum.h"
@@ -30,6 +38,117 @@ void* LSTSegment::base_addr_ = nullptr;
 
 namespace fs = boost::filesystem;
 
+constexpr size_t LSTFlatMap::kOffsetBits;
+constexpr uint64_t LSTFlatMap::kMaxOffset;
+constexpr uint64_t LSTFlatMap::kEmpty;
+constexpr uint64_t LSTFlatMap::kDeleted;
+constexpr size_t LSTFlatMap::kNotFound;
+constexpr size_t LSTFlatMap::kMinCapacity;
+
+size_t LSTFlatMap::Find(const key_type& key) const {
+  if (size_ == 0) return kNotFound;
+  const size_t mask = slots_.size() - 1;
+  const uint64_t tag = Tag(key.hash_);
+  for (size_t i = Home(key.hash_) & mask; ; i = (i + 1) & mask) {
+    uint64_t slot = slots_[i];
+    if (slot == kEmpty) return kNotFound;
+    if (slot != kDeleted && (slot >> kOffsetBits) == tag
+        && std::memcmp(HashPtr(slot), key.hash_, Hash::kByteLength) == 0)
+      return i;
+  }
+}
+
+LSTFlatMap::const_iterator LSTFlatMap::find(const key_type& key) const {
+  size_t i = Find(key);
+  return i == kNotFound ? end() : const_iterator(i, ChunkPtr(slots_[i]));
+}
+
+std::pair<LSTFlatMap::iterator, bool> LSTFlatMap::emplace(
+    const key_type& key, const mapped_type& value) {
+  DCHECK_EQ(key.hash_, value.chunk_ + PtrToChunkLength(value.chunk_));
+  // keep the load factor (including deleted slots) below 3/4
+  if ((size_ + deleted_ + 1) * 4 > slots_.size() * 3)
+    Rehash(std::max(kMinCapacity, (size_ + 1) * 4 > slots_.size() * 3
+                                  ? slots_.size() * 2 : slots_.size()));
+
+  const size_t mask = slots_.size() - 1;
+  const uint64_t tag = Tag(key.hash_);
+  size_t target = kNotFound;
+  for (size_t i = Home(key.hash_) & mask; ; i = (i + 1) & mask) {
+    uint64_t slot = slots_[i];
+    if (slot == kEmpty) {
+      if (target == kNotFound) target = i;
+      break;
+    }
+    if (slot == kDeleted) {
+      if (target == kNotFound) target = i;
+    } else if ((slot >> kOffsetBits) == tag
+               && std::memcmp(HashPtr(slot), key.hash_,
+                              Hash::kByteLength) == 0) {
+      return {const_iterator(i, ChunkPtr(slot)), false};
+    }
+  }
+
+  uint64_t offset = uintptr_t(value.chunk_) - uintptr_t(LSTSegment::base_addr_);
+  DCHECK_LE(offset, kMaxOffset);
+  if (slots_[target] == kDeleted) --deleted_;
+  slots_[target] = tag << kOffsetBits | offset;
+  ++size_;
+  return {const_iterator(target, value.chunk_), true};
+}
+
+size_t LSTFlatMap::erase(const key_type& key) {
+  size_t i = Find(key);
+  if (i == kNotFound) return 0;
+  slots_[i] = kDeleted;
+  --size_;
+  ++deleted_;
+  return 1;
+}
+
+void LSTFlatMap::reserve(size_t n) {
+  size_t capacity = kMinCapacity;
+  while (capacity * 3 < n * 4) capacity *= 2;
+  if (capacity > slots_.size()) Rehash(capacity);
+}
+
+void LSTFlatMap::clear() {
+  slots_.clear();
+  size_ = 0;
+  deleted_ = 0;
+}
+
+bool LSTFlatMap::Assign(std::vector<uint64_t>&& slots, size_t size) {
+  // the capacity must be a power of two that respects the load factor
+  if (slots.size() & (slots.size() - 1)) return false;
+  size_t live = 0, deleted = 0;
+  for (uint64_t slot : slots) {
+    if (slot == kDeleted)
+      ++deleted;
+    else if (slot != kEmpty)
+      ++live;
+  }
+  if (live != size || (live + deleted) * 4 > slots.size() * 3) return false;
+  slots_ = std::move(slots);
+  size_ = live;
+  deleted_ = deleted;
+  return true;
+}
+
+void LSTFlatMap::Rehash(size_t capacity) {
+  std::vector<uint64_t> old_slots(capacity, kEmpty);
+  old_slots.swap(slots_);
+  const size_t mask = capacity - 1;
+  for (uint64_t slot : old_slots) {
+    if (slot == kEmpty || slot == kDeleted) continue;
+    // the home slot is derived from the full hash kept in the log
+    size_t i = Home(HashPtr(slot)) & mask;
+    while (slots_[i] != kEmpty) i = (i + 1) & mask;
+    slots_[i] = slot;
+  }
+  deleted_ = 0;
+}
+
 static void DestroySegmentList(LSTSegment* head) {
   while (head != nullptr) {
     auto next = head->next_;
@@ -72,6 +191,17 @@ static inline byte_t* GetValidateHashPtr(const LSTSegment* segment) {
     - Hash::kByteLength;
 }
 
+/**
+ * @brief a segment is sealed once its validation hash has been written, i.e.,
+ * no more chunks will be appended to it
+ */
+static bool IsSealed(const LSTSegment* segment) {
+  const byte_t* first_chunk = GetFirstChunkPtr(segment);
+  if (IsEndChunk(PtrToChunkType(first_chunk))) return false;
+  return std::memcmp(first_chunk + PtrToChunkLength(first_chunk),
+                     GetValidateHashPtr(segment), Hash::kByteLength) == 0;
+}
+
 static size_t LinkSegmentList(LSTSegment** begin) {
   LSTSegment *iter = *begin;
   LSTSegment *last = nullptr;
@@ -142,6 +272,7 @@ void LSTStore::UpdateStore() {
       SyncToDisk(last_segment, kMetaSegmentSize);
     }
     last_free_segment_ = sync_block_.last_;
+    std::lock_guard<std::mutex> lock(info_mutex_);
     storeInfo.freeSegments += sync_block_.segments_;
     storeInfo.allocSegments += sync_block_.segments_;
   }
@@ -216,13 +347,18 @@ void* LSTStore::MmapUstoreLogFile(const std::string& dir,
                                   const std::string& file, bool persist) {
   fs::path path(dir);
   path /= file + ".dat";
-  if (!persist) fs::remove(path);
+  checkpoint_path_ = (fs::path(dir) / (file + ".idx")).string();
+  if (!persist) {
+    fs::remove(path);
+    fs::remove(checkpoint_path_);
+  }
 
   if (fs::exists(path) &&
       (fs::file_size(path) - kMetaLogSize) % kSegmentSize == 0) {
     fd_ = ::open(path.c_str(), O_RDWR, S_IRWXU);
   } else {
     // init the log
+    fs::remove(checkpoint_path_);
     fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
     char* meta_log = new char[kMetaLogSize];
     std::memset(meta_log, 0, kMetaLogSize);
@@ -236,17 +372,29 @@ void* LSTStore::MmapUstoreLogFile(const std::string& dir,
   }
 
   CHECK_GE(fd_, 0);
+  // chunk offsets are packed into 40 bits by the index
+  CHECK_LE(max_log_size_, LSTFlatMap::kMaxOffset)
+    << "max_segments is too large for the chunk index";
   void* address = ::mmap(nullptr, max_log_size_, PROT_READ | PROT_WRITE,
                          MAP_SHARED, fd_, 0);
   LOG_LST_STORE_FATAL_ERROR_IF(address == reinterpret_cast<void*>(-1),
                                "MMAP ERROR: ");
 
-  // lock the mmap'ed memory to guarantee in-memory access
-  ::mlock(address, max_log_size_);
+  if (resident_budget_ == 0) {
+    // lock the mmap'ed memory to guarantee in-memory access
+    ::mlock(address, max_log_size_);
+  } else {
+    referenced_.reset(new std::atomic<bool>[max_segments_]);
+    for (size_t i = 0; i < max_segments_; ++i) referenced_[i].store(false);
+    resident_.assign(max_segments_, false);
+  }
   LSTSegment::base_addr_ = address;
   initStoreInfo(&storeInfo);
   storeInfo.maxSegments = max_segments_;
   this->Load(address);
+  // drop the pages read by loading; the residency thread brings back those
+  // in use
+  if (resident_budget_) ::madvise(address, max_log_size_, MADV_DONTNEED);
   if (storeInfo.freeSegments < segment_increment_) {
     thread_status_.store(ThreadStatus::kScheduled);
     Enlarge();
@@ -256,7 +404,35 @@ void* LSTStore::MmapUstoreLogFile(const std::string& dir,
   return address;
 }
 
-LSTSegment* LSTStore::AllocateMajor() {
+size_t LSTStore::GetLaneId() {
+  static std::atomic<size_t> next_lane(0);
+  thread_local size_t lane = next_lane.fetch_add(1) % kNumAppendLanes;
+  return lane;
+}
+
+void LSTStore::Seal(LSTSegment* segment) {
+  // write the hash of the first chunk into the last 20 bytes of the segment
+  byte_t* first_chunk = GetFirstChunkPtr(segment);
+  byte_t* first_hash = first_chunk + PtrToChunkLength(first_chunk);
+  std::copy(first_hash, first_hash + ::ustore::Hash::kByteLength,
+      GetValidateHashPtr(segment));
+  SyncToDisk(segment->segment_, kSegmentSize);
+}
+
+offset_t LSTStore::GetTailOffset() const {
+  for (const AppendLane& lane : lanes_)
+    if (lane.segment_ == current_major_segment_) return lane.offset_.load();
+  return kMetaSegmentSize;
+}
+
+LSTSegment* LSTStore::AllocateMajor(AppendLane* lane) {
+  Lock lock(this);
+  if (lane->segment_ != nullptr) {
+    Seal(lane->segment_);
+    MaybeScheduleCheckpoint();
+  }
+  // the new segment is always appended to the tail of the major list,
+  // no matter which lane it is allocated for
   LSTSegment* new_segment = Allocate(current_major_segment_);
   if (current_major_segment_ != nullptr)
     current_major_segment_->next_ = new_segment;
@@ -269,8 +445,38 @@ LSTSegment* LSTStore::AllocateMajor() {
       SegmentPtrToOffset(major_list_),
       SegmentPtrToOffset(current_major_segment_));
   SyncToDisk(LSTSegment::base_addr_, kMetaLogSize);
-  major_segment_offset_ = kMetaSegmentSize;
-  return current_major_segment_;
+  if (group_commit_) {
+    // the chunks left in the sealed segment, the link to the new segment
+    // and the log meta block have to be flushed as well
+    const byte_t* base = static_cast<const byte_t*>(LSTSegment::base_addr_);
+    if (lane->segment_ != nullptr) {
+      const byte_t* end = static_cast<const byte_t*>(lane->segment_->segment_)
+                          + kSegmentSize;
+      lane->dirty_ranges_.emplace_back(lane->dirty_begin_, end);
+    }
+    if (new_segment->prev_ != nullptr) {
+      const byte_t* prev = static_cast<const byte_t*>(
+          new_segment->prev_->segment_);
+      lane->dirty_ranges_.emplace_back(prev, prev + kMetaSegmentSize);
+    }
+    lane->dirty_ranges_.emplace_back(base, base + kMetaLogSize);
+  }
+  lane->segment_ = new_segment;
+  lane->dirty_begin_ = static_cast<const byte_t*>(new_segment->segment_);
+  lane->offset_.store(kMetaSegmentSize);
+  lane->to_sync_chunks_ = 0;
+  lane->sync_timer_.Reset();
+  lane->sync_timer_.Start();
+  return new_segment;
+}
+
+void LSTStore::Clear(LSTSegment* segment) {
+  // punch a hole to release the disk space, which then reads as zeros
+  offset_t offset = SegmentPtrToOffset(segment) + kMetaSegmentSize;
+  if (-1 == ::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        offset, kSegmentSize - kMetaSegmentSize))
+    std::memset(GetFirstChunkPtr(segment), 0,
+                kSegmentSize - kMetaSegmentSize);
 }
 
 LSTSegment* LSTStore::Allocate(LSTSegment* current) {
@@ -305,15 +511,10 @@ LSTSegment* LSTStore::Allocate(LSTSegment* current) {
   }
 
   LSTSegment* next = free_list_;
+  // a segment reclaimed by GC still holds its old chunks
+  if (!IsEndChunk(PtrToChunkType(GetFirstChunkPtr(next)))) Clear(next);
 
   if (current != nullptr) {
-    // write the hash of the first chunk into the last 20 bytes of the
-    // current segment
-    byte_t* first_chunk = GetFirstChunkPtr(current);
-    byte_t* first_hash = first_chunk + PtrToChunkLength(first_chunk);
-    std::copy(first_hash, first_hash + ::ustore::Hash::kByteLength,
-        GetValidateHashPtr(current));
-    SyncToDisk(current->segment_, kSegmentSize);
     AppendInteger(reinterpret_cast<char*>(current->segment_) + sizeof(offset_t),
         SegmentPtrToOffset(next));
     // need to sync the content before metasegment to ensure the correct load
@@ -334,13 +535,15 @@ LSTSegment* LSTStore::Allocate(LSTSegment* current) {
   current = next;
 
   // update store information
+  std::lock_guard<std::mutex> lock(info_mutex_);
   ++storeInfo.usedSegments;
   --storeInfo.freeSegments;
 
   return current;
 }
 
-offset_t LSTStore::LoadFromLastSegment(LSTSegment* segment) {
+offset_t LSTStore::LoadFromLastSegment(LSTSegment* segment, offset_t start,
+                                       LoadBuckets* buckets) {
   // first check if it is the last segment, if not, simply make it the last
   offset_t next_segment_offset;
   ReadInteger(reinterpret_cast<char*>(segment->segment_) + sizeof(offset_t),
@@ -357,7 +560,15 @@ offset_t LSTStore::LoadFromLastSegment(LSTSegment* segment) {
     need_sync = true;
   }
 
-  byte_t* chunk_offset = GetFirstChunkPtr(segment);
+  if (need_sync) SyncToDisk(segment->segment_, kMetaSegmentSize);
+  return LoadFromOpenSegment(segment, start, buckets);
+}
+
+offset_t LSTStore::LoadFromOpenSegment(LSTSegment* segment, offset_t start,
+                                       LoadBuckets* buckets) {
+  // chunks of an unsealed segment may be partially written; validate each
+  bool need_sync = false;
+  byte_t* chunk_offset = reinterpret_cast<byte_t*>(segment->segment_) + start;
   while (true) {
     Chunk chunk(chunk_offset);
     byte_t* hash_offset = chunk_offset + chunk.numBytes();
@@ -370,14 +581,7 @@ offset_t LSTStore::LoadFromLastSegment(LSTSegment* segment) {
 
     if (IsEndChunk(chunk.type())) break;
 
-    if (chunk.type() == ChunkType::kInvalid) {
-      this->chunk_map_.erase(hash_offset);
-      onRemoveChunk(&storeInfo, chunk.type(), PtrToChunkLength(
-            this->chunk_map_.at(LSTHash(hash_offset)).chunk_));
-    } else {
-      chunk_map_.emplace(hash_offset, chunk.head());
-      onNewChunk(&storeInfo, chunk.type(), chunk.numBytes());
-    }
+    (*buckets)[IndexType::ShardId(hash_offset)].push_back(chunk_offset);
     chunk_offset += chunk.numBytes() + Hash::kByteLength;
   }
 
@@ -387,13 +591,15 @@ offset_t LSTStore::LoadFromLastSegment(LSTSegment* segment) {
                                   - uintptr_t(segment->segment_));
 }
 
-offset_t LSTStore::LoadFromValidSegment(LSTSegment* segment) {
+offset_t LSTStore::LoadFromValidSegment(LSTSegment* segment, offset_t start,
+                                        LoadBuckets* buckets) {
   // TODO(qingchao): take alignment into consideration
   CHECK_NE(segment, nullptr);
   const byte_t* chunk_offset = GetFirstChunkPtr(segment);
   CHECK(Hash(chunk_offset + PtrToChunkLength(chunk_offset))
       == Hash(GetValidateHashPtr(segment)));
 
+  chunk_offset = reinterpret_cast<const byte_t*>(segment->segment_) + start;
   while (true) {
     ChunkType type = PtrToChunkType(chunk_offset);
 
@@ -404,22 +610,64 @@ offset_t LSTStore::LoadFromValidSegment(LSTSegment* segment) {
 
     uint32_t chunk_length = PtrToChunkLength(chunk_offset);
     const byte_t *hash_offset = chunk_offset + chunk_length;
-    if (type == ChunkType::kInvalid) {
-      this->chunk_map_.erase(hash_offset);
-      onRemoveChunk(&storeInfo, type,
-                    chunk_length);
-    } else {
-      chunk_map_.emplace(hash_offset, chunk_offset);
-      onNewChunk(&storeInfo, type, chunk_length);
-    }
+    (*buckets)[IndexType::ShardId(hash_offset)].push_back(chunk_offset);
 
-    chunk_offset += chunk_length + Hash::kByteLength;;
+    chunk_offset += chunk_length + Hash::kByteLength;
   }
 
   return reinterpret_cast<offset_t>(uintptr_t(chunk_offset)
       - uintptr_t(segment->segment_));
 }
 
+void LSTStore::MergeLoaded(const std::vector<LoadBuckets>& buckets,
+                           size_t n_threads) {
+  // chunks of a shard are replayed in the order of the major list, since
+  // buckets of earlier loading threads hold chunks of earlier segments
+  std::vector<StoreInfo> infos(IndexType::kNumShards);
+  auto merge = [&](size_t first) {
+    for (size_t s = first; s < IndexType::kNumShards; s += n_threads) {
+      MapType& map = chunk_index_.shard_at(s).map_;
+      StoreInfo* info = &infos[s];
+      initStoreInfo(info);
+      size_t n = 0;
+      for (const LoadBuckets& b : buckets) n += b[s].size();
+      if (n > 0) map.reserve(map.size() + n);
+      for (const LoadBuckets& b : buckets) {
+        for (const byte_t* chunk : b[s]) {
+          ChunkType type = PtrToChunkType(chunk);
+          size_t length = PtrToChunkLength(chunk);
+          LSTHash hash(chunk + length);
+          if (type == ChunkType::kInvalid) {
+            auto it = map.find(hash);
+            if (it == map.end()) continue;
+            const byte_t* removed = it->second.chunk_;
+            onRemoveChunk(info, PtrToChunkType(removed),
+                          PtrToChunkLength(removed));
+            map.erase(hash);
+          } else if (map.emplace(hash, chunk).second) {
+            onNewChunk(info, type, length);
+          }
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < n_threads; ++t) threads.emplace_back(merge, t);
+  merge(0);
+  for (auto& t : threads) t.join();
+
+  for (const StoreInfo& info : infos) {
+    storeInfo.chunks += info.chunks;
+    storeInfo.chunkBytes += info.chunkBytes;
+    storeInfo.validChunks += info.validChunks;
+    storeInfo.validChunkBytes += info.validChunkBytes;
+    for (const auto& kv : info.chunksPerType)
+      storeInfo.chunksPerType[kv.first] += kv.second;
+    for (const auto& kv : info.bytesPerType)
+      storeInfo.bytesPerType[kv.first] += kv.second;
+  }
+}
+
 void LSTStore::Load(void* address) {
   offset_t v[5];
   ReadInteger(reinterpret_cast<char*>(address), v);
@@ -431,91 +679,758 @@ void LSTStore::Load(void* address) {
   last_free_segment_ = segment;
   segment = major_list_;
   storeInfo.allocSegments += LinkSegmentList(&segment);
+  current_major_segment_ = segment;
+
+  std::vector<LSTSegment*> major;
+  for (LSTSegment* iter = major_list_; iter != nullptr; iter = iter->next_)
+    major.push_back(iter);
+
+  // chunks up to the covered offsets are indexed by the checkpoint
+  std::unordered_map<offset_t, SegmentRecord> covered;
+  if (ReadCheckpoint(major, &covered))
+    LOG(INFO) << "restored " << chunk_index_.size()
+              << " chunks from index checkpoint";
+
+  // segments to scan, together with their start offsets
+  std::vector<size_t> to_scan;
+  std::vector<offset_t> offsets(major.size(), kMetaSegmentSize);
+  for (size_t i = 0; i < major.size(); ++i) {
+    auto it = covered.find(SegmentPtrToOffset(major[i]));
+    if (it != covered.end()) {
+      // the last segment is always scanned to truncate its list
+      if (it->second.sealed_ && i + 1 < major.size()) continue;
+      offsets[i] = it->second.covered_;
+    }
+    to_scan.push_back(i);
+  }
 
-  int loaded = 0;
+  // contiguous ranges of the major list are scanned in parallel
+  size_t n_threads = Env::Instance()->config().load_threads();
+  if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+  n_threads = std::max(size_t(1), std::min(n_threads, to_scan.size()));
+  std::vector<LoadBuckets> buckets(n_threads);
+  // whether a segment was still being appended
+  std::vector<char> open(major.size(), false);
+  auto scan = [&](size_t tid, size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      size_t i = to_scan[k];
+      if (i + 1 == major.size()) {
+        offsets[i] = LoadFromLastSegment(major[i], offsets[i], &buckets[tid]);
+        open[i] = true;
+      } else if (IsSealed(major[i])) {
+        LoadFromValidSegment(major[i], offsets[i], &buckets[tid]);
+      } else {
+        offsets[i] = LoadFromOpenSegment(major[i], offsets[i], &buckets[tid]);
+        open[i] = true;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t step = (to_scan.size() + n_threads - 1) / n_threads;
+  for (size_t t = 1; t < n_threads; ++t)
+    threads.emplace_back(scan, t, std::min(to_scan.size(), t * step),
+                         std::min(to_scan.size(), (t + 1) * step));
+  scan(0, 0, std::min(to_scan.size(), step));
+  for (auto& t : threads) t.join();
+  MergeLoaded(buckets, n_threads);
+
+  // resume appending to the latest open segments, so that the tail of the
+  // major list is always owned by a lane; the others are sealed
+  size_t lane = 0;
+  for (size_t i = major.size(); i-- > 0; ) {
+    if (!open[i]) continue;
+    if (lane < kNumAppendLanes) {
+      lanes_[lane].segment_ = major[i];
+      lanes_[lane].offset_.store(offsets[i]);
+      lanes_[lane].dirty_begin_ =
+        static_cast<const byte_t*>(major[i]->segment_) + offsets[i];
+      lanes_[lane].sync_timer_.Start();
+      ++lane;
+    } else {
+      Seal(major[i]);
+    }
+  }
 
-  // load from the major list first
-  LSTSegment *iter = major_list_;
-  while (iter != segment) {
-    LoadFromValidSegment(iter);
-    iter = iter->next_;
-    ++loaded;
+  storeInfo.usedSegments = major.size();
+  storeInfo.freeSegments = storeInfo.allocSegments - major.size();
+
+  LOG(INFO) << "load completed: scanned " << to_scan.size() << " of "
+            << major.size() << " segments with " << n_threads << " threads";
+  LOG(INFO) << GetInfo();
+}
+
+/**
+ * @brief read exactly length bytes from fd
+ *
+ * @return false on a short read
+ */
+static bool FdReadFully(int fd, void* buf, size_t length) {
+  char* ptr = reinterpret_cast<char*>(buf);
+  while (length > 0) {
+    ssize_t nb = ::read(fd, ptr, length);
+    if (nb <= 0) return false;
+    ptr += nb;
+    length -= nb;
   }
+  return true;
+}
 
-  if (iter != nullptr) {
-    major_segment_offset_ = LoadFromLastSegment(iter);
-    ++loaded;
+static void FdWriteFully(int fd, const void* buf, size_t length) {
+  const char* ptr = reinterpret_cast<const char*>(buf);
+  while (length > 0) {
+    ssize_t nb = ::write(fd, ptr, length);
+    LOG_LST_STORE_FATAL_ERROR_IF(nb < 0, "WRITE ERROR: ");
+    ptr += nb;
+    length -= nb;
   }
-  current_major_segment_ = iter;
+}
 
-  storeInfo.usedSegments = loaded;
-  storeInfo.freeSegments = storeInfo.allocSegments - loaded;
+/*
+ * Index checkpoint format (all fields are uint64_t):
+ * | magic | # segments | [offset, covered, sealed] | chunks | chunk bytes |
+ * valid chunks | valid chunk bytes | # types | [type, chunks, bytes] |
+ * # shards | [size, # slots, slots] | magic |
+ */
+static constexpr uint64_t kCheckpointMagic = 0x3130584449545355;  // USTIDX01
+
+void LSTStore::WriteCheckpoint() {
+  std::vector<uint64_t> header;
+  std::vector<std::pair<size_t, std::vector<uint64_t>>> shards;
+  offset_t log_size;
+  {
+    // stop the writers so that the index matches the fill offsets
+    std::vector<shared_lock<shared_mutex>> shard_locks;
+    for (size_t s = 0; s < IndexType::kNumShards; ++s)
+      shard_locks.emplace_back(chunk_index_.shard_at(s).mtx_);
+    Lock lock(this);
+
+    header.push_back(kCheckpointMagic);
+    header.push_back(0);
+    for (const LSTSegment* seg = major_list_; seg != nullptr;
+         seg = seg->next_) {
+      // segments not owned by any lane are sealed
+      offset_t covered = kSegmentSize;
+      bool sealed = true;
+      for (const AppendLane& lane : lanes_) {
+        if (lane.segment_ == seg) {
+          covered = lane.offset_.load();
+          sealed = false;
+        }
+      }
+      header.insert(header.end(), {SegmentPtrToOffset(seg), covered, sealed});
+      ++header[1];
+    }
+    StoreInfo info = GetInfo();
+    log_size = kMetaLogSize + info.allocSegments * kSegmentSize;
+    header.insert(header.end(), {info.chunks, info.chunkBytes,
+                                 info.validChunks, info.validChunkBytes});
+    header.push_back(info.chunksPerType.size());
+    for (const auto& kv : info.chunksPerType)
+      header.insert(header.end(), {uint64_t(kv.first), kv.second,
+                                   info.bytesPerType[kv.first]});
+    for (size_t s = 0; s < IndexType::kNumShards; ++s) {
+      const MapType& map = chunk_index_.shard_at(s).map_;
+      shards.emplace_back(map.size(), map.slots());
+    }
+  }
 
-  LOG(INFO) << "load completed";
-  LOG(INFO) << GetInfo();
+  // indexed chunks have to reach the disk before the checkpoint
+  LOG_LST_STORE_FATAL_ERROR_IF(
+      -1 == msync(LSTSegment::base_addr_, log_size, MS_SYNC), "MSYNC ERROR: ");
+
+  std::string tmp_path = checkpoint_path_ + ".tmp";
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  S_IRUSR | S_IWUSR);
+  LOG_LST_STORE_FATAL_ERROR_IF(fd < 0, "OPEN ERROR: ");
+  header.push_back(shards.size());
+  FdWriteFully(fd, header.data(), header.size() * sizeof(uint64_t));
+  for (const auto& shard : shards) {
+    uint64_t meta[2] = {shard.first, shard.second.size()};
+    FdWriteFully(fd, meta, sizeof(meta));
+    FdWriteFully(fd, shard.second.data(),
+                 shard.second.size() * sizeof(uint64_t));
+  }
+  FdWriteThenSync(fd, &kCheckpointMagic, sizeof(kCheckpointMagic));
+  ::close(fd);
+  // atomically replace the previous checkpoint
+  LOG_LST_STORE_FATAL_ERROR_IF(
+      -1 == ::rename(tmp_path.c_str(), checkpoint_path_.c_str()),
+      "RENAME ERROR: ");
+  DLOG(INFO) << "index checkpoint of " << header[1] << " segments written";
+}
+
+bool LSTStore::ReadCheckpoint(
+    const std::vector<LSTSegment*>& major,
+    std::unordered_map<offset_t, SegmentRecord>* covered) {
+  int fd = ::open(checkpoint_path_.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  std::unordered_map<offset_t, SegmentRecord> records;
+  StoreInfo info;
+  initStoreInfo(&info);
+  std::vector<std::pair<size_t, std::vector<uint64_t>>> shards;
+  auto read = [fd](uint64_t* v, size_t n) {
+    return FdReadFully(fd, v, n * sizeof(uint64_t));
+  };
+  bool valid = [&] {
+    uint64_t v[4];
+    if (!read(v, 2) || v[0] != kCheckpointMagic) return false;
+    std::unordered_set<offset_t> in_major;
+    for (const LSTSegment* seg : major) in_major.insert(SegmentPtrToOffset(seg));
+    for (uint64_t n = v[1]; n > 0; --n) {
+      // every recorded segment must still be in the major list
+      if (!read(v, 3) || !in_major.count(v[0]) || v[1] < kMetaSegmentSize
+          || v[1] > kSegmentSize)
+        return false;
+      records[v[0]] = SegmentRecord{v[1], v[2] != 0};
+    }
+    if (!read(v, 4)) return false;
+    info.chunks = v[0];
+    info.chunkBytes = v[1];
+    info.validChunks = v[2];
+    info.validChunkBytes = v[3];
+    if (!read(v, 1)) return false;
+    for (uint64_t n = v[0]; n > 0; --n) {
+      if (!read(v, 3)) return false;
+      info.chunksPerType[ChunkType(v[0])] = v[1];
+      info.bytesPerType[ChunkType(v[0])] = v[2];
+    }
+    if (!read(v, 1) || v[0] != IndexType::kNumShards) return false;
+    for (size_t s = 0; s < IndexType::kNumShards; ++s) {
+      if (!read(v, 2) || v[1] > max_log_size_) return false;
+      std::vector<uint64_t> slots(v[1]);
+      if (!read(slots.data(), slots.size())) return false;
+      shards.emplace_back(v[0], std::move(slots));
+    }
+    return read(v, 1) && v[0] == kCheckpointMagic;
+  }();
+  ::close(fd);
+
+  for (size_t s = 0; valid && s < shards.size(); ++s)
+    valid = chunk_index_.shard_at(s).map_.Assign(std::move(shards[s].second),
+                                                 shards[s].first);
+  if (!valid) {
+    LOG(WARNING) << "Ignore invalid index checkpoint " << checkpoint_path_;
+    for (size_t s = 0; s < IndexType::kNumShards; ++s)
+      chunk_index_.shard_at(s).map_.clear();
+    return false;
+  }
+
+  storeInfo.chunks = info.chunks;
+  storeInfo.chunkBytes = info.chunkBytes;
+  storeInfo.validChunks = info.validChunks;
+  storeInfo.validChunkBytes = info.validChunkBytes;
+  storeInfo.chunksPerType = info.chunksPerType;
+  storeInfo.bytesPerType = info.bytesPerType;
+  covered->swap(records);
+  return true;
+}
+
+void LSTStore::MaybeScheduleCheckpoint() {
+  int interval = Env::Instance()->config().index_checkpoint_interval();
+  if (interval <= 0 || ++sealed_since_checkpoint_ < size_t(interval)) return;
+  // at most one checkpoint is written at a time
+  if (checkpointing_.exchange(true)) return;
+  sealed_since_checkpoint_ = 0;
+  checkpoint_future_ = std::async(std::launch::async, [this] {
+    WriteCheckpoint();
+    checkpointing_.store(false);
+  });
 }
 
 Chunk LSTStore::Get(const Hash& key) {
   LSTHash hash(key.value());
-  shared_lock<shared_mutex> lock(chunk_map_mutex_);
-  auto it = chunk_map_.find(hash);
-  if (it != chunk_map_.end())
+  const IndexType::Shard& shard = chunk_index_.shard(hash);
+  shared_lock<shared_mutex> lock(shard.mtx_);
+  auto it = shard.map_.find(hash);
+  if (it != shard.map_.end()) {
+    Touch(it->second.chunk_);
     return Chunk(it->second.chunk_, it->first.hash_);
+  }
   LOG(WARNING) << "Key: " << key << " does not exist in chunk store";
   return Chunk();
 }
 
+template <typename F>
+void LSTStore::ForEachShard(const std::vector<Hash>& keys,
+                            std::vector<size_t>* order, F f) {
+  order->resize(keys.size());
+  std::iota(order->begin(), order->end(), 0);
+  auto shard_of = [&keys](size_t i) {
+    return IndexType::ShardId(keys[i].value());
+  };
+  std::sort(order->begin(), order->end(), [&shard_of](size_t a, size_t b) {
+    return shard_of(a) < shard_of(b);
+  });
+  for (auto first = order->cbegin(); first != order->cend();) {
+    const size_t id = shard_of(*first);
+    auto last = first;
+    while (last != order->cend() && shard_of(*last) == id) ++last;
+    f(&chunk_index_.shard_at(id), first, last);
+    first = last;
+  }
+}
+
+std::vector<Chunk> LSTStore::MultiGet(const std::vector<Hash>& keys) {
+  std::vector<Chunk> chunks(keys.size());
+  std::vector<size_t> order;
+  ForEachShard(keys, &order, [&](IndexType::Shard* shard,
+                                 std::vector<size_t>::const_iterator first,
+                                 std::vector<size_t>::const_iterator last) {
+    shared_lock<shared_mutex> lock(shard->mtx_);
+    for (; first != last; ++first) {
+      auto it = shard->map_.find(keys[*first].value());
+      if (it == shard->map_.end()) {
+        LOG(WARNING) << "Key: " << keys[*first]
+                     << " does not exist in chunk store";
+        continue;
+      }
+      Touch(it->second.chunk_);
+      chunks[*first] = Chunk(it->second.chunk_, it->first.hash_);
+    }
+  });
+  return chunks;
+}
+
+bool LSTStore::MultiPut(const std::vector<Hash>& keys,
+                        const std::vector<const Chunk*>& chunks) {
+  CHECK_EQ(keys.size(), chunks.size());
+  uint64_t ticket = 0;
+  std::vector<size_t> order;
+  ForEachShard(keys, &order, [&](IndexType::Shard* shard,
+                                 std::vector<size_t>::const_iterator first,
+                                 std::vector<size_t>::const_iterator last) {
+    std::lock_guard<shared_mutex> lock(shard->mtx_);
+    for (; first != last; ++first) {
+      ticket = std::max(ticket,
+                        PutLocked(shard, keys[*first], *chunks[*first]));
+    }
+  });
+  if (group_commit_ && ticket != 0) WaitDurable(ticket);
+  return true;
+}
+
+std::vector<bool> LSTStore::MultiExists(const std::vector<Hash>& keys) {
+  std::vector<bool> exists(keys.size());
+  std::vector<size_t> order;
+  ForEachShard(keys, &order, [&](IndexType::Shard* shard,
+                                 std::vector<size_t>::const_iterator first,
+                                 std::vector<size_t>::const_iterator last) {
+    shared_lock<shared_mutex> lock(shard->mtx_);
+    for (; first != last; ++first)
+      exists[*first] = shard->map_.count(keys[*first].value()) != 0;
+  });
+  return exists;
+}
+
 bool LSTStore::Put(const Hash& key, const Chunk& chunk) {
-  const size_t len = key.kByteLength + chunk.numBytes();
-  // prevent concurrent threads from simultaneously modifying the underlying
-  // chunk store
+  uint64_t ticket = PutUnsynced(key, chunk);
+  if (group_commit_) WaitDurable(ticket);
+  return true;
+}
+
+uint64_t LSTStore::PutUnsynced(const Hash& key, const Chunk& chunk) {
+  // writers of the same shard are serialized until the chunk is indexed,
+  // so that a chunk is never appended twice
+  IndexType::Shard& shard = chunk_index_.shard(key.value());
+  std::lock_guard<shared_mutex> shard_lock(shard.mtx_);
+  return PutLocked(&shard, key, chunk);
+}
+
+uint64_t LSTStore::PutLocked(IndexType::Shard* shard, const Hash& key,
+                             const Chunk& chunk) {
+  LSTHash hash(key.value());
+  if (shard->map_.count(hash)) {
+    // a running GC has to keep the chunk, as it may be referred to again
+    if (gc_tracking_.load())
+      gc_touched_[IndexType::ShardId(hash)].insert(key.Clone());
+    // the put that appended the chunk has already got its ticket
+    return write_seq_.load();
+  }
+
+  uint64_t ticket = Append(shard, chunk.head(), key.value());
+  std::lock_guard<std::mutex> info_lock(info_mutex_);
+  onNewChunk(&storeInfo, chunk.type(), chunk.numBytes());
+  return ticket;
+}
+
+uint64_t LSTStore::Append(IndexType::Shard* shard, const byte_t* chunk,
+                          const byte_t* hash) {
+  const size_t num_bytes = PtrToChunkLength(chunk);
+  const size_t len = Hash::kByteLength + num_bytes;
+  AppendLane& lane = lanes_[GetLaneId()];
+  std::lock_guard<std::mutex> lane_lock(lane.mtx_);
+  lane.write_timer_->Start();
+  if (lane.segment_ == nullptr || GetFreeSpace(lane) < len) {
+    AllocateMajor(&lane);
+  }
+
+  byte_t* offset = reinterpret_cast<byte_t*>(lane.segment_->segment_)
+                   + lane.offset_.load();
+  if (hash == chunk + num_bytes) {
+    // a chunk built in memory is followed by its hash, as in the log
+    std::copy(chunk, chunk + len, offset);
+  } else {
+    // first write chunk and then write hash
+    std::copy(chunk, chunk + num_bytes, offset);
+    std::copy(hash, hash + Hash::kByteLength, offset + num_bytes);
+  }
+
+  shard->map_.emplace(offset + num_bytes, offset);
+  lane.offset_.fetch_add(len);
+  Touch(offset);
+  // taken after the chunk is appended, see FlushLoop()
+  uint64_t ticket = write_seq_.fetch_add(1) + 1;
+
+  ++lane.to_sync_chunks_;
+  if (lane.to_sync_chunks_ >= kMaxPendingSyncChunks ||
+      lane.sync_timer_.ElapsedMilliseconds() >= kMaxSyncTimeoutMilliseconds) {
+    SyncToDisk(lane.segment_->segment_, kSegmentSize);
+    lane.to_sync_chunks_ = 0;
+    lane.sync_timer_.Reset();
+    lane.sync_timer_.Start();
+  }
+  lane.write_timer_->Stop();
+  return ticket;
+}
+
+bool LSTStore::IsAppending(const LSTSegment* segment) const {
+  for (const AppendLane& lane : lanes_)
+    if (lane.segment_ == segment) return true;
+  return false;
+}
+
+void LSTStore::Reclaim(LSTSegment* segment) {
   Lock lock(this);
-  if (Exists(key)) {
-    return true;
+  DCHECK_NE(segment, current_major_segment_);
+  // unlink from the major list
+  LSTSegment *prev = segment->prev_, *next = segment->next_;
+  if (prev != nullptr) {
+    prev->next_ = next;
+    AppendInteger(reinterpret_cast<char*>(prev->segment_) + sizeof(offset_t),
+                  SegmentPtrToOffset(next));
+    SyncToDisk(prev->segment_, kMetaSegmentSize);
+  } else {
+    major_list_ = next;
+  }
+  if (next != nullptr) {
+    next->prev_ = prev;
+    AppendInteger(reinterpret_cast<char*>(next->segment_),
+                  SegmentPtrToOffset(prev));
+    SyncToDisk(next->segment_, kMetaSegmentSize);
   }
 
-  write_timer_.Start();
-  if (current_major_segment_ == nullptr || GetFreeSpaceMajor() < len) {
-    AllocateMajor();
-    sync_timer_.Reset();
-    sync_timer_.Start();
-    to_sync_chunks_ = 0;
+  // append to the tail of the free list, so that it is reused as late as
+  // possible; its content is cleared upon reuse
+  segment->next_ = nullptr;
+  if (free_list_ == nullptr) {
+    segment->prev_ = nullptr;
+    free_list_ = segment;
+  } else {
+    segment->prev_ = last_free_segment_;
+    last_free_segment_->next_ = segment;
+    AppendInteger(reinterpret_cast<char*>(last_free_segment_->segment_)
+                  + sizeof(offset_t), SegmentPtrToOffset(segment));
+    SyncToDisk(last_free_segment_->segment_, kMetaSegmentSize);
   }
+  last_free_segment_ = segment;
+  AppendInteger(reinterpret_cast<char*>(segment->segment_),
+                SegmentPtrToOffset(segment->prev_), (offset_t)0);
+  SyncToDisk(segment->segment_, kMetaSegmentSize);
 
-  byte_t* offset = reinterpret_cast<byte_t*>(current_major_segment_->segment_)
-                   + major_segment_offset_;
-  // first write chunk and then write hash
-  std::copy(chunk.head(), chunk.head() + chunk.numBytes(), offset);
-  std::copy(key.value(), key.value() + key.kByteLength,
-      offset + chunk.numBytes());
+  AppendInteger(static_cast<char*>(LSTSegment::base_addr_),
+      SegmentPtrToOffset(free_list_),
+      SegmentPtrToOffset(major_list_),
+      SegmentPtrToOffset(current_major_segment_));
+  SyncToDisk(LSTSegment::base_addr_, kMetaLogSize);
 
-  // prevent other concurrent threads from reading the map
-  chunk_map_mutex_.lock();
-  this->chunk_map_.emplace(offset + chunk.numBytes(), offset);
-  chunk_map_mutex_.unlock();
+  std::lock_guard<std::mutex> info_lock(info_mutex_);
+  --storeInfo.usedSegments;
+  ++storeInfo.freeSegments;
+}
 
-  major_segment_offset_ += key.kByteLength + chunk.numBytes();
-  onNewChunk(&storeInfo, chunk.type(), chunk.numBytes());
+size_t LSTStore::GC(const std::function<LivenessFunc()>& mark) {
+  // checkpoints are held back, as they may record segments to be reclaimed
+  while (checkpointing_.exchange(true))
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // only chunks in sealed segments are collected; chunks appended from now on
+  // go to other segments, and those deduplicated by puts are tracked
+  std::vector<LSTSegment*> sealed;
+  {
+    Lock lock(this);
+    for (LSTSegment* seg = major_list_; seg != nullptr; seg = seg->next_)
+      if (!IsAppending(seg)) sealed.push_back(seg);
+    gc_tracking_.store(true);
+  }
+  LivenessFunc is_live = mark();
+
+  // the chunk if it is the indexed copy
+  auto indexed = [this](const byte_t* chunk) {
+    LSTHash hash(chunk + PtrToChunkLength(chunk));
+    const IndexType::Shard& shard = chunk_index_.shard(hash);
+    shared_lock<shared_mutex> lock(shard.mtx_);
+    auto it = shard.map_.find(hash);
+    return it != shard.map_.end() && it->second.chunk_ == chunk;
+  };
+
+  // pick the sparsest segments
+  const double max_live_ratio = Env::Instance()->config().gc_live_ratio();
+  std::vector<std::pair<double, LSTSegment*>> sparse;
+  for (LSTSegment* seg : sealed) {
+    size_t used = 0, live = 0;
+    bool has_tombstone = false;
+    for (const byte_t* chunk = GetFirstChunkPtr(seg);
+         !IsEndChunk(PtrToChunkType(chunk)); chunk = GetPtrToNextChunk(chunk)) {
+      size_t len = PtrToChunkLength(chunk) + Hash::kByteLength;
+      used += len;
+      // tombstones have to stay behind the chunks they remove
+      has_tombstone |= PtrToChunkType(chunk) == ChunkType::kInvalid;
+      if (indexed(chunk)
+          && is_live(Hash(chunk + PtrToChunkLength(chunk))))
+        live += len;
+    }
+    double ratio = used ? double(live) / used : 0;
+    if (!has_tombstone && ratio <= max_live_ratio)
+      sparse.emplace_back(ratio, seg);
+  }
+  std::sort(sparse.begin(), sparse.end(),
+            [](const std::pair<double, LSTSegment*>& a,
+               const std::pair<double, LSTSegment*>& b) {
+    return a.first < b.first;
+  });
+
+  // the old checkpoint records the segments to be reclaimed
+  if (!sparse.empty()) fs::remove(checkpoint_path_);
+
+  // relocation is throttled to leave the disk bandwidth to puts
+  const double rate = Env::Instance()->config().gc_rate_mb() * double(1 << 20);
+  size_t copied = 0;
+  Timer timer;
+  timer.Start();
+  for (const auto& entry : sparse) {
+    LSTSegment* seg = entry.second;
+    uint64_t ticket = 0;
+    for (const byte_t* chunk = GetFirstChunkPtr(seg);
+         !IsEndChunk(PtrToChunkType(chunk)); chunk = GetPtrToNextChunk(chunk)) {
+      ChunkType type = PtrToChunkType(chunk);
+      size_t num_bytes = PtrToChunkLength(chunk);
+      const byte_t* hash_ptr = chunk + num_bytes;
+      LSTHash hash(hash_ptr);
+      size_t shard_id = IndexType::ShardId(hash);
+      IndexType::Shard& shard = chunk_index_.shard_at(shard_id);
+      {
+        std::lock_guard<shared_mutex> shard_lock(shard.mtx_);
+        auto it = shard.map_.find(hash);
+        // skip copies not indexed, e.g., those put again after removal
+        if (it == shard.map_.end() || it->second.chunk_ != chunk) continue;
+        shard.map_.erase(hash);
+        Hash key(const_cast<byte_t*>(hash_ptr));
+        if (is_live(key) || gc_touched_[shard_id].count(key)) {
+          ticket = Append(&shard, chunk, hash_ptr);
+          copied += num_bytes + Hash::kByteLength;
+        } else {
+          std::lock_guard<std::mutex> info_lock(info_mutex_);
+          onRemoveChunk(&storeInfo, type, num_bytes);
+        }
+      }
+      if (rate > 0) {
+        double ahead = copied / rate - timer.ElapsedSeconds();
+        if (ahead > 0)
+          std::this_thread::sleep_for(std::chrono::duration<double>(ahead));
+      }
+    }
+    // relocated chunks must be durable before their old copies are gone
+    if (group_commit_) WaitDurable(ticket);
+  }
+  // gets from now on find the relocated copies, while readers pinned before
+  // may still hold the old ones
+  if (!sparse.empty()) {
+    std::unique_lock<std::mutex> lock(epoch_mutex_);
+    const uint64_t epoch = epoch_++;
+    epoch_cv_.wait(lock, [this, epoch] {
+      return pinned_.empty() || pinned_.begin()->first > epoch;
+    });
+  }
+  for (const auto& entry : sparse) Reclaim(entry.second);
 
-  ++to_sync_chunks_;
-  if (to_sync_chunks_ >= kMaxPendingSyncChunks ||
-      sync_timer_.ElapsedMilliseconds() >= kMaxSyncTimeoutMilliseconds) {
-    SyncToDisk(current_major_segment_->segment_, kSegmentSize);
-    to_sync_chunks_ = 0;
-    sync_timer_.Reset();
-    sync_timer_.Start();
+  gc_tracking_.store(false);
+  for (size_t s = 0; s < IndexType::kNumShards; ++s) {
+    std::lock_guard<shared_mutex> shard_lock(chunk_index_.shard_at(s).mtx_);
+    gc_touched_[s].clear();
+  }
+  if (sparse.empty()) {
+    checkpointing_.store(false);
+  } else {
+    Lock lock(this);
+    sealed_since_checkpoint_ = 0;
+    checkpoint_future_ = std::async(std::launch::async, [this] {
+      WriteCheckpoint();
+      checkpointing_.store(false);
+    });
+  }
+  LOG(INFO) << "GC reclaimed " << sparse.size() << " of " << sealed.size()
+            << " sealed segments, relocating " << copied << " bytes";
+  return sparse.size() * kSegmentSize - copied;
+}
+
+uint64_t LSTStore::Pin() {
+  std::lock_guard<std::mutex> lock(epoch_mutex_);
+  ++pinned_[epoch_];
+  return epoch_;
+}
+
+void LSTStore::Unpin(uint64_t epoch) {
+  std::lock_guard<std::mutex> lock(epoch_mutex_);
+  auto it = pinned_.find(epoch);
+  DCHECK(it != pinned_.end());
+  if (--it->second) return;
+  bool oldest = it == pinned_.begin();
+  pinned_.erase(it);
+  if (oldest) epoch_cv_.notify_all();
+}
+
+void LSTStore::Admit(size_t id) {
+  byte_t* segment = static_cast<byte_t*>(LSTSegment::base_addr_)
+                    + kMetaLogSize + id * kSegmentSize;
+  ::madvise(segment, kSegmentSize, MADV_WILLNEED);
+  ::mlock(segment, kSegmentSize);
+  resident_[id] = true;
+  ++num_resident_;
+}
+
+bool LSTStore::Evict(const std::vector<char>& appending) {
+  // two rounds at most, as the first one may only clear reference bits
+  for (size_t step = 0; step < 2 * resident_.size(); ++step) {
+    size_t id = clock_hand_;
+    clock_hand_ = (clock_hand_ + 1) % resident_.size();
+    if (!resident_[id] || appending[id]) continue;
+    if (referenced_[id].exchange(false, std::memory_order_relaxed)) continue;
+    byte_t* segment = static_cast<byte_t*>(LSTSegment::base_addr_)
+                      + kMetaLogSize + id * kSegmentSize;
+    ::munlock(segment, kSegmentSize);
+    // dirty pages of a shared mapping are kept in the page cache and written
+    // back; then they are dropped from there as well
+    ::madvise(segment, kSegmentSize, MADV_DONTNEED);
+    ::posix_fadvise(fd_, kMetaLogSize + id * kSegmentSize, kSegmentSize,
+                    POSIX_FADV_DONTNEED);
+    resident_[id] = false;
+    --num_resident_;
+    return true;
+  }
+  return false;
+}
+
+void LSTStore::ResidencyLoop() {
+  std::vector<char> appending(max_segments_);
+  std::unique_lock<std::mutex> lock(residency_mutex_);
+  while (!residency_cv_.wait_for(
+      lock, std::chrono::milliseconds(kResidencyIntervalMilliseconds),
+      [this] { return stop_residency_; })) {
+    std::fill(appending.begin(), appending.end(), false);
+    {
+      Lock store_lock(this);
+      for (const AppendLane& lane : lanes_)
+        if (lane.segment_ != nullptr)
+          appending[SegmentId(lane.segment_->segment_)] = true;
+    }
+    for (size_t id = 0; id < max_segments_; ++id) {
+      if (resident_[id]) continue;
+      if (!appending[id]
+          && !referenced_[id].load(std::memory_order_relaxed)) continue;
+      if (num_resident_ >= resident_budget_ && !Evict(appending)) break;
+      Admit(id);
+    }
+  }
+}
+
+/**
+ * @brief msync the pages overlapping with [begin, end)
+ */
+static void SyncRange(const byte_t* begin, const byte_t* end) {
+  static const uintptr_t page_size = ::sysconf(_SC_PAGESIZE);
+  uintptr_t first = uintptr_t(begin) & ~(page_size - 1);
+  LOG_LST_STORE_FATAL_ERROR_IF(
+      -1 == msync(reinterpret_cast<void*>(first), uintptr_t(end) - first,
+                  MS_SYNC), "MSYNC ERROR: ");
+}
+
+void LSTStore::FlushDirty() {
+  std::vector<std::pair<const byte_t*, const byte_t*>> ranges;
+  for (AppendLane& lane : lanes_) {
+    std::lock_guard<std::mutex> lane_lock(lane.mtx_);
+    ranges.insert(ranges.end(), lane.dirty_ranges_.begin(),
+                  lane.dirty_ranges_.end());
+    lane.dirty_ranges_.clear();
+    if (lane.segment_ == nullptr) continue;
+    const byte_t* tail = reinterpret_cast<const byte_t*>(
+        lane.segment_->segment_) + lane.offset_.load();
+    if (tail > lane.dirty_begin_) ranges.emplace_back(lane.dirty_begin_, tail);
+    lane.dirty_begin_ = tail;
+  }
+  for (const auto& range : ranges) SyncRange(range.first, range.second);
+}
+
+void LSTStore::FlushLoop() {
+  std::unique_lock<std::mutex> lock(commit_mutex_);
+  while (true) {
+    flush_cv_.wait(lock, [this] {
+      return stop_flusher_ || write_seq_.load() > durable_seq_.load();
+    });
+    if (write_seq_.load() == durable_seq_.load()) break;  // stopped
+    // let more puts join this group
+    if (commit_window_.count() > 0)
+      flush_cv_.wait_for(lock, commit_window_, [this] {
+        return stop_flusher_;
+      });
+    lock.unlock();
+    // puts take their tickets after appending, hence all puts up to the
+    // ticket are covered by the dirty ranges collected afterwards
+    uint64_t ticket = write_seq_.load();
+    FlushDirty();
+    lock.lock();
+    durable_seq_.store(ticket);
+    durable_cv_.notify_all();
   }
-  write_timer_.Stop();
-  return true;
+}
+
+void LSTStore::WaitDurable(uint64_t ticket) {
+  if (durable_seq_.load() >= ticket) return;
+  std::unique_lock<std::mutex> lock(commit_mutex_);
+  flush_cv_.notify_one();
+  durable_cv_.wait(lock, [this, ticket] {
+    return durable_seq_.load() >= ticket;
+  });
 }
 
 void LSTStore::Sync() const {
-  if (current_major_segment_ != nullptr)
-    SyncToDisk(current_major_segment_->segment_, kSegmentSize);
+  Lock lock(this);
+  for (const AppendLane& lane : lanes_)
+    if (lane.segment_ != nullptr)
+      SyncToDisk(lane.segment_->segment_, kSegmentSize);
 }
 
 LSTStore::~LSTStore() noexcept(false) {
+  if (residency_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(residency_mutex_);
+      stop_residency_ = true;
+    }
+    residency_cv_.notify_one();
+    residency_thread_.join();
+  }
+  if (flusher_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(commit_mutex_);
+      stop_flusher_ = true;
+    }
+    flush_cv_.notify_one();
+    flusher_.join();
+  }
+  if (checkpoint_future_.valid()) checkpoint_future_.wait();
   Sync();
+  // the next load then only needs to scan chunks written after this point
+  WriteCheckpoint();
   LOG(INFO) << GetInfo();
   DestroySegmentList(free_list_);
   DestroySegmentList(major_list_);
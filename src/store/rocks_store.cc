@@ -2,7 +2,9 @@
 
 #ifdef USE_ROCKSDB
 
+#include <unordered_set>
 #include <utility>
+#include "rocksdb/write_batch.h"
 #include "utils/enum.h"
 
 #include "store/rocks_store.h"
@@ -67,6 +69,68 @@ bool RocksStore::Put(const Hash& key, const Chunk& chunk) {
   return success;
 }
 
+std::vector<Chunk> RocksStore::MultiGet(const std::vector<Hash>& keys) {
+  std::vector<rocksdb::Slice> key_slices;
+  key_slices.reserve(keys.size());
+  for (const Hash& key : keys) key_slices.push_back(ToRocksSlice(key));
+  std::vector<std::string> values;
+  auto stats = DBMultiGet(key_slices, &values);
+
+  std::vector<Chunk> chunks;
+  chunks.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (stats[i].ok()) {
+      chunks.push_back(ToChunk(values[i]));
+      DCHECK(keys[i] == chunks.back().hash());
+    } else {
+      LOG(WARNING) << "Failed to get chunk \"" << keys[i] << "\"";
+      chunks.emplace_back();
+    }
+  }
+  return chunks;
+}
+
+bool RocksStore::MultiPut(const std::vector<Hash>& keys,
+                          const std::vector<const Chunk*>& chunks) {
+  CHECK_EQ(keys.size(), chunks.size());
+  // skip the chunks already stored or repeated in the batch
+  auto added = MultiExists(keys);
+  added.flip();
+  std::unordered_set<Hash> batched;
+  rocksdb::WriteBatch batch;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (added[i] && batched.insert(keys[i]).second) {
+      batch.Put(ToRocksSlice(keys[i]), ToRocksSlice(*chunks[i]));
+    } else {
+      added[i] = false;
+    }
+  }
+  if (batch.Count() == 0) return true;
+  auto success = DBWrite(&batch);
+
+#ifdef ENABLE_STORE_INFO
+  if (success) {
+    std::lock_guard<std::mutex> lock(mtx_store_info_);
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (added[i]) UpdateStoreInfoForNewChunk(*chunks[i]);
+  }
+#endif
+
+  return success;
+}
+
+std::vector<bool> RocksStore::MultiExists(const std::vector<Hash>& keys) {
+  std::vector<rocksdb::Slice> key_slices;
+  key_slices.reserve(keys.size());
+  for (const Hash& key : keys) key_slices.push_back(ToRocksSlice(key));
+  std::vector<std::string> values;
+  auto stats = DBMultiGet(key_slices, &values);
+
+  std::vector<bool> exists(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) exists[i] = stats[i].ok();
+  return exists;
+}
+
 void RocksStore::InitStoreInfo() {
   store_info_.chunks = 0;
   store_info_.chunkBytes = 0;
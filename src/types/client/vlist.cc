@@ -21,4 +21,27 @@ Hash VList::Splice(uint64_t start_idx, uint64_t num_to_delete,
   return Hash::kNull;
 }
 
+Hash VList::Set(const std::vector<uint64_t>& indices,
+                const std::vector<Slice>& entries) const {
+  CHECK_EQ(indices.size(), entries.size());
+  BufferIndices(indices, entries);
+  return Hash::kNull;
+}
+
+Hash VList::Delete(const std::vector<uint64_t>& indices) const {
+  BufferIndices(indices, {});
+  return Hash::kNull;
+}
+
+void VList::BufferIndices(const std::vector<uint64_t>& indices,
+                          const std::vector<Slice>& entries) const {
+  indices_ = indices;
+  std::vector<Slice> keys;
+  for (const uint64_t& idx : indices_) {
+    keys.emplace_back(reinterpret_cast<const byte_t*>(&idx), sizeof(idx));
+  }
+  // each index removes one element
+  buffer_ = {UType::kList, root_node_->hash(), 0, 1, entries, keys};
+}
+
 }  // namespace ustore
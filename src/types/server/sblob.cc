@@ -20,11 +20,9 @@ SBlob::SBlob(std::shared_ptr<ChunkLoader> loader, ChunkWriter* writer,
     chunk_writer_->Write(chunk_info.chunk.hash(), chunk_info.chunk);
     SetNodeForHash(chunk_info.chunk.hash());
   } else {
-    NodeBuilder nb(chunk_writer_, BlobChunker::Instance(),
-                   MetaChunker::Instance());
     FixedSegment seg(data.data(), data.len(), 1);
-    nb.SpliceElements(0, &seg);
-    Hash root_hash(nb.Commit());
+    Hash root_hash(NodeBuilder::BulkBuild(&seg, chunk_writer_,
+        BlobChunker::Instance(), MetaChunker::Instance()));
     SetNodeForHash(root_hash);
   }
 }
@@ -2,6 +2,7 @@
 
 #include "types/server/slist.h"
 
+#include <algorithm>
 #include "node/list_node.h"
 #include "node/node_builder.h"
 #include "node/node_comparator.h"
@@ -23,11 +24,9 @@ SList::SList(std::shared_ptr<ChunkLoader> loader, ChunkWriter* writer,
     chunk_writer_->Write(chunk_info.chunk.hash(), chunk_info.chunk);
     SetNodeForHash(chunk_info.chunk.hash());
   } else {
-    NodeBuilder nb(chunk_writer_, ListChunker::Instance(),
-                   MetaChunker::Instance());
     std::unique_ptr<const Segment> seg = ListNode::Encode(elements);
-    nb.SpliceElements(0, seg.get());
-    SetNodeForHash(nb.Commit());
+    SetNodeForHash(NodeBuilder::BulkBuild(seg.get(), chunk_writer_,
+        ListChunker::Instance(), MetaChunker::Instance()));
   }
 }
 
@@ -44,6 +43,42 @@ Hash SList::Splice(size_t start_idx, size_t num_to_delete,
   return nb.Commit();
 }
 
+Hash SList::Set(const std::vector<uint64_t>& indices,
+                 const std::vector<Slice>& entries) const {
+  CHECK_EQ(indices.size(), entries.size());
+  return MultiSplice(indices, entries);
+}
+
+Hash SList::Delete(const std::vector<uint64_t>& indices) const {
+  return MultiSplice(indices, {});
+}
+
+Hash SList::MultiSplice(const std::vector<uint64_t>& indices,
+                        const std::vector<Slice>& entries) const {
+  CHECK(!empty());
+  std::vector<size_t> order(indices.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  // a duplicated index keeps its given order, so that the last one wins
+  std::stable_sort(order.begin(), order.end(),
+                   [&indices](size_t lhs, size_t rhs) {
+    return indices[lhs] < indices[rhs];
+  });
+  AdvancedNodeBuilder nb(hash(), chunk_loader_.get(), chunk_writer_);
+  for (size_t k = 0; k < order.size(); ++k) {
+    size_t i = order[k];
+    if (k + 1 < order.size() && indices[i] == indices[order[k + 1]])
+      continue;
+    if (indices[i] >= numElements()) {
+      LOG(WARNING) << "Index " << indices[i] << " is out of range";
+      return Hash::kNull;
+    }
+    std::vector<std::unique_ptr<const Segment>> segs;
+    if (!entries.empty()) segs.push_back(ListNode::Encode({entries[i]}));
+    nb.Splice(indices[i], 1, std::move(segs));
+  }
+  return nb.Commit(*ListChunker::Instance());
+}
+
 Hash SList::Merge(const SList& node1, const SList& node2) const {
   if (numElements() == 0 || node1.numElements() == 0 ||
       node2.numElements() == 0) {
@@ -25,8 +25,6 @@ SMap::SMap(std::shared_ptr<ChunkLoader> loader, ChunkWriter* writer,
     chunk_writer_->Write(chunk_info.chunk.hash(), chunk_info.chunk);
     SetNodeForHash(chunk_info.chunk.hash());
   } else {
-    NodeBuilder nb(chunk_writer_, MapChunker::Instance(),
-                   MetaChunker::Instance());
     std::vector<KVItem> kv_items;
 
     auto sorted_idx = Utils::SortIndexes<Slice>(keys);
@@ -44,8 +42,8 @@ SMap::SMap(std::shared_ptr<ChunkLoader> loader, ChunkWriter* writer,
       }  // end if
     }  // end for
     std::unique_ptr<const Segment> seg = MapNode::Encode(kv_items);
-    nb.SpliceElements(0, seg.get());
-    SetNodeForHash(nb.Commit());
+    SetNodeForHash(NodeBuilder::BulkBuild(seg.get(), chunk_writer_,
+        MapChunker::Instance(), MetaChunker::Instance()));
   }
 }
 
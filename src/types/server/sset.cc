@@ -24,16 +24,14 @@ SSet::SSet(std::shared_ptr<ChunkLoader> loader, ChunkWriter* writer,
     chunk_writer_->Write(chunk_info.chunk.hash(), chunk_info.chunk);
     SetNodeForHash(chunk_info.chunk.hash());
   } else {
-    NodeBuilder nb(chunk_writer_, SetChunker::Instance(),
-                   MetaChunker::Instance());
     std::vector<Slice> items;
 
     for (size_t i : Utils::SortIndexes<Slice>(keys)) {
       items.push_back(keys[i]);
     }
     std::unique_ptr<const Segment> seg = SetNode::Encode(items);
-    nb.SpliceElements(0, seg.get());
-    SetNodeForHash(nb.Commit());
+    SetNodeForHash(NodeBuilder::BulkBuild(seg.get(), chunk_writer_,
+        SetChunker::Instance(), MetaChunker::Instance()));
   }
 }
 
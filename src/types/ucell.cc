@@ -33,6 +33,8 @@ UCell::UCell(Chunk&& chunk) {
   if (chunk.empty()) {
     LOG(WARNING) << "Empty Chunk. Loading Failed. ";
   } else if (chunk.type() == ChunkType::kCell) {
+    // cells are small and may be kept by users for long
+    chunk.LeaveArena();
     node_.reset(new CellNode(std::move(chunk)));
   } else {
     LOG(FATAL) << "Cannot be other chunk type for UCell"
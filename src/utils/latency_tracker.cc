@@ -0,0 +1,39 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "utils/latency_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include "utils/logging.h"
+
+namespace ustore {
+
+constexpr size_t LatencyTracker::kWindow;
+constexpr size_t LatencyTracker::kInterval;
+
+LatencyTracker::LatencyTracker(double percentile) : percentile_(percentile) {
+  CHECK(percentile > 0 && percentile <= 100)
+      << "Percentile must be in (0, 100]: " << percentile;
+  window_.reserve(kWindow);
+}
+
+void LatencyTracker::Record(size_t us) {
+  std::vector<size_t> samples;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (window_.size() < kWindow)
+      window_.push_back(us);
+    else
+      window_[recorded_ % kWindow] = us;
+    if (++recorded_ % kInterval) return;
+    samples = window_;
+  }
+  // select the percentile out of the lock
+  size_t rank = static_cast<size_t>(
+      std::ceil(percentile_ / 100 * samples.size()));
+  rank = std::min(rank ? rank - 1 : 0, samples.size() - 1);
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  percentile_us_.store(samples[rank], std::memory_order_relaxed);
+}
+
+}  // namespace ustore
@@ -57,9 +57,14 @@ static const std::unordered_map<ErrorCode, std::string> ec2str = {
   {ErrorCode::kBranchExists, "branch already exists"},
   {ErrorCode::kBranchNotExists, "branch does not exist"},
   {ErrorCode::kReferringVersionNotExist, "referring version does not exist"},
+  {ErrorCode::kKeyMoved, "key is moved to another worker"},
+  {ErrorCode::kFailedMigrate, "failed to migrate keys"},
   {ErrorCode::kUCellNotExists, "UCell does not exist"},
   {ErrorCode::kChunkNotExists, "chunk does not exist"},
   {ErrorCode::kStoreInfoUnavailable, "storage information is unavailable"},
+  {ErrorCode::kFailedGC, "failed to collect garbage"},
+  {ErrorCode::kRequestTimeout, "no response to the request in time"},
+  {ErrorCode::kConnectionLost, "connection to the server is lost"},
   {ErrorCode::kTypeUnsupported, "unsupported data type"},
   {ErrorCode::kFailedCreateUCell, "failed to create UCell"},
   {ErrorCode::kFailedCreateSBlob, "failed to create SBlob"},
@@ -287,6 +287,10 @@ bool RocksLatestVersionDB::Merge(const Slice& key, const Hash& prev_ver1,
   }
 }
 
+bool RocksLatestVersionDB::Delete(const Slice& key) {
+  return DBDelete(ToRocksSlice(key));
+}
+
 std::vector<std::string> RocksLatestVersionDB::GetKeys() const {
   std::vector<std::string> keys;
   DBFullScan([this, &keys](const rocksdb::Iterator * it) {
@@ -370,6 +374,12 @@ void RocksHeadVersion::RenameBranch(const Slice& key, const Slice& old_branch,
   }
 }
 
+void RocksHeadVersion::RemoveKey(const Slice& key) {
+  for (const auto& branch : branch_db_.GetBranches(key))
+    branch_db_.Delete(key, Slice(branch));
+  latest_db_.Delete(key);
+}
+
 }  // namespace ustore
 
 #endif  // USE_ROCKSDB
@@ -1,6 +1,7 @@
 // Copyright (c) 2017 The Ustore Authors.
 
 #include <fstream>
+#include <mutex>
 #include <utility>
 
 #include "proto/head_version.pb.h"
@@ -15,6 +16,7 @@ bool SimpleHeadVersion::Load(const std::string& log_path) {
   LOG(INFO) << "Loading head version file: " << log_path << " ......";
   KeyVersions key_versions;  // protobuf
   if (!key_versions.ParseFromIstream(&ifs)) return false;
+  std::lock_guard<shared_mutex> lock(mtx_);
   size_t num_keys = key_versions.key_versions_size();
   for (size_t key_idx = 0; key_idx < num_keys; ++key_idx) {
     const KeyVersion& key_version = key_versions.key_versions(key_idx);
@@ -41,6 +43,7 @@ bool SimpleHeadVersion::Dump(const std::string& log_path) {
   LOG(INFO) << "Dumping head version file: " << log_path << " ......";
   std::ofstream ofs(log_path, std::ofstream::out);
   KeyVersions key_versions;
+  shared_lock<shared_mutex> lock(mtx_);
   for (const auto& k2branchversion : branch_ver_) {
     PSlice key = k2branchversion.first;
     KeyVersion* key_version = key_versions.add_key_versions();
@@ -65,8 +68,11 @@ bool SimpleHeadVersion::Dump(const std::string& log_path) {
 bool SimpleHeadVersion::GetBranch(const Slice& key,
                                   const Slice& branch,
                                   Hash* ver) const {
-  if (Exists(key, branch)) {
-    *ver = branch_ver_.at(key).at(branch);
+  shared_lock<shared_mutex> lock(mtx_);
+  const Hash* head = FindBranch(key, branch);
+  if (head != nullptr) {
+    // copy out the head, which may be replaced once the lock is released
+    *ver = head->Clone();
     return true;
   } else {
     *ver = Hash::kNull;
@@ -75,20 +81,23 @@ bool SimpleHeadVersion::GetBranch(const Slice& key,
 }
 
 std::vector<Hash> SimpleHeadVersion::GetLatest(const Slice& key) const {
-  if (latest_ver_.find(key) == latest_ver_.end()) {
+  shared_lock<shared_mutex> lock(mtx_);
+  auto key_it = latest_ver_.find(key);
+  if (key_it == latest_ver_.end()) {
     DLOG(INFO) << "No data exists for Key \"" << key << "\"";
     static const std::vector<Hash> empty;
     return empty;
   } else {
-    const auto& lv_key = latest_ver_.at(key);
+    const auto& lv_key = key_it->second;
     std::vector<Hash> latest;
-    for (const auto& v : lv_key) latest.emplace_back(v);
+    for (const auto& v : lv_key) latest.emplace_back(v.Clone());
     return latest;
   }
 }
 
 void SimpleHeadVersion::PutBranch(const Slice& key, const Slice& branch,
                                   const Hash& ver) {
+  std::lock_guard<shared_mutex> lock(mtx_);
   auto key_it = branch_ver_.find(key);
   // create key if not exists
   if (key_it == branch_ver_.end()) {
@@ -113,6 +122,7 @@ void SimpleHeadVersion::PutBranch(const Slice& key, const Slice& branch,
 
 void SimpleHeadVersion::PutLatest(const Slice& key, const Hash& prev_ver1,
                                   const Hash& prev_ver2, const Hash& ver) {
+  std::lock_guard<shared_mutex> lock(mtx_);
   auto key_it = latest_ver_.find(key);
   // create key is not exists
   if (key_it == latest_ver_.end()) {
@@ -128,7 +138,8 @@ void SimpleHeadVersion::PutLatest(const Slice& key, const Hash& prev_ver1,
 }
 
 void SimpleHeadVersion::RemoveBranch(const Slice& key, const Slice& branch) {
-  if (Exists(key, branch)) {
+  std::lock_guard<shared_mutex> lock(mtx_);
+  if (FindBranch(key, branch) != nullptr) {
     auto& bv_key = branch_ver_.at(key);
     bv_key.erase(branch);
     LogBranchUpdate(key, branch, Hash::kNull);
@@ -140,10 +151,11 @@ void SimpleHeadVersion::RemoveBranch(const Slice& key, const Slice& branch) {
 
 void SimpleHeadVersion::RenameBranch(const Slice& key, const Slice& old_branch,
                                      const Slice& new_branch) {
-  DCHECK(Exists(key, old_branch)) << ": Branch \"" << old_branch
+  std::lock_guard<shared_mutex> lock(mtx_);
+  DCHECK(FindBranch(key, old_branch) != nullptr) << ": Branch \"" << old_branch
                                   << "\" for Key \"" << key
                                   << "\" does not exist!";
-  DCHECK(!Exists(key, new_branch)) << ": Branch \"" << new_branch
+  DCHECK(FindBranch(key, new_branch) == nullptr) << ": Branch \"" << new_branch
                                    << "\" for Key \"" << key
                                    << "\" already exists!";
   auto& bv_key = branch_ver_.at(key);
@@ -153,14 +165,33 @@ void SimpleHeadVersion::RenameBranch(const Slice& key, const Slice& old_branch,
   LogBranchUpdate(key, old_branch, Hash::kNull);
 }
 
+void SimpleHeadVersion::RemoveKey(const Slice& key) {
+  std::lock_guard<shared_mutex> lock(mtx_);
+  auto bv_it = branch_ver_.find(key);
+  if (bv_it != branch_ver_.end()) {
+    for (const auto& bv : bv_it->second)
+      LogBranchUpdate(key, bv.first, Hash::kNull);
+    branch_ver_.erase(bv_it);
+  }
+  latest_ver_.erase(key);
+}
+
 bool SimpleHeadVersion::Exists(const Slice& key, const Slice& branch) const {
+  shared_lock<shared_mutex> lock(mtx_);
+  return FindBranch(key, branch) != nullptr;
+}
+
+const Hash* SimpleHeadVersion::FindBranch(const Slice& key,
+                                          const Slice& branch) const {
   auto key_it = branch_ver_.find(key);
-  if (key_it == branch_ver_.end()) return false;
+  if (key_it == branch_ver_.end()) return nullptr;
   const auto& bv_key = key_it->second;
-  return bv_key.find(branch) != bv_key.end();
+  auto branch_it = bv_key.find(branch);
+  return branch_it == bv_key.end() ? nullptr : &branch_it->second;
 }
 
 bool SimpleHeadVersion::IsLatest(const Slice& key, const Hash& ver) const {
+  shared_lock<shared_mutex> lock(mtx_);
   auto key_it = latest_ver_.find(key);
   if (key_it == latest_ver_.end()) return false;
   const auto& lv_key = key_it->second;
@@ -169,14 +200,17 @@ bool SimpleHeadVersion::IsLatest(const Slice& key, const Hash& ver) const {
 
 std::vector<std::string> SimpleHeadVersion::ListKey() const {
   std::vector<std::string> keys;
+  shared_lock<shared_mutex> lock(mtx_);
   for (auto& lv : latest_ver_) keys.emplace_back(lv.first.ToString());
   return keys;
 }
 
 std::vector<std::string> SimpleHeadVersion::ListBranch(const Slice& key) const {
   std::vector<std::string> branchs;
-  if (branch_ver_.find(key) != branch_ver_.end()) {
-    for (const auto& bv : branch_ver_.at(key)) {
+  shared_lock<shared_mutex> lock(mtx_);
+  auto key_it = branch_ver_.find(key);
+  if (key_it != branch_ver_.end()) {
+    for (const auto& bv : key_it->second) {
       branchs.emplace_back(bv.first.ToString());
     }
   }
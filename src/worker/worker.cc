@@ -3,7 +3,11 @@
 #include "worker/worker.h"
 
 #include <boost/filesystem.hpp>
+#include <cstring>
 #include <memory>
+#include <unordered_set>
+#include "node/cell_node.h"
+#include "node/meta_node.h"
 #include "types/server/sblob.h"
 #include "types/server/slist.h"
 #include "types/server/smap.h"
@@ -144,6 +148,9 @@ ErrorCode Worker::Merge(const Slice& key, const Value& val,
 ErrorCode Worker::WriteUCell(const Slice& key, const Value& val,
                              const Hash& prev_ver1, const Hash& prev_ver2,
                              Hash* ver) {
+  // chunks deduplicated before a GC starts to mark are kept alive by the
+  // version, which is published before the marking
+  shared_lock<shared_mutex> lock(publish_mtx_);
   // for primitive types
   if (val.type == UType::kString) {
     USTORE_GUARD(CheckString(val));
@@ -204,6 +211,27 @@ ErrorCode Worker::WriteList(const Value& val, Hash* ver) {
       return ErrorCode::kFailedCreateSList;
     }
     *ver = list.hash().Clone();  // need to clone a full copy
+  } else if (!val.keys.empty()) {  // update elements at multiple indices
+    // keys are indices, each of which removes one element and is replaced
+    //   by the value at the same position if any
+    std::vector<uint64_t> indices;
+    for (const Slice& key : val.keys) {
+      if (key.len() != sizeof(uint64_t)) return ErrorCode::kInvalidValue;
+      uint64_t idx;
+      std::memcpy(&idx, key.data(), sizeof(idx));
+      indices.push_back(idx);
+    }
+    auto list = factory_.Load<SList>(val.base);
+    Hash data_hash;
+    if (val.vals.empty()) {
+      data_hash = list.Delete(indices);
+    } else if (val.vals.size() == indices.size()) {
+      data_hash = list.Set(indices, val.vals);
+    } else {
+      return ErrorCode::kInvalidValue;
+    }
+    if (data_hash == Hash::kNull) return ErrorCode::kFailedModifySList;
+    *ver = std::move(data_hash);
   } else if (!val.dels && val.vals.empty()) {  // origin
     *ver = val.base;
   } else {  // update
@@ -293,6 +321,7 @@ ErrorCode Worker::CreateUCell(const Slice& key, const UType& utype,
     return ErrorCode::kFailedCreateUCell;
   }
   *ver = ucell.hash().Clone();  // need to clone a full copy
+  if (!KeepAlive(*ver)) return ErrorCode::kFailedCreateUCell;
   UpdateLatestVersion(ucell);
   return ErrorCode::kOK;
 }
@@ -307,6 +336,7 @@ ErrorCode Worker::CreateUCell(const Slice& key, const UType& utype,
     return ErrorCode::kFailedCreateUCell;
   }
   *ver = ucell.hash().Clone();  // need to clone a full copy
+  if (!KeepAlive(*ver)) return ErrorCode::kFailedCreateUCell;
   UpdateLatestVersion(ucell);
   return ErrorCode::kOK;
 }
@@ -329,7 +359,8 @@ ErrorCode Worker::Branch(const Slice& key, const Hash& ver,
                << "\" already exists!";
     return ErrorCode::kBranchExists;
   }
-  if (Exists(ver)) {
+  shared_lock<shared_mutex> lock(publish_mtx_);
+  if (Exists(ver) && KeepAlive(ver)) {
     head_ver_.PutBranch(key, new_branch, ver);
     return ErrorCode::kOK;
   } else {
@@ -396,6 +427,124 @@ ErrorCode Worker::GetStorageInfo(std::vector<StoreInfo>* info) const {
 #endif
 }
 
+ErrorCode Worker::PutChunk(const Hash& ver, const Chunk& chunk) {
+  static const auto chunk_store = store::GetChunkStore();
+  return chunk_store->Put(ver, chunk) ? ErrorCode::kOK
+                                      : ErrorCode::kFailedCreateChunk;
+}
+
+ErrorCode Worker::PutBranchHead(const Slice& key, const Slice& branch,
+                                const Hash& ver) {
+  shared_lock<shared_mutex> lock(publish_mtx_);
+  if (!KeepAlive(ver)) return ErrorCode::kReferringVersionNotExist;
+  head_ver_.PutBranch(key, branch, ver);
+  return ErrorCode::kOK;
+}
+
+ErrorCode Worker::PutLatestVersion(const Slice& key, const Hash& ver) {
+  shared_lock<shared_mutex> lock(publish_mtx_);
+  if (!KeepAlive(ver)) return ErrorCode::kReferringVersionNotExist;
+  head_ver_.PutLatest(key, Hash::kNull, Hash::kNull, ver);
+  return ErrorCode::kOK;
+}
+
+// append the chunks a chunk refers to, i.e., the previous versions and the
+// data of a version, or the children of a meta node
+static void AppendChildren(Chunk chunk, std::vector<Hash>* hashes) {
+  if (chunk.type() == ChunkType::kCell) {
+    CellNode cell(std::move(chunk));
+    for (size_t i = 0; i < cell.numPreHash(); ++i)
+      hashes->push_back(cell.preHash(i).Clone());
+    UType type = cell.type();
+    if (type == UType::kBlob || type == UType::kList
+        || type == UType::kMap || type == UType::kSet)
+      hashes->push_back(Hash(cell.data()).Clone());
+  } else if (chunk.type() == ChunkType::kMeta) {
+    MetaNode node(&chunk);
+    for (size_t i = 0; i < node.numEntries(); ++i)
+      hashes->push_back(node.GetChildHashByEntry(i).Clone());
+  }
+}
+
+void Worker::CollectChunks(std::vector<Hash> roots,
+                           std::unordered_set<Hash>* visited,
+                           std::vector<Hash>* found) const {
+  static const auto chunk_store = store::GetChunkStore();
+  // traverse versions and their pos-trees
+  while (!roots.empty()) {
+    Hash hash = std::move(roots.back());
+    roots.pop_back();
+    if (hash.empty() || hash == Hash::kNull || visited->count(hash)) continue;
+    Chunk chunk = chunk_store->Get(hash);
+    if (chunk.empty()) continue;
+    visited->insert(hash.Clone());
+    if (found) found->push_back(hash.Clone());
+    AppendChildren(std::move(chunk), &roots);
+  }
+}
+
+bool Worker::KeepAlive(const Hash& ver) {
+  if (gc_live_ == nullptr) return true;
+  std::vector<Hash> hashes;
+  hashes.push_back(ver.Clone());
+  return MarkLive(std::move(hashes));
+}
+
+bool Worker::MarkLive(std::vector<Hash> hashes) {
+  static const auto chunk_store = store::GetChunkStore();
+  bool intact = true;
+  while (!hashes.empty()) {
+    Hash hash = std::move(hashes.back());
+    hashes.pop_back();
+    if (hash.empty() || hash == Hash::kNull) continue;
+    // marked live before the chunk is got, so that it is either relocated by
+    // the GC or found collected already
+    if (!gc_live_->Insert(hash)) continue;
+    Chunk chunk = chunk_store->Get(hash);
+    if (chunk.empty()) {
+      LOG(ERROR) << "Chunk \"" << hash << "\" is missing or collected by GC";
+      intact = false;
+      continue;
+    }
+    AppendChildren(std::move(chunk), &hashes);
+  }
+  return intact;
+}
+
+ErrorCode Worker::GC(size_t* reclaimed) {
+  static const auto chunk_store = store::GetChunkStore();
+  // one GC at a time, which tracks the versions published meanwhile
+  std::lock_guard<std::mutex> gc_lock(gc_mtx_);
+  LiveSet live;
+  auto mark = [this, &live]() -> ChunkStore::LivenessFunc {
+    std::vector<Hash> roots;
+    {
+      // versions published from now on are kept alive by the writers
+      std::lock_guard<shared_mutex> lock(publish_mtx_);
+      for (const auto& key : head_ver_.ListKey()) {
+        for (const auto& branch : head_ver_.ListBranch(Slice(key))) {
+          Hash head;
+          if (head_ver_.GetBranch(Slice(key), Slice(branch), &head))
+            roots.push_back(head.Clone());
+        }
+        for (const auto& ver : head_ver_.GetLatest(Slice(key)))
+          roots.push_back(ver.Clone());
+      }
+      gc_live_ = &live;
+    }
+    MarkLive(std::move(roots));
+    // chunks skipped above, as marked by a writer, are only fully marked once
+    // the writers in progress are done
+    std::lock_guard<shared_mutex> lock(publish_mtx_);
+    LOG(INFO) << "GC found " << live.size() << " live chunks";
+    return [&live](const Hash& hash) { return live.Contains(hash); };
+  };
+  *reclaimed = chunk_store->GC(mark);
+  std::lock_guard<shared_mutex> lock(publish_mtx_);
+  gc_live_ = nullptr;
+  return ErrorCode::kOK;
+}
+
 ErrorCode Worker::ListKeys(std::vector<std::string>* keys) const {
   keys->clear();
   for (auto && k : head_ver_.ListKey()) {
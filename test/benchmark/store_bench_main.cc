@@ -0,0 +1,777 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "chunk/chunk.h"
+#include "chunk/chunk_cache.h"
+#include "chunk/chunk_loader.h"
+#include "hash/blake3.h"
+#include "hash/sha2.h"
+#include "hash/sha256.h"
+#include "node/blob_node.h"
+#include "node/cursor.h"
+#include "node/meta_node.h"
+#include "node/node_builder.h"
+#include "node/offset_cache.h"
+#include "node/rolling_hash.h"
+#include "store/chunk_store.h"
+#include "store/lst_store.h"
+#include "types/server/factory.h"
+#include "utils/arguments.h"
+#include "utils/env.h"
+#include "utils/timer.h"
+
+using namespace ustore;
+
+class StoreBenchArguments : public Arguments {
+ public:
+  std::string command;
+  int num_chunks;
+  int chunk_size;
+  int max_threads;
+  int max_segments;
+  int blob_mb;
+  int list_size;
+
+  StoreBenchArguments() {
+    AddPositional(&command, "command",
+                  "benchmark to run: putget, index, load, commit, scan, hash, "
+                  "chunk, build, write, merge, lookup",
+                  "putget");
+    Add(&num_chunks, "chunks", "n", "# of chunks per round", 1 << 20);
+    Add(&chunk_size, "chunk-size", "s", "bytes of chunk payload", 4096);
+    Add(&max_threads, "threads", "t", "maximum # of threads", 32);
+    Add(&max_segments, "segments", "g", "maximum # of segments to load", 256);
+    Add(&blob_mb, "blob-mb", "b",
+        "MB of data to scan, hash, chunk, build or write", 16);
+    Add(&list_size, "list-size", "l",
+        "# of elements of lists to merge or maps to look up", 1 << 16);
+  }
+
+  bool CheckArgs() override {
+    GUARD(CheckGT(num_chunks, 0, "Number of chunks"));
+    GUARD(CheckGT(chunk_size, 8, "Chunk size"));
+    GUARD(CheckGT(max_threads, 0, "Number of threads"));
+    GUARD(CheckGT(max_segments, 0, "Number of segments"));
+    GUARD(CheckGT(blob_mb, 0, "Blob size"));
+    GUARD(CheckGT(list_size, 0, "List size"));
+    return true;
+  }
+};
+
+static StoreBenchArguments args;
+
+// heap allocations of the process, counted by the replaced operator new
+static std::atomic<size_t> num_allocs{0};
+
+void* operator new(size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+ChunkStore* GetStore() {
+  static ChunkStore* store = nullptr;
+  if (store == nullptr) {
+    const std::string& data_dir = Env::Instance()->config().data_dir();
+    boost::filesystem::create_directory(boost::filesystem::path(data_dir));
+    store = store::InitChunkStore(data_dir, "store_bench", false);
+  }
+  return store;
+}
+
+// distinct chunks whose first 8 bytes encode a global sequence number
+std::vector<Chunk> MakeChunks(size_t n, size_t size, uint64_t first_seq) {
+  std::vector<Chunk> chunks;
+  chunks.reserve(n);
+  std::mt19937_64 rng(first_seq);
+  for (size_t i = 0; i < n; ++i) {
+    Chunk chunk(ChunkType::kBlob, size);
+    uint64_t seq = first_seq + i;
+    byte_t* data = chunk.m_data();
+    std::memcpy(data, &seq, sizeof(seq));
+    for (size_t j = sizeof(seq); j + sizeof(uint64_t) <= size;
+         j += sizeof(uint64_t)) {
+      uint64_t r = rng();
+      std::memcpy(data + j, &r, sizeof(r));
+    }
+    chunk.forceHash();
+    chunks.push_back(std::move(chunk));
+  }
+  return chunks;
+}
+
+// run func(tid, begin, end) on n_threads threads over [0, n)
+double RunParallel(size_t n, size_t n_threads,
+                   const std::function<void(size_t, size_t, size_t)>& func) {
+  return Timer::TimeSeconds([&] {
+    std::vector<std::thread> threads;
+    size_t step = (n + n_threads - 1) / n_threads;
+    for (size_t t = 0; t < n_threads; ++t) {
+      size_t begin = std::min(n, t * step), end = std::min(n, begin + step);
+      threads.emplace_back(func, t, begin, end);
+    }
+    for (auto& t : threads) t.join();
+  });
+}
+
+void BenchPutGet() {
+  ChunkStore* store = GetStore();
+  std::cout << std::setw(8) << "threads" << std::setw(16) << "put (ops/s)"
+            << std::setw(16) << "get (ops/s)" << std::setw(16)
+            << "exists (ops/s)" << std::endl;
+  uint64_t seq = 0;
+  for (size_t n_threads = 1; n_threads <= size_t(args.max_threads);
+       n_threads *= 2) {
+    // every round writes fresh chunks, so that no put is deduplicated
+    auto chunks = MakeChunks(args.num_chunks, args.chunk_size, seq);
+    seq += args.num_chunks;
+    size_t n = chunks.size();
+
+    double put_time = RunParallel(n, n_threads,
+        [&](size_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        store->Put(chunks[i].hash(), chunks[i]);
+    });
+
+    double get_time = RunParallel(n, n_threads,
+        [&](size_t tid, size_t begin, size_t end) {
+      std::vector<size_t> order(end - begin);
+      for (size_t i = 0; i < order.size(); ++i) order[i] = begin + i;
+      std::shuffle(order.begin(), order.end(), std::mt19937(tid));
+      for (size_t i : order)
+        CHECK(!store->Get(chunks[i].hash()).empty());
+    });
+
+    double exists_time = RunParallel(n, n_threads,
+        [&](size_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        CHECK(store->Exists(chunks[i].hash()));
+    });
+
+    std::cout << std::setw(8) << n_threads << std::fixed
+              << std::setprecision(0)
+              << std::setw(16) << n / put_time
+              << std::setw(16) << n / get_time
+              << std::setw(16) << n / exists_time << std::endl;
+  }
+}
+
+size_t index_bytes = 0;
+
+// allocator that tracks the bytes held by std::unordered_map
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+  CountingAllocator() = default;
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) {}  // NOLINT
+
+  T* allocate(size_t n) {
+    index_bytes += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) {
+    index_bytes -= n * sizeof(T);
+    std::allocator<T>().deallocate(p, n);
+  }
+  template <typename U>
+  bool operator==(const CountingAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+template <typename MapType>
+void BenchIndexMap(const std::string& name, MapType* map,
+                   const std::vector<const byte_t*>& chunks,
+                   const std::vector<const byte_t*>& missing,
+                   const std::function<size_t()>& memory) {
+  using lst_store::PtrToChunkLength;
+  double insert_time = Timer::TimeNanoseconds([&] {
+    for (auto chunk : chunks)
+      map->emplace(chunk + PtrToChunkLength(chunk), chunk);
+  });
+  std::vector<const byte_t*> order(chunks);
+  std::shuffle(order.begin(), order.end(), std::mt19937(0));
+  size_t found = 0;
+  double hit_time = Timer::TimeNanoseconds([&] {
+    for (auto chunk : order)
+      found += map->count(chunk + PtrToChunkLength(chunk));
+  });
+  CHECK_EQ(found, chunks.size());
+  double miss_time = Timer::TimeNanoseconds([&] {
+    for (auto hash : missing) found -= map->count(hash);
+  });
+  CHECK_EQ(found, chunks.size());
+  size_t n = chunks.size();
+  std::cout << std::setw(16) << name << std::fixed << std::setprecision(1)
+            << std::setw(16) << double(memory()) / n
+            << std::setw(16) << insert_time / n
+            << std::setw(16) << hit_time / n
+            << std::setw(16) << miss_time / n << std::endl;
+}
+
+void BenchIndex() {
+  using lst_store::LSTHash;
+  using lst_store::LSTChunk;
+  using lst_store::LSTSegment;
+  constexpr size_t kPayload = 8;
+  constexpr size_t kRecord = Chunk::kMetaLength + kPayload + Hash::kByteLength;
+  // a fake log holding only chunk records with random hashes
+  size_t n = args.num_chunks;
+  std::vector<byte_t> log(lst_store::kMetaLogSize + n * kRecord);
+  LSTSegment::base_addr_ = log.data();
+  std::mt19937_64 rng(0);
+  std::vector<const byte_t*> chunks, missing;
+  std::vector<byte_t> missing_hashes(n * Hash::kByteLength);
+  for (size_t i = 0; i < n; ++i) {
+    byte_t* chunk = log.data() + lst_store::kMetaLogSize + i * kRecord;
+    uint32_t num_bytes = Chunk::kMetaLength + kPayload;
+    std::memcpy(chunk + Chunk::kNumBytesOffset, &num_bytes, sizeof(num_bytes));
+    chunk[Chunk::kChunkTypeOffset] = byte_t(ChunkType::kBlob);
+    for (size_t j = 0; j < Hash::kByteLength; ++j) {
+      chunk[num_bytes + j] = byte_t(rng());
+      missing_hashes[i * Hash::kByteLength + j] = byte_t(rng());
+    }
+    chunks.push_back(chunk);
+    missing.push_back(&missing_hashes[i * Hash::kByteLength]);
+  }
+
+  std::cout << "index of " << n << " chunks" << std::endl
+            << std::setw(16) << "map" << std::setw(16) << "bytes/entry"
+            << std::setw(16) << "insert (ns)" << std::setw(16) << "hit (ns)"
+            << std::setw(16) << "miss (ns)" << std::endl;
+  {
+    using NodeMap = std::unordered_map<LSTHash, LSTChunk, std::hash<LSTHash>,
+          std::equal_to<LSTHash>,
+          CountingAllocator<std::pair<const LSTHash, LSTChunk>>>;
+    NodeMap map;
+    BenchIndexMap("unordered_map", &map, chunks, missing,
+                  [] { return index_bytes; });
+  }
+  {
+    lst_store::LSTFlatMap map;
+    BenchIndexMap("LSTFlatMap", &map, chunks, missing,
+                  [&map] { return map.memory(); });
+  }
+}
+
+// run func in a child process, so that it owns a fresh chunk store
+void RunInChild(const std::function<void()>& func) {
+  pid_t pid = fork();
+  CHECK_GE(pid, 0);
+  if (pid == 0) {
+    func();
+    std::cout.flush();
+    // destructs the chunk store, which writes the index checkpoint
+    std::exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void BenchLoad() {
+  const std::string& data_dir = Env::Instance()->config().data_dir();
+  boost::filesystem::create_directory(boost::filesystem::path(data_dir));
+  const std::string file = "store_bench_load";
+  const size_t chunks_per_segment = lst_store::kSegmentSize
+      / (args.chunk_size + Chunk::kMetaLength + Hash::kByteLength) - 1;
+  std::cout << std::setw(10) << "segments" << std::setw(16) << "chunks"
+            << std::setw(16) << "checkpoint (s)" << std::setw(16)
+            << "parallel (s)" << std::setw(16) << "serial (s)" << std::endl;
+  for (size_t segments = 16; segments <= size_t(args.max_segments);
+       segments *= 2) {
+    Config& config = Env::Instance()->m_config();
+    config.set_max_segments(segments * 2 + 64);
+    config.set_load_threads(0);
+    std::cout << std::setw(10) << segments << std::setw(16)
+              << segments * chunks_per_segment << std::flush;
+    // populate a new log
+    RunInChild([&] {
+      ChunkStore* store = store::InitChunkStore(data_dir, file, false);
+      for (size_t i = 0; i < segments; ++i)
+        for (const auto& chunk : MakeChunks(chunks_per_segment,
+                                            args.chunk_size,
+                                            i * chunks_per_segment))
+          store->Put(chunk.hash(), chunk);
+    });
+    auto time_load = [&] {
+      RunInChild([&] {
+        double t = Timer::TimeSeconds([&] {
+          store::InitChunkStore(data_dir, file, true);
+        });
+        std::cout << std::fixed << std::setprecision(3) << std::setw(16) << t
+                  << std::flush;
+      });
+    };
+    const std::string index_path = data_dir + "/" + file + ".idx";
+    // restore from the checkpoint written at shutdown
+    time_load();
+    // scan the whole log without checkpoint
+    boost::filesystem::remove(index_path);
+    time_load();
+    boost::filesystem::remove(index_path);
+    config.set_load_threads(1);
+    time_load();
+    std::cout << std::endl;
+  }
+  boost::filesystem::remove(data_dir + "/" + file + ".dat");
+  boost::filesystem::remove(data_dir + "/" + file + ".idx");
+}
+
+void BenchCommit() {
+  const std::string& data_dir = Env::Instance()->config().data_dir();
+  boost::filesystem::create_directory(boost::filesystem::path(data_dir));
+  const std::string file = "store_bench_commit";
+  auto chunks = MakeChunks(args.num_chunks, args.chunk_size, 0);
+  size_t n = chunks.size(), n_threads = args.max_threads;
+  Config& config = Env::Instance()->m_config();
+  config.set_max_segments(n * args.chunk_size / lst_store::kSegmentSize * 2
+                          + 64);
+  std::cout << "commit " << n << " chunks with " << n_threads << " threads"
+            << std::endl << std::setw(16) << "window (us)" << std::setw(16)
+            << "put (ops/s)" << std::setw(16) << "avg (us)" << std::setw(16)
+            << "p99 (us)" << std::endl;
+  auto run = [&](const std::string& name) {
+    RunInChild([&] {
+      ChunkStore* store = store::InitChunkStore(data_dir, file, false);
+      std::vector<double> latency(n);
+      double put_time = RunParallel(n, n_threads,
+          [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          latency[i] = Timer::TimeNanoseconds([&] {
+            store->Put(chunks[i].hash(), chunks[i]);
+          }) / 1000;
+        }
+      });
+      std::sort(latency.begin(), latency.end());
+      double sum = 0;
+      for (double l : latency) sum += l;
+      std::cout << std::setw(16) << name << std::fixed << std::setprecision(0)
+                << std::setw(16) << n / put_time << std::setprecision(1)
+                << std::setw(16) << sum / n
+                << std::setw(16) << latency[n * 99 / 100] << std::endl;
+    });
+  };
+  // no durability as the baseline
+  config.set_durability(Config::ASYNC);
+  run("async");
+  config.set_durability(Config::GROUP_COMMIT);
+  for (int window : {0, 100, 500, 2000, 10000}) {
+    config.set_group_commit_window_us(window);
+    run(std::to_string(window));
+  }
+  boost::filesystem::remove(data_dir + "/" + file + ".dat");
+  boost::filesystem::remove(data_dir + "/" + file + ".idx");
+}
+
+// loads copies of local chunks after a delay, as if they were remote
+class DelayedChunkLoader : public ChunkLoader {
+ public:
+  explicit DelayedChunkLoader(int delay_us)
+    : ChunkLoader([delay_us](const Hash& key) {
+        // a thread stands for the network of remote fetches
+        return std::async(std::launch::async, [delay_us](Hash k) {
+          return Result<Chunk>{Fetch(k, delay_us), ErrorCode::kOK};
+        }, key.Clone());
+      }),
+      delay_us_(delay_us) {}
+
+ protected:
+  Chunk GetChunk(const Hash& key) override { return Fetch(key, delay_us_); }
+
+ private:
+  static Chunk Fetch(const Hash& key, int delay_us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    Chunk chunk = store::GetChunkStore()->Get(key);
+    std::unique_ptr<byte_t[]> buf(new byte_t[chunk.numBytes()]);
+    std::copy(chunk.head(), chunk.head() + chunk.numBytes(), buf.get());
+    return Chunk(std::move(buf));
+  }
+
+  const int delay_us_;
+};
+
+std::vector<byte_t> RandomBytes(size_t n, uint64_t seed = 0) {
+  std::vector<byte_t> data(n);
+  std::mt19937_64 rng(seed);
+  for (size_t i = 0; i + sizeof(uint64_t) <= data.size();
+       i += sizeof(uint64_t)) {
+    uint64_t r = rng();
+    std::memcpy(&data[i], &r, sizeof(r));
+  }
+  return data;
+}
+
+// words drawn at random from a play, as in the rolling hash test
+std::vector<byte_t> RandomText(size_t n) {
+  static const std::vector<std::string> words = {
+    "SCENE", "Rome.", "street.", "Enter", "FLAVIUS,", "MARULLUS,", "and",
+    "certain", "Commoners", "Hence!", "home,", "you", "idle", "creatures",
+    "get", "Is", "this", "a", "holiday?", "what!", "know", "not,", "Being",
+    "mechanical,", "ought", "walk", "Upon", "labouring", "day", "without",
+    "the", "sign", "Of", "your", "profession?", "Speak,", "trade", "art",
+    "thou?", "Why,", "sir,", "carpenter.", "Where", "is", "thy", "leather",
+    "apron", "rule?", "What", "dost", "thou", "with", "best", "apparel",
+    "on?", "Caesar", "Pompey", "Tiber", "banks,", "triumph.", "cobbler."
+  };
+  std::vector<byte_t> data;
+  data.reserve(n + 16);
+  std::mt19937_64 rng(0);
+  while (data.size() < n) {
+    const std::string& word = words[rng() % words.size()];
+    data.insert(data.end(), word.begin(), word.end());
+    data.push_back(' ');
+  }
+  data.resize(n);
+  return data;
+}
+
+void BenchChunk() {
+  GetStore();
+  const size_t num_bytes = size_t(args.blob_mb) << 20;
+  std::vector<std::pair<std::string, std::vector<byte_t>>> inputs;
+  inputs.emplace_back("text", RandomText(num_bytes));
+  inputs.emplace_back("random", RandomBytes(num_bytes));
+  std::vector<std::pair<std::string, RollingHasher::Engine>> engines = {
+    {"buzhash", RollingHasher::Engine::kBuzHash},
+    {"fastcdc", RollingHasher::Engine::kFastCDC}
+  };
+  std::cout << "chunk " << args.blob_mb << " MB with the default chunker "
+            << "parameters" << std::endl
+            << std::setw(10) << "input" << std::setw(10) << "engine"
+            << std::setw(14) << "detect (GB/s)" << std::setw(14)
+            << "avg chunk (B)" << std::setw(14) << "blob (MB/s)" << std::endl;
+  for (const auto& input : inputs) {
+    for (const auto& engine : engines) {
+      const byte_t* data = input.second.data();
+      size_t num_chunks = 0;
+      std::unique_ptr<RollingHasher> rhasher(new RollingHasher(
+          RollingHasher::kDefaultChunkPattern,
+          RollingHasher::kDefaultChunkWindow,
+          RollingHasher::kDefaultMaxChunkSize, engine.second));
+      double detect_time = Timer::TimeSeconds([&] {
+        for (size_t pos = 0; pos < num_bytes;) {
+          pos += rhasher->TryHashBytes(data + pos, num_bytes - pos) + 1;
+          if (rhasher->CrossedBoundary()) {
+            ++num_chunks;
+            rhasher->ClearLastBoundary();
+          }
+        }
+      });
+      // end to end, including hashing and writing chunks
+      BlobChunker::Instance()->SetRHasherEngine(engine.second);
+      ChunkableTypeFactory factory;
+      double blob_time = Timer::TimeSeconds([&] {
+        CHECK(!factory.Create<SBlob>(Slice(data, num_bytes)).hash().empty());
+      });
+      std::cout << std::setw(10) << input.first << std::setw(10)
+                << engine.first << std::fixed << std::setprecision(2)
+                << std::setw(14) << num_bytes / detect_time / (1 << 30)
+                << std::setw(14) << num_bytes / std::max<size_t>(num_chunks, 1)
+                << std::setprecision(1) << std::setw(14)
+                << args.blob_mb / blob_time << std::endl;
+    }
+  }
+  BlobChunker::Instance()->SetRHasherEngine(RollingHasher::Engine::kBuzHash);
+}
+
+void BenchBuild() {
+  GetStore();
+  const size_t num_bytes = size_t(args.blob_mb) << 20;
+  std::vector<byte_t> data = RandomBytes(num_bytes);
+  FixedSegment seg(data.data(), num_bytes, 1);
+  ChunkableTypeFactory factory;
+  std::cout << "bulk build a " << args.blob_mb << " MB blob" << std::endl
+            << std::setw(10) << "threads" << std::setw(14) << "build (MB/s)"
+            << std::endl;
+  Hash expected;
+  for (size_t n_threads = 1; n_threads <= size_t(args.max_threads);
+       n_threads *= 2) {
+    Hash root;
+    double elapsed = Timer::TimeSeconds([&] {
+      root = NodeBuilder::BulkBuild(&seg, factory.writer(),
+          BlobChunker::Instance(), MetaChunker::Instance(), n_threads);
+    });
+    if (expected.empty()) expected = root.Clone();
+    CHECK(root == expected) << "bulk build with " << n_threads
+                            << " threads gives a different root";
+    std::cout << std::setw(10) << n_threads << std::fixed
+              << std::setprecision(1) << std::setw(14)
+              << args.blob_mb / elapsed << std::endl;
+  }
+}
+
+void BenchWrite() {
+  const std::string& data_dir = Env::Instance()->config().data_dir();
+  boost::filesystem::create_directory(boost::filesystem::path(data_dir));
+  const std::string file = "store_bench_write";
+  const size_t num_bytes = size_t(args.blob_mb) << 20;
+  const size_t num_splices = 1024;
+  std::vector<byte_t> data = RandomBytes(num_bytes);
+  std::cout << "write new chunks by creating a " << args.blob_mb
+            << " MB blob and splicing it " << num_splices << " times"
+            << std::endl << std::setw(10) << "arena" << std::setw(14)
+            << "create (MB/s)" << std::setw(14) << "allocs/chunk"
+            << std::setw(14) << "splice (op/s)" << std::setw(14)
+            << "allocs/chunk" << std::endl;
+  for (bool arena : {false, true}) {
+    Env::Instance()->m_config().set_chunk_arena(arena);
+    RunInChild([&] {
+      ChunkStore* store = store::InitChunkStore(data_dir, file, false);
+      // run func, and return its elapsed time and heap allocations per new
+      // chunk
+      auto measure = [store](const std::function<void()>& func) {
+        size_t chunks = store->GetInfo().chunks;
+        size_t allocs = num_allocs.load();
+        double time = Timer::TimeSeconds(func);
+        allocs = num_allocs.load() - allocs;
+        chunks = store->GetInfo().chunks - chunks;
+        return std::make_pair(time,
+                              double(allocs) / std::max<size_t>(chunks, 1));
+      };
+      ChunkableTypeFactory factory;
+      Hash root;
+      auto create = measure([&] {
+        root = factory.Create<SBlob>(Slice(data.data(), num_bytes))
+                 .hash().Clone();
+      });
+      std::mt19937_64 rng(0);
+      auto splice = measure([&] {
+        for (size_t i = 0; i < num_splices; ++i) {
+          SBlob blob = factory.Load<SBlob>(root);
+          uint64_t bytes = rng();
+          root = blob.Splice(rng() % blob.size(), sizeof(bytes),
+                             reinterpret_cast<const byte_t*>(&bytes),
+                             sizeof(bytes));
+        }
+      });
+      std::cout << std::setw(10) << (arena ? "on" : "off") << std::fixed
+                << std::setprecision(1) << std::setw(14)
+                << args.blob_mb / create.first << std::setw(14)
+                << create.second << std::setw(14)
+                << num_splices / splice.first << std::setw(14)
+                << splice.second << std::endl;
+    });
+  }
+  boost::filesystem::remove(data_dir + "/" + file + ".dat");
+  boost::filesystem::remove(data_dir + "/" + file + ".idx");
+}
+
+void BenchMerge() {
+  GetStore();
+  const size_t n = args.list_size;
+  std::vector<uint64_t> base_vals(n);
+  for (size_t i = 0; i < n; ++i) base_vals[i] = i;
+  auto to_slices = [](const std::vector<uint64_t>& vals) {
+    std::vector<Slice> slices;
+    for (const uint64_t& v : vals) {
+      slices.emplace_back(reinterpret_cast<const byte_t*>(&v), sizeof(v));
+    }
+    return slices;
+  };
+  ChunkableTypeFactory factory;
+  SList base = factory.Create<SList>(to_slices(base_vals));
+  std::cout << "three-way merge two branches of a list of " << n
+            << " elements, each replacing elements in its own half"
+            << std::endl << std::setw(14) << "divergence" << std::setw(14)
+            << "merge (ms)" << std::endl;
+  for (double divergence : {0.001, 0.01, 0.1}) {
+    std::mt19937_64 rng(0);
+    std::vector<uint64_t> vals1 = base_vals, vals2 = base_vals, merged;
+    for (size_t i = 0; i < std::max<size_t>(n * divergence / 2, 1); ++i) {
+      vals1[rng() % (n / 2)] = n + 2 * i;
+      vals2[n / 2 + rng() % (n - n / 2)] = n + 2 * i + 1;
+    }
+    merged.assign(vals1.begin(), vals1.begin() + n / 2);
+    merged.insert(merged.end(), vals2.begin() + n / 2, vals2.end());
+    SList node1 = factory.Create<SList>(to_slices(vals1));
+    SList node2 = factory.Create<SList>(to_slices(vals2));
+    Hash result;
+    double time = Timer::TimeSeconds([&] {
+      result = base.Merge(node1, node2);
+    });
+    CHECK(result == factory.Create<SList>(to_slices(merged)).hash())
+        << "merge gives a wrong list";
+    std::cout << std::fixed << std::setprecision(1) << std::setw(13)
+              << divergence * 100 << "%" << std::setw(14) << time * 1000
+              << std::endl;
+  }
+}
+
+void BenchLookup() {
+  GetStore();
+  const size_t n = args.list_size;
+  constexpr size_t kNumLookups = 1 << 14;
+  auto make_key = [](size_t i) {
+    std::ostringstream os;
+    os << std::setw(16) << std::setfill('0') << i;
+    return os.str();
+  };
+  std::vector<std::string> keys, vals;
+  for (size_t i = 0; i < n; ++i) {
+    keys.push_back(make_key(i));
+    vals.push_back(std::to_string(i));
+  }
+  std::vector<Slice> key_slices(keys.begin(), keys.end());
+  std::vector<Slice> val_slices(vals.begin(), vals.end());
+  ChunkableTypeFactory factory;
+  Hash root = factory.Create<SMap>(key_slices, val_slices).hash().Clone();
+  std::cout << "look up random keys of a map of " << n
+            << " entries, each loading the map anew" << std::endl
+            << std::setw(14) << "offsets" << std::setw(16) << "lookup (us)"
+            << std::endl;
+  OffsetCache* cache = OffsetCache::Instance();
+  for (bool shared : {false, true}) {
+    cache->Clear();
+    std::mt19937_64 rng(0);
+    double time = Timer::TimeSeconds([&] {
+      for (size_t i = 0; i < kNumLookups; ++i) {
+        // decode every node again as if the cache were disabled
+        if (!shared) cache->Clear();
+        const std::string& key = keys[rng() % n];
+        CHECK(!factory.Load<SMap>(root).Get(Slice(key)).empty());
+      }
+    });
+    std::cout << std::setw(14) << (shared ? "shared" : "per-node")
+              << std::fixed << std::setprecision(2) << std::setw(16)
+              << time * 1e6 / kNumLookups << std::endl;
+  }
+}
+
+void BenchScan() {
+  GetStore();
+  std::vector<byte_t> data = RandomBytes(size_t(args.blob_mb) << 20);
+  ChunkableTypeFactory factory;
+  Hash root = factory.Create<SBlob>(Slice(data.data(), data.size()))
+                .hash().Clone();
+  Config& config = Env::Instance()->m_config();
+  std::cout << "scan a blob of " << args.blob_mb << " MB" << std::endl
+            << std::setw(16) << "latency (us)" << std::setw(16)
+            << "read-ahead" << std::setw(16) << "scan (MB/s)"
+            << std::setw(16) << "cache hits (%)" << std::endl;
+  for (int delay : {0, 50, 200, 1000}) {
+    for (int read_ahead : {0, 16}) {
+      config.set_max_read_ahead(read_ahead);
+      ChunkCache::Instance()->Clear();
+      auto before = ChunkCache::Instance()->GetStats();
+      DelayedChunkLoader loader(delay);
+      uint64_t checksum = 0;
+      double time = Timer::TimeSeconds([&] {
+        NodeCursor cursor(root, 0, &loader);
+        do {
+          checksum += *cursor.current();
+        } while (cursor.Advance(true));
+      });
+      CHECK_NE(checksum, uint64_t(0));
+      auto after = ChunkCache::Instance()->GetStats();
+      size_t hits = after.hits - before.hits;
+      size_t lookups = hits + after.misses - before.misses;
+      std::cout << std::setw(16) << delay << std::setw(16) << read_ahead
+                << std::fixed << std::setprecision(1) << std::setw(16)
+                << args.blob_mb / time << std::setw(16)
+                << (lookups ? 100.0 * hits / lookups : 0.0) << std::endl;
+    }
+  }
+}
+
+void BenchHash() {
+  std::vector<byte_t> data = RandomBytes(size_t(args.blob_mb) << 20);
+  using HashFunc = std::function<void(const byte_t*, size_t, byte_t*)>;
+  std::vector<std::pair<std::string, HashFunc>> hashes = {
+    {"picosha2", [](const byte_t* in, size_t len, byte_t* out) {
+      picosha2::hash256(in, in + len, out, out + sha256::kDigestLength);
+    }},
+    {"sha256", [](const byte_t* in, size_t len, byte_t* out) {
+      sha256::Digest(sha256::Impl::kPortable, in, len, out);
+    }},
+    {"blake3", [](const byte_t* in, size_t len, byte_t* out) {
+      blake3::Digest(blake3::Impl::kPortable, in, len, out);
+    }}
+  };
+  if (sha256::IsSupported(sha256::Impl::kShaNi)) {
+    hashes.emplace_back("sha256-ni", [](const byte_t* in, size_t len,
+                                        byte_t* out) {
+      sha256::Digest(sha256::Impl::kShaNi, in, len, out);
+    });
+  }
+  if (blake3::IsSupported(blake3::Impl::kAVX2)) {
+    hashes.emplace_back("blake3-avx2", [](const byte_t* in, size_t len,
+                                          byte_t* out) {
+      blake3::Digest(blake3::Impl::kAVX2, in, len, out);
+    });
+  }
+  std::cout << "hash " << args.blob_mb << " MB in chunks, throughput (MB/s)"
+            << std::endl << std::setw(12) << "chunk size";
+  for (const auto& h : hashes) std::cout << std::setw(14) << h.first;
+  std::cout << std::endl;
+  for (size_t size = 256; size <= (64 << 10) && size <= data.size();
+       size <<= 2) {
+    std::cout << std::setw(12) << size;
+    for (const auto& h : hashes) {
+      byte_t digest[32];
+      uint64_t checksum = 0;
+      double time = Timer::TimeSeconds([&] {
+        for (size_t pos = 0; pos + size <= data.size(); pos += size) {
+          h.second(&data[pos], size, digest);
+          checksum += digest[0];
+        }
+      });
+      CHECK_NE(checksum, uint64_t(0));
+      std::cout << std::fixed << std::setprecision(1) << std::setw(14)
+                << args.blob_mb / time;
+    }
+    std::cout << std::endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (!args.ParseCmdArgs(argc, argv)) {
+    std::cerr << BOLD_RED("[FAILURE] ")
+              << "Found invalid command-line option" << std::endl;
+    return -1;
+  }
+  if (args.is_help) return 0;
+
+  std::map<std::string, std::function<void()>> benchmarks = {
+    {"putget", BenchPutGet},
+    {"index", BenchIndex},
+    {"load", BenchLoad},
+    {"commit", BenchCommit},
+    {"scan", BenchScan},
+    {"hash", BenchHash},
+    {"chunk", BenchChunk},
+    {"build", BenchBuild},
+    {"write", BenchWrite},
+    {"merge", BenchMerge},
+    {"lookup", BenchLookup}
+  };
+  if (!benchmarks.count(args.command)) {
+    std::cerr << BOLD_RED("[FAILURE] ") << "Unknown benchmark \""
+              << args.command << "\"" << std::endl;
+    return -1;
+  }
+  benchmarks[args.command]();
+  return 0;
+}
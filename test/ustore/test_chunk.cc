@@ -1,8 +1,12 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
 #include "chunk/chunk.h"
+#include "chunk/chunk_arena.h"
 #include "hash/hash.h"
 
 const ustore::byte_t raw_data[] = "The quick brown fox jumps over the lazy dog";
@@ -44,3 +48,92 @@ TEST(Chunk, LoadChunk) {
   EXPECT_EQ(h.ToBase32(), chunk.hash().ToBase32());
   delete[] buffer;
 }
+
+TEST(Chunk, HashInline) {
+  ustore::Chunk chunk(ustore::ChunkType::kBlob, sizeof(raw_data));
+  std::memcpy(chunk.m_data(), raw_data, sizeof(raw_data));
+  // the hash of a new chunk is computed right after its bytes
+  EXPECT_EQ(chunk.head() + chunk.numBytes(), chunk.hash().value());
+  ustore::Hash h = ustore::Hash::ComputeFrom(chunk.head(), chunk.numBytes());
+  EXPECT_EQ(h, chunk.hash());
+  // and stays valid when the chunk is moved
+  std::vector<ustore::Chunk> chunks;
+  chunks.push_back(std::move(chunk));
+  EXPECT_EQ(h, chunks[0].hash());
+}
+
+TEST(Chunk, AdoptString) {
+  const ustore::Chunk origin(ustore::ChunkType::kBlob, sizeof(raw_data));
+  std::memcpy(origin.m_data(), raw_data, sizeof(raw_data));
+  std::unique_ptr<std::string> bytes(new std::string(
+      reinterpret_cast<const char*>(origin.head()), origin.numBytes()));
+  const ustore::byte_t* head =
+      reinterpret_cast<const ustore::byte_t*>(bytes->data());
+  // the chunk views the bytes of the string without copying them
+  const ustore::Chunk chunk(std::move(bytes));
+  EXPECT_EQ(head, chunk.head());
+  EXPECT_EQ(ustore::ChunkType::kBlob, chunk.type());
+  EXPECT_EQ(origin.numBytes(), chunk.numBytes());
+  EXPECT_EQ(0, std::memcmp(raw_data, chunk.data(), sizeof(raw_data)));
+  EXPECT_EQ(origin.hash(), chunk.hash());
+}
+
+TEST(ChunkArena, Allocate) {
+  ustore::ChunkArena* arena = ustore::ChunkArena::ThisThread();
+  ustore::ChunkArena::Block *b1, *b2, *b3;
+  ustore::byte_t* p1 = arena->Allocate(100, &b1);
+  ustore::byte_t* p2 = arena->Allocate(100, &b2);
+  ASSERT_NE(nullptr, b1);
+  EXPECT_EQ(b1, b2);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p2) %
+                ustore::ChunkArena::kAlignment);
+  EXPECT_LE(p1 + 100, p2);
+  // large buffers go to the heap
+  ustore::byte_t* p3 =
+    arena->Allocate(ustore::ChunkArena::kMaxBufferSize + 1, &b3);
+  EXPECT_EQ(nullptr, b3);
+  delete[] p3;
+  // the block is rewound once all its buffers are released
+  ustore::ChunkArena::Release(b1);
+  ustore::ChunkArena::Release(b2);
+  ustore::byte_t* p4 = arena->Allocate(100, &b1);
+  EXPECT_EQ(b2, b1);
+  EXPECT_EQ(p1, p4);
+  // but not while any of them is in use
+  ustore::byte_t* p5 = arena->Allocate(100, &b2);
+  EXPECT_NE(p4, p5);
+  ustore::ChunkArena::Release(b1);
+  ustore::ChunkArena::Release(b2);
+}
+
+TEST(ChunkArena, LeaveArena) {
+  ustore::Chunk chunk(ustore::ChunkType::kBlob, sizeof(raw_data));
+  std::memcpy(chunk.m_data(), raw_data, sizeof(raw_data));
+  ustore::Hash hash = chunk.hash().Clone();
+  const bool in_arena = chunk.inArena();
+  const ustore::byte_t* head = chunk.head();
+  chunk.LeaveArena();
+  EXPECT_FALSE(chunk.inArena());
+  EXPECT_EQ(in_arena, head != chunk.head());
+  EXPECT_EQ(0, std::memcmp(raw_data, chunk.data(), sizeof(raw_data)));
+  EXPECT_EQ(hash, chunk.hash());
+  EXPECT_EQ(hash, chunk.forceHash());
+}
+
+TEST(ChunkArena, ReleaseByOtherThread) {
+  std::vector<ustore::Chunk> chunks;
+  std::thread maker([&chunks] {
+    for (size_t i = 0; i < 1000; ++i) {
+      chunks.emplace_back(ustore::ChunkType::kBlob, 4096);
+      std::memcpy(chunks.back().m_data(), &i, sizeof(i));
+    }
+  });
+  maker.join();
+  // chunks outlive the arena of their thread
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    size_t j;
+    std::memcpy(&j, chunks[i].data(), sizeof(j));
+    EXPECT_EQ(i, j);
+  }
+  chunks.clear();
+}
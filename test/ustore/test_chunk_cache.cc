@@ -0,0 +1,131 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "chunk/chunk_cache.h"
+#include "chunk/chunk_loader.h"
+
+namespace {
+
+std::shared_ptr<const ustore::Chunk> MakeChunk(int i, size_t len) {
+  std::shared_ptr<ustore::Chunk> chunk = std::make_shared<ustore::Chunk>(
+      ustore::ChunkType::kBlob, len);
+  std::string data = std::to_string(i);
+  data.resize(len, '-');
+  std::copy(data.begin(), data.end(), chunk->m_data());
+  chunk->hash();
+  return chunk;
+}
+
+// loads owned copies of chunks, like a loader of remote chunks
+class CopyChunkLoader : public ustore::ChunkLoader {
+ public:
+  size_t fetched = 0;
+
+ protected:
+  ustore::Chunk GetChunk(const ustore::Hash& key) override {
+    ++fetched;
+    return ustore::Chunk(ustore::ChunkType::kBlob, 64);
+  }
+};
+
+// loads views of a chunk, like a loader of local chunks
+class ViewChunkLoader : public ustore::ChunkLoader {
+ public:
+  explicit ViewChunkLoader(const ustore::Chunk& chunk) : chunk_(chunk) {}
+
+ protected:
+  ustore::Chunk GetChunk(const ustore::Hash& key) override {
+    return ustore::Chunk(chunk_.head());
+  }
+
+ private:
+  const ustore::Chunk& chunk_;
+};
+
+}  // namespace
+
+TEST(ChunkCache, HitAndMiss) {
+  ustore::ChunkCache cache(1 << 20);
+  auto chunk = MakeChunk(0, 100);
+  EXPECT_EQ(nullptr, cache.Get(chunk->hash()));
+  cache.Put(chunk->hash(), chunk);
+  EXPECT_EQ(chunk, cache.Get(chunk->hash()));
+  // putting the same chunk again keeps the cached one
+  EXPECT_EQ(chunk, cache.Put(chunk->hash(), MakeChunk(0, 100)));
+
+  auto stats = cache.GetStats();
+  EXPECT_EQ(size_t(1), stats.hits);
+  EXPECT_EQ(size_t(1), stats.misses);
+  EXPECT_EQ(size_t(1), stats.entries);
+  EXPECT_EQ(size_t(chunk->numBytes()), stats.bytes);
+}
+
+TEST(ChunkCache, Evict) {
+  constexpr size_t kCapacity = 64 << 10;
+  constexpr int kChunks = 1000;
+  ustore::ChunkCache cache(kCapacity);
+  std::vector<ustore::Hash> keys;
+  for (int i = 0; i < kChunks; ++i) {
+    auto chunk = MakeChunk(i, 1000);
+    keys.push_back(chunk->hash().Clone());
+    cache.Put(keys.back(), std::move(chunk));
+  }
+  auto stats = cache.GetStats();
+  EXPECT_LE(stats.bytes, kCapacity);
+  EXPECT_EQ(size_t(kChunks), stats.entries + stats.evictions);
+  // the latest chunk survives
+  EXPECT_NE(nullptr, cache.Get(keys.back()));
+}
+
+TEST(ChunkCache, Pin) {
+  constexpr size_t kCapacity = 64 << 10;
+  ustore::ChunkCache cache(kCapacity);
+  auto pinned = MakeChunk(-1, 1000);
+  cache.Put(pinned->hash(), pinned);
+  for (int i = 0; i < 1000; ++i) {
+    auto chunk = MakeChunk(i, 1000);
+    cache.Put(chunk->hash(), chunk);
+  }
+  EXPECT_EQ(pinned, cache.Get(pinned->hash()));
+  // evictable once unpinned
+  ustore::Hash key = pinned->hash().Clone();
+  pinned.reset();
+  for (int i = 1000; i < 2000; ++i) {
+    auto chunk = MakeChunk(i, 1000);
+    cache.Put(chunk->hash(), chunk);
+  }
+  EXPECT_EQ(nullptr, cache.Get(key));
+}
+
+TEST(ChunkCache, SharedByLoaders) {
+  ustore::ChunkCache* cache = ustore::ChunkCache::Instance();
+  if (cache->capacity() == 0) return;
+  auto chunk = MakeChunk(0, 64);
+  CopyChunkLoader loader1, loader2;
+  const ustore::Chunk* c1 = loader1.Load(chunk->hash());
+  const ustore::Chunk* c2 = loader2.Load(chunk->hash());
+  EXPECT_EQ(size_t(1), loader1.fetched);
+  EXPECT_EQ(size_t(0), loader2.fetched);
+  EXPECT_EQ(c1, c2);
+  cache->Clear();
+}
+
+TEST(ChunkCache, LoaderWindow) {
+  auto chunk = MakeChunk(0, 64);
+  ViewChunkLoader loader(*chunk);
+  std::vector<ustore::Hash> keys;
+  for (size_t i = 0; i <= ustore::ChunkLoader::kWindow; ++i)
+    keys.push_back(MakeChunk(i, 64)->hash().Clone());
+  std::weak_ptr<const ustore::Chunk> first = loader.LoadShared(keys[0]);
+  // reused while in the window
+  EXPECT_EQ(first.lock(), loader.LoadShared(keys[0]));
+  for (size_t i = 1; i < keys.size(); ++i) loader.LoadShared(keys[i]);
+  EXPECT_TRUE(first.expired());
+  // kept alive by the caller instead
+  auto held = loader.LoadShared(keys[0]);
+  for (size_t i = 1; i < keys.size(); ++i) loader.LoadShared(keys[i]);
+  EXPECT_EQ(chunk->head(), held->head());
+}
@@ -2,13 +2,37 @@
 
 #include <algorithm>
 #include <cstring>
+#include <future>
+#include <memory>
 #include <string>
+#include <vector>
 #include "gtest/gtest.h"
 #include "chunk/chunk_loader.h"
 #include "store/chunk_store.h"
 
 const ustore::byte_t raw_data[] = "The quick brown fox jumps over the lazy dog";
 
+namespace {
+
+// fetches chunks of the store once the test fulfills them
+class PendingChunkLoader : public ustore::ChunkLoader {
+ public:
+  std::vector<std::promise<ustore::Result<ustore::Chunk>>> pending;
+
+  PendingChunkLoader()
+    : ChunkLoader([this](const ustore::Hash& key) {
+        pending.emplace_back();
+        return pending.back().get_future();
+      }) {}
+
+ protected:
+  ustore::Chunk GetChunk(const ustore::Hash& key) override {
+    return ustore::store::GetChunkStore()->Get(key);
+  }
+};
+
+}  // namespace
+
 TEST(ChunkLoader, GetChunk) {
   ustore::Chunk chunk(ustore::ChunkType::kBlob, sizeof(raw_data));
   std::copy(raw_data, raw_data + sizeof(raw_data), chunk.m_data());
@@ -28,3 +52,49 @@ TEST(ChunkLoader, GetChunk) {
   EXPECT_EQ(c->numBytes(), chunk.numBytes());
   EXPECT_EQ(c->capacity(), chunk.capacity());
 }
+
+TEST(ChunkLoader, Prefetch) {
+  ustore::Chunk chunk(ustore::ChunkType::kBlob, sizeof(raw_data));
+  std::copy(raw_data, raw_data + sizeof(raw_data), chunk.m_data());
+  ustore::ChunkStore* cs = ustore::store::GetChunkStore();
+  EXPECT_TRUE(cs->Put(chunk.hash(), chunk));
+  ustore::LocalChunkLoader cl;
+  EXPECT_TRUE(cl.canPrefetch());
+  cl.Prefetch({chunk.hash()});
+  // prefetched chunk is taken by load
+  const ustore::Chunk* c = cl.Load(chunk.hash());
+  EXPECT_EQ(c->hash(), chunk.hash());
+  EXPECT_EQ(c->numBytes(), chunk.numBytes());
+  EXPECT_GT(cl.fetchLatency(), 0);
+  // prefetching loaded chunks does nothing
+  cl.Prefetch({chunk.hash()});
+  EXPECT_EQ(c, cl.Load(chunk.hash()));
+}
+
+TEST(ChunkLoader, PrefetchWindow) {
+  std::vector<ustore::Hash> keys;
+  for (size_t i = 0; i < ustore::ChunkLoader::kWindow + 8; ++i) {
+    std::string data = "prefetch window " + std::to_string(i);
+    ustore::Chunk chunk(ustore::ChunkType::kBlob, data.size());
+    std::copy(data.begin(), data.end(), chunk.m_data());
+    EXPECT_TRUE(ustore::store::GetChunkStore()->Put(chunk.hash(), chunk));
+    keys.push_back(chunk.hash().Clone());
+  }
+  PendingChunkLoader cl;
+  cl.Prefetch(keys);
+  // no more than the window is fetched at once
+  ASSERT_EQ(ustore::ChunkLoader::kWindow, cl.pending.size());
+  std::string data = "fetched";
+  ustore::Chunk fetched(ustore::ChunkType::kBlob, data.size());
+  std::copy(data.begin(), data.end(), fetched.m_data());
+  const ustore::byte_t* head = fetched.head();
+  cl.pending[0].set_value({std::move(fetched), ustore::ErrorCode::kOK});
+  EXPECT_EQ(head, cl.Load(keys[0])->head());
+  // failed fetches are retried
+  cl.pending[1].set_value({ustore::Chunk(),
+                           ustore::ErrorCode::kChunkNotExists});
+  EXPECT_EQ(keys[1], cl.Load(keys[1])->hash());
+  // taken ones make room for more
+  cl.Prefetch(keys);
+  EXPECT_EQ(ustore::ChunkLoader::kWindow + 2, cl.pending.size());
+}
@@ -1,6 +1,9 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
 #include <fstream>
 #include <thread>
 #include <vector>
@@ -9,10 +12,12 @@
 #include "gtest/gtest.h"
 #include "proto/messages.pb.h"
 #include "utils/env.h"
+#include "chunk/chunk_writer.h"
 #include "cluster/chunk_service.h"
 #include "cluster/chunk_client_service.h"
 #include "hash/hash.h"
 #include "utils/logging.h"
+#include "utils/message_parser.h"
 
 using ustore::byte_t;
 using ustore::ChunkService;
@@ -28,6 +33,9 @@ using ustore::ChunkType;
 using ustore::UType;
 using ustore::UCell;
 using ustore::StoreInfo;
+using ustore::UMessage;
+using ustore::MessageParser;
+using ustore::node_id_t;
 using std::thread;
 using std::vector;
 using std::set;
@@ -153,3 +161,221 @@ TEST(TestChunkService, ChunkService2Services2ClientThreads) {
   for (auto& cs : services) delete cs;
 }
 
+
+// A chunk service counting requests, which responds late to every so many
+// reads without holding up the others
+class TracedChunkService : public ChunkService {
+ public:
+  TracedChunkService(const string& addr, int stall_every)
+    : ChunkService(addr), stall_every_(stall_every) {}
+  ~TracedChunkService() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto& t : stalled_) t.join();
+  }
+
+  void HandleRequest(const void *msg, int size, const node_id_t& source)
+      override {
+    UMessage umsg;
+    MessageParser::Parse(msg, size, &umsg);
+    if (umsg.type() == UMessage::PUT_CHUNK_REQUEST) ++puts;
+    if (umsg.type() != UMessage::GET_CHUNK_REQUEST) {
+      ChunkService::HandleRequest(msg, size, source);
+      return;
+    }
+    int n = ++gets;
+    if (!stall_every_ || n % stall_every_) {
+      ChunkService::HandleRequest(msg, size, source);
+      return;
+    }
+    string copy(static_cast<const char*>(msg), size);
+    std::lock_guard<std::mutex> lock(mtx_);
+    stalled_.emplace_back([this, copy, source]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      ChunkService::HandleRequest(copy.data(), copy.size(), source);
+    });
+  }
+
+  std::atomic<int> puts{0};
+  std::atomic<int> gets{0};
+
+ private:
+  const int stall_every_;
+  std::mutex mtx_;
+  vector<thread> stalled_;
+};
+
+// Launch a chunk service of each host over tcp, with chunks of 2 replicas,
+// where the first service stalls every so many reads (0 for none)
+vector<TracedChunkService*> ReplicaServiceInit(const vector<string>& hosts,
+                                               int stall_every) {
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  Env::Instance()->m_config().set_chunk_replicas(2);
+  vector<TracedChunkService*> services;
+  for (const auto& addr : hosts) {
+    services.push_back(new TracedChunkService(addr, stall_every));
+    stall_every = 0;
+  }
+  for (auto& cs : services) cs->Run();
+  return services;
+}
+
+void ReplicaServiceStop(const vector<TracedChunkService*>& services) {
+  for (auto& cs : services) delete cs;
+  Env::Instance()->m_config().set_chunk_replicas(1);
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
+TEST(TestChunkService, ReplicatedChunks) {
+  const vector<string> hosts = {"127.0.0.1:50650", "127.0.0.1:50652",
+                                "127.0.0.1:50654"};
+  auto services = ReplicaServiceInit(hosts, 0);
+  ChunkClientService clientservice(hosts);
+  clientservice.Run();
+  ChunkClient chunkdb = clientservice.CreateChunkClient();
+  EXPECT_EQ(size_t(2), chunkdb.replicas());
+
+  vector<Chunk> chunks;
+  for (int i = 0; i < kValues; ++i) {
+    chunks.emplace_back(ChunkType::kBlob, values[i].size());
+    std::copy(values[i].begin(), values[i].end(), chunks[i].m_data());
+    EXPECT_EQ(ErrorCode::kOK, chunkdb.Put(chunks[i].hash(), chunks[i]));
+  }
+  // each chunk is sent to both of its replicas
+  int puts = 0;
+  for (auto& cs : services) puts += cs->puts;
+  EXPECT_EQ(2 * kValues, puts);
+  // but not to a skipped one
+  ustore::ChunkPartitioner ptt(hosts, "");
+  const Hash& hash = chunks[0].hash();
+  auto replicas = ptt.GetDestIds(hash, 2);
+  int owner_puts = services[replicas[0]]->puts;
+  int other_puts = services[replicas[1]]->puts;
+  EXPECT_EQ(ErrorCode::kOK, chunkdb.PutAsync(hash, chunks[0],
+                                             replicas[0]).get());
+  EXPECT_EQ(owner_puts, services[replicas[0]]->puts);
+  EXPECT_EQ(other_puts + 1, services[replicas[1]]->puts);
+
+  // reads are spread over the replicas
+  const int nreads = 20;
+  vector<int> stored(hosts.size(), 0);
+  for (int i = 0; i < kValues; ++i) {
+    for (int id : ptt.GetDestIds(chunks[i].hash(), 2)) ++stored[id];
+    for (int n = 0; n < nreads; ++n) {
+      Chunk result;
+      EXPECT_EQ(ErrorCode::kOK, chunkdb.Get(chunks[i].hash(), &result));
+      EXPECT_EQ(chunks[i].hash(), result.hash());
+    }
+  }
+  for (size_t id = 0; id < hosts.size(); ++id)
+    EXPECT_GE(services[id]->gets, stored[id] * nreads / 4);
+  clientservice.Stop();
+  ReplicaServiceStop(services);
+}
+
+TEST(TestChunkService, HedgedReads) {
+  const vector<string> hosts = {"127.0.0.1:50660", "127.0.0.1:50662"};
+  // one of the replicas is slow to every 20th read
+  auto services = ReplicaServiceInit(hosts, 20);
+  ChunkClientService clientservice(hosts);
+  clientservice.Run();
+  ChunkClient chunkdb = clientservice.CreateChunkClient();
+
+  vector<Chunk> chunks;
+  for (int i = 0; i < kValues; ++i) {
+    chunks.emplace_back(ChunkType::kBlob, values[i].size());
+    std::copy(values[i].begin(), values[i].end(), chunks[i].m_data());
+    EXPECT_EQ(ErrorCode::kOK, chunkdb.Put(chunks[i].hash(), chunks[i]));
+  }
+  auto read = [&](int n) {
+    Chunk result;
+    EXPECT_EQ(ErrorCode::kOK, chunkdb.Get(chunks[n % kValues].hash(),
+                                          &result));
+    EXPECT_EQ(chunks[n % kValues].hash(), result.hash());
+  };
+  // learn the latencies
+  for (int n = 0; n < 200; ++n) read(n);
+  // slow reads are answered by the other replica
+  int stalled = services[0]->gets / 20;
+  for (int n = 0; n < 400; ++n) {
+    auto start = std::chrono::steady_clock::now();
+    read(n);
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(250));
+  }
+  EXPECT_GT(services[0]->gets / 20, stalled);
+  clientservice.Stop();
+  ReplicaServiceStop(services);
+}
+
+TEST(TestChunkService, FailoverReadsTcp) {
+  const vector<string> hosts = {"127.0.0.1:50670", "127.0.0.1:50672"};
+  // one of the replicas is slow to every read, and no latency is tracked
+  Env::Instance()->m_config().set_hedge_percentile(0);
+  Env::Instance()->m_config().set_hedge_fallback_ms(50);
+  auto services = ReplicaServiceInit(hosts, 1);
+  ChunkClientService clientservice(hosts);
+  clientservice.Run();
+  ChunkClient chunkdb = clientservice.CreateChunkClient();
+
+  vector<Chunk> chunks;
+  for (int i = 0; i < kValues; ++i) {
+    chunks.emplace_back(ChunkType::kBlob, values[i].size());
+    std::copy(values[i].begin(), values[i].end(), chunks[i].m_data());
+    EXPECT_EQ(ErrorCode::kOK, chunkdb.Put(chunks[i].hash(), chunks[i]));
+  }
+  // reads to the slow replica are answered by the other one after the delay
+  for (int n = 0; n < 20; ++n) {
+    auto start = std::chrono::steady_clock::now();
+    Chunk result;
+    EXPECT_EQ(ErrorCode::kOK, chunkdb.Get(chunks[n % kValues].hash(),
+                                          &result));
+    EXPECT_EQ(chunks[n % kValues].hash(), result.hash());
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(250));
+  }
+  EXPECT_GT(services[0]->gets, 0);
+  clientservice.Stop();
+  ReplicaServiceStop(services);
+  Env::Instance()->m_config().set_hedge_fallback_ms(100);
+  Env::Instance()->m_config().set_hedge_percentile(95);
+}
+
+TEST(TestChunkService, LostReplicaTcp) {
+  const vector<string> hosts = {"127.0.0.1:50680", "127.0.0.1:50682",
+                                "127.0.0.1:50684"};
+  auto services = ReplicaServiceInit(hosts, 0);
+  Env::Instance()->m_config().set_chunk_replicas(3);
+  ChunkClientService clientservice(hosts);
+  clientservice.Run();
+  ChunkClient chunkdb = clientservice.CreateChunkClient();
+  ustore::ChunkPartitioner ptt(hosts, "");
+  ustore::PartitionedChunkWriter writer(&ptt, &chunkdb);
+  // one of the replicas is lost
+  delete services.back();
+  services.pop_back();
+
+  vector<Chunk> chunks;
+  vector<Hash> keys;
+  vector<const Chunk*> ptrs;
+  for (int i = 0; i < kValues; ++i) {
+    chunks.emplace_back(ChunkType::kBlob, values[i].size());
+    std::copy(values[i].begin(), values[i].end(), chunks[i].m_data());
+  }
+  // writes go on with a majority of the replicas
+  for (auto& chunk : chunks) {
+    EXPECT_TRUE(writer.Write(chunk.hash(), chunk));
+    keys.push_back(chunk.hash());
+    ptrs.push_back(&chunk);
+  }
+  EXPECT_TRUE(writer.MultiWrite(keys, ptrs));
+  // and so do reads
+  for (auto& chunk : chunks) {
+    Chunk result;
+    EXPECT_EQ(ErrorCode::kOK, chunkdb.Get(chunk.hash(), &result));
+    EXPECT_EQ(chunk.hash(), result.hash());
+  }
+  // but not the puts waiting for every replica
+  EXPECT_NE(ErrorCode::kOK, chunkdb.Put(chunks[0].hash(), chunks[0]));
+  clientservice.Stop();
+  ReplicaServiceStop(services);
+}
@@ -1,13 +1,20 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <cstring>
+#include <iomanip>
 #include <string>
 #include <sstream>
 #include <utility>
+#include <vector>
 #include "gtest/gtest.h"
+#include "hash/blake3.h"
 #include "hash/hash.h"
+#include "hash/sha256.h"
 
 const ustore::byte_t raw_str[] = "The quick brown fox jumps over the lazy dog";
-#ifdef USE_BLAKE2b
+#ifdef USE_BLAKE3
+const char base32_encoded[] = "F4KRIGA2VXGNSE5L3FGPUWJHAGSWQ2VS";
+const char hash_hex_str[] = "2f1514181aadccd913abd94cfa592701a5686ab2";
+#elif USE_BLAKE2b
 const char base32_encoded[] = "VCW5JPO57WJ6JB35E5DOMKAXWELDMSQ7";
 const char hash_hex_str[] = "a8add4bdddfd93e4877d2746e62817b116364a1f";
 #else
@@ -52,3 +59,84 @@ TEST(Hash, Movable) {
   EXPECT_TRUE(h.own());
   EXPECT_EQ(base32_encoded, h.ToBase32());
 }
+
+// input of the official BLAKE3 test vectors
+std::vector<ustore::byte_t> TestInput(size_t len) {
+  std::vector<ustore::byte_t> input(len);
+  for (size_t i = 0; i < len; ++i) input[i] = ustore::byte_t(i % 251);
+  return input;
+}
+
+std::string ToHex(const ustore::byte_t* digest, size_t len) {
+  std::ostringstream stm;
+  for (size_t i = 0; i < len; ++i)
+    stm << std::hex << std::setfill('0') << std::setw(2) << uint32_t(digest[i]);
+  return stm.str();
+}
+
+TEST(Hash, Sha256) {
+  const std::vector<std::pair<std::string, std::string>> vectors = {
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc",
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"}
+  };
+  for (auto impl : {ustore::sha256::Impl::kPortable,
+                    ustore::sha256::Impl::kShaNi}) {
+    if (!ustore::sha256::IsSupported(impl)) continue;
+    ustore::byte_t digest[ustore::sha256::kDigestLength];
+    for (const auto& v : vectors) {
+      ustore::sha256::Digest(
+          impl, reinterpret_cast<const ustore::byte_t*>(v.first.data()),
+          v.first.size(), digest);
+      EXPECT_EQ(v.second, ToHex(digest, sizeof(digest)));
+    }
+  }
+}
+
+TEST(Hash, Sha256Impls) {
+  if (!ustore::sha256::IsSupported(ustore::sha256::Impl::kShaNi)) return;
+  ustore::byte_t expected[ustore::sha256::kDigestLength];
+  ustore::byte_t actual[ustore::sha256::kDigestLength];
+  // cover every padding case around block boundaries
+  for (size_t len = 0; len < 1024; len += 7) {
+    auto input = TestInput(len);
+    ustore::sha256::Digest(ustore::sha256::Impl::kPortable, input.data(), len,
+                           expected);
+    ustore::sha256::Digest(ustore::sha256::Impl::kShaNi, input.data(), len,
+                           actual);
+    EXPECT_EQ(ToHex(expected, sizeof(expected)), ToHex(actual, sizeof(actual)));
+  }
+}
+
+TEST(Hash, Blake3) {
+  const std::vector<std::pair<size_t, std::string>> vectors = {
+    {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+    {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+    {1024,
+     "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+    {1025,
+     "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+    {2048,
+     "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    {3073,
+     "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+    {8193,
+     "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+    {31744,
+     "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+    {102400,
+     "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"}
+  };
+  for (auto impl : {ustore::blake3::Impl::kPortable,
+                    ustore::blake3::Impl::kAVX2}) {
+    if (!ustore::blake3::IsSupported(impl)) continue;
+    ustore::byte_t digest[ustore::blake3::kDigestLength];
+    for (const auto& v : vectors) {
+      auto input = TestInput(v.first);
+      ustore::blake3::Digest(impl, input.data(), input.size(), digest);
+      EXPECT_EQ(v.second, ToHex(digest, sizeof(digest)));
+    }
+  }
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include "gtest/gtest.h"
+#include "utils/latency_tracker.h"
+
+using ustore::LatencyTracker;
+
+TEST(LatencyTracker, Percentile) {
+  LatencyTracker tracker(95);
+  // unknown until enough latencies are seen
+  for (size_t i = 1; i < LatencyTracker::kInterval; ++i) tracker.Record(i);
+  EXPECT_EQ(size_t(0), tracker.percentileUs());
+  tracker.Record(LatencyTracker::kInterval);
+  // latencies of 1 to 64
+  EXPECT_EQ(size_t(61), tracker.percentileUs());
+  // a few slow ones only move the tail
+  for (size_t i = 0; i < LatencyTracker::kWindow; ++i)
+    tracker.Record(i % 50 ? 100 : 10000);
+  EXPECT_EQ(size_t(100), tracker.percentileUs());
+}
+
+TEST(LatencyTracker, FollowRecent) {
+  LatencyTracker tracker(50);
+  for (size_t i = 0; i < LatencyTracker::kWindow; ++i) tracker.Record(1000);
+  EXPECT_EQ(size_t(1000), tracker.percentileUs());
+  // the window slides over faster ones
+  for (size_t i = 0; i < LatencyTracker::kWindow; ++i) tracker.Record(10);
+  EXPECT_EQ(size_t(10), tracker.percentileUs());
+}
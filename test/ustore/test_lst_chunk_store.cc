@@ -1,9 +1,12 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <algorithm>
 #include <cstring>
+#include <future>
 #include <string>
 #include <chrono>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 #include "gtest/gtest.h"
 #include "store/lst_store.h"
 #include "store/iterator.h"
@@ -226,3 +229,218 @@ TEST(LSTStore, MultiThread) {
   t4.join();
   LOG(INFO) << LSTStore::Instance()->GetInfo();
 }
+
+TEST(LSTStore, ConcurrentPutGet) {
+  constexpr int kThreads = 8;
+  constexpr int kChunksPerThread = 10000;
+  LSTStore* lstStore = LSTStore::Instance();
+  auto worker = [lstStore](int tid) {
+    ustore::byte_t raw_data[LEN];
+    std::memset(raw_data, 0, LEN);
+    uint64_t* val = reinterpret_cast<uint64_t*>(raw_data);
+    *val = 2 * NUMBER + tid * kChunksPerThread;
+    for (int i = 0; i < kChunksPerThread; ++i, ++(*val)) {
+      ustore::Chunk chunk(ustore::ChunkType::kBlob, LEN);
+      std::copy(raw_data, raw_data + LEN, chunk.m_data());
+      lstStore->Put(chunk.hash(), chunk);
+    }
+    *val = 2 * NUMBER + tid * kChunksPerThread;
+    for (int i = 0; i < kChunksPerThread; ++i, ++(*val)) {
+      ustore::Chunk chunk(ustore::ChunkType::kBlob, LEN);
+      std::copy(raw_data, raw_data + LEN, chunk.m_data());
+      EXPECT_TRUE(lstStore->Exists(chunk.hash()));
+      ustore::Chunk c = lstStore->Get(chunk.hash());
+      EXPECT_EQ(c.hash(), chunk.hash());
+      EXPECT_EQ(c.numBytes(), chunk.numBytes());
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) threads.emplace_back(worker, i);
+  for (auto& t : threads) t.join();
+
+  // chunks appended by all lanes are reachable from the segment list
+  MAKE_TYPE_ITERATOR(Blob);
+  auto info = lstStore->GetInfo();
+  EXPECT_EQ(size_t(std::distance(lstStore->begin<BlobIterator>(),
+                                 lstStore->end<BlobIterator>())),
+            info.chunksPerType[ustore::ChunkType::kBlob]);
+}
+
+TEST(LSTStore, MultiPutGet) {
+  constexpr int kChunks = 1000;
+  LSTStore* lstStore = LSTStore::Instance();
+  ustore::byte_t raw_data[LEN];
+  std::memset(raw_data, 0, LEN);
+  uint64_t* val = reinterpret_cast<uint64_t*>(raw_data);
+  std::vector<Chunk> chunks;
+  for (int i = 0; i < kChunks; ++i) {
+    *val = 4 * NUMBER + i;
+    chunks.emplace_back(ustore::ChunkType::kBlob, LEN);
+    std::copy(raw_data, raw_data + LEN, chunks.back().m_data());
+  }
+  // a batch may repeat its own chunks
+  std::vector<ustore::Hash> keys;
+  std::vector<const Chunk*> ptrs;
+  for (int i = 0; i < kChunks; ++i) {
+    keys.push_back(chunks[i].hash());
+    ptrs.push_back(&chunks[i]);
+  }
+  keys.push_back(chunks[0].hash());
+  ptrs.push_back(&chunks[0]);
+
+  auto exists = lstStore->MultiExists(keys);
+  EXPECT_EQ(size_t(0), size_t(std::count(exists.begin(), exists.end(), true)));
+  size_t before = lstStore->GetInfo().chunks;
+  EXPECT_TRUE(lstStore->MultiPut(keys, ptrs));
+  EXPECT_EQ(before + kChunks, lstStore->GetInfo().chunks);
+
+  exists = lstStore->MultiExists(keys);
+  EXPECT_EQ(keys.size(),
+            size_t(std::count(exists.begin(), exists.end(), true)));
+  auto got = lstStore->MultiGet(keys);
+  ASSERT_EQ(keys.size(), got.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(keys[i], got[i].hash());
+    EXPECT_EQ(0, std::memcmp(got[i].head(), ptrs[i]->head(),
+                             ptrs[i]->numBytes()));
+  }
+
+  // results follow the order of keys, and absent keys give empty chunks
+  std::memset(raw_data, 0xff, LEN);
+  Chunk absent(ustore::ChunkType::kBlob, LEN);
+  std::copy(raw_data, raw_data + LEN, absent.m_data());
+  got = lstStore->MultiGet({keys[1], absent.hash(), keys[0]});
+  EXPECT_EQ(keys[1], got[0].hash());
+  EXPECT_TRUE(got[1].empty());
+  EXPECT_EQ(keys[0], got[2].hash());
+}
+
+TEST(LSTStore, FlatMap) {
+  using ustore::lst_store::LSTFlatMap;
+  LSTStore* lstStore = LSTStore::Instance();
+  LSTFlatMap map;
+  std::vector<const ustore::byte_t*> chunks;
+  ustore::byte_t raw_data[LEN];
+  std::memset(raw_data, 0, LEN);
+  uint64_t* val = reinterpret_cast<uint64_t*>(raw_data);
+  for (int i = 0; i < NUMBER; ++i, ++(*val)) {
+    ustore::Chunk chunk(ustore::ChunkType::kBlob, LEN);
+    std::copy(raw_data, raw_data + LEN, chunk.m_data());
+    // index chunks that already reside in the log
+    const ustore::byte_t* head = lstStore->Get(chunk.hash()).head();
+    ASSERT_NE(head, nullptr);
+    chunks.push_back(head);
+    EXPECT_TRUE(map.emplace(head + LEN + Chunk::kMetaLength, head).second);
+  }
+  EXPECT_EQ(map.size(), size_t(NUMBER));
+  EXPECT_FALSE(map.emplace(chunks[0] + LEN + Chunk::kMetaLength,
+                           chunks[0]).second);
+
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    auto it = map.find(chunks[i] + LEN + Chunk::kMetaLength);
+    ASSERT_NE(it, map.end());
+    EXPECT_EQ(it->second.chunk_, chunks[i]);
+  }
+  // erase every other chunk and insert them back
+  for (size_t i = 0; i < chunks.size(); i += 2)
+    EXPECT_EQ(map.erase(chunks[i] + LEN + Chunk::kMetaLength), size_t(1));
+  EXPECT_EQ(map.size(), size_t(NUMBER / 2));
+  for (size_t i = 0; i < chunks.size(); ++i)
+    EXPECT_EQ(map.count(chunks[i] + LEN + Chunk::kMetaLength), i % 2);
+  for (size_t i = 0; i < chunks.size(); i += 2)
+    EXPECT_TRUE(map.emplace(chunks[i] + LEN + Chunk::kMetaLength,
+                            chunks[i]).second);
+  EXPECT_EQ(map.size(), size_t(NUMBER));
+
+  // restore a copy from the raw slots, as done for index checkpoints
+  LSTFlatMap copy;
+  std::vector<uint64_t> slots(map.slots());
+  EXPECT_FALSE(copy.Assign(std::vector<uint64_t>(slots), NUMBER + 1));
+  EXPECT_TRUE(copy.Assign(std::move(slots), NUMBER));
+  EXPECT_EQ(copy.size(), size_t(NUMBER));
+  for (size_t i = 0; i < chunks.size(); ++i)
+    EXPECT_EQ(copy.find(chunks[i] + LEN + Chunk::kMetaLength)->second.chunk_,
+              chunks[i]);
+}
+
+TEST(LSTStore, GC) {
+  LSTStore* lstStore = LSTStore::Instance();
+  // fill a few segments where only one chunk out of eight is live
+  const size_t kChunkSize = 1024;
+  const size_t kNumChunks = 3 * ustore::lst_store::kSegmentSize / kChunkSize;
+  std::vector<Chunk> chunks;
+  std::unordered_set<ustore::Hash> garbage;
+  for (size_t i = 0; i < kNumChunks; ++i) {
+    Chunk chunk(ustore::ChunkType::kBlob, kChunkSize);
+    std::memset(chunk.m_data(), 0, kChunkSize);
+    uint64_t seq = 3 * NUMBER + i;
+    std::memcpy(chunk.m_data(), &seq, sizeof(seq));
+    EXPECT_TRUE(lstStore->Put(chunk.hash(), chunk));
+    if (i % 8) garbage.insert(chunk.hash().Clone());
+    chunks.push_back(std::move(chunk));
+  }
+  size_t valid = lstStore->GetInfo().validChunks;
+
+  size_t reclaimed = lstStore->GC([&garbage] {
+    return [&garbage](const ustore::Hash& hash) {
+      return garbage.count(hash) == 0;
+    };
+  });
+  EXPECT_GE(reclaimed, ustore::lst_store::kSegmentSize);
+  // relocated live chunks do not count
+  EXPECT_NE(reclaimed % ustore::lst_store::kSegmentSize, size_t(0));
+  size_t removed = 0;
+  for (const Chunk& chunk : chunks) {
+    if (garbage.count(chunk.hash())) {
+      removed += !lstStore->Exists(chunk.hash());
+    } else {
+      // live chunks are relocated with the same content
+      Chunk stored = lstStore->Get(chunk.hash());
+      ASSERT_FALSE(stored.empty());
+      EXPECT_EQ(stored.numBytes(), chunk.numBytes());
+      EXPECT_EQ(std::memcmp(stored.head(), chunk.head(), chunk.numBytes()), 0);
+    }
+  }
+  EXPECT_GT(removed, size_t(0));
+  EXPECT_EQ(lstStore->GetInfo().validChunks, valid - removed);
+
+  // a reclaimed segment can be reused
+  for (const Chunk& chunk : chunks)
+    EXPECT_TRUE(lstStore->Put(chunk.hash(), chunk));
+  for (const Chunk& chunk : chunks)
+    EXPECT_TRUE(lstStore->Exists(chunk.hash()));
+}
+
+TEST(LSTStore, GCWaitsForReaders) {
+  LSTStore* lstStore = LSTStore::Instance();
+  const size_t kChunkSize = 1024;
+  const size_t kNumChunks = 3 * ustore::lst_store::kSegmentSize / kChunkSize;
+  std::unordered_set<ustore::Hash> garbage;
+  for (size_t i = 0; i < kNumChunks; ++i) {
+    Chunk chunk(ustore::ChunkType::kBlob, kChunkSize);
+    std::memset(chunk.m_data(), 0, kChunkSize);
+    uint64_t seq = 5 * NUMBER + i;
+    std::memcpy(chunk.m_data(), &seq, sizeof(seq));
+    EXPECT_TRUE(lstStore->Put(chunk.hash(), chunk));
+    garbage.insert(chunk.hash().Clone());
+  }
+  const size_t used = lstStore->GetInfo().usedSegments;
+
+  std::future<size_t> reclaimed;
+  {
+    // a reader pinned before the collection holds back the reclamation
+    ustore::ReadGuard guard(lstStore);
+    reclaimed = std::async(std::launch::async, [lstStore, &garbage] {
+      return lstStore->GC([&garbage] {
+        return [&garbage](const ustore::Hash& hash) {
+          return garbage.count(hash) == 0;
+        };
+      });
+    });
+    EXPECT_EQ(reclaimed.wait_for(std::chrono::milliseconds(200)),
+              std::future_status::timeout);
+    EXPECT_EQ(lstStore->GetInfo().usedSegments, used);
+  }
+  EXPECT_GE(reclaimed.get(), 2 * ustore::lst_store::kSegmentSize);
+  EXPECT_LT(lstStore->GetInfo().usedSegments, used);
+}
@@ -1,12 +1,15 @@
 // Copyright (c) 2017 The Ustore Authors.
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 
 #include "node/map_node.h"
+#include "node/offset_cache.h"
 
 TEST(MapNode, Codec) {
   constexpr const ustore::byte_t key_data[] = "key";
@@ -184,3 +187,72 @@ TEST(MapNode, Basic) {
                         actual_kv3.val.data(),
                         kv3.val.len()));
 }
+
+TEST(MapNode, SharedOffsets) {
+  constexpr const ustore::byte_t k1[] = "k1";
+  constexpr const ustore::byte_t v1[] = "v1";
+  constexpr const ustore::byte_t k2[] = "k22";
+  constexpr const ustore::byte_t v2[] = "v22";
+  ustore::KVItem kv1{{k1, 2}, {v1, 2}};
+  ustore::KVItem kv2{{k2, 3}, {v2, 3}};
+  auto seg = ustore::MapNode::Encode({kv1, kv2});
+  ustore::ChunkInfo chunk_info =
+      ustore::MapChunker::Instance()->Make({seg.get()});
+  ASSERT_TRUE(chunk_info.chunk.hashed());
+
+  ustore::OffsetCache* cache = ustore::OffsetCache::Instance();
+  auto before = cache->GetStats();
+  ustore::MapNode first(&chunk_info.chunk);
+  ustore::MapNode second(&chunk_info.chunk);
+  auto after = cache->GetStats();
+  // the second node reuses the offsets decoded by the first
+  EXPECT_EQ(before.misses + 1, after.misses);
+  EXPECT_EQ(before.hits + 1, after.hits);
+  EXPECT_EQ(first.len(1), second.len(1));
+  EXPECT_EQ(first.data(1), second.data(1));
+
+  // a view of the chunk whose hash is unknown is decoded on its own
+  ustore::Chunk view(chunk_info.chunk.head());
+  ustore::MapNode third(&view);
+  EXPECT_FALSE(view.hashed());
+  EXPECT_EQ(after.hits, cache->GetStats().hits);
+  EXPECT_EQ(after.misses, cache->GetStats().misses);
+  EXPECT_EQ(ustore::MapNode::EncodeNumBytes(kv2), third.len(1));
+}
+
+TEST(MapNode, FindIndexForKeyByPrefix) {
+  // keys share a long prefix, and some differ only beyond 8 more bytes
+  std::vector<std::string> keys;
+  for (int i = 0; i < 100; ++i) {
+    std::string key = "user/profile/" + std::to_string(1000 + i / 4);
+    if (i % 4) key += "/setting/" + std::to_string(i % 4);
+    keys.push_back(key);
+  }
+  std::vector<ustore::KVItem> items;
+  for (const auto& key : keys) {
+    const ustore::byte_t* data =
+        reinterpret_cast<const ustore::byte_t*>(key.data());
+    items.push_back({{data, key.size()}, {data, key.size()}});
+  }
+  auto seg = ustore::MapNode::Encode(items);
+  ustore::ChunkInfo chunk_info =
+      ustore::MapChunker::Instance()->Make({seg.get()});
+  ustore::MapNode mnode(&chunk_info.chunk);
+
+  std::vector<std::string> probes(keys);
+  probes.push_back("");
+  probes.push_back("a");
+  probes.push_back("user/");
+  probes.push_back("user/profile/");
+  probes.push_back("user/profile/1000/setting/0");
+  probes.push_back("user/profile/1010/z");
+  probes.push_back("user/profile/9");
+  probes.push_back("zzz");
+  for (const auto& probe : probes) {
+    ustore::OrderedKey key(false,
+        reinterpret_cast<const ustore::byte_t*>(probe.data()), probe.size());
+    size_t expected = std::lower_bound(keys.begin(), keys.end(), probe)
+                      - keys.begin();
+    EXPECT_EQ(expected, mnode.FindIndexForKey(key, nullptr)) << probe;
+  }
+}
@@ -4,6 +4,8 @@
 #include "proto/messages.pb.h"
 #include "types/type.h"
 #include "hash/hash.h"
+#include "net/message_buffer.h"
+#include "utils/message_parser.h"
 
 using ustore::UMessage;
 using ustore::RequestPayload;
@@ -13,6 +15,8 @@ using ustore::UType;
 using ustore::Hash;
 using ustore::byte_t;
 using ustore::ErrorCode;
+using ustore::MessageBuffer;
+using ustore::MessageParser;
 const size_t TEST_KEY_SIZE = 32;
 const size_t TEST_VERSION_SIZE = 32;
 const size_t TEST_BRANCH_SIZE = 32;
@@ -236,3 +240,42 @@ TEST(TestMessage, TestMergeRequest) {
 
   delete[] serialized;
 }
+
+TEST(TestMessage, TestSerializeToBuffer) {
+  UMessage msg;
+  populateHeader(&msg, UMessage::PUT_REQUEST);
+  byte_t value[TEST_VALUE_SIZE];
+  randomVals(value, TEST_VALUE_SIZE);
+  msg.mutable_value_payload()->set_base(value, TEST_VALUE_SIZE);
+
+  MessageBuffer buf = MessageParser::Serialize(msg);
+  EXPECT_EQ(size_t(msg.ByteSize()), buf.size());
+  UMessage recovered_msg;
+  EXPECT_TRUE(MessageParser::Parse(buf.data(), buf.size(), &recovered_msg));
+  EXPECT_EQ(recovered_msg.type(), UMessage::PUT_REQUEST);
+  EXPECT_EQ(checkPayload(value, TEST_VALUE_SIZE,
+     (const byte_t*)recovered_msg.value_payload().base().data(),
+     recovered_msg.value_payload().base().length()), true);
+}
+
+TEST(TestMessage, TestMessageBufferPool) {
+  MessageBuffer buf(100);
+  byte_t* data = buf.data();
+  EXPECT_EQ(size_t(100), buf.size());
+  // moving keeps the bytes in place
+  MessageBuffer moved(std::move(buf));
+  EXPECT_TRUE(buf.empty());
+  EXPECT_EQ(data, moved.data());
+  // a released buffer is recycled once freed
+  byte_t* released = moved.Release();
+  EXPECT_TRUE(moved.empty());
+  MessageBuffer::Free(released, nullptr);
+  MessageBuffer reused(MessageBuffer::kMinPooledSize);
+  EXPECT_EQ(data, reused.data());
+  // but not for another size class
+  MessageBuffer larger(MessageBuffer::kMinPooledSize + 1);
+  EXPECT_NE(data, larger.data());
+  // nor above the pooled sizes
+  MessageBuffer huge(MessageBuffer::kMaxPooledSize + 1);
+  EXPECT_EQ(MessageBuffer::kMaxPooledSize + 1, huge.size());
+}
@@ -2,10 +2,14 @@
 
 #include <gflags/gflags.h>
 #include <unistd.h>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include "net/net.h"
+#include "utils/env.h"
 #include "utils/logging.h"
+#include "utils/timer.h"
 #include "gtest/gtest.h"
 
 // by default, it choose the zmq_net
@@ -15,6 +19,7 @@
 #ifdef USE_RDMA
 #include "net/rdma_net.h"
 #else
+#include "net/tcp_net.h"
 #include "net/zmq_net.h"
 #endif
 
@@ -48,7 +53,7 @@ class ServerCallBack : public CallBack {
     //EXPECT_TRUE(source.compare(m) == 0);
     //EXPECT_TRUE((m == kID0) || (m == kID1) || (m == kID2));
     DLOG(INFO) << "Server received msg = " << m;
-    net->GetNetContext(source)->Send(m.c_str(), m.size());
+    net->Reply(source, m.c_str(), m.size());
   }
 };
 
@@ -318,3 +323,194 @@ TEST(NetTest, CreateContexts) {
   delete client;
 #endif
 }
+
+#ifndef USE_RDMA
+// counts the received messages and their bytes
+class CountCallBack : public CallBack {
+ public:
+  CountCallBack() : CallBack(nullptr) {}
+  void operator()(const void *msg, int size, const node_id_t& source) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(msg);
+    size_t sum = 0;
+    for (int i = 0; i < size; ++i) sum += bytes[i];
+    std::lock_guard<std::mutex> lock(mtx_);
+    ++count_;
+    bytes_ += size;
+    checksum_ += sum;
+    cv_.notify_all();
+  }
+  // wait until n messages are received in total
+  void WaitFor(size_t n) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [this, n] { return count_ >= n; });
+  }
+  size_t count() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return count_;
+  }
+  size_t bytes() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return bytes_;
+  }
+  size_t checksum() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return checksum_;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  size_t count_ = 0;
+  size_t bytes_ = 0;
+  size_t checksum_ = 0;
+};
+
+// networks of the given backend
+Net* NewServerNet(Config::NetBackend backend, const node_id_t& id,
+                  int nthreads) {
+  if (backend == Config::TCP) return new ServerTcpNet(id, nthreads);
+  return new ServerZmqNet(id, nthreads);
+}
+
+Net* NewClientNet(Config::NetBackend backend, int nthreads) {
+  if (backend == Config::TCP) return new ClientTcpNet(nthreads);
+  return new ClientZmqNet(nthreads);
+}
+
+// one message in flight at a time, to measure round trips over loopback
+void PingPong(Config::NetBackend backend) {
+  const size_t kRounds = 5000;
+  const string payload(64, 'p');
+  Net* server = NewServerNet(backend, kID0, 2);
+  Net* client = NewClientNet(backend, 2);
+  usleep(kSleepTime);
+  NetContext* context = client->CreateNetContext(kID0);
+
+  CountCallBack client_cb;
+  ServerCallBack server_cb(server);
+  client->RegisterRecv(&client_cb);
+  server->RegisterRecv(&server_cb);
+  thread t0(Start, client);
+  thread t1(Start, server);
+  usleep(kSleepTime);
+
+  Timer timer;
+  timer.Start();
+  for (size_t i = 0; i < kRounds; ++i) {
+    context->Send(payload.data(), payload.size());
+    client_cb.WaitFor(i + 1);
+  }
+  timer.Stop();
+  EXPECT_EQ(kRounds, client_cb.count());
+  EXPECT_EQ(kRounds * payload.size(), client_cb.bytes());
+  LOG(INFO) << "ping-pong: " << kRounds / timer.ElapsedSeconds()
+            << " round trips/s, "
+            << timer.ElapsedMicroseconds() / kRounds << " us each";
+
+  client->Stop();
+  t0.join();
+  delete client;
+  server->Stop();
+  t1.join();
+  delete server;
+  usleep(kSleepTime);
+}
+
+// many threads keep sending to several servers without waiting
+void FanOut(Config::NetBackend backend, size_t msg_size) {
+  const size_t kSenders = 4;
+  const size_t kMsgsPerServer = (5 << 20) / (msg_size + 1024);
+  const vector<node_id_t> nodes = {kID0, kID1, kID2};
+  vector<Net*> servers;
+  vector<ServerCallBack> server_cbs;
+  vector<thread> server_threads;
+  // callbacks are registered by address
+  server_cbs.reserve(nodes.size());
+  for (auto& id : nodes) {
+    servers.push_back(NewServerNet(backend, id, 2));
+    server_cbs.emplace_back(servers.back());
+    servers.back()->RegisterRecv(&server_cbs.back());
+  }
+  Net* client = NewClientNet(backend, 2);
+  usleep(kSleepTime);
+  client->CreateNetContexts(nodes);
+  CountCallBack client_cb;
+  client->RegisterRecv(&client_cb);
+  for (auto net : servers) server_threads.emplace_back(Start, net);
+  thread client_thread(Start, client);
+  usleep(kSleepTime);
+
+  const size_t total = kSenders * kMsgsPerServer * nodes.size();
+  Timer timer;
+  timer.Start();
+  vector<thread> senders;
+  for (size_t t = 0; t < kSenders; ++t) {
+    senders.emplace_back([&, t] {
+      // each sender fills its messages with its own byte
+      const string payload(msg_size, static_cast<char>('a' + t));
+      for (size_t i = 0; i < kMsgsPerServer; ++i)
+        for (auto& id : nodes)
+          client->GetNetContext(id)->Send(payload.data(), payload.size());
+    });
+  }
+  for (auto& t : senders) t.join();
+  client_cb.WaitFor(total);
+  timer.Stop();
+  size_t checksum = 0;
+  for (size_t t = 0; t < kSenders; ++t)
+    checksum += ('a' + t) * msg_size * kMsgsPerServer * nodes.size();
+  EXPECT_EQ(total, client_cb.count());
+  EXPECT_EQ(total * msg_size, client_cb.bytes());
+  EXPECT_EQ(checksum, client_cb.checksum());
+  LOG(INFO) << "fan-out: " << total / timer.ElapsedSeconds()
+            << " msgs/s of " << msg_size << " bytes to " << nodes.size()
+            << " servers from " << kSenders << " threads";
+
+  client->Stop();
+  client_thread.join();
+  delete client;
+  for (size_t i = 0; i < servers.size(); ++i) {
+    servers[i]->Stop();
+    server_threads[i].join();
+    delete servers[i];
+  }
+  usleep(kSleepTime);
+}
+
+TEST(NetTest, PingPongThroughput) {
+  PingPong(Config::ZMQ);
+}
+
+TEST(NetTest, FanOutThroughput) {
+  FanOut(Config::ZMQ, 1024);
+}
+
+// buffers are handed over to zmq without copying, and freed once sent
+TEST(NetTest, FanOutLargeMessages) {
+  FanOut(Config::ZMQ, 1 << 20);
+}
+
+TEST(TcpNetTest, PingPongThroughput) {
+  PingPong(Config::TCP);
+}
+
+TEST(TcpNetTest, FanOutThroughput) {
+  FanOut(Config::TCP, 1024);
+}
+
+// messages larger than socket buffers are written in parts
+TEST(TcpNetTest, FanOutLargeMessages) {
+  FanOut(Config::TCP, 1 << 20);
+}
+
+TEST(TcpNetTest, SelectedAtStartup) {
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  Net* server = net::CreateServerNetwork(kID0);
+  Net* client = net::CreateClientNetwork();
+  EXPECT_NE(nullptr, dynamic_cast<ServerTcpNet*>(server));
+  EXPECT_NE(nullptr, dynamic_cast<ClientTcpNet*>(client));
+  delete client;
+  delete server;
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+#endif  // USE_RDMA
@@ -1,5 +1,6 @@
 // Copyright (c) 2017 The Ustore Authors.
 
+#include <functional>
 #include "gtest/gtest.h"
 
 #include "node/blob_node.h"
@@ -613,6 +614,58 @@ TEST_F(KeyComparatorBigEnv, Basic) {
 }
 
 
+// A loader counting the distinct chunks it has loaded
+class CountingChunkLoader : public ustore::LocalChunkLoader {
+ public:
+  size_t numLoaded() const { return cache_.size(); }
+};
+
+TEST_F(KeyComparatorBigEnv, LoadOnlyChanged) {
+  ustore::LocalChunkWriter writer;
+  // lhs is constructed by updating the value of the 10000th kvitem
+  const ustore::OrderedKey key10000{false, keys_[10000], entry_size_};
+  auto seg = ustore::MapNode::Encode(
+      {{{keys_[10000], entry_size_}, {vals_[0], entry_size_}}});
+
+  ustore::NodeBuilder nb(rhs_root_, key10000, loader_.get(), &writer,
+                         ustore::MapChunker::Instance(),
+                         ustore::MetaChunker::Instance());
+  nb.SpliceElements(1, seg.get());
+  ustore::Hash lhs = nb.Commit();
+
+  CountingChunkLoader loader;
+  ustore::KeyDiffer differ(rhs_root_, &loader);
+  std::vector<ustore::IndexRange> df_ranges = differ.Compare(lhs);
+  ASSERT_EQ(size_t(1), df_ranges.size());
+  EXPECT_EQ(size_t(10000), df_ranges[0].start_idx);
+  EXPECT_EQ(size_t(1), df_ranges[0].num_subsequent);
+
+  // only the paths to the changed leaf are loaded, not the whole trees
+  size_t num_leaves = 0;
+  std::function<void(const ustore::Hash&)> count_leaves =
+      [&](const ustore::Hash& hash) {
+    auto node = ustore::SeqNode::CreateFromChunk(loader_->Load(hash));
+    if (node->isLeaf()) {
+      ++num_leaves;
+      return;
+    }
+    auto meta = dynamic_cast<const ustore::MetaNode*>(node.get());
+    for (size_t i = 0; i < meta->numEntries(); ++i)
+      count_leaves(ustore::MetaEntry(meta->data(i)).targetHash());
+  };
+  count_leaves(rhs_root_);
+  EXPECT_LT(loader.numLoaded() * 4, num_leaves);
+
+  ustore::KeyMapper mapper(rhs_root_, &loader);
+  auto range_maps = mapper.Compare(lhs);
+  ASSERT_EQ(size_t(2), range_maps.size());
+  EXPECT_EQ(size_t(10000), range_maps[0].first.num_subsequent);
+  EXPECT_EQ(size_t(10001), range_maps[1].first.start_idx);
+  EXPECT_EQ(size_t(10001), range_maps[1].second.start_idx);
+  EXPECT_EQ(num_items_ - 10001, range_maps[1].second.num_subsequent);
+}
+
+
 TEST(LevenshteinMapper, Simple) {
   const ustore::Slice k("k", 1);
   const ustore::Slice s("s", 1);
@@ -784,3 +837,52 @@ Final Result Map: LHS => RHS
 
   for (const ustore::byte_t* val : vals) delete[] val;
 }
+
+TEST(LevenshteinMapper, LargeWindow) {
+  // RHS is constructed by replacing every 16th element of LHS, so that all
+  //   the leaves differ, and the window exceeds the edit matrix
+  constexpr uint32_t kNumElements = 1 << 14;
+  std::vector<uint32_t> lhs_vals, rhs_vals;
+  for (uint32_t i = 0; i < kNumElements; i++) {
+    lhs_vals.push_back(i);
+    rhs_vals.push_back(i % 16 == 8 ? i + kNumElements : i);
+  }
+  std::vector<ustore::Slice> lhs_slices, rhs_slices;
+  for (uint32_t i = 0; i < kNumElements; i++) {
+    lhs_slices.emplace_back(
+        reinterpret_cast<const ustore::byte_t*>(&lhs_vals[i]),
+        sizeof(uint32_t));
+    rhs_slices.emplace_back(
+        reinterpret_cast<const ustore::byte_t*>(&rhs_vals[i]),
+        sizeof(uint32_t));
+  }
+
+  ustore::LocalChunkWriter writer;
+  auto loader = std::make_shared<ustore::LocalChunkLoader>();
+
+  auto lhs_seg = ustore::ListNode::Encode(lhs_slices);
+  ustore::NodeBuilder lhs_nb(&writer, ustore::ListChunker::Instance(),
+                             ustore::MetaChunker::Instance());
+  lhs_nb.SpliceElements(0, lhs_seg.get());
+  const ustore::Hash lhs_root = lhs_nb.Commit();
+
+  auto rhs_seg = ustore::ListNode::Encode(rhs_slices);
+  ustore::NodeBuilder rhs_nb(&writer, ustore::ListChunker::Instance(),
+                             ustore::MetaChunker::Instance());
+  rhs_nb.SpliceElements(0, rhs_seg.get());
+  const ustore::Hash rhs_root = rhs_nb.Commit();
+
+  ustore::LevenshteinMapper mapper(rhs_root, loader.get());
+  ustore::RangeMaps result = mapper.Compare(lhs_root);
+
+  // (0, 8) => (0, 8), (9, 15) => (9, 15), (25, 15) => (25, 15), ...
+  ASSERT_EQ(size_t(kNumElements / 16 + 1), result.size());
+  for (size_t i = 0; i < result.size(); ++i) {
+    uint64_t start = i == 0 ? 0 : 16 * (i - 1) + 9;
+    uint64_t len = i == 0 ? 8 : (i + 1 == result.size() ? 7 : 15);
+    EXPECT_EQ(start, result[i].first.start_idx);
+    EXPECT_EQ(len, result[i].first.num_subsequent);
+    EXPECT_EQ(start, result[i].second.start_idx);
+    EXPECT_EQ(len, result[i].second.num_subsequent);
+  }
+}
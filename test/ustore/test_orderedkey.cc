@@ -62,3 +62,17 @@ TEST(OrderedKey, Encode) {
   delete[] buffer;
 }
 
+
+TEST(OrderedKey, Prefix) {
+  auto key = [](const char* str) {
+    return ustore::OrderedKey(false,
+        reinterpret_cast<const ustore::byte_t*>(str), std::strlen(str));
+  };
+  EXPECT_EQ(uint64_t(5), ustore::OrderedKey(5).prefix());
+  EXPECT_LT(key("abc").prefix(), key("abd").prefix());
+  EXPECT_LT(key("ab").prefix(), key("abc").prefix());
+  // keys only differing after 8 bytes tie on their prefix
+  EXPECT_EQ(key("abcdefgh1").prefix(), key("abcdefgh2").prefix());
+  EXPECT_LT(key("abcdefgh1").prefix(1), key("abcdefgh2").prefix(1));
+  EXPECT_EQ(uint64_t(0), key("abc").prefix(3));
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2017 The Ustore Authors.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cluster/partitioner.h"
+
+namespace {
+
+const size_t kNumKeys = 20000;
+
+std::vector<std::string> Hosts(int n) {
+  std::vector<std::string> hosts;
+  for (int i = 0; i < n; ++i)
+    hosts.push_back("10.0.0." + std::to_string(i + 1) + ":50600");
+  return hosts;
+}
+
+std::string Key(size_t i) { return "key-" + std::to_string(i); }
+
+}  // namespace
+
+TEST(Partitioner, Balanced) {
+  auto hosts = Hosts(8);
+  ustore::WorkerPartitioner ptt(hosts, hosts[0]);
+  EXPECT_EQ(0, ptt.id());
+  std::vector<size_t> owned(hosts.size(), 0);
+  for (size_t i = 0; i < kNumKeys; ++i) {
+    std::string key = Key(i);
+    ++owned[ptt.GetDestId(ustore::Slice(key))];
+  }
+  // each worker owns its share give or take a half
+  for (size_t n : owned) {
+    EXPECT_GT(n, kNumKeys / hosts.size() / 2);
+    EXPECT_LT(n, kNumKeys / hosts.size() * 3 / 2);
+  }
+}
+
+TEST(Partitioner, AddWorker) {
+  auto hosts = Hosts(4);
+  ustore::WorkerPartitioner before(hosts, "");
+  hosts.push_back(Hosts(5).back());
+  ustore::WorkerPartitioner after(hosts, "");
+  size_t moved = 0;
+  for (size_t i = 0; i < kNumKeys; ++i) {
+    std::string k = Key(i);
+    ustore::Slice key(k);
+    if (before.GetDestAddr(key) == after.GetDestAddr(key)) continue;
+    // keys only move to the new worker
+    EXPECT_EQ(after.id2addr(4), after.GetDestAddr(key));
+    ++moved;
+  }
+  // about a fifth of the keys move, rather than most of them
+  EXPECT_GT(moved, kNumKeys / 10);
+  EXPECT_LT(moved, kNumKeys * 3 / 10);
+}
+
+TEST(Partitioner, SameRingForAllServices) {
+  auto hosts = Hosts(4);
+  std::vector<std::string> reversed(hosts.rbegin(), hosts.rend());
+  ustore::WorkerPartitioner worker(hosts, hosts[1]);
+  ustore::ChunkPartitioner chunk(reversed, hosts[1]);
+  EXPECT_EQ(1, worker.id());
+  EXPECT_EQ(2, chunk.id());
+  // the owner is the same whatever the port and the order of hosts
+  for (size_t i = 0; i < 1000; ++i) {
+    std::string k = Key(i);
+    ustore::Slice key(k);
+    EXPECT_EQ(ustore::PortHelper::ChunkPort(worker.GetDestAddr(key)),
+              chunk.GetDestAddr(key));
+  }
+}
+
+TEST(Partitioner, Replicas) {
+  auto hosts = Hosts(5);
+  ustore::ChunkPartitioner ptt(hosts, "");
+  std::vector<size_t> stored(hosts.size(), 0);
+  for (size_t i = 0; i < kNumKeys; ++i) {
+    std::string k = Key(i);
+    ustore::Hash hash = ustore::Hash::ComputeFrom(k);
+    auto ids = ptt.GetDestIds(hash, 3);
+    ASSERT_EQ(size_t(3), ids.size());
+    // the owner comes first, followed by distinct others
+    EXPECT_EQ(ptt.GetDestId(hash), ids[0]);
+    EXPECT_NE(ids[0], ids[1]);
+    EXPECT_NE(ids[0], ids[2]);
+    EXPECT_NE(ids[1], ids[2]);
+    // a replica more keeps the others
+    auto more = ptt.GetDestIds(hash, 4);
+    EXPECT_TRUE(std::equal(ids.begin(), ids.end(), more.begin()));
+    for (int id : ids) ++stored[id];
+  }
+  // replicas are as balanced as owners
+  for (size_t n : stored) {
+    EXPECT_GT(n, kNumKeys * 3 / hosts.size() / 2);
+    EXPECT_LT(n, kNumKeys * 3 / hosts.size() * 3 / 2);
+  }
+  // there are no more replicas than hosts
+  EXPECT_EQ(hosts.size(), ptt.GetDestIds(ustore::Hash::ComputeFrom(Key(0)),
+                                         10).size());
+}
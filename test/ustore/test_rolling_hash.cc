@@ -1,5 +1,8 @@
 // Copyright (c) 2017 The Ustore Authors.
+#include <algorithm>
 #include <cstring>
+#include <random>
+#include <vector>
 #include "gtest/gtest.h"
 #include "node/rolling_hash.h"
 
@@ -74,3 +77,85 @@ TEST(RollingHasher, RollingHasherTest) {
   EXPECT_TRUE(rh2.CrossedBoundary());
   rh2.ClearLastBoundary();
 }
+
+// cut data into chunks, feeding the hasher with pieces of the given size
+std::vector<size_t> CutChunks(const std::vector<ustore::byte_t>& data,
+                              ustore::RollingHasher* rh, size_t piece) {
+  std::vector<size_t> chunk_sizes;
+  size_t chunk_start = 0;
+  for (size_t pos = 0; pos < data.size();) {
+    size_t len = std::min(piece, data.size() - pos);
+    size_t i = rh->TryHashBytes(data.data() + pos, len);
+    if (rh->CrossedBoundary()) {
+      chunk_sizes.push_back(pos + i + 1 - chunk_start);
+      chunk_start = pos + i + 1;
+      rh->ClearLastBoundary();
+      pos += i + 1;
+    } else {
+      pos += len;
+    }
+  }
+  return chunk_sizes;
+}
+
+std::vector<ustore::byte_t> RandomData(size_t len) {
+  std::vector<ustore::byte_t> data(len);
+  std::mt19937 rng(0);
+  for (auto& b : data) b = ustore::byte_t(rng());
+  return data;
+}
+
+TEST(RollingHasher, FastCDCChunkSize) {
+  const uint32_t pattern = (1 << 12) - 1;
+  const size_t window = 256, max_size = 1 << 15;
+  ustore::RollingHasher rh{pattern, window, max_size,
+                           ustore::RollingHasher::Engine::kFastCDC};
+  auto data = RandomData(1 << 23);
+  auto chunk_sizes = CutChunks(data, &rh, data.size());
+  ASSERT_GT(chunk_sizes.size(), size_t(0));
+  size_t total = 0;
+  for (size_t size : chunk_sizes) {
+    // the first quarter of the expected size is skipped
+    EXPECT_GE(size, (pattern + 1) / 4);
+    EXPECT_LE(size, max_size);
+    total += size;
+  }
+  // normalized chunking keeps the average close to the expected size
+  size_t avg = total / chunk_sizes.size();
+  EXPECT_GT(avg, (pattern + 1) / 2);
+  EXPECT_LT(avg, (pattern + 1) * 2);
+}
+
+TEST(RollingHasher, FastCDCMaxSize) {
+  ustore::RollingHasher rh{uint32_t((1 << 12) - 1), 256, 1 << 10,
+                           ustore::RollingHasher::Engine::kFastCDC};
+  std::vector<ustore::byte_t> zeros(1 << 14, 0);
+  for (size_t size : CutChunks(zeros, &rh, zeros.size()))
+    EXPECT_EQ(size_t(1 << 10), size);
+}
+
+TEST(RollingHasher, FastCDCStreaming) {
+  // boundaries do not depend on how bytes are fed
+  auto data = RandomData(1 << 20);
+  std::vector<std::vector<size_t>> results;
+  for (size_t piece : {size_t(1), size_t(7), size_t(64), size_t(4099),
+                       data.size()}) {
+    ustore::RollingHasher rh{uint32_t((1 << 12) - 1), 256, 1 << 15,
+                             ustore::RollingHasher::Engine::kFastCDC};
+    results.push_back(CutChunks(data, &rh, piece));
+  }
+  for (size_t i = 1; i < results.size(); ++i)
+    EXPECT_EQ(results[0], results[i]);
+
+  ustore::RollingHasher rh{uint32_t((1 << 8) - 1), 64, 1 << 12,
+                           ustore::RollingHasher::Engine::kFastCDC};
+  for (size_t i = 0; i < strlen(julius_caeser_str); ++i)
+    rh.HashByte(uint8_t(julius_caeser_str[i]));
+  EXPECT_EQ(strlen(julius_caeser_str), rh.byte_hashed());
+  EXPECT_TRUE(rh.CrossedBoundary());
+  rh.ClearLastBoundary();
+  rh.HashBytes(reinterpret_cast<const ustore::byte_t*>(julius_caeser_str),
+               strlen(julius_caeser_str));
+  EXPECT_EQ(strlen(julius_caeser_str), rh.byte_hashed());
+  EXPECT_TRUE(rh.CrossedBoundary());
+}
@@ -1,9 +1,13 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <cstring>
+#include <random>
 #include <string>
 
 #include "gtest/gtest.h"
 
+#include "node/blob_node.h"
+#include "node/meta_node.h"
+#include "node/node_builder.h"
 #include "types/server/factory.h"
 #include "types/server/sblob.h"
 
@@ -447,3 +451,35 @@ TEST(SBlob, Empty) {
   ASSERT_FALSE(chunk_it.end());
   ASSERT_TRUE(chunk_it.head());
 }
+
+TEST(SBlob, BulkBuild) {
+  ustore::ChunkableTypeFactory factory;
+  // a few hundred leaf chunks
+  const size_t len = 1 << 20;
+  std::unique_ptr<ustore::byte_t[]> data(new ustore::byte_t[len]);
+  std::mt19937 gen(12);
+  for (size_t i = 0; i < len; ++i) data[i] = ustore::byte_t(gen());
+  ustore::FixedSegment seg(data.get(), len, 1);
+
+  const ustore::Hash root = ustore::NodeBuilder::BulkBuild(&seg,
+      factory.writer(), ustore::BlobChunker::Instance(),
+      ustore::MetaChunker::Instance(), 4);
+  ustore::SBlob sblob = factory.Load<ustore::SBlob>(root);
+  ASSERT_EQ(len, sblob.numElements());
+  std::unique_ptr<ustore::byte_t[]> buffer(new ustore::byte_t[len]);
+  ASSERT_EQ(len, sblob.Read(0, len, buffer.get()));
+  ASSERT_EQ(0, std::memcmp(data.get(), buffer.get(), len));
+
+  ustore::NodeBuilder nb(factory.writer(), ustore::BlobChunker::Instance(),
+                         ustore::MetaChunker::Instance());
+  nb.SpliceElements(0, &seg);
+  const ustore::Hash expected = nb.Commit();
+  EXPECT_EQ(expected, root);
+  // ranges of many threads are too small to contain any boundary
+  for (size_t num_threads : {1, 3, 16, 4096}) {
+    EXPECT_EQ(expected, ustore::NodeBuilder::BulkBuild(&seg,
+        factory.writer(), ustore::BlobChunker::Instance(),
+        ustore::MetaChunker::Instance(), num_threads))
+        << "with " << num_threads << " threads";
+  }
+}
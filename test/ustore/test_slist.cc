@@ -1,5 +1,6 @@
 // Copyright (c) 2017 The Ustore Authors.
 
+#include <algorithm>
 #include "gtest/gtest.h"
 
 #include "types/server/factory.h"
@@ -314,6 +315,55 @@ TEST_F(SListHugeEnv, Remove) {
                          expected_slist2, &it2);
 }
 
+TEST_F(SListHugeEnv, MultiSplice) {
+  ustore::ChunkableTypeFactory factory;
+  ustore::SList slist = factory.Create<ustore::SList>(elements_);
+  // scattered and unsorted indices, touching the first and last elements
+  std::vector<uint64_t> indices = {1023, 0, 500, 17, 18, 640, 3};
+
+  // Set all of them to element 7 in one commit
+  ustore::SList slist1 = factory.Load<ustore::SList>(
+    slist.Set(indices, std::vector<ustore::Slice>(indices.size(),
+                                                  elements_[7])));
+  std::vector<ustore::Slice> expected_slist1(elements_);
+  for (auto idx : indices) expected_slist1[idx] = elements_[7];
+  auto it1 = slist1.Scan();
+  CheckIdenticalElements(idxs(expected_slist1.size()),
+                         expected_slist1, &it1);
+  // same tree as if built from scratch
+  ustore::SList fresh1 = factory.Create<ustore::SList>(expected_slist1);
+  EXPECT_EQ(fresh1.hash(), slist1.hash());
+
+  // Delete all of them in one commit
+  ustore::SList slist2 = factory.Load<ustore::SList>(slist.Delete(indices));
+  std::vector<ustore::Slice> expected_slist2;
+  for (uint64_t i = 0; i < elements_.size(); ++i) {
+    if (std::find(indices.begin(), indices.end(), i) == indices.end())
+      expected_slist2.push_back(elements_[i]);
+  }
+  auto it2 = slist2.Scan();
+  CheckIdenticalElements(idxs(expected_slist2.size()),
+                         expected_slist2, &it2);
+  ustore::SList fresh2 = factory.Create<ustore::SList>(expected_slist2);
+  EXPECT_EQ(fresh2.hash(), slist2.hash());
+
+  // the last write of a duplicated index wins
+  ustore::SList slist3 = factory.Load<ustore::SList>(
+    slist.Set({17, 500, 17}, {elements_[1], elements_[2], elements_[3]}));
+  std::vector<ustore::Slice> expected_slist3(elements_);
+  expected_slist3[17] = elements_[3];
+  expected_slist3[500] = elements_[2];
+  auto it3 = slist3.Scan();
+  CheckIdenticalElements(idxs(expected_slist3.size()),
+                         expected_slist3, &it3);
+  // and a duplicated index is deleted once
+  ustore::SList slist4 = factory.Load<ustore::SList>(slist.Delete({5, 5}));
+  EXPECT_EQ(elements_.size() - 1, slist4.numElements());
+
+  // out of range index fails the whole batch
+  EXPECT_EQ(ustore::Hash::kNull, slist.Delete({3, 1024}));
+}
+
 TEST_F(SListHugeEnv, Insert) {
   ustore::ChunkableTypeFactory factory;
   ustore::SList slist = factory.Create<ustore::SList>(elements_);
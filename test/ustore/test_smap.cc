@@ -6,8 +6,12 @@
 
 #include "gtest/gtest.h"
 
+#include "node/map_node.h"
+#include "node/meta_node.h"
+#include "node/node_builder.h"
 #include "types/server/factory.h"
 #include "types/server/smap.h"
+#include "utils/utils.h"
 
 inline void CheckIdenticalItems(
   const std::vector<ustore::Slice>& keys,
@@ -347,6 +351,24 @@ TEST_F(SMapHugeEnv, Multiset) {
   CheckIdenticalItems({keys_[0], keys_[1]}, {vals_[0], vals_[1]}, &it3);
 }
 
+TEST_F(SMapHugeEnv, BulkBuild) {
+  ustore::ChunkableTypeFactory factory;
+  ustore::SMap smap = factory.Create<ustore::SMap>(keys_, vals_);
+
+  std::vector<ustore::KVItem> kv_items;
+  for (size_t i : ustore::Utils::SortIndexes<ustore::Slice>(keys_)) {
+    kv_items.push_back({keys_[i], vals_[i]});
+  }
+  std::unique_ptr<const ustore::Segment> seg =
+      ustore::MapNode::Encode(kv_items);
+  for (size_t num_threads : {2, 5, 64}) {
+    const ustore::Hash root = ustore::NodeBuilder::BulkBuild(seg.get(),
+        factory.writer(), ustore::MapChunker::Instance(),
+        ustore::MetaChunker::Instance(), num_threads);
+    EXPECT_EQ(smap.hash(), root) << "with " << num_threads << " threads";
+  }
+}
+
 TEST_F(SMapHugeEnv, Compare) {
   ustore::ChunkableTypeFactory factory;
   ustore::SMap lhs = factory.Create<ustore::SMap>(keys_, vals_);
@@ -1,7 +1,14 @@
 // Copyright (c) 2017 The Ustore Authors.
 
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <forward_list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include "gtest/gtest.h"
@@ -479,6 +486,93 @@ TEST(Worker, DeleteBranch) {
   EXPECT_FALSE(exist);
 }
 
+TEST(Worker, GCWhileWriting) {
+  // a long live history, so that marking takes a while
+  const size_t kHistory = 100000;
+  Hash history;
+  for (size_t i = 0; i < kHistory; ++i) {
+    std::string content = "history " + std::to_string(i);
+    Value val{UType::kString, {}, 0, 0, {Slice(content)}, {}};
+    EXPECT_EQ(ErrorCode::kOK,
+              worker().Put(key[4], val, branch[4], &history));
+  }
+  // how long marking the history takes
+  std::unordered_set<Hash> visited;
+  auto start = std::chrono::steady_clock::now();
+  worker().CollectChunks({history.Clone()}, &visited);
+  auto mark_time = std::chrono::steady_clock::now() - start;
+
+  // garbage blobs filling a few segments, some of whose content is written
+  // again by versions put during the collection
+  const size_t kBlobSize = 1 << 18;
+  const size_t kNumBlobs = 48;
+  std::vector<std::string> contents;
+  for (size_t i = 0; i < kNumBlobs; ++i) {
+    std::string content(kBlobSize, 0);
+    for (size_t j = 0; j < kBlobSize; j += sizeof(size_t)) {
+      size_t word = (i << 32) + j;
+      content.replace(j, sizeof(word), reinterpret_cast<char*>(&word),
+                      sizeof(word));
+    }
+    Hash garbage;
+    Value val{UType::kBlob, {}, 0, 0, {Slice(content)}, {}};
+    EXPECT_EQ(ErrorCode::kOK, worker().PutUnkeyed(Slice(), val, &garbage));
+    contents.push_back(std::move(content));
+  }
+
+  std::vector<Hash> written;
+  std::thread writer([&contents, &written] {
+    for (size_t i = 0; i < kNumBlobs; i += 4) {
+      Hash version;
+      Value val{UType::kBlob, {}, 0, 0, {Slice(contents[i])}, {}};
+      EXPECT_EQ(ErrorCode::kOK,
+                worker().Put(key[5], val, branch[0], &version));
+      written.push_back(std::move(version));
+    }
+  });
+  // small puts are not held off by marking
+  std::atomic<bool> collecting{true};
+  std::chrono::steady_clock::duration max_latency{0};
+  size_t num_puts = 0;
+  std::thread putter([&collecting, &max_latency, &num_puts] {
+    for (; collecting; ++num_puts) {
+      Hash version;
+      std::string content = "put " + std::to_string(num_puts);
+      Value val{UType::kString, {}, 0, 0, {Slice(content)}, {}};
+      auto start = std::chrono::steady_clock::now();
+      EXPECT_EQ(ErrorCode::kOK,
+                worker().Put(key[3], val, branch[3], &version));
+      max_latency = std::max(max_latency,
+                             std::chrono::steady_clock::now() - start);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  size_t reclaimed = 0;
+  EXPECT_EQ(ErrorCode::kOK, worker().GC(&reclaimed));
+  collecting = false;
+  putter.join();
+  writer.join();
+  EXPECT_GT(reclaimed, size_t(0));
+  EXPECT_GT(num_puts, size_t(0));
+  EXPECT_LT(max_latency, mark_time / 2);
+
+  // versions written during the collection are intact
+  ChunkableTypeFactory factory;
+  for (size_t i = 0; i < written.size(); ++i) {
+    UCell value;
+    ec = worker().Get(key[5], written[i], &value);
+    ASSERT_EQ(ErrorCode::kOK, ec);
+    SBlob blob = factory.Load<SBlob>(value.dataHash());
+    ASSERT_EQ(kBlobSize, blob.size());
+    std::unique_ptr<byte_t[]> buf(new byte_t[blob.size()]);
+    blob.Read(0, blob.size(), buf.get());
+    EXPECT_EQ(Slice(contents[4 * i]), Slice(buf.get(), blob.size()));
+  }
+  // and so are those written before
+  UCell value;
+  EXPECT_EQ(ErrorCode::kOK, worker().Get(key[1], ver[10], &value));
+}
+
 TEST(Worker, Destruct) {
   delete &worker();
 }
@@ -1,10 +1,19 @@
 // Copyright (c) 2017 The Ustore Authors.
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include "gtest/gtest.h"
 #include "proto/messages.pb.h"
 #include "types/type.h"
@@ -13,10 +22,13 @@
 #include "cluster/worker_service.h"
 #include "cluster/worker_client_service.h"
 #include "hash/hash.h"
+#include "spec/object_db.h"
 #include "spec/slice.h"
 #include "spec/value.h"
 #include "utils/logging.h"
+#include "utils/message_parser.h"
 #include "utils/utils.h"
+#include "worker/worker.h"
 
 using ustore::byte_t;
 using ustore::WorkerService;
@@ -205,6 +217,522 @@ TEST(TestMessage, TestWorkerClient1Thread) {
   for (auto& worker : workers) delete worker;
 }
 
+TEST(TestMessage, TestWorkerClientAsync) {
+  // launch workers
+  Env::Instance()->m_config().set_worker_file("conf/test_single_worker.lst");
+  ifstream fin(Env::Instance()->config().worker_file());
+  string worker_addr;
+  vector<WorkerService*> workers;
+  while (fin >> worker_addr)
+    workers.push_back(new WorkerService(worker_addr, false));
+
+  for (auto& worker : workers) worker->Run();
+
+  // launch clients
+  WorkerClientService service;
+  service.Run();
+  WorkerClient client = service.CreateWorkerClient();
+
+  // keep all requests of a round in flight at once
+  vector<std::future<ustore::Result<Hash>>> puts;
+  for (int i = 0; i < NREQUESTS; ++i) {
+    Value val;
+    val.type = UType::kString;
+    val.vals.push_back(Slice(values[i]));
+    puts.push_back(client.PutAsync(Slice(keys[i]), val, Slice("async")));
+  }
+  vector<Hash> versions;
+  for (auto& put : puts) {
+    auto result = put.get();
+    EXPECT_EQ(ErrorCode::kOK, result.stat);
+    versions.push_back(std::move(result.value));
+  }
+
+  vector<std::future<ustore::Result<UCell>>> gets;
+  for (int i = 0; i < NREQUESTS; ++i)
+    gets.push_back(client.GetAsync(Slice(keys[i]), versions[i]));
+  for (auto& get : gets) {
+    auto result = get.get();
+    EXPECT_EQ(ErrorCode::kOK, result.stat);
+    EXPECT_EQ(UType::kString, result.value.type());
+  }
+
+  auto head = client.GetBranchHeadAsync(Slice(keys[0]), Slice("async"));
+  auto exists = client.ExistsAsync(Slice(random_key), Slice("async"));
+  // synchronous requests may be mixed with asynchronous ones
+  bool sync_exists = true;
+  EXPECT_EQ(ErrorCode::kOK, client.Exists(Slice(random_key), &sync_exists));
+  EXPECT_FALSE(sync_exists);
+  EXPECT_EQ(versions[0], head.get().value);
+  EXPECT_FALSE(exists.get().value);
+  for (int i = 0; i < NREQUESTS; ++i) {
+    EXPECT_EQ(ErrorCode::kOK,
+              client.DeleteAsync(Slice(keys[i]), Slice("async")).get());
+  }
+
+  // stop the client service
+  service.Stop();
+  // stop workers
+  for (auto& worker : workers) delete worker;
+}
+
+// run rounds of updates on a worker with a pool of service threads, to the
+// given branch
+void TestServiceThreads(const string& branch) {
+  // launch workers
+  Env::Instance()->m_config().set_worker_file("conf/test_single_worker.lst");
+  Env::Instance()->m_config().set_service_threads(4);
+  ifstream fin(Env::Instance()->config().worker_file());
+  string worker_addr;
+  vector<WorkerService*> workers;
+  while (fin >> worker_addr)
+    workers.push_back(new WorkerService(worker_addr, false));
+
+  for (auto& worker : workers) worker->Run();
+
+  // launch clients
+  WorkerClientService service;
+  service.Run();
+  WorkerClient client = service.CreateWorkerClient();
+
+  // keep rounds of updates to all keys in flight at once
+  const int kRounds = 8;
+  vector<std::future<ustore::Result<Hash>>> puts;
+  for (int r = 0; r < kRounds; ++r) {
+    for (int i = 0; i < NREQUESTS; ++i) {
+      Value val;
+      val.type = UType::kString;
+      val.vals.push_back(Slice(values[r % NREQUESTS]));
+      puts.push_back(client.PutAsync(Slice(keys[i]), val, Slice(branch)));
+    }
+  }
+  // updates of a key are executed in order, each following the last one
+  vector<Hash> heads(NREQUESTS, Hash::kNull);
+  for (size_t n = 0; n < puts.size(); ++n) {
+    auto result = puts[n].get();
+    EXPECT_EQ(ErrorCode::kOK, result.stat);
+    int i = n % NREQUESTS;
+    UCell ucell;
+    EXPECT_EQ(ErrorCode::kOK, client.Get(Slice(keys[i]), result.value, &ucell));
+    EXPECT_EQ(heads[i], ucell.preHash());
+    heads[i] = result.value.Clone();
+  }
+  for (int i = 0; i < NREQUESTS; ++i) {
+    Hash head;
+    EXPECT_EQ(ErrorCode::kOK,
+              client.GetBranchHead(Slice(keys[i]), Slice(branch), &head));
+    EXPECT_EQ(heads[i], head);
+  }
+  for (auto& worker : workers) {
+    EXPECT_EQ(size_t(4), worker->numServiceThreads());
+    EXPECT_GE(worker->GetStats().requests, puts.size());
+  }
+
+  // stop the client service
+  service.Stop();
+  // stop workers
+  for (auto& worker : workers) delete worker;
+  Env::Instance()->m_config().set_service_threads(0);
+}
+
+TEST(TestMessage, TestWorkerServiceThreads) {
+  TestServiceThreads("pool");
+}
+
+TEST(TestMessage, TestWorkerServiceThreadsTcp) {
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  TestServiceThreads("pool-tcp");
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
+TEST(TestMessage, TestWorkerClientTcp) {
+  // launch workers
+  Env::Instance()->m_config().set_worker_file("conf/test_single_worker.lst");
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  ifstream fin(Env::Instance()->config().worker_file());
+  string worker_addr;
+  vector<WorkerService*> workers;
+  while (fin >> worker_addr)
+    workers.push_back(new WorkerService(worker_addr, false));
+
+  for (auto& worker : workers) worker->Run();
+
+  // launch clients
+  WorkerClientService service;
+  service.Run();
+
+  WorkerClient client = service.CreateWorkerClient();
+  TestClientRequest(&client, 0, NREQUESTS);
+  // asynchronous requests share the connection
+  vector<std::future<ustore::Result<Hash>>> puts;
+  for (int i = 0; i < NREQUESTS; ++i) {
+    Value val;
+    val.type = UType::kString;
+    val.vals.push_back(Slice(values[i]));
+    puts.push_back(client.PutAsync(Slice(keys[i]), val, Slice("tcp")));
+  }
+  for (auto& put : puts) EXPECT_EQ(ErrorCode::kOK, put.get().stat);
+  // workers collect garbage on request, and keep the versions put
+  size_t reclaimed;
+  EXPECT_EQ(ErrorCode::kOK, client.GC(&reclaimed));
+  for (int i = 0; i < NREQUESTS; ++i) {
+    UCell cell;
+    EXPECT_EQ(ErrorCode::kOK, client.Get(Slice(keys[i]), Slice("tcp"), &cell));
+    EXPECT_EQ(Slice(values[i]), cell.data());
+  }
+
+  // stop the client service
+  service.Stop();
+  // stop workers
+  for (auto& worker : workers) delete worker;
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
+// a worker losing the responses of EXISTS requests
+class LossyWorker : public WorkerService {
+ public:
+  using WorkerService::WorkerService;
+
+  void HandleRequest(const void *msg, int size,
+                     const ustore::node_id_t& source) override {
+    ustore::UMessage umsg;
+    ustore::MessageParser::Parse(msg, size, &umsg);
+    if (umsg.type() == ustore::UMessage::EXISTS_REQUEST) return;
+    WorkerService::HandleRequest(msg, size, source);
+  }
+};
+
+TEST(TestMessage, TestRequestTimeoutTcp) {
+  Env::Instance()->m_config().set_worker_file("conf/test_single_worker.lst");
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  Env::Instance()->m_config().set_request_timeout_ms(200);
+  ifstream fin(Env::Instance()->config().worker_file());
+  string worker_addr;
+  fin >> worker_addr;
+  LossyWorker worker(worker_addr, false);
+  worker.Run();
+
+  WorkerClientService service;
+  service.Run();
+  WorkerClient client = service.CreateWorkerClient();
+  // the request without a response fails once expired
+  auto exists = client.ExistsAsync(Slice(random_key), Slice("lossy"));
+  ASSERT_EQ(std::future_status::ready,
+            exists.wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(ErrorCode::kRequestTimeout, exists.get().stat);
+  // while others go on
+  Value val;
+  val.type = UType::kString;
+  val.vals.push_back(Slice(values[0]));
+  EXPECT_EQ(ErrorCode::kOK,
+            client.PutAsync(Slice(keys[0]), val, Slice("lossy")).get().stat);
+
+  service.Stop();
+  Env::Instance()->m_config().set_request_timeout_ms(60000);
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
+TEST(TestMessage, TestConnectionLostTcp) {
+  Env::Instance()->m_config().set_worker_file("conf/test_single_worker.lst");
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  ifstream fin(Env::Instance()->config().worker_file());
+  string worker_addr;
+  fin >> worker_addr;
+  std::unique_ptr<LossyWorker> worker(new LossyWorker(worker_addr, false));
+  worker->Run();
+
+  WorkerClientService service;
+  service.Run();
+  WorkerClient client = service.CreateWorkerClient();
+  WorkerClient blocking = service.CreateWorkerClient();
+  auto exists = client.ExistsAsync(Slice(random_key), Slice("lossy"));
+  auto sync_exists = std::async(std::launch::async, [&blocking]() {
+    bool exist;
+    return blocking.Exists(Slice(random_key), Slice("lossy"), &exist);
+  });
+  Value val;
+  val.type = UType::kString;
+  val.vals.push_back(Slice(values[0]));
+  EXPECT_EQ(ErrorCode::kOK,
+            client.PutAsync(Slice(keys[0]), val, Slice("lossy")).get().stat);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // the requests without responses fail along with the connection, long
+  // before they expire
+  worker.reset();
+  ASSERT_EQ(std::future_status::ready,
+            exists.wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(ErrorCode::kConnectionLost, exists.get().stat);
+  ASSERT_EQ(std::future_status::ready,
+            sync_exists.wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(ErrorCode::kConnectionLost, sync_exists.get());
+  // so do the requests sent afterwards
+  auto put = client.PutAsync(Slice(keys[0]), val, Slice("lossy"));
+  ASSERT_EQ(std::future_status::ready, put.wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(ErrorCode::kConnectionLost, put.get().stat);
+  UCell ucell;
+  EXPECT_EQ(ErrorCode::kConnectionLost,
+            blocking.Get(Slice(keys[0]), Slice("lossy"), &ucell));
+
+  service.Stop();
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
+// a worker recording the chunks moved in
+class MigrateTarget : public WorkerService {
+ public:
+  using WorkerService::WorkerService;
+
+  void HandleRequest(const void *msg, int size,
+                     const ustore::node_id_t& source) override {
+    ustore::UMessage umsg;
+    ustore::MessageParser::Parse(msg, size, &umsg);
+    if (umsg.type() == ustore::UMessage::PUT_CHUNK_REQUEST) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      received_.insert(Hash(umsg.request_payload().version()).Clone());
+    }
+    WorkerService::HandleRequest(msg, size, source);
+  }
+
+  bool Received(const Hash& hash) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return received_.count(hash) != 0;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::unordered_set<Hash> received_;
+};
+
+TEST(TestMessage, TestMigrateToNewWorker) {
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  const vector<string> before = {"127.0.0.1:50640", "127.0.0.1:50642"};
+  vector<string> after = before;
+  after.push_back("127.0.0.1:50644");
+  std::ofstream("migrate_before.lst") << before[0] << "\n" << before[1];
+  std::ofstream("migrate_after.lst") << after[0] << "\n" << after[1] << "\n"
+                                     << after[2];
+  // launch the workers
+  Env::Instance()->m_config().set_worker_file("migrate_before.lst");
+  vector<WorkerService*> workers;
+  for (const auto& addr : before) workers.push_back(new WorkerService(addr,
+                                                                      false));
+  for (auto& worker : workers) worker->Run();
+
+  WorkerClientService service;
+  service.Run();
+  WorkerClient client = service.CreateWorkerClient();
+  const int nkeys = 32;
+  vector<string> mkeys, mvals;
+  for (int i = 0; i < nkeys; ++i) {
+    mkeys.push_back("migrate_" + std::to_string(i));
+    // blobs span a number of chunks
+    mvals.push_back(i % 2 ? string(i * 4096, 'a' + i % 26)
+                          : "value " + std::to_string(i));
+  }
+  vector<Hash> heads;
+  for (int i = 0; i < nkeys; ++i) {
+    Value val;
+    val.type = i % 2 ? UType::kBlob : UType::kString;
+    val.vals.push_back(Slice(mvals[i]));
+    Hash ver;
+    EXPECT_EQ(ErrorCode::kOK, client.Put(Slice(mkeys[i]), val,
+                                         Slice("master"), &ver));
+    heads.push_back(ver.Clone());
+  }
+
+  // a third worker joins
+  Env::Instance()->m_config().set_worker_file("migrate_after.lst");
+  MigrateTarget* target = new MigrateTarget(after[2], false);
+  workers.push_back(target);
+  workers.back()->Run();
+  // keys are served while moving, until handed off
+  std::atomic<bool> done(false);
+  std::thread reader([&]() {
+    WorkerClient reader = service.CreateWorkerClient();
+    for (int i = 0; !done; i = (i + 1) % nkeys) {
+      UCell cell;
+      ErrorCode err = reader.Get(Slice(mkeys[i]), Slice("master"), &cell);
+      EXPECT_TRUE(err == ErrorCode::kOK || err == ErrorCode::kKeyMoved);
+    }
+  });
+  EXPECT_EQ(ErrorCode::kOK, client.Migrate(after));
+  done = true;
+  reader.join();
+
+  // keys of the new worker are refused by the old ones
+  ustore::WorkerPartitioner ptt(after, "");
+  // chunks are looked up in the store shared by all workers of the process
+  ustore::Worker probe(ustore::WorkerID(99), nullptr, false);
+  int nmoved = 0;
+  for (int i = 0; i < nkeys; ++i) {
+    UCell cell;
+    ErrorCode err = client.Get(Slice(mkeys[i]), Slice("master"), &cell);
+    bool moved = ptt.GetDestAddr(Slice(mkeys[i])) == after[2];
+    EXPECT_EQ(moved ? ErrorCode::kKeyMoved : ErrorCode::kOK, err);
+    nmoved += moved;
+    if (!moved) continue;
+    // all chunks of the key are sent to the new worker
+    std::unordered_set<Hash> visited;
+    vector<Hash> found;
+    probe.CollectChunks({heads[i].Clone()}, &visited, &found);
+    EXPECT_LT(size_t(i % 2), found.size());
+    for (const auto& hash : found) EXPECT_TRUE(target->Received(hash));
+  }
+  EXPECT_GT(nmoved, 0);
+  EXPECT_LT(nmoved, nkeys);
+  service.Stop();
+
+  // all keys are served under the new host list
+  WorkerClientService new_service(after);
+  new_service.Run();
+  WorkerClient new_client = new_service.CreateWorkerClient();
+  vector<string> listed;
+  EXPECT_EQ(ErrorCode::kOK, new_client.ListKeys(&listed));
+  EXPECT_EQ(size_t(nkeys), listed.size());
+  for (int i = 0; i < nkeys; ++i) {
+    Hash head;
+    EXPECT_EQ(ErrorCode::kOK, new_client.GetBranchHead(Slice(mkeys[i]),
+                                                       Slice("master"), &head));
+    EXPECT_EQ(heads[i], head);
+    vector<Hash> latest;
+    EXPECT_EQ(ErrorCode::kOK, new_client.GetLatestVersions(Slice(mkeys[i]),
+                                                           &latest));
+    EXPECT_EQ(size_t(1), latest.size());
+    UCell cell;
+    EXPECT_EQ(ErrorCode::kOK, new_client.Get(Slice(mkeys[i]), Slice("master"),
+                                             &cell));
+    EXPECT_EQ(i % 2 ? UType::kBlob : UType::kString, cell.type());
+    auto meta = ustore::ObjectDB(&new_client).Get(Slice(mkeys[i]),
+                                                 Slice("master"));
+    EXPECT_EQ(ErrorCode::kOK, meta.stat);
+    if (i % 2) {
+      auto blob = meta.value.Blob();
+      ASSERT_EQ(mvals[i].size(), blob.size());
+      std::unique_ptr<byte_t[]> buf(new byte_t[blob.size()]);
+      blob.Read(0, blob.size(), buf.get());
+      EXPECT_EQ(Slice(mvals[i]), Slice(buf.get(), blob.size()));
+    } else {
+      EXPECT_EQ(Slice(mvals[i]), cell.data());
+    }
+    // and updated
+    Value val;
+    val.type = UType::kString;
+    val.vals.push_back(Slice(values[0]));
+    Hash ver;
+    EXPECT_EQ(ErrorCode::kOK, new_client.Put(Slice(mkeys[i]), val, heads[i],
+                                             &ver));
+  }
+  new_service.Stop();
+
+  for (auto& worker : workers) delete worker;
+  std::remove("migrate_before.lst");
+  std::remove("migrate_after.lst");
+  Env::Instance()->m_config().set_worker_file("conf/workers.lst");
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
+// a worker holding off the heads moved in until released, so that the keys
+// stay fenced on the old worker
+class FencingTarget : public WorkerService {
+ public:
+  using WorkerService::WorkerService;
+
+  void HandleRequest(const void *msg, int size,
+                     const ustore::node_id_t& source) override {
+    ustore::UMessage umsg;
+    ustore::MessageParser::Parse(msg, size, &umsg);
+    if (umsg.type() == ustore::UMessage::PUT_HEAD_REQUEST) {
+      std::unique_lock<std::mutex> lock(mtx_);
+      fenced_ = true;
+      cv_.notify_all();
+      cv_.wait(lock, [this] { return released_; });
+    }
+    WorkerService::HandleRequest(msg, size, source);
+  }
+
+  void WaitFenced() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [this] { return fenced_; });
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    released_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool fenced_ = false;
+  bool released_ = false;
+};
+
+TEST(TestMessage, TestMigrateFencedTcp) {
+  // requests are executed by the receiving threads
+  Env::Instance()->m_config().set_service_threads(0);
+  Env::Instance()->m_config().set_net_backend(Config::TCP);
+  const vector<string> before = {"127.0.0.1:50670"};
+  const vector<string> after = {before[0], "127.0.0.1:50672"};
+  std::ofstream("fenced_before.lst") << before[0];
+  std::ofstream("fenced_after.lst") << after[0] << "\n" << after[1];
+  Env::Instance()->m_config().set_worker_file("fenced_before.lst");
+  WorkerService* worker = new WorkerService(before[0], false);
+  worker->Run();
+
+  WorkerClientService service;
+  service.Run();
+  WorkerClient client = service.CreateWorkerClient();
+  // a key moving to the new worker, and one staying
+  ustore::WorkerPartitioner ptt(after, "");
+  string moving, staying;
+  for (int i = 0; moving.empty() || staying.empty(); ++i) {
+    string key = "fenced_" + std::to_string(i);
+    (ptt.GetDestAddr(Slice(key)) == after[1] ? moving : staying) = key;
+  }
+  for (const auto& key : {moving, staying}) {
+    Value val;
+    val.type = UType::kString;
+    val.vals.push_back(Slice(values[0]));
+    Hash ver;
+    EXPECT_EQ(ErrorCode::kOK, client.Put(Slice(key), val, Slice("master"),
+                                         &ver));
+  }
+
+  Env::Instance()->m_config().set_worker_file("fenced_after.lst");
+  FencingTarget* target = new FencingTarget(after[1], false);
+  target->Run();
+  auto migrate = std::async(std::launch::async, [&client, &after] {
+    return client.Migrate(after);
+  });
+  target->WaitFenced();
+  // the moving key waits, while the staying key is served meanwhile
+  WorkerClient fenced_client = service.CreateWorkerClient();
+  auto fenced = fenced_client.GetAsync(Slice(moving), Slice("master"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  WorkerClient other_client = service.CreateWorkerClient();
+  auto served = std::async(std::launch::async, [&other_client, &staying] {
+    UCell cell;
+    return other_client.Get(Slice(staying), Slice("master"), &cell);
+  });
+  auto status = served.wait_for(std::chrono::seconds(10));
+  EXPECT_EQ(std::future_status::timeout,
+            fenced.wait_for(std::chrono::milliseconds(0)));
+  target->Release();
+  ASSERT_EQ(std::future_status::ready, status);
+  EXPECT_EQ(ErrorCode::kOK, served.get());
+  EXPECT_EQ(ErrorCode::kKeyMoved, fenced.get().stat);
+  EXPECT_EQ(ErrorCode::kOK, migrate.get());
+  service.Stop();
+
+  delete target;
+  delete worker;
+  std::remove("fenced_before.lst");
+  std::remove("fenced_after.lst");
+  Env::Instance()->m_config().set_worker_file("conf/workers.lst");
+  Env::Instance()->m_config().set_net_backend(Config::ZMQ);
+}
+
 /*
 TEST(TestMessage, TestClient2Threads) {
   ustore::SetStderrLogging(ustore::WARNING);